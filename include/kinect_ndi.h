@@ -0,0 +1,291 @@
+#ifndef KINECT_NDI_H
+#define KINECT_NDI_H
+
+// libkinectndi: embeddable Kinect capture / conversion / NDI pipeline.
+//
+// The API is plain C so it can be used from C, C++ (openFrameworks etc.)
+// and language bindings alike. All objects are opaque; functions that can
+// fail return 0 on success and a negative KNDI_ERROR_* code otherwise.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32) && defined(KNDI_SHARED)
+  #ifdef KNDI_BUILDING
+    #define KNDI_API __declspec(dllexport)
+  #else
+    #define KNDI_API __declspec(dllimport)
+  #endif
+#elif defined(__GNUC__)
+  #define KNDI_API __attribute__((visibility("default")))
+#else
+  #define KNDI_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bumped whenever the API changes incompatibly. 2: kndi_frame gained
+// synced_timestamp_ns; fused depth, point cloud and mesh streams.
+#define KNDI_API_VERSION 2
+
+// Error codes.
+#define KNDI_OK                 0
+#define KNDI_ERROR_INVALID     -1  // Bad argument or invalid combination.
+#define KNDI_ERROR_STATE       -2  // Not allowed while the pipeline is running (or frames are held).
+#define KNDI_ERROR_NDI         -3  // NDI runtime missing or sender creation failed.
+#define KNDI_ERROR_THREAD      -4  // Could not start the capture thread.
+#define KNDI_ERROR_UNSUPPORTED -5  // Unknown option or feature not available.
+#define KNDI_ERROR_BUDGET      -6  // Estimated cost exceeds the host's frame budget.
+#define KNDI_ERROR_IO          -7  // A file could not be written.
+
+// Streams. RGB and IR share the Kinect video channel and are exclusive.
+// Derived streams are produced by pipeline stages rather than captured.
+typedef enum kndi_stream {
+    KNDI_STREAM_RGB         = 1 << 0,  // 24-bit RGB, 3 bytes per pixel.
+    KNDI_STREAM_IR          = 1 << 1,  // 8-bit infrared, 1 byte per pixel.
+    KNDI_STREAM_DEPTH       = 1 << 2,  // 11-bit depth in uint16, 2 bytes per pixel.
+    KNDI_STREAM_FUSED_DEPTH = 1 << 3,  // Derived: multi-Kinect merged depth, uint16 mm (0 = empty).
+    KNDI_STREAM_POINT_CLOUD = 1 << 4,  // Derived: world points, 3 floats (mm) each; width = count.
+    KNDI_STREAM_MESH        = 1 << 5   // Derived: triangle mesh of the depth (see kndi_mesh_header);
+                                       // width = bytes.
+} kndi_stream;
+
+#define KNDI_STREAM_VIDEO   (KNDI_STREAM_RGB | KNDI_STREAM_IR)
+#define KNDI_STREAM_CAPTURE (KNDI_STREAM_RGB | KNDI_STREAM_IR | KNDI_STREAM_DEPTH)
+#define KNDI_STREAM_ALL     (KNDI_STREAM_CAPTURE | KNDI_STREAM_FUSED_DEPTH | KNDI_STREAM_POINT_CLOUD | \
+                             KNDI_STREAM_MESH)
+
+// Start of a KNDI_STREAM_MESH frame (the "mesh" option). It is followed by
+// vertex_count vertices of three int16 (x, y, z in millimetres, depth camera
+// space: x right, y down, z forward), then triangle_count triangles of
+// three uint16 vertex indices, clockwise as seen from the Kinect. All
+// little-endian.
+typedef struct kndi_mesh_header {
+    uint32_t vertex_count;
+    uint32_t triangle_count;
+} kndi_mesh_header;
+
+// A captured frame. `data` points straight into the pipeline's frame pool
+// (libfreenect writes into it directly), so no copy is made on the way to
+// callbacks. The frame is valid for the duration of the callback; call
+// kndi_frame_retain() to keep it longer and kndi_frame_release() when done.
+// Retained frames must be released before kndi_close(), and before a
+// kndi_start() that reallocates their pool (after a change of streams,
+// devices or "pool_frames"); that start returns KNDI_ERROR_STATE instead.
+typedef struct kndi_frame {
+    kndi_stream stream;
+    int device_index;          // -1 for frames merged from several Kinects.
+    int width;
+    int height;
+    int stride;              // Bytes per row.
+    int bytes_per_pixel;
+    const void* data;
+    size_t size;             // Bytes of valid data.
+    uint32_t device_timestamp; // Kinect 60 MHz counter.
+    int64_t host_timestamp_ns; // Host monotonic clock at callback time.
+    uint64_t sequence;       // Per-stream frame counter.
+    int64_t synced_timestamp_ns; // Device counter mapped to the host monotonic clock
+                                 // with USB jitter removed; 0 until the clock estimate locks.
+} kndi_frame;
+
+typedef void (*kndi_frame_callback)(const kndi_frame* frame, void* user);
+
+typedef struct kndi_pipeline kndi_pipeline;
+
+KNDI_API int kndi_version(void);
+KNDI_API const char* kndi_error_string(int error);
+
+// Create a pipeline bound to the Kinect at `device_index`. The device itself
+// is opened (and re-opened after disconnects) by the capture loop. Set the
+// "standby_device" option to keep a second Kinect as a hot standby that
+// takes over the same sinks if this one stalls or disconnects, or the
+// "fusion_devices" option to merge depth from further Kinects into the
+// KNDI_STREAM_FUSED_DEPTH and KNDI_STREAM_POINT_CLOUD streams.
+KNDI_API kndi_pipeline* kndi_open(int device_index);
+// Stop the pipeline if running and free everything it owns.
+KNDI_API void kndi_close(kndi_pipeline* pipeline);
+
+// Select the streams to capture (bitmask of KNDI_STREAM_CAPTURE flags).
+KNDI_API int kndi_set_streams(kndi_pipeline* pipeline, unsigned streams);
+// Generic key/value configuration, e.g. ("pool_frames", "6").
+KNDI_API int kndi_set_option(kndi_pipeline* pipeline, const char* key, const char* value);
+
+// Register a callback for the given streams. Called on the capture thread.
+KNDI_API int kndi_add_frame_callback(kndi_pipeline* pipeline, unsigned streams,
+                                     kndi_frame_callback callback, void* user);
+// Attach an NDI sender. Each image stream in `streams` is converted to BGRX
+// and sent; `ndi_name` may be NULL to use the default "Kinect <stream>
+// Stream". Point clouds and meshes cannot be sent over NDI.
+KNDI_API int kndi_add_ndi_sink(kndi_pipeline* pipeline, unsigned streams, const char* ndi_name);
+
+// Attach a pre-roll replay buffer holding the last `seconds` of `streams`
+// (any but KNDI_STREAM_POINT_CLOUD and KNDI_STREAM_MESH) in at most `memory_bytes` of RAM,
+// allocated when the pipeline starts. Depth is losslessly compressed, RGB
+// and IR are kept as captured. One replay buffer per pipeline.
+KNDI_API int kndi_add_replay_sink(kndi_pipeline* pipeline, unsigned streams,
+                                  size_t memory_bytes, int seconds);
+// Write the replay buffer's frames to `path` (a time-stamped .knr file in
+// the "replay_dir" directory when NULL) on a background thread; streaming
+// continues meanwhile. Returns KNDI_ERROR_STATE while an earlier save runs.
+KNDI_API int kndi_save_replay(kndi_pipeline* pipeline, const char* path);
+
+// Serve raw depth frames (KNDI_STREAM_DEPTH and/or KNDI_STREAM_FUSED_DEPTH)
+// and depth meshes (KNDI_STREAM_MESH) to any number of local subscribers on
+// `address`: "unix:/path", "tcp:port" (loopback) or "tcp:host:port". Each
+// frame is a 48-byte header (as in .knr replay files) and the samples,
+// losslessly compressed when `compressed` is non-zero, or the mesh as is. Subscribers that fall behind skip frames;
+// capture never waits for them. Linux only (KNDI_ERROR_UNSUPPORTED
+// elsewhere); KNDI_ERROR_IO if the address cannot be listened on.
+KNDI_API int kndi_add_depth_server(kndi_pipeline* pipeline, unsigned streams, const char* address,
+                                   int compressed);
+// Benchmark the depth server with `subscribers` local clients (no Kinect
+// needed) and write the results to `report` (NUL-terminated, truncated to
+// `report_size`).
+KNDI_API int kndi_benchmark_depth_server(int subscribers, int compressed, char* report,
+                                         size_t report_size);
+
+// Time the depth filters (median, bilateral, Sobel) in the row-major and
+// tiled layouts on a synthetic width x height depth frame, on one thread
+// and on `threads` worker threads (0 = one per core), and write the table to
+// `report` (NUL-terminated, truncated to `report_size`). Pick the
+// depth_filter_layout option from it.
+KNDI_API int kndi_benchmark_depth_filters(int width, int height, int threads, char* report,
+                                          size_t report_size);
+
+// Run the RGB temporal denoise ("video_denoise" option) with this strength
+// and threshold over a synthetic noisy width x height sequence with motion,
+// timed on one thread and on `threads` worker threads (0 = one per core),
+// and write the cost and a bitrate proxy (residual entropy per sample,
+// before and after) to `report` (NUL-terminated, truncated to
+// `report_size`).
+KNDI_API int kndi_benchmark_video_denoise(int width, int height, int threads, float strength, int threshold,
+                                          char* report, size_t report_size);
+
+// Time the RGB → BGRX conversion graded through a 3D LUT ("colour_lut"
+// option) against the plain one, with synthetic 17x17x17 and 33x33x33
+// tables on a width x height frame, on one thread and on `threads` worker
+// threads (0 = one per core), and write the full-frame costs and the
+// largest difference from float interpolation to `report` (NUL-terminated,
+// truncated to `report_size`).
+KNDI_API int kndi_benchmark_colour_lut(int width, int height, int threads, char* report, size_t report_size);
+
+// Track retroreflective markers in the IR stream (KNDI_STREAM_IR must be
+// captured) and send them to `address` ("host:port", or "port" for
+// 127.0.0.1) as one OSC bundle per frame over UDP:
+//   /kinect/frame  ,ihi      Kinect index, frame time (host monotonic ns), marker count
+//   /kinect/marker ,iffifff  index, u, v (sub-pixel IR coordinates), pixels,
+//                            x, y, z (depth camera space in mm, 0 without depth)
+// The bundle's time tag is the frame's capture time. Pixels at or above
+// `threshold` (1-255) are lit; blobs of `min_pixels` to `max_pixels` count
+// as markers. With `use_depth` and the depth stream captured, each marker's
+// depth is taken from the latest depth frame. Not available on Windows
+// (KNDI_ERROR_UNSUPPORTED); KNDI_ERROR_IO if the address cannot be resolved.
+KNDI_API int kndi_add_marker_tracker(kndi_pipeline* pipeline, const char* address, int threshold,
+                                     int min_pixels, int max_pixels, int use_depth);
+
+// Detect touches on the surface in view of the depth camera (a table, a
+// wall or the floor; KNDI_STREAM_DEPTH must be captured) and send them to
+// `address` ("host:port", or "port" for 127.0.0.1) as TUIO 1.1 cursors:
+// one OSC bundle of /tuio/2Dcur source, alive, set and fseq messages per
+// depth frame, time-tagged with its capture time, with positions
+// normalised to the depth image. The surface is learned from the first 60
+// depth frames, which must show it clear; a touch is then anything between
+// `min_mm` and `max_mm` above it. The latency from the depth callback to
+// each send is reported when the pipeline is closed. Not available on
+// Windows (KNDI_ERROR_UNSUPPORTED); KNDI_ERROR_IO if the address cannot be
+// resolved.
+KNDI_API int kndi_add_touch_surface(kndi_pipeline* pipeline, const char* address, float min_mm, float max_mm);
+
+// Kinect clock estimate of one stream (see synced_timestamp_ns).
+typedef struct kndi_clock_stats {
+    int locked;              // Enough frames for synced timestamps.
+    double drift_ppm;        // Device counter rate vs its nominal 60 MHz on the host clock.
+    double jitter_us;        // RMS spread of host receive times around the fit.
+    uint64_t frames;         // Frames seen.
+} kndi_clock_stats;
+
+// Clock estimate for `stream` (RGB/IR or depth) of the Kinect at
+// `device_index` (the primary, standby or a fused Kinect) since it last
+// connected. KNDI_ERROR_INVALID if the pipeline has no such Kinect.
+KNDI_API int kndi_get_clock_stats(kndi_pipeline* pipeline, int device_index, kndi_stream stream,
+                                  kndi_clock_stats* stats);
+
+// Where a Kinect is attached and what it lost on the bus (Linux; the
+// location is empty elsewhere or until it connects).
+typedef struct kndi_usb_stats {
+    int bus;                 // USB bus number, -1 if not found.
+    char port[32];           // USB device name, e.g. "3-2.1".
+    char controller[32];     // PCI address of the host controller.
+    int numa_node;           // -1 if unknown.
+    char irq_cpus[64];       // CPUs the controller's interrupts go to, e.g. "0-3".
+    int capture_cpu;         // Core the capture thread is pinned to ("usb_placement"), -1 if not pinned.
+    uint64_t frames;         // Frames received since the pipeline started.
+    uint64_t lost_frames;    // Frames missing from the Kinect's frame counter (discarded after packet loss).
+    uint64_t lost_packets;   // USB packets libfreenect reported lost.
+} kndi_usb_stats;
+
+// USB location and loss of the Kinect at `device_index` since the pipeline
+// started; compare runs with and without "usb_placement".
+// KNDI_ERROR_INVALID if the pipeline has no such Kinect.
+KNDI_API int kndi_get_usb_stats(kndi_pipeline* pipeline, int device_index, kndi_usb_stats* stats);
+
+// Floors and ceilings face within 30 degrees of vertical, walls within 30
+// degrees of horizontal, assuming a roughly level Kinect.
+typedef enum kndi_plane_kind {
+    KNDI_PLANE_FLOOR   = 0,
+    KNDI_PLANE_CEILING = 1,
+    KNDI_PLANE_WALL    = 2,
+    KNDI_PLANE_OTHER   = 3
+} kndi_plane_kind;
+
+// A dominant plane of the depth image ("planes" option), in depth camera
+// space (millimetres; x right, y down, z forward): points p on it satisfy
+// dot(normal, p) + distance_mm = 0. The normal faces the Kinect.
+typedef struct kndi_plane {
+    int id;                  // Kept for as long as the plane is tracked.
+    kndi_plane_kind kind;
+    float normal[3];
+    float distance_mm;       // From the Kinect to the plane.
+    float rms_mm;            // Spread of its points about the plane.
+    int inliers;             // Sampled points on it (one per 8x8 pixels).
+    int64_t timestamp_ns;    // Host time of the depth frame it was last fitted to.
+} kndi_plane;
+
+// The planes currently tracked in the streaming Kinect's depth, largest
+// first: up to `capacity` are copied to `planes` and their number is
+// stored in `count` (0 until the pipeline has started). Safe to call from
+// any thread. KNDI_ERROR_INVALID if the "planes" option is off.
+KNDI_API int kndi_get_planes(kndi_pipeline* pipeline, kndi_plane* planes, int capacity, int* count);
+
+// Dry run: benchmark the configured streams, stages and sinks on this host
+// (synthetic frames, no Kinect needed) and estimate the per-frame CPU and
+// memory-bandwidth cost. A per-stage cost table is written to `report`
+// (NUL-terminated, truncated to `report_size`; may be NULL). Returns KNDI_OK
+// if the estimate fits the frame budget, KNDI_ERROR_BUDGET if it does not.
+// kndi_start() runs the same check and prints the table when it fails
+// (disable with the "plan_check" option).
+KNDI_API int kndi_plan(kndi_pipeline* pipeline, char* report, size_t report_size);
+
+// Start capturing on background threads (one per Kinect).
+KNDI_API int kndi_start(kndi_pipeline* pipeline);
+// Like kndi_start(), but blocks the calling thread until kndi_stop().
+KNDI_API int kndi_run(kndi_pipeline* pipeline);
+// Ask the capture loops to exit and wait for their threads.
+KNDI_API void kndi_stop(kndi_pipeline* pipeline);
+
+// Write the flight recorder (the last "flight_recorder_frames" per-frame
+// timing records and events) as CSV to `path`, or to a time-stamped file in
+// the "flight_recorder_dir" directory when `path` is NULL. The pipeline
+// also dumps it by itself on disconnects, failovers and watchdog trips.
+KNDI_API int kndi_dump_flight_recorder(kndi_pipeline* pipeline, const char* path);
+
+KNDI_API void kndi_frame_retain(const kndi_frame* frame);
+KNDI_API void kndi_frame_release(const kndi_frame* frame);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // KINECT_NDI_H
@@ -1,72 +1,144 @@
-#include <iostream>
-#include <mutex>
-#include <atomic>
-#include <thread>
 #include <chrono>
-#include <vector>
+#include <csignal>
 #include <cstring>
+#include <cstdlib>
+#include <iostream>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #ifdef _WIN32
   #include <windows.h>
 #endif
 
-// Kinect and NDI headers.
-#include <libfreenect.h>
-#include <Processing.NDI.Lib.h>
-
-// Frame dimensions.
-constexpr int WIDTH  = 640;
-constexpr int HEIGHT = 480;
+// Capture, conversion and NDI output live in libkinectndi.
+#include "kinect_ndi.h"
 
 // Global flags from command‑line.
 bool enable_rgb   = false;
 bool enable_ir    = false;
 bool enable_depth = false;
+int device_index  = 0;
+bool enable_fusion = false;
+bool plan_only     = false;
+int replay_seconds = 0;
+long replay_mb     = 1024;
+std::string depth_server_address;
+bool depth_server_compress = false;
+int depth_server_bench = 0;
+bool depth_filter_bench = false;
+bool denoise_bench = false;
+bool lut_bench = false;
+bool enable_mesh = false;
+std::string markers_address;
+int marker_threshold = 200;
+std::string touch_address;
+float touch_min_mm = 6.0f;
+float touch_max_mm = 25.0f;
+std::string denoise_strength = "0.75";
+std::string denoise_threshold = "20";
 
-// Determines the number of channels for video data (1 for IR, 3 for RGB).
-int videoChannels = 0;
-
-// Global buffers and synchronization for video frames.
-std::mutex videoMutex;
-std::atomic<bool> newVideoFrame(false);
-std::vector<uint8_t> videoBuffer;  // Size: WIDTH * HEIGHT * videoChannels
-
-// Global buffers and synchronization for depth frames.
-std::mutex depthMutex;
-std::atomic<bool> newDepthFrame(false);
-std::vector<uint16_t> depthBuffer; // Size: WIDTH * HEIGHT
+// Set by SIGUSR2 to save the replay buffer.
+volatile std::sig_atomic_t replay_requested = 0;
+// Set by SIGINT / SIGTERM to shut down.
+volatile std::sig_atomic_t stop_requested = 0;
 
-// Callback for video frames (IR or RGB).
-void VideoCallback(freenect_device* dev, void* video, uint32_t /*timestamp*/)
-{
-    std::lock_guard<std::mutex> lock(videoMutex);
-    size_t frameSize = WIDTH * HEIGHT * videoChannels;
-    if (videoBuffer.size() != frameSize)
-        videoBuffer.resize(frameSize);
-    std::memcpy(videoBuffer.data(), video, frameSize);
-    newVideoFrame = true;
+void OnStopSignal(int) {
+    stop_requested = 1;
 }
 
-// Callback for depth frames.
-void DepthCallback(freenect_device* dev, void* depth, uint32_t /*timestamp*/)
-{
-    std::lock_guard<std::mutex> lock(depthMutex);
-    size_t frameSize = WIDTH * HEIGHT;
-    if (depthBuffer.size() != frameSize)
-        depthBuffer.resize(frameSize);
-    std::memcpy(depthBuffer.data(), depth, frameSize * sizeof(uint16_t));
-    newDepthFrame = true;
+#ifdef SIGUSR2
+void OnReplaySignal(int) {
+    replay_requested = 1;
 }
+#endif
+
+// Pipeline options collected from the command line, applied in order.
+std::vector<std::pair<std::string, std::string>> pipeline_options;
 
 // Print help/usage information.
 void PrintUsage(const char* progName) {
-    std::cout << "Usage: " << progName << " [--ir | --rgb] [--depth] [--help]\n"
+    std::cout << "Usage: " << progName << " [--ir | --rgb] [--depth] [options] [--help]\n"
               << "Options:\n"
-              << "  --ir      Enable infrared (IR) streaming (8-bit grayscale).\n"
-              << "  --rgb     Enable RGB video streaming.\n"
-              << "  --depth   Enable depth streaming.\n"
-              << "  --help    Display this help message.\n"
+              << "  --ir              Enable infrared (IR) streaming (8-bit grayscale).\n"
+              << "  --rgb             Enable RGB video streaming.\n"
+              << "  --depth           Enable depth streaming.\n"
+              << "  --device N        Kinect to stream from (default 0).\n"
+              << "  --standby N       Keep Kinect N as a hot standby on the same NDI sources.\n"
+              << "  --standby-idle    Keep the standby open but not streaming (saves USB\n"
+              << "                    bandwidth, slower switchover).\n"
+              << "  --stall-ms MS     Switch to the standby after MS without frames (default 40).\n"
+              << "  --fuse N,M        Fuse depth from Kinects N, M with --device into one\n"
+              << "                    extra \"Kinect Fused Depth Stream\" source (implies --depth).\n"
+              << "  --poses FILE      Camera-to-world poses of the fused Kinects.\n"
+              << "  --fuse-view V     Fused view: top (overhead, default) or camera (pose \"virtual\").\n"
+              << "  --retune          Benchmark the conversion kernels again instead of using\n"
+              << "                    the choices cached from an earlier run.\n"
+              << "  --plan            Print the estimated per-stage CPU cost on this host and\n"
+              << "                    exit (1 if the frame budget cannot be met).\n"
+              << "  --flight-dir DIR  Where flight recorder dumps go (default: the temp\n"
+              << "                    directory). kill -USR1 <pid> dumps the recent frame timing.\n"
+              << "  --orientation O   Turn the output for a mounted Kinect: mirror, flip,\n"
+              << "                    rotate90, rotate180 or rotate270 (clockwise).\n"
+              << "  --auto-frame [WxH]  Crop the RGB source to the subject found in depth\n"
+              << "                    and send it at WxH (default 640x360; implies --depth).\n"
+              << "  --auto-frame-range NEAR,FAR  Depth range of the subject in mm\n"
+              << "                    (default 500,3000).\n"
+              << "  --volume X,Y,Z,W,H,D[,YAW,PITCH,ROLL]  Keep only depth inside this box\n"
+              << "                    (camera space, mm and degrees).\n"
+              << "  --volume-key      Send depth outside the box as transparent (BGRA)\n"
+              << "                    instead of as no reading.\n"
+              << "  --privacy MODE    Hide RGB behind FAR: blank or pixelate (implies --depth).\n"
+              << "                    Edges are trimmed by one 16-px block for the camera\n"
+              << "                    parallax; closer than ~0.8 m a sliver of background\n"
+              << "                    can still show beside the subject.\n"
+              << "  --privacy-far-mm FAR  Farthest foreground distance in mm (default 2000).\n"
+              << "  --mesh            Build a triangle mesh of the depth; served by\n"
+              << "                    --depth-server (implies --depth).\n"
+              << "  --mesh-tolerance N  Flatness, in raw disparity units, for merging cells\n"
+              << "                    (default 2; 0 keeps the full grid).\n"
+              << "  --planes          Find the floor, walls and other large planes in depth and\n"
+              << "                    send them as NDI metadata (implies --depth).\n"
+              << "  --planes-interval N  Depth frames between full plane searches (default 15).\n"
+              << "  --markers HOST:PORT  Track bright IR markers and send them as OSC over\n"
+              << "                    UDP (needs --ir; with --depth, adds their 3D position).\n"
+              << "  --marker-threshold N  IR level counted as a marker, 1-255 (default 200).\n"
+              << "  --touch HOST:PORT Learn the surface in view of the depth camera and send\n"
+              << "                    touches on it as TUIO cursors (usually port 3333;\n"
+              << "                    implies --depth). Keep the surface clear at startup.\n"
+              << "  --touch-band MIN,MAX  Height above the surface counted as a touch, in mm\n"
+              << "                    (default 6,25).\n"
+              << "  --roi X,Y;X,Y;... Only process pixels inside this polygon (several\n"
+              << "                    separated by |); outside is black.\n"
+              << "  --replay SECONDS  Keep the last SECONDS of every stream in RAM; kill -USR2\n"
+              << "                    <pid> writes them to a .knr file.\n"
+              << "  --replay-mb MB    Memory for the replay buffer (default 1024).\n"
+              << "  --replay-dir DIR  Where replay files go (default: the temp directory).\n"
+              << "  --depth-server ADDR  Also serve raw depth to local subscribers on\n"
+              << "                    unix:/path or tcp:[host:]port (see README).\n"
+              << "  --depth-server-compress  Compress served depth losslessly.\n"
+              << "  --depth-server-bench N  Benchmark the depth server with N local\n"
+              << "                    subscribers and exit (no Kinect needed).\n"
+              << "  --depth-filter F  Filter depth before it is sent: median or bilateral.\n"
+              << "  --depth-filter-layout L  Layout the filter walks: rows (default),\n"
+              << "                    tiled8 or tiled16.\n"
+              << "  --depth-filter-bench  Time the depth filters in each layout on this\n"
+              << "                    host and exit (no Kinect needed).\n"
+              << "  --denoise         Temporal denoise of the RGB or IR stream (less NDI bitrate\n"
+              << "                    in low light).\n"
+              << "  --denoise-strength S  Weight of the past frames, 0-0.95 (default 0.75).\n"
+              << "  --denoise-threshold N  Change in levels treated as motion (default 20).\n"
+              << "  --denoise-bench   Time the denoise and estimate its bitrate saving on a\n"
+              << "                    synthetic sequence, then exit (no Kinect needed).\n"
+              << "  --lut FILE        Grade the RGB output through a 3D LUT (.cube file).\n"
+              << "  --lut-bench       Time the LUT grading with 17^3 and 33^3 tables, then\n"
+              << "                    exit (no Kinect needed).\n"
+              << "  --realtime-memory Prefault all frame buffers and lock the process in RAM\n"
+              << "                    (needs CAP_IPC_LOCK or a high ulimit -l).\n"
+              << "  --usb-placement   Pin each Kinect's capture thread to a core near its USB\n"
+              << "                    controller (Linux); USB loss is printed either way.\n"
+              << "  --help            Display this help message.\n"
               << "\nNotes:\n"
               << "  You can enable either --ir or --rgb for the video stream (not both simultaneously).\n"
               << "  Depth streaming can be enabled along with either video mode.\n";
@@ -90,12 +162,150 @@ int main(int argc, char** argv)
             enable_rgb = true;
         } else if (arg == "--depth") {
             enable_depth = true;
+        } else if (arg == "--device" && i + 1 < argc) {
+            device_index = std::atoi(argv[++i]);
+        } else if (arg == "--standby" && i + 1 < argc) {
+            pipeline_options.push_back(std::make_pair("standby_device", argv[++i]));
+        } else if (arg == "--standby-idle") {
+            pipeline_options.push_back(std::make_pair("standby_streaming", "0"));
+        } else if (arg == "--stall-ms" && i + 1 < argc) {
+            pipeline_options.push_back(std::make_pair("stall_timeout_ms", argv[++i]));
+        } else if (arg == "--retune") {
+            pipeline_options.push_back(std::make_pair("retune", "1"));
+        } else if (arg == "--flight-dir" && i + 1 < argc) {
+            pipeline_options.push_back(std::make_pair("flight_recorder_dir", argv[++i]));
+        } else if (arg == "--replay" && i + 1 < argc) {
+            replay_seconds = std::atoi(argv[++i]);
+        } else if (arg == "--replay-mb" && i + 1 < argc) {
+            replay_mb = std::atol(argv[++i]);
+        } else if (arg == "--replay-dir" && i + 1 < argc) {
+            pipeline_options.push_back(std::make_pair("replay_dir", argv[++i]));
+        } else if (arg == "--depth-server" && i + 1 < argc) {
+            depth_server_address = argv[++i];
+        } else if (arg == "--depth-server-compress") {
+            depth_server_compress = true;
+        } else if (arg == "--depth-server-bench" && i + 1 < argc) {
+            depth_server_bench = std::atoi(argv[++i]);
+        } else if (arg == "--depth-filter" && i + 1 < argc) {
+            pipeline_options.push_back(std::make_pair("depth_filter", argv[++i]));
+        } else if (arg == "--depth-filter-layout" && i + 1 < argc) {
+            pipeline_options.push_back(std::make_pair("depth_filter_layout", argv[++i]));
+        } else if (arg == "--depth-filter-bench") {
+            depth_filter_bench = true;
+        } else if (arg == "--denoise") {
+            pipeline_options.push_back(std::make_pair("video_denoise", "1"));
+        } else if (arg == "--denoise-strength" && i + 1 < argc) {
+            denoise_strength = argv[++i];
+            pipeline_options.push_back(std::make_pair("video_denoise_strength", denoise_strength));
+        } else if (arg == "--denoise-threshold" && i + 1 < argc) {
+            denoise_threshold = argv[++i];
+            pipeline_options.push_back(std::make_pair("video_denoise_threshold", denoise_threshold));
+        } else if (arg == "--denoise-bench") {
+            denoise_bench = true;
+        } else if (arg == "--lut" && i + 1 < argc) {
+            pipeline_options.push_back(std::make_pair("colour_lut", argv[++i]));
+        } else if (arg == "--lut-bench") {
+            lut_bench = true;
+        } else if (arg == "--realtime-memory") {
+            pipeline_options.push_back(std::make_pair("realtime_memory", "1"));
+        } else if (arg == "--usb-placement") {
+            pipeline_options.push_back(std::make_pair("usb_placement", "1"));
+        } else if (arg == "--orientation" && i + 1 < argc) {
+            pipeline_options.push_back(std::make_pair("orientation", argv[++i]));
+        } else if (arg == "--auto-frame") {
+            pipeline_options.push_back(std::make_pair("auto_frame", "1"));
+            if (i + 1 < argc && std::strchr(argv[i + 1], 'x') && argv[i + 1][0] != '-')
+                pipeline_options.push_back(std::make_pair("auto_frame_size", argv[++i]));
+            enable_depth = true;
+        } else if (arg == "--auto-frame-range" && i + 1 < argc) {
+            pipeline_options.push_back(std::make_pair("auto_frame_range_mm", argv[++i]));
+        } else if (arg == "--volume" && i + 1 < argc) {
+            pipeline_options.push_back(std::make_pair("volume_crop", argv[++i]));
+        } else if (arg == "--volume-key") {
+            pipeline_options.push_back(std::make_pair("volume_crop_mode", "key"));
+        } else if (arg == "--privacy" && i + 1 < argc) {
+            pipeline_options.push_back(std::make_pair("privacy", argv[++i]));
+            enable_depth = true;
+        } else if (arg == "--privacy-far-mm" && i + 1 < argc) {
+            pipeline_options.push_back(std::make_pair("privacy_far_mm", argv[++i]));
+        } else if (arg == "--mesh") {
+            pipeline_options.push_back(std::make_pair("mesh", "1"));
+            enable_mesh = true;
+            enable_depth = true;
+        } else if (arg == "--mesh-tolerance" && i + 1 < argc) {
+            pipeline_options.push_back(std::make_pair("mesh_tolerance", argv[++i]));
+        } else if (arg == "--planes") {
+            pipeline_options.push_back(std::make_pair("planes", "1"));
+            enable_depth = true;
+        } else if (arg == "--planes-interval" && i + 1 < argc) {
+            pipeline_options.push_back(std::make_pair("planes_interval", argv[++i]));
+        } else if (arg == "--markers" && i + 1 < argc) {
+            markers_address = argv[++i];
+        } else if (arg == "--marker-threshold" && i + 1 < argc) {
+            marker_threshold = std::atoi(argv[++i]);
+        } else if (arg == "--touch" && i + 1 < argc) {
+            touch_address = argv[++i];
+            enable_depth = true;
+        } else if (arg == "--touch-band" && i + 1 < argc) {
+            std::string band = argv[++i];
+            size_t comma = band.find(',');
+            touch_min_mm = static_cast<float>(std::atof(band.c_str()));
+            touch_max_mm = comma == std::string::npos ? 0.0f : static_cast<float>(std::atof(band.c_str() + comma + 1));
+        } else if (arg == "--roi" && i + 1 < argc) {
+            pipeline_options.push_back(std::make_pair("roi", argv[++i]));
+        } else if (arg == "--plan") {
+            plan_only = true;
+        } else if (arg == "--fuse" && i + 1 < argc) {
+            pipeline_options.push_back(std::make_pair("fusion_devices", argv[++i]));
+            enable_fusion = true;
+            enable_depth = true;
+        } else if (arg == "--poses" && i + 1 < argc) {
+            pipeline_options.push_back(std::make_pair("poses_file", argv[++i]));
+        } else if (arg == "--fuse-view" && i + 1 < argc) {
+            pipeline_options.push_back(std::make_pair("fusion_view", argv[++i]));
         } else {
             std::cerr << "Unknown argument: " << arg << "\n";
             PrintUsage(argv[0]);
             return 1;
         }
     }
+    if (depth_server_bench > 0) {
+        char report[2048];
+        int ret = kndi_benchmark_depth_server(depth_server_bench, depth_server_compress, report, sizeof(report));
+        if (ret == KNDI_OK)
+            std::cout << report;
+        else
+            std::cerr << "Depth server benchmark failed: " << kndi_error_string(ret) << std::endl;
+        return ret == KNDI_OK ? 0 : 1;
+    }
+    if (depth_filter_bench) {
+        char report[2048];
+        int ret = kndi_benchmark_depth_filters(640, 480, 0, report, sizeof(report));
+        if (ret == KNDI_OK)
+            std::cout << report;
+        else
+            std::cerr << "Depth filter benchmark failed: " << kndi_error_string(ret) << std::endl;
+        return ret == KNDI_OK ? 0 : 1;
+    }
+    if (denoise_bench) {
+        char report[2048];
+        int ret = kndi_benchmark_video_denoise(640, 480, 0, static_cast<float>(std::atof(denoise_strength.c_str())),
+                                               std::atoi(denoise_threshold.c_str()), report, sizeof(report));
+        if (ret == KNDI_OK)
+            std::cout << report;
+        else
+            std::cerr << "Video denoise benchmark failed: " << kndi_error_string(ret) << std::endl;
+        return ret == KNDI_OK ? 0 : 1;
+    }
+    if (lut_bench) {
+        char report[2048];
+        int ret = kndi_benchmark_colour_lut(640, 480, 0, report, sizeof(report));
+        if (ret == KNDI_OK)
+            std::cout << report;
+        else
+            std::cerr << "Colour LUT benchmark failed: " << kndi_error_string(ret) << std::endl;
+        return ret == KNDI_OK ? 0 : 1;
+    }
     if (enable_ir && enable_rgb) {
         std::cerr << "Error: Cannot enable both IR and RGB streaming simultaneously.\n";
         return 1;
@@ -104,223 +314,93 @@ int main(int argc, char** argv)
         std::cerr << "Error: No streaming mode enabled. Use --ir, --rgb, and/or --depth.\n";
         return 1;
     }
-    // Set the number of video channels.
-    if (enable_ir) {
-        videoChannels = 1;
-    } else if (enable_rgb) {
-        videoChannels = 3;
-    }
-    
-    // Initialize the NDI library.
-    if (!NDIlib_initialize()) {
-        std::cerr << "NDI initialization failed – please ensure the NDI runtime is installed." << std::endl;
+
+    unsigned streams = 0;
+    if (enable_ir)
+        streams |= KNDI_STREAM_IR;
+    if (enable_rgb)
+        streams |= KNDI_STREAM_RGB;
+    if (enable_depth)
+        streams |= KNDI_STREAM_DEPTH;
+
+    kndi_pipeline* pipeline = kndi_open(device_index);
+    if (!pipeline) {
+        std::cerr << "Failed to create the capture pipeline." << std::endl;
         return 1;
     }
-    
-    // Create NDI sender instances.
-    NDIlib_send_instance_t ndiSenderVideo = nullptr;
-    if (enable_ir || enable_rgb) {
-        NDIlib_send_create_t ndiSendDesc;
-        std::memset(&ndiSendDesc, 0, sizeof(ndiSendDesc));
-        ndiSendDesc.p_ndi_name = (enable_ir ? "Kinect IR Stream" : "Kinect RGB Stream");
-        ndiSenderVideo = NDIlib_send_create(&ndiSendDesc);
-        if (!ndiSenderVideo) {
-            std::cerr << "Failed to create NDI video sender." << std::endl;
-            NDIlib_destroy();
+    int ret = kndi_set_streams(pipeline, streams);
+    // The command line tool owns the process, so SIGUSR1 may dump the recorder.
+    if (ret == KNDI_OK)
+        ret = kndi_set_option(pipeline, "flight_recorder_signal", "1");
+    for (size_t i = 0; ret == KNDI_OK && i < pipeline_options.size(); i++) {
+        ret = kndi_set_option(pipeline, pipeline_options[i].first.c_str(),
+                              pipeline_options[i].second.c_str());
+        if (ret != KNDI_OK)
+            std::cerr << "Invalid value for " << pipeline_options[i].first << ": "
+                      << pipeline_options[i].second << std::endl;
+    }
+    // One NDI source per stream, with the default stream names.
+    if (ret == KNDI_OK)
+        ret = kndi_add_ndi_sink(pipeline, enable_fusion ? streams | KNDI_STREAM_FUSED_DEPTH : streams, nullptr);
+    if (ret == KNDI_OK && replay_seconds > 0)
+        ret = kndi_add_replay_sink(pipeline, enable_fusion ? streams | KNDI_STREAM_FUSED_DEPTH : streams,
+                                   static_cast<size_t>(replay_mb) << 20, replay_seconds);
+    if (ret == KNDI_OK && !depth_server_address.empty()) {
+        if (!enable_depth) {
+            std::cerr << "Error: --depth-server needs --depth.\n";
+            kndi_close(pipeline);
             return 1;
         }
+        unsigned served = enable_fusion ? KNDI_STREAM_DEPTH | KNDI_STREAM_FUSED_DEPTH : KNDI_STREAM_DEPTH;
+        if (enable_mesh)
+            served |= KNDI_STREAM_MESH;
+        ret = kndi_add_depth_server(pipeline, served, depth_server_address.c_str(), depth_server_compress);
     }
-    NDIlib_send_instance_t ndiSenderDepth = nullptr;
-    if (enable_depth) {
-        NDIlib_send_create_t ndiSendDesc;
-        std::memset(&ndiSendDesc, 0, sizeof(ndiSendDesc));
-        ndiSendDesc.p_ndi_name = "Kinect Depth Stream";
-        ndiSenderDepth = NDIlib_send_create(&ndiSendDesc);
-        if (!ndiSenderDepth) {
-            std::cerr << "Failed to create NDI depth sender." << std::endl;
-            if (ndiSenderVideo)
-                NDIlib_send_destroy(ndiSenderVideo);
-            NDIlib_destroy();
+    if (ret == KNDI_OK && !markers_address.empty()) {
+        if (!enable_ir) {
+            std::cerr << "Error: --markers needs --ir.\n";
+            kndi_close(pipeline);
             return 1;
         }
+        ret = kndi_add_marker_tracker(pipeline, markers_address.c_str(), marker_threshold, 4, 4000, enable_depth);
+    }
+    if (ret == KNDI_OK && !touch_address.empty())
+        ret = kndi_add_touch_surface(pipeline, touch_address.c_str(), touch_min_mm, touch_max_mm);
+    if (ret != KNDI_OK) {
+        std::cerr << "Failed to set up streaming: " << kndi_error_string(ret) << std::endl;
+        kndi_close(pipeline);
+        return 1;
     }
-    
-    std::cout << "Starting Kinect streaming with auto-detection and reconnection..." << std::endl;
-    
-    // Outer loop: attempt to (re)connect to the Kinect device.
-    while (true) {
-        freenect_context* f_ctx = nullptr;
-        freenect_device* f_dev = nullptr;
 
-        // Initialize the Kinect context.
-        if (freenect_init(&f_ctx, nullptr) < 0) {
-            std::cerr << "freenect_init() failed. No Kinect found. Retrying in 5 seconds..." << std::endl;
-            std::this_thread::sleep_for(std::chrono::seconds(5));
-            continue;
-        }
-        // Open the first available Kinect.
-        if (freenect_open_device(f_ctx, &f_dev, 0) < 0) {
-            std::cerr << "Could not open Kinect device. Retrying in 5 seconds..." << std::endl;
-            freenect_shutdown(f_ctx);
-            std::this_thread::sleep_for(std::chrono::seconds(5));
-            continue;
-        }
+    if (plan_only) {
+        char report[4096];
+        ret = kndi_plan(pipeline, report, sizeof(report));
+        if (ret == KNDI_OK || ret == KNDI_ERROR_BUDGET)
+            std::cout << report;
+        else
+            std::cerr << "Planning failed: " << kndi_error_string(ret) << std::endl;
+        kndi_close(pipeline);
+        return ret == KNDI_OK ? 0 : 1;
+    }
 
-        // Set up video stream if enabled.
-        if (enable_ir || enable_rgb) {
-            freenect_set_video_callback(f_dev, VideoCallback);
-            freenect_frame_mode video_mode;
-            if (enable_ir) {
-                video_mode = freenect_find_video_mode(FREENECT_RESOLUTION_MEDIUM, FREENECT_VIDEO_IR_8BIT);
-            } else { // RGB mode
-                video_mode = freenect_find_video_mode(FREENECT_RESOLUTION_MEDIUM, FREENECT_VIDEO_RGB);
-            }
-            if (freenect_set_video_mode(f_dev, video_mode) < 0) {
-                std::cerr << "Could not set the video mode. Reconnecting..." << std::endl;
-                freenect_close_device(f_dev);
-                freenect_shutdown(f_ctx);
-                std::this_thread::sleep_for(std::chrono::seconds(5));
-                continue;
-            }
-            // IMPORTANT: Start the video stream.
-            if (freenect_start_video(f_dev) < 0) {
-                std::cerr << "Could not start the video stream. Reconnecting..." << std::endl;
-                freenect_close_device(f_dev);
-                freenect_shutdown(f_ctx);
-                std::this_thread::sleep_for(std::chrono::seconds(5));
-                continue;
-            }
-        }
-        // Set up depth stream if enabled.
-        if (enable_depth) {
-            freenect_set_depth_callback(f_dev, DepthCallback);
-            freenect_frame_mode depth_mode = freenect_find_depth_mode(FREENECT_RESOLUTION_MEDIUM, FREENECT_DEPTH_11BIT);
-            if (freenect_set_depth_mode(f_dev, depth_mode) < 0) {
-                std::cerr << "Could not set the depth mode. Reconnecting..." << std::endl;
-                if (enable_ir || enable_rgb)
-                    freenect_stop_video(f_dev);
-                freenect_close_device(f_dev);
-                freenect_shutdown(f_ctx);
-                std::this_thread::sleep_for(std::chrono::seconds(5));
-                continue;
-            }
-            // IMPORTANT: Start the depth stream.
-            if (freenect_start_depth(f_dev) < 0) {
-                std::cerr << "Could not start the depth stream. Reconnecting..." << std::endl;
-                if (enable_ir || enable_rgb)
-                    freenect_stop_video(f_dev);
-                freenect_close_device(f_dev);
-                freenect_shutdown(f_ctx);
-                std::this_thread::sleep_for(std::chrono::seconds(5));
-                continue;
-            }
+    // Runs the connect / stream / reconnect loop until SIGINT or SIGTERM,
+    // then stops cleanly so the stats segment is removed.
+    std::signal(SIGINT, OnStopSignal);
+    std::signal(SIGTERM, OnStopSignal);
+#ifdef SIGUSR2
+    if (replay_seconds > 0)
+        std::signal(SIGUSR2, OnReplaySignal);
+#endif
+    ret = kndi_start(pipeline);
+    while (ret == KNDI_OK && !stop_requested) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (replay_requested) {
+            replay_requested = 0;
+            int saved = kndi_save_replay(pipeline, nullptr);
+            if (saved != KNDI_OK)
+                std::cerr << "Replay not saved: " << kndi_error_string(saved) << std::endl;
         }
-
-        std::cout << "Kinect connected. Streaming data over NDI..." << std::endl;
-
-        // Inner loop: process Kinect events and transmit frames.
-        bool kinect_active = true;
-        while (kinect_active) {
-            int ret = freenect_process_events(f_ctx);
-            if (ret < 0) {
-                std::cerr << "Kinect disconnected or error encountered (code " << ret << "). Reconnecting..." << std::endl;
-                kinect_active = false;
-                break;
-            }
-
-            // Process video frame (IR or RGB) if available.
-            if ((enable_ir || enable_rgb) && newVideoFrame.load()) {
-                // Create a BGRX frame buffer.
-                std::vector<uint8_t> rgbaFrame(WIDTH * HEIGHT * 4);
-                std::vector<uint8_t> localVideoBuffer;
-                {
-                    std::lock_guard<std::mutex> lock(videoMutex);
-                    localVideoBuffer = videoBuffer;
-                    newVideoFrame = false;
-                }
-                if (enable_ir) {
-                    // For IR, replicate the single channel into B, G, and R.
-                    for (int i = 0; i < WIDTH * HEIGHT; i++) {
-                        uint8_t gray = localVideoBuffer[i];
-                        rgbaFrame[i * 4 + 0] = gray;  // Blue
-                        rgbaFrame[i * 4 + 1] = gray;  // Green
-                        rgbaFrame[i * 4 + 2] = gray;  // Red
-                        rgbaFrame[i * 4 + 3] = 255;   // Unused (X)
-                    }
-                } else if (enable_rgb) {
-                    // For RGB, convert from RGB to BGRX.
-                    for (int i = 0; i < WIDTH * HEIGHT; i++) {
-                        uint8_t r = localVideoBuffer[i * 3 + 0];
-                        uint8_t g = localVideoBuffer[i * 3 + 1];
-                        uint8_t b = localVideoBuffer[i * 3 + 2];
-                        rgbaFrame[i * 4 + 0] = b; // Blue
-                        rgbaFrame[i * 4 + 1] = g; // Green
-                        rgbaFrame[i * 4 + 2] = r; // Red
-                        rgbaFrame[i * 4 + 3] = 255; // Unused (X)
-                    }
-                }
-                NDIlib_video_frame_v2_t videoFrame;
-                videoFrame.xres = WIDTH;
-                videoFrame.yres = HEIGHT;
-                videoFrame.FourCC = NDIlib_FourCC_type_BGRX;
-                videoFrame.frame_rate_N = 30;
-                videoFrame.frame_rate_D = 1;
-                videoFrame.picture_aspect_ratio = static_cast<float>(WIDTH) / HEIGHT;
-                videoFrame.p_data = rgbaFrame.data();
-                videoFrame.line_stride_in_bytes = WIDTH * 4;
-                if (ndiSenderVideo)
-                    NDIlib_send_send_video_v2(ndiSenderVideo, &videoFrame);
-            }
-
-            // Process depth frame if available.
-            if (enable_depth && newDepthFrame.load()) {
-                std::vector<uint8_t> rgbaFrame(WIDTH * HEIGHT * 4);
-                std::vector<uint16_t> localDepthBuffer;
-                {
-                    std::lock_guard<std::mutex> lock(depthMutex);
-                    localDepthBuffer = depthBuffer;
-                    newDepthFrame = false;
-                }
-                // Map 11-bit depth (0–2047) to an 8-bit grayscale image.
-                for (int i = 0; i < WIDTH * HEIGHT; i++) {
-                    uint16_t depthVal = localDepthBuffer[i];
-                    uint8_t gray = static_cast<uint8_t>((depthVal * 255) / 2047);
-                    rgbaFrame[i * 4 + 0] = gray; // Blue
-                    rgbaFrame[i * 4 + 1] = gray; // Green
-                    rgbaFrame[i * 4 + 2] = gray; // Red
-                    rgbaFrame[i * 4 + 3] = 255;  // Unused (X)
-                }
-                NDIlib_video_frame_v2_t depthFrame;
-                depthFrame.xres = WIDTH;
-                depthFrame.yres = HEIGHT;
-                depthFrame.FourCC = NDIlib_FourCC_type_BGRX;
-                depthFrame.frame_rate_N = 30;
-                depthFrame.frame_rate_D = 1;
-                depthFrame.picture_aspect_ratio = static_cast<float>(WIDTH) / HEIGHT;
-                depthFrame.p_data = rgbaFrame.data();
-                depthFrame.line_stride_in_bytes = WIDTH * 4;
-                if (ndiSenderDepth)
-                    NDIlib_send_send_video_v2(ndiSenderDepth, &depthFrame);
-            }
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
-        }  // End inner loop
-
-        // Kinect disconnected or error occurred; clean up.
-        if (enable_ir || enable_rgb)
-            freenect_stop_video(f_dev);
-        if (enable_depth)
-            freenect_stop_depth(f_dev);
-        freenect_close_device(f_dev);
-        freenect_shutdown(f_ctx);
-        std::cerr << "Kinect connection lost. Attempting to reconnect in 5 seconds..." << std::endl;
-        std::this_thread::sleep_for(std::chrono::seconds(5));
-    }  // End outer loop
-
-    // Cleanup (unreachable in this infinite-loop design).
-    if (ndiSenderVideo)
-        NDIlib_send_destroy(ndiSenderVideo);
-    if (ndiSenderDepth)
-        NDIlib_send_destroy(ndiSenderDepth);
-    NDIlib_destroy();
-    return 0;
+    }
+    kndi_close(pipeline);
+    return ret == KNDI_OK ? 0 : 1;
 }
@@ -0,0 +1,187 @@
+// Live view of every kinect-ndi sender on this host, read from the stats
+// segments they publish in shared memory (see src/stats_segment.h).
+// Reading never blocks or slows down a sender.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+#include <sys/mman.h>
+
+#include "kinect_ndi.h"
+#include "stats_segment.h"
+
+bool once = false;
+int interval_ms = 1000;
+std::vector<int> only_pids;
+
+void PrintUsage(const char* progName) {
+    std::cout << "Usage: " << progName << " [--once] [--interval MS] [PID...]\n"
+              << "Show frame rate, latency, drops, pool depth and per-thread CPU of the\n"
+              << "running kinect-ndi senders (all of them, or those with the given PIDs).\n"
+              << "  --once          Print one snapshot and exit.\n"
+              << "  --interval MS   Refresh period (default 1000).\n"
+              << "  --help          Display this help message.\n";
+}
+
+const char* StreamName(uint32_t stream) {
+    switch (stream) {
+    case KNDI_STREAM_RGB:         return "rgb";
+    case KNDI_STREAM_IR:          return "ir";
+    case KNDI_STREAM_DEPTH:       return "depth";
+    case KNDI_STREAM_FUSED_DEPTH: return "fused_depth";
+    case KNDI_STREAM_POINT_CLOUD: return "point_cloud";
+    }
+    return "?";
+}
+
+std::string Duration(int64_t ms) {
+    int64_t seconds = std::max<int64_t>(0, ms / 1000);
+    char text[32];
+    if (seconds >= 3600)
+        std::snprintf(text, sizeof(text), "%lldh%02lldm", static_cast<long long>(seconds / 3600),
+                      static_cast<long long>(seconds / 60 % 60));
+    else
+        std::snprintf(text, sizeof(text), "%lldm%02llds", static_cast<long long>(seconds / 60),
+                      static_cast<long long>(seconds % 60));
+    return text;
+}
+
+bool ProcessAlive(int pid) {
+    return kill(pid, 0) == 0 || errno == EPERM;
+}
+
+void Render(const std::vector<kndi::StatsPage>& pages, bool clear) {
+    int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    std::string out = clear ? "\x1b[H\x1b[2J" : "";
+    char line[256];
+    std::snprintf(line, sizeof(line), "kinect-ndi-top: %zu sender(s)\n", pages.size());
+    out += line;
+    for (const kndi::StatsPage& page : pages) {
+        int64_t age = now - page.updatedUnixMs;
+        std::snprintf(line, sizeof(line), "\nPID %d  %s  up %s  %s  active Kinect %d\n", page.pid, page.name,
+                      Duration(now - page.startedUnixMs).c_str(),
+                      age > 3 * static_cast<int64_t>(page.intervalMs) ? "NOT UPDATING"
+                                                                       : (page.running ? "running" : "stopped"),
+                      page.activeDevice);
+        out += line;
+        std::snprintf(line, sizeof(line), "  connects %llu  disconnects %llu  failovers %llu  watchdogs %llu  fused drops %llu\n",
+                      static_cast<unsigned long long>(page.connects), static_cast<unsigned long long>(page.disconnects),
+                      static_cast<unsigned long long>(page.failovers), static_cast<unsigned long long>(page.watchdogs),
+                      static_cast<unsigned long long>(page.derivedDrops));
+        out += line;
+        static const char* const locks[] = { "no", "frame pools only", "yes" };
+        std::snprintf(line, sizeof(line), "  page faults/s: minor %.0f  major %.0f  memory locked: %s\n",
+                      page.minorFaultsPerSecond, page.majorFaultsPerSecond, locks[std::min<uint32_t>(page.memoryLock, 2)]);
+        out += line;
+        out += "  STREAM       KINECT    FPS   P50 ms   P95 ms   P99 ms   MAX ms  POOL    DROPPED     FRAMES\n";
+        for (uint32_t i = 0; i < std::min<uint32_t>(page.streamCount, kndi::StatsPage::kMaxStreams); i++) {
+            const kndi::StatsStream& stream = page.streams[i];
+            char device[16];
+            if (stream.device < 0)
+                std::snprintf(device, sizeof(device), "merged");
+            else
+                std::snprintf(device, sizeof(device), "%d%s", stream.device, stream.active ? "" : " sb");
+            std::snprintf(line, sizeof(line), "  %-12s %6s %6.1f %8.2f %8.2f %8.2f %8.2f  %u/%-3u %8llu %10llu\n",
+                          StreamName(stream.stream), device, stream.fps, stream.latencyP50Ms, stream.latencyP95Ms,
+                          stream.latencyP99Ms, stream.latencyMaxMs, stream.poolInUse, page.poolSlots,
+                          static_cast<unsigned long long>(stream.dropped), static_cast<unsigned long long>(stream.frames));
+            out += line;
+        }
+        out += "  THREAD            CPU %  MINFLT/s  MAJFLT/s\n";
+        for (uint32_t i = 0; i < std::min<uint32_t>(page.threadCount, kndi::StatsPage::kMaxThreads); i++) {
+            const kndi::StatsThread& thread = page.threads[i];
+            // Idle threads that do not fault are left out after the busiest few.
+            if (i >= 8 && thread.cpuPercent < 0.5f && thread.minorFaultsPerSecond == 0.0f &&
+                thread.majorFaultsPerSecond == 0.0f)
+                continue;
+            std::snprintf(line, sizeof(line), "  %-16.16s %6.1f  %8.0f  %8.0f\n", thread.name, thread.cpuPercent,
+                          thread.minorFaultsPerSecond, thread.majorFaultsPerSecond);
+            out += line;
+        }
+    }
+    std::fwrite(out.data(), 1, out.size(), stdout);
+    std::fflush(stdout);
+}
+
+int main(int argc, char** argv)
+{
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            PrintUsage(argv[0]);
+            return 0;
+        } else if (arg == "--once") {
+            once = true;
+        } else if (arg == "--interval" && i + 1 < argc) {
+            interval_ms = std::max(100, std::atoi(argv[++i]));
+        } else if (std::atoi(arg.c_str()) > 0) {
+            only_pids.push_back(std::atoi(arg.c_str()));
+        } else {
+            std::cerr << "Unknown argument: " << arg << "\n";
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::map<std::string, std::unique_ptr<kndi::StatsReader>> readers;
+    for (;;) {
+        std::vector<std::string> names = kndi::StatsReader::List();
+        // Without a listing (not Linux), probe the given senders' first
+        // pipelines.
+        bool listed = !names.empty();
+        for (int pid : only_pids) {
+            for (int n = 0; !listed && n < 4; n++)
+                names.push_back("/" + std::string(kndi::kStatsSegmentPrefix) + std::to_string(pid) + "-" +
+                                std::to_string(n));
+        }
+        std::vector<kndi::StatsPage> pages;
+        for (const std::string& name : names) {
+            std::unique_ptr<kndi::StatsReader>& reader = readers[name];
+            if (!reader) {
+                reader.reset(new kndi::StatsReader);
+                if (!reader->Open(name)) {
+                    readers.erase(name);
+                    continue;
+                }
+            }
+            kndi::StatsPage page;
+            if (!reader->Read(page))
+                continue;
+            if (!ProcessAlive(page.pid)) {
+                // Left behind by a sender that crashed.
+                shm_unlink(name.c_str());
+                readers.erase(name);
+                continue;
+            }
+            if (only_pids.empty() || std::find(only_pids.begin(), only_pids.end(), page.pid) != only_pids.end())
+                pages.push_back(page);
+        }
+        // Forget segments that are gone.
+        for (std::map<std::string, std::unique_ptr<kndi::StatsReader>>::iterator it = readers.begin();
+             it != readers.end();) {
+            if (std::find(names.begin(), names.end(), it->first) == names.end())
+                it = readers.erase(it);
+            else
+                ++it;
+        }
+        std::sort(pages.begin(), pages.end(),
+                  [](const kndi::StatsPage& a, const kndi::StatsPage& b) { return a.pid < b.pid; });
+        Render(pages, !once);
+        if (once)
+            return 0;
+        std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+    }
+}
@@ -0,0 +1,588 @@
+// Python extension module on top of libkinectndi.
+//
+// Frames are handed to Python as `kinectndi.Frame` objects that keep a
+// reference on the underlying frame pool buffer and expose it through the
+// buffer protocol, so `frame.array` / `numpy.asarray(frame)` is a view of the
+// buffer libfreenect captured into. The pool buffer is released when the last
+// Python reference (frame or array) is garbage collected.
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "kinect_ndi.h"
+
+namespace {
+
+// Default pool size for Python consumers: arrays tend to be kept around a
+// little longer than in C callbacks.
+constexpr const char* kDefaultPoolFrames = "8";
+
+int StreamSlot(unsigned stream)
+{
+    switch (stream) {
+    case KNDI_STREAM_RGB:   return 0;
+    case KNDI_STREAM_IR:    return 1;
+    case KNDI_STREAM_DEPTH: return 2;
+    case KNDI_STREAM_FUSED_DEPTH: return 3;
+    case KNDI_STREAM_POINT_CLOUD: return 4;
+    }
+    return -1;
+}
+
+constexpr int kStreamSlots = 5;
+
+// Latest frame per stream, filled on the capture thread without the GIL.
+struct FrameMailbox {
+    std::mutex mutex;
+    std::condition_variable ready;
+    const kndi_frame* latest[kStreamSlots] = {};
+    uint64_t dropped[kStreamSlots] = {};
+
+    static void OnFrame(const kndi_frame* frame, void* user)
+    {
+        FrameMailbox* self = static_cast<FrameMailbox*>(user);
+        int slot = StreamSlot(frame->stream);
+        if (slot < 0)
+            return;
+        kndi_frame_retain(frame);
+        const kndi_frame* previous;
+        {
+            std::lock_guard<std::mutex> lock(self->mutex);
+            previous = self->latest[slot];
+            self->latest[slot] = frame;
+            if (previous)
+                self->dropped[slot]++;
+        }
+        if (previous)
+            kndi_frame_release(previous);
+        self->ready.notify_all();
+    }
+
+    void Clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int i = 0; i < kStreamSlots; i++) {
+            if (latest[i])
+                kndi_frame_release(latest[i]);
+            latest[i] = nullptr;
+        }
+    }
+};
+
+struct PipelineObject {
+    PyObject_HEAD
+    kndi_pipeline* pipeline;
+    FrameMailbox* mailbox;
+    bool callbackRegistered;
+};
+
+struct FrameObject {
+    PyObject_HEAD
+    PyObject* owner;   // PipelineObject owning the frame pool; start() will not reallocate it meanwhile.
+    const kndi_frame* frame;
+    Py_ssize_t shape[3];
+    Py_ssize_t strides[3];
+    int ndim;
+};
+
+// Zero-initialized; PyInit_kinectndi() fills in the object header and slots.
+PyTypeObject FrameType;
+PyTypeObject PipelineType;
+
+PyObject* RaiseError(int error)
+{
+    PyErr_Format(PyExc_RuntimeError, "kinectndi: %s (%d)", kndi_error_string(error), error);
+    return nullptr;
+}
+
+// ---------------------------------------------------------------------------
+// Frame
+// ---------------------------------------------------------------------------
+
+// Takes over one reference on `frame`.
+PyObject* NewFrame(PyObject* owner, const kndi_frame* frame)
+{
+    FrameObject* self = PyObject_New(FrameObject, &FrameType);
+    if (!self) {
+        kndi_frame_release(frame);
+        return nullptr;
+    }
+    Py_INCREF(owner);
+    self->owner = owner;
+    self->frame = frame;
+    self->shape[0] = frame->height;
+    self->shape[1] = frame->width;
+    self->strides[0] = frame->stride;
+    self->strides[1] = frame->bytes_per_pixel;
+    self->ndim = 2;
+    if (frame->stream == KNDI_STREAM_RGB) {
+        self->shape[2] = 3;
+        self->strides[2] = 1;
+        self->ndim = 3;
+    } else if (frame->stream == KNDI_STREAM_POINT_CLOUD) {
+        // N x 3 float32 (x, y, z) in world millimetres.
+        self->shape[0] = frame->width;
+        self->shape[1] = 3;
+        self->strides[0] = frame->bytes_per_pixel;
+        self->strides[1] = sizeof(float);
+    }
+    return reinterpret_cast<PyObject*>(self);
+}
+
+void Frame_dealloc(FrameObject* self)
+{
+    kndi_frame_release(self->frame);
+    Py_XDECREF(self->owner);
+    PyObject_Del(self);
+}
+
+int Frame_getbuffer(FrameObject* self, Py_buffer* view, int flags)
+{
+    if ((flags & PyBUF_WRITABLE) == PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "kinectndi frames are read-only");
+        view->obj = nullptr;
+        return -1;
+    }
+    view->obj = reinterpret_cast<PyObject*>(self);
+    Py_INCREF(self);
+    view->buf = const_cast<void*>(self->frame->data);
+    view->len = static_cast<Py_ssize_t>(self->frame->size);
+    view->readonly = 1;
+    const char* format = "B";
+    view->itemsize = 1;
+    if (self->frame->stream == KNDI_STREAM_DEPTH || self->frame->stream == KNDI_STREAM_FUSED_DEPTH) {
+        format = "H";
+        view->itemsize = 2;
+    } else if (self->frame->stream == KNDI_STREAM_POINT_CLOUD) {
+        format = "f";
+        view->itemsize = sizeof(float);
+    }
+    view->format = (flags & PyBUF_FORMAT) ? const_cast<char*>(format) : nullptr;
+    view->ndim = self->ndim;
+    view->shape = (flags & PyBUF_ND) ? self->shape : nullptr;
+    view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? self->strides : nullptr;
+    view->suboffsets = nullptr;
+    view->internal = nullptr;
+    return 0;
+}
+
+PyBufferProcs FrameBufferProcs = { reinterpret_cast<getbufferproc>(Frame_getbuffer), nullptr };
+
+PyObject* Frame_array(FrameObject* self, void*)
+{
+    PyObject* numpy = PyImport_ImportModule("numpy");
+    if (!numpy)
+        return nullptr;
+    PyObject* array = PyObject_CallMethod(numpy, "asarray", "O", self);
+    Py_DECREF(numpy);
+    return array;
+}
+
+PyObject* Frame_stream(FrameObject* self, void*) { return PyLong_FromLong(self->frame->stream); }
+PyObject* Frame_device_index(FrameObject* self, void*) { return PyLong_FromLong(self->frame->device_index); }
+PyObject* Frame_width(FrameObject* self, void*) { return PyLong_FromLong(self->frame->width); }
+PyObject* Frame_height(FrameObject* self, void*) { return PyLong_FromLong(self->frame->height); }
+PyObject* Frame_sequence(FrameObject* self, void*) { return PyLong_FromUnsignedLongLong(self->frame->sequence); }
+PyObject* Frame_device_timestamp(FrameObject* self, void*) { return PyLong_FromUnsignedLong(self->frame->device_timestamp); }
+PyObject* Frame_host_timestamp_ns(FrameObject* self, void*) { return PyLong_FromLongLong(self->frame->host_timestamp_ns); }
+PyObject* Frame_synced_timestamp_ns(FrameObject* self, void*) { return PyLong_FromLongLong(self->frame->synced_timestamp_ns); }
+
+PyGetSetDef FrameGetSet[] = {
+    { "array", reinterpret_cast<getter>(Frame_array), nullptr, "Zero-copy read-only numpy view of the frame.", nullptr },
+    { "stream", reinterpret_cast<getter>(Frame_stream), nullptr, "Stream flag (RGB, IR, DEPTH, FUSED_DEPTH or POINT_CLOUD).", nullptr },
+    { "device_index", reinterpret_cast<getter>(Frame_device_index), nullptr, "Kinect index.", nullptr },
+    { "width", reinterpret_cast<getter>(Frame_width), nullptr, "Width in pixels.", nullptr },
+    { "height", reinterpret_cast<getter>(Frame_height), nullptr, "Height in pixels.", nullptr },
+    { "sequence", reinterpret_cast<getter>(Frame_sequence), nullptr, "Per-stream frame counter.", nullptr },
+    { "device_timestamp", reinterpret_cast<getter>(Frame_device_timestamp), nullptr, "Kinect 60 MHz counter.", nullptr },
+    { "host_timestamp_ns", reinterpret_cast<getter>(Frame_host_timestamp_ns), nullptr, "Host monotonic time at capture.", nullptr },
+    { "synced_timestamp_ns", reinterpret_cast<getter>(Frame_synced_timestamp_ns), nullptr,
+      "Kinect clock mapped to host monotonic time, USB jitter removed (0 until locked).", nullptr },
+    { nullptr, nullptr, nullptr, nullptr, nullptr }
+};
+
+// ---------------------------------------------------------------------------
+// Pipeline
+// ---------------------------------------------------------------------------
+
+int Pipeline_init(PipelineObject* self, PyObject* args, PyObject* kwds)
+{
+    static const char* keywords[] = { "device", "streams", nullptr };
+    int device = 0;
+    unsigned int streams = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|iI", const_cast<char**>(keywords), &device, &streams))
+        return -1;
+    if (self->pipeline) {
+        PyErr_SetString(PyExc_RuntimeError, "Pipeline already initialized");
+        return -1;
+    }
+    self->pipeline = kndi_open(device);
+    if (!self->pipeline) {
+        PyErr_SetString(PyExc_ValueError, "invalid device index");
+        return -1;
+    }
+    self->mailbox = new FrameMailbox;
+    self->callbackRegistered = false;
+    kndi_set_option(self->pipeline, "pool_frames", kDefaultPoolFrames);
+    if (streams) {
+        int ret = kndi_set_streams(self->pipeline, streams);
+        if (ret < 0) {
+            RaiseError(ret);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void Pipeline_dealloc(PipelineObject* self)
+{
+    if (self->pipeline) {
+        Py_BEGIN_ALLOW_THREADS
+        kndi_stop(self->pipeline);
+        Py_END_ALLOW_THREADS
+        self->mailbox->Clear();
+        kndi_close(self->pipeline);
+    }
+    delete self->mailbox;
+    Py_TYPE(self)->tp_free(reinterpret_cast<PyObject*>(self));
+}
+
+bool CheckOpen(PipelineObject* self)
+{
+    if (!self->pipeline) {
+        PyErr_SetString(PyExc_RuntimeError, "Pipeline not initialized");
+        return false;
+    }
+    return true;
+}
+
+PyObject* Pipeline_set_streams(PipelineObject* self, PyObject* args)
+{
+    unsigned int streams = 0;
+    if (!CheckOpen(self) || !PyArg_ParseTuple(args, "I", &streams))
+        return nullptr;
+    int ret = kndi_set_streams(self->pipeline, streams);
+    if (ret < 0)
+        return RaiseError(ret);
+    Py_RETURN_NONE;
+}
+
+PyObject* Pipeline_set_option(PipelineObject* self, PyObject* args)
+{
+    const char* key = nullptr;
+    PyObject* value = nullptr;
+    if (!CheckOpen(self) || !PyArg_ParseTuple(args, "sO", &key, &value))
+        return nullptr;
+    PyObject* text = PyObject_Str(value);
+    if (!text)
+        return nullptr;
+    int ret = kndi_set_option(self->pipeline, key, PyUnicode_AsUTF8(text));
+    Py_DECREF(text);
+    if (ret < 0)
+        return RaiseError(ret);
+    Py_RETURN_NONE;
+}
+
+PyObject* Pipeline_add_ndi_sink(PipelineObject* self, PyObject* args, PyObject* kwds)
+{
+    static const char* keywords[] = { "streams", "name", nullptr };
+    unsigned int streams = 0;
+    const char* name = nullptr;
+    if (!CheckOpen(self) ||
+        !PyArg_ParseTupleAndKeywords(args, kwds, "I|z", const_cast<char**>(keywords), &streams, &name))
+        return nullptr;
+    int ret = kndi_add_ndi_sink(self->pipeline, streams, name);
+    if (ret < 0)
+        return RaiseError(ret);
+    Py_RETURN_NONE;
+}
+
+PyObject* Pipeline_start(PipelineObject* self, PyObject*)
+{
+    if (!CheckOpen(self))
+        return nullptr;
+    int ret = KNDI_OK;
+    if (!self->callbackRegistered) {
+        ret = kndi_add_frame_callback(self->pipeline, KNDI_STREAM_ALL, FrameMailbox::OnFrame, self->mailbox);
+        if (ret < 0)
+            return RaiseError(ret);
+        self->callbackRegistered = true;
+    }
+    // Tuning, planning and prefaulting can take seconds on a first run.
+    Py_BEGIN_ALLOW_THREADS
+    ret = kndi_start(self->pipeline);
+    Py_END_ALLOW_THREADS
+    if (ret < 0)
+        return RaiseError(ret);
+    Py_RETURN_NONE;
+}
+
+PyObject* Pipeline_plan(PipelineObject* self, PyObject*)
+{
+    if (!CheckOpen(self))
+        return nullptr;
+    std::vector<char> report(8192);
+    int ret;
+    Py_BEGIN_ALLOW_THREADS
+    ret = kndi_plan(self->pipeline, report.data(), report.size());
+    Py_END_ALLOW_THREADS
+    if (ret < 0 && ret != KNDI_ERROR_BUDGET)
+        return RaiseError(ret);
+    return Py_BuildValue("(Os)", ret == KNDI_OK ? Py_True : Py_False, report.data());
+}
+
+PyObject* Pipeline_add_replay_sink(PipelineObject* self, PyObject* args, PyObject* kwds)
+{
+    static const char* keywords[] = { "streams", "memory_mb", "seconds", nullptr };
+    unsigned int streams = 0;
+    Py_ssize_t memoryMb = 0;
+    int seconds = 0;
+    if (!CheckOpen(self) ||
+        !PyArg_ParseTupleAndKeywords(args, kwds, "Ini", const_cast<char**>(keywords),
+                                     &streams, &memoryMb, &seconds))
+        return nullptr;
+    if (memoryMb <= 0)
+        return RaiseError(KNDI_ERROR_INVALID);
+    int ret = kndi_add_replay_sink(self->pipeline, streams, static_cast<size_t>(memoryMb) << 20, seconds);
+    if (ret < 0)
+        return RaiseError(ret);
+    Py_RETURN_NONE;
+}
+
+PyObject* Pipeline_add_depth_server(PipelineObject* self, PyObject* args, PyObject* kwds)
+{
+    static const char* keywords[] = { "streams", "address", "compressed", nullptr };
+    unsigned int streams = 0;
+    const char* address = nullptr;
+    int compressed = 0;
+    if (!CheckOpen(self) ||
+        !PyArg_ParseTupleAndKeywords(args, kwds, "Is|p", const_cast<char**>(keywords),
+                                     &streams, &address, &compressed))
+        return nullptr;
+    int ret = kndi_add_depth_server(self->pipeline, streams, address, compressed);
+    if (ret < 0)
+        return RaiseError(ret);
+    Py_RETURN_NONE;
+}
+
+PyObject* Pipeline_save_replay(PipelineObject* self, PyObject* args, PyObject* kwds)
+{
+    static const char* keywords[] = { "path", nullptr };
+    const char* path = nullptr;
+    if (!CheckOpen(self) ||
+        !PyArg_ParseTupleAndKeywords(args, kwds, "|z", const_cast<char**>(keywords), &path))
+        return nullptr;
+    int ret = kndi_save_replay(self->pipeline, path);
+    if (ret < 0)
+        return RaiseError(ret);
+    Py_RETURN_NONE;
+}
+
+PyObject* Pipeline_clock_stats(PipelineObject* self, PyObject* args, PyObject* kwds)
+{
+    static const char* keywords[] = { "device", "stream", nullptr };
+    int device = 0;
+    unsigned int stream = KNDI_STREAM_DEPTH;
+    if (!CheckOpen(self) ||
+        !PyArg_ParseTupleAndKeywords(args, kwds, "i|I", const_cast<char**>(keywords), &device, &stream))
+        return nullptr;
+    kndi_clock_stats stats;
+    int ret = kndi_get_clock_stats(self->pipeline, device, static_cast<kndi_stream>(stream), &stats);
+    if (ret < 0)
+        return RaiseError(ret);
+    return Py_BuildValue("{s:O,s:d,s:d,s:K}", "locked", stats.locked ? Py_True : Py_False,
+                         "drift_ppm", stats.drift_ppm, "jitter_us", stats.jitter_us,
+                         "frames", static_cast<unsigned long long>(stats.frames));
+}
+
+PyObject* Pipeline_dump_flight_recorder(PipelineObject* self, PyObject* args, PyObject* kwds)
+{
+    static const char* keywords[] = { "path", nullptr };
+    const char* path = nullptr;
+    if (!CheckOpen(self) ||
+        !PyArg_ParseTupleAndKeywords(args, kwds, "|z", const_cast<char**>(keywords), &path))
+        return nullptr;
+    int ret;
+    Py_BEGIN_ALLOW_THREADS
+    ret = kndi_dump_flight_recorder(self->pipeline, path);
+    Py_END_ALLOW_THREADS
+    if (ret < 0)
+        return RaiseError(ret);
+    Py_RETURN_NONE;
+}
+
+PyObject* Pipeline_stop(PipelineObject* self, PyObject*)
+{
+    if (!CheckOpen(self))
+        return nullptr;
+    Py_BEGIN_ALLOW_THREADS
+    kndi_stop(self->pipeline);
+    Py_END_ALLOW_THREADS
+    self->mailbox->Clear();
+    Py_RETURN_NONE;
+}
+
+PyObject* Pipeline_read(PipelineObject* self, PyObject* args, PyObject* kwds)
+{
+    static const char* keywords[] = { "stream", "timeout", nullptr };
+    unsigned int stream = 0;
+    PyObject* timeoutObj = Py_None;
+    if (!CheckOpen(self) ||
+        !PyArg_ParseTupleAndKeywords(args, kwds, "I|O", const_cast<char**>(keywords), &stream, &timeoutObj))
+        return nullptr;
+    int slot = StreamSlot(stream);
+    if (slot < 0) {
+        PyErr_SetString(PyExc_ValueError, "stream must be one of RGB, IR, DEPTH, FUSED_DEPTH or POINT_CLOUD");
+        return nullptr;
+    }
+    double timeout = -1.0;
+    if (timeoutObj != Py_None) {
+        timeout = PyFloat_AsDouble(timeoutObj);
+        if (PyErr_Occurred())
+            return nullptr;
+    }
+
+    // Wait without the GIL for a frame that has not been read yet.
+    FrameMailbox* mailbox = self->mailbox;
+    const kndi_frame* frame = nullptr;
+    Py_BEGIN_ALLOW_THREADS
+    std::unique_lock<std::mutex> lock(mailbox->mutex);
+    auto available = [mailbox, slot] { return mailbox->latest[slot] != nullptr; };
+    bool ready;
+    if (timeout < 0) {
+        mailbox->ready.wait(lock, available);
+        ready = true;
+    } else {
+        ready = mailbox->ready.wait_for(lock, std::chrono::duration<double>(timeout), available);
+    }
+    if (ready) {
+        frame = mailbox->latest[slot];
+        mailbox->latest[slot] = nullptr;
+    }
+    lock.unlock();
+    Py_END_ALLOW_THREADS
+
+    if (!frame)
+        Py_RETURN_NONE;
+    return NewFrame(reinterpret_cast<PyObject*>(self), frame);
+}
+
+PyObject* Pipeline_dropped(PipelineObject* self, void*)
+{
+    if (!CheckOpen(self))
+        return nullptr;
+    std::lock_guard<std::mutex> lock(self->mailbox->mutex);
+    return Py_BuildValue("{s:K,s:K,s:K,s:K,s:K}",
+                         "rgb", static_cast<unsigned long long>(self->mailbox->dropped[0]),
+                         "ir", static_cast<unsigned long long>(self->mailbox->dropped[1]),
+                         "depth", static_cast<unsigned long long>(self->mailbox->dropped[2]),
+                         "fused_depth", static_cast<unsigned long long>(self->mailbox->dropped[3]),
+                         "point_cloud", static_cast<unsigned long long>(self->mailbox->dropped[4]));
+}
+
+// Method table entry for a callback of any calling convention; the cast goes
+// through void (*)(void) so the compiler knows the signature change is meant.
+template <typename Function>
+PyCFunction Method(Function function)
+{
+    return reinterpret_cast<PyCFunction>(reinterpret_cast<void (*)(void)>(function));
+}
+
+PyMethodDef PipelineMethods[] = {
+    { "set_streams", Method(Pipeline_set_streams), METH_VARARGS,
+      "set_streams(streams)\nSelect streams to capture (bitmask of RGB, IR, DEPTH)." },
+    { "set_option", Method(Pipeline_set_option), METH_VARARGS,
+      "set_option(key, value)\nSet a pipeline option (see kndi_set_option)." },
+    { "add_ndi_sink", Method(Pipeline_add_ndi_sink), METH_VARARGS | METH_KEYWORDS,
+      "add_ndi_sink(streams, name=None)\nAlso send the given streams over NDI." },
+    { "plan", Method(Pipeline_plan), METH_NOARGS,
+      "plan() -> (within_budget, report)\nEstimate the per-frame CPU cost of the configured\n"
+      "pipeline on this host and return a per-stage cost table." },
+    { "add_replay_sink", Method(Pipeline_add_replay_sink),
+      METH_VARARGS | METH_KEYWORDS,
+      "add_replay_sink(streams, memory_mb, seconds)\nKeep the last `seconds` of `streams` in at\n"
+      "most `memory_mb` of RAM for save_replay()." },
+    { "add_depth_server", Method(Pipeline_add_depth_server),
+      METH_VARARGS | METH_KEYWORDS,
+      "add_depth_server(streams, address, compressed=False)\nServe raw depth frames to local\n"
+      "subscribers on \"unix:/path\" or \"tcp:[host:]port\"." },
+    { "save_replay", Method(Pipeline_save_replay), METH_VARARGS | METH_KEYWORDS,
+      "save_replay(path=None)\nWrite the replay buffer to `path` (a time-stamped file in\n"
+      "replay_dir if None) in the background." },
+    { "clock_stats", Method(Pipeline_clock_stats), METH_VARARGS | METH_KEYWORDS,
+      "clock_stats(device, stream=DEPTH) -> dict\nDrift (ppm) and receive jitter (us) of a\n"
+      "Kinect's clock estimate." },
+    { "dump_flight_recorder", Method(Pipeline_dump_flight_recorder),
+      METH_VARARGS | METH_KEYWORDS,
+      "dump_flight_recorder(path=None)\nWrite the recent per-frame timing records as CSV to\n"
+      "`path` (a time-stamped file in flight_recorder_dir if None)." },
+    { "start", Method(Pipeline_start), METH_NOARGS,
+      "start()\nStart capturing on a background thread." },
+    { "stop", Method(Pipeline_stop), METH_NOARGS,
+      "stop()\nStop capturing." },
+    { "read", Method(Pipeline_read), METH_VARARGS | METH_KEYWORDS,
+      "read(stream, timeout=None) -> Frame or None\n"
+      "Return the newest frame of `stream` not returned before, waiting up to\n"
+      "`timeout` seconds (forever if None). Older unread frames are dropped." },
+    { nullptr, nullptr, 0, nullptr }
+};
+
+PyGetSetDef PipelineGetSet[] = {
+    { "dropped", reinterpret_cast<getter>(Pipeline_dropped), nullptr,
+      "Frames replaced before read() picked them up, per stream.", nullptr },
+    { nullptr, nullptr, nullptr, nullptr, nullptr }
+};
+
+PyModuleDef ModuleDef = {
+    PyModuleDef_HEAD_INIT, "kinectndi",
+    "Kinect capture with zero-copy numpy frames and optional NDI output.",
+    -1, nullptr, nullptr, nullptr, nullptr, nullptr
+};
+
+} // namespace
+
+PyMODINIT_FUNC PyInit_kinectndi(void)
+{
+    // PyType_Ready() takes ob_type from the base type.
+    Py_SET_REFCNT(&FrameType, 1);
+    FrameType.tp_name = "kinectndi.Frame";
+    FrameType.tp_basicsize = sizeof(FrameObject);
+    FrameType.tp_flags = Py_TPFLAGS_DEFAULT;
+    FrameType.tp_doc = "Captured frame backed by the pipeline's frame pool (buffer protocol).";
+    FrameType.tp_dealloc = reinterpret_cast<destructor>(Frame_dealloc);
+    FrameType.tp_as_buffer = &FrameBufferProcs;
+    FrameType.tp_getset = FrameGetSet;
+
+    Py_SET_REFCNT(&PipelineType, 1);
+    PipelineType.tp_name = "kinectndi.Pipeline";
+    PipelineType.tp_basicsize = sizeof(PipelineObject);
+    PipelineType.tp_flags = Py_TPFLAGS_DEFAULT;
+    PipelineType.tp_doc = "Pipeline(device=0, streams=0)\nKinect capture pipeline.";
+    PipelineType.tp_new = PyType_GenericNew;
+    PipelineType.tp_init = reinterpret_cast<initproc>(Pipeline_init);
+    PipelineType.tp_dealloc = reinterpret_cast<destructor>(Pipeline_dealloc);
+    PipelineType.tp_methods = PipelineMethods;
+    PipelineType.tp_getset = PipelineGetSet;
+
+    if (PyType_Ready(&FrameType) < 0 || PyType_Ready(&PipelineType) < 0)
+        return nullptr;
+
+    PyObject* module = PyModule_Create(&ModuleDef);
+    if (!module)
+        return nullptr;
+    Py_INCREF(&FrameType);
+    PyModule_AddObject(module, "Frame", reinterpret_cast<PyObject*>(&FrameType));
+    Py_INCREF(&PipelineType);
+    PyModule_AddObject(module, "Pipeline", reinterpret_cast<PyObject*>(&PipelineType));
+    PyModule_AddIntConstant(module, "RGB", KNDI_STREAM_RGB);
+    PyModule_AddIntConstant(module, "IR", KNDI_STREAM_IR);
+    PyModule_AddIntConstant(module, "DEPTH", KNDI_STREAM_DEPTH);
+    PyModule_AddIntConstant(module, "FUSED_DEPTH", KNDI_STREAM_FUSED_DEPTH);
+    PyModule_AddIntConstant(module, "POINT_CLOUD", KNDI_STREAM_POINT_CLOUD);
+    return module;
+}
@@ -0,0 +1,267 @@
+#include "auto_frame.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "depth_units.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+  #include <immintrin.h>
+  #define KNDI_X86_SIMD 1
+#endif
+
+namespace kndi {
+
+// Share of the subject's samples ignored at each side of its extent, so a
+// few stray pixels (a hand, a chair edge, noise) do not stretch the frame.
+static constexpr float kTrimShare = 0.02f;
+
+// Fewer subject samples than this share of the grid is nobody.
+static constexpr float kMinSubjectShare = 0.005f;
+
+// The camera holds still until the subject moves this share of the crop
+// height, so a presenter shifting their weight does not make it drift.
+static constexpr float kDeadband = 0.05f;
+
+// Widest source frame the cropping conversion reads (the Kinect's 1280x1024 mode).
+static constexpr int kMaxCropSourceWidth = 1280;
+
+// Closest zoom: the crop is never less than this share of the frame height.
+static constexpr float kMinCropShare = 0.25f;
+
+AutoFramer::AutoFramer(const AutoFrameSettings& settings, int depthWidth, int depthHeight, int videoWidth,
+                       int videoHeight)
+    : settings(settings), depthWidth(depthWidth), depthHeight(depthHeight), videoWidth(videoWidth),
+      videoHeight(videoHeight), aspect(static_cast<float>(settings.width) / settings.height),
+      nearRaw(kRawDepthInvalid), farRaw(0),
+      columnCounts((depthWidth + kGridStep - 1) / kGridStep),
+      rowCounts((depthHeight + kGridStep - 1) / kGridStep), lastNs(0)
+{
+    // Disparity grows with distance, so the range is one span of raw values.
+    const uint16_t* mm = RawDepthToMillimetres();
+    for (int raw = 0; raw < kRawDepthInvalid; raw++) {
+        if (mm[raw] && mm[raw] >= settings.nearMm && mm[raw] <= settings.farMm) {
+            nearRaw = std::min<uint16_t>(nearRaw, static_cast<uint16_t>(raw));
+            farRaw = std::max<uint16_t>(farRaw, static_cast<uint16_t>(raw));
+        }
+    }
+    goal = Fit(videoWidth * 0.5f, videoHeight * 0.5f, static_cast<float>(videoHeight));
+    current = goal;
+}
+
+// Largest output-shaped crop of `height` that fits the frame, moved inside
+// it if it sticks out.
+CropRect AutoFramer::Fit(float centreX, float centreY, float height) const
+{
+    height = std::max(height, kMinCropShare * videoHeight);
+    float width = height * aspect;
+    if (width > videoWidth) {
+        width = static_cast<float>(videoWidth);
+        height = width / aspect;
+    }
+    if (height > videoHeight) {
+        height = static_cast<float>(videoHeight);
+        width = height * aspect;
+    }
+    CropRect crop;
+    crop.width = width;
+    crop.height = height;
+    crop.x = std::min(std::max(centreX - width * 0.5f, 0.0f), videoWidth - width);
+    crop.y = std::min(std::max(centreY - height * 0.5f, 0.0f), videoHeight - height);
+    return crop;
+}
+
+// Grid index below which `share` of the `total` counted samples lie.
+static int Percentile(const std::vector<int>& counts, int total, float share)
+{
+    int limit = static_cast<int>(total * share);
+    int sum = 0;
+    for (size_t i = 0; i < counts.size(); i++) {
+        sum += counts[i];
+        if (sum > limit)
+            return static_cast<int>(i);
+    }
+    return static_cast<int>(counts.size()) - 1;
+}
+
+CropRect AutoFramer::Target(const uint16_t* depth, int stride)
+{
+    std::fill(columnCounts.begin(), columnCounts.end(), 0);
+    std::fill(rowCounts.begin(), rowCounts.end(), 0);
+    int total = 0;
+    for (int gy = 0; gy < static_cast<int>(rowCounts.size()); gy++) {
+        int y = std::min(gy * kGridStep + kGridStep / 2, depthHeight - 1);
+        const uint16_t* row = reinterpret_cast<const uint16_t*>(
+            reinterpret_cast<const uint8_t*>(depth) + static_cast<size_t>(y) * stride);
+        int count = 0;
+        for (int gx = 0; gx < static_cast<int>(columnCounts.size()); gx++) {
+            int x = std::min(gx * kGridStep + kGridStep / 2, depthWidth - 1);
+            uint16_t raw = row[x];
+            if (raw >= nearRaw && raw <= farRaw) {
+                columnCounts[gx]++;
+                count++;
+            }
+        }
+        rowCounts[gy] = count;
+        total += count;
+    }
+    if (total == 0 || total < kMinSubjectShare * columnCounts.size() * rowCounts.size())
+        return Fit(videoWidth * 0.5f, videoHeight * 0.5f, static_cast<float>(videoHeight));
+
+    // Subject box in depth pixels, then in video pixels. RGB and depth come
+    // from two cameras a few centimetres apart; the margin absorbs the
+    // parallax, so the box is only scaled.
+    float left = static_cast<float>(Percentile(columnCounts, total, kTrimShare) * kGridStep);
+    float right = static_cast<float>((Percentile(columnCounts, total, 1.0f - kTrimShare) + 1) * kGridStep);
+    float top = static_cast<float>(Percentile(rowCounts, total, kTrimShare) * kGridStep);
+    float bottom = static_cast<float>((Percentile(rowCounts, total, 1.0f - kTrimShare) + 1) * kGridStep);
+    float scaleX = static_cast<float>(videoWidth) / depthWidth;
+    float scaleY = static_cast<float>(videoHeight) / depthHeight;
+    float width = (right - left) * scaleX * (1.0f + 2.0f * settings.margin);
+    float height = (bottom - top) * scaleY * (1.0f + 2.0f * settings.margin);
+    return Fit((left + right) * 0.5f * scaleX, (top + bottom) * 0.5f * scaleY, std::max(height, width / aspect));
+}
+
+void AutoFramer::Update(const uint16_t* depth, int stride, int64_t timestampNs)
+{
+    CropRect target = Target(depth, stride);
+    float threshold = kDeadband * goal.height;
+    if (std::fabs(target.x + target.width * 0.5f - goal.x - goal.width * 0.5f) > threshold ||
+        std::fabs(target.y + target.height * 0.5f - goal.y - goal.height * 0.5f) > threshold ||
+        std::fabs(target.height - goal.height) > threshold)
+        goal = target;
+
+    // Exponential approach to the goal, independent of the frame rate.
+    double elapsedMs = lastNs ? (timestampNs - lastNs) / 1e6 : 0.0;
+    lastNs = timestampNs;
+    float follow = settings.smoothingMs > 0
+        ? static_cast<float>(1.0 - std::exp(-std::max(elapsedMs, 0.0) / settings.smoothingMs)) : 1.0f;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    float centreX = current.x + current.width * 0.5f;
+    float centreY = current.y + current.height * 0.5f;
+    centreX += (goal.x + goal.width * 0.5f - centreX) * follow;
+    centreY += (goal.y + goal.height * 0.5f - centreY) * follow;
+    float height = current.height + (goal.height - current.height) * follow;
+    current = Fit(centreX, centreY, height);
+}
+
+CropRect AutoFramer::Crop() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return current;
+}
+
+// Bilinear weights are 7-bit (1/128 pixel), so a vertically blended sample
+// fits a signed 16-bit lane and both taps of a channel one pmaddwd.
+static constexpr int kWeightBits = 7;
+static constexpr int kWeightOne = 1 << kWeightBits;
+
+#ifdef KNDI_X86_SIMD
+// Four output pixels from their blended source pairs; `weights` hold
+// (wx << 16) | (kWeightOne - wx).
+static inline void BlendFour(const uint16_t* blended, const int* columns, const uint32_t* weights, uint8_t* out)
+{
+    __m128i pixels[4];
+    for (int i = 0; i < 4; i++) {
+        // p0..p2 is the left neighbour, p3..p5 the right; interleave them
+        // so one multiply-add gives each channel.
+        __m128i pair = _mm_loadu_si128(reinterpret_cast<const __m128i*>(blended + columns[i]));
+        __m128i taps = _mm_unpacklo_epi16(pair, _mm_srli_si128(pair, 6));
+        __m128i sums = _mm_madd_epi16(taps, _mm_set1_epi32(static_cast<int>(weights[i])));
+        sums = _mm_srli_epi32(_mm_add_epi32(sums, _mm_set1_epi32(1 << (2 * kWeightBits - 1))), 2 * kWeightBits);
+        pixels[i] = _mm_shuffle_epi32(sums, _MM_SHUFFLE(3, 0, 1, 2));   // R, G, B → B, G, R.
+    }
+    __m128i packed = _mm_packus_epi16(_mm_packs_epi32(pixels[0], pixels[1]), _mm_packs_epi32(pixels[2], pixels[3]));
+    packed = _mm_or_si128(_mm_and_si128(packed, _mm_set1_epi32(0x00FFFFFF)), _mm_set1_epi32(static_cast<int>(0xFF000000u)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), packed);
+}
+#endif
+
+void ConvertRgbCropToBgrx(const uint8_t* src, int srcStride, int srcWidth, int srcHeight, const CropRect& crop,
+                          uint8_t* dst, int dstStride, int width, int height, int firstRow, int rows,
+                          const PrivacyBlocks* privacy)
+{
+    // Offset of the left neighbour (relative to the crop's first column)
+    // and packed weights of every output column, sampled at pixel centres.
+    int columns[kMaxAutoFrameWidth];
+    uint32_t weights[kMaxAutoFrameWidth];
+    width = std::min(width, kMaxAutoFrameWidth);
+    srcWidth = std::min(srcWidth, kMaxCropSourceWidth);
+    float stepX = crop.width / width;
+    int first = 0;
+    for (int x = 0; x < width; x++) {
+        float sx = std::min(std::max(crop.x + (x + 0.5f) * stepX - 0.5f, 0.0f), srcWidth - 1.0f);
+        int column = std::min(static_cast<int>(sx), srcWidth - 2);
+        uint32_t wx = static_cast<uint32_t>(std::min((sx - column) * kWeightOne + 0.5f, static_cast<float>(kWeightOne)));
+        if (x == 0)
+            first = column * 3;
+        columns[x] = column * 3 - first;
+        weights[x] = (wx << 16) | (kWeightOne - wx);
+    }
+    // Source samples spanned by the crop, blended vertically; two spare
+    // entries for the SIMD loads.
+    uint16_t blended[kMaxCropSourceWidth * 3 + 2] = {};
+    int span = columns[width - 1] + 6;
+    float stepY = crop.height / height;
+    for (int y = firstRow; y < firstRow + rows; y++) {
+        float sy = std::min(std::max(crop.y + (y + 0.5f) * stepY - 0.5f, 0.0f), srcHeight - 1.0f);
+        int line = std::min(static_cast<int>(sy), srcHeight - 2);
+        int wy = static_cast<int>(std::min((sy - line) * kWeightOne + 0.5f, static_cast<float>(kWeightOne)));
+        const uint8_t* upper = src + static_cast<size_t>(line) * srcStride + first;
+        const uint8_t* lower = upper + srcStride;
+        // Blend the two rows over the crop's columns first, a loop the
+        // compiler vectorizes, then each output pixel from two neighbours.
+        for (int i = 0; i < span; i++)
+            blended[i] = static_cast<uint16_t>(upper[i] * (kWeightOne - wy) + lower[i] * wy);
+        uint8_t* out = dst + static_cast<size_t>(y) * dstStride;
+        int x = 0;
+#ifdef KNDI_X86_SIMD
+        for (; x + 4 <= width; x += 4)
+            BlendFour(blended, columns + x, weights + x, out + x * 4);
+#endif
+        for (; x < width; x++) {
+            const uint16_t* pair = blended + columns[x];
+            uint32_t left = weights[x] & 0xFFFF;
+            uint32_t right = weights[x] >> 16;
+            uint32_t round = 1 << (2 * kWeightBits - 1);
+            out[x * 4 + 0] = static_cast<uint8_t>((pair[2] * left + pair[5] * right + round) >> (2 * kWeightBits));
+            out[x * 4 + 1] = static_cast<uint8_t>((pair[1] * left + pair[4] * right + round) >> (2 * kWeightBits));
+            out[x * 4 + 2] = static_cast<uint8_t>((pair[0] * left + pair[3] * right + round) >> (2 * kWeightBits));
+            out[x * 4 + 3] = 255;
+        }
+        if (privacy) {
+            size_t rowBlocks = static_cast<size_t>(line / kPrivacyBlock) * privacy->blocksX;
+            const uint8_t* visible = privacy->visible.data() + rowBlocks;
+            const uint32_t* colours = privacy->colours.data() + rowBlocks;
+            uint32_t* pixels = reinterpret_cast<uint32_t*>(out);
+            for (x = 0; x < width; x++) {
+                int block = (first + columns[x]) / 3 / kPrivacyBlock;
+                if (!visible[block])
+                    pixels[x] = colours[block];
+            }
+        }
+    }
+}
+
+void RunCropConversion(ThreadPool* pool, const uint8_t* src, int srcStride, int srcWidth, int srcHeight,
+                       const CropRect& crop, uint8_t* dst, int dstStride, int width, int height,
+                       const PrivacyBlocks* privacy)
+{
+    int bands = pool ? std::min(pool->Size(), height) : 1;
+    if (bands <= 1) {
+        ConvertRgbCropToBgrx(src, srcStride, srcWidth, srcHeight, crop, dst, dstStride, width, height, 0, height,
+                             privacy);
+        return;
+    }
+    int rowsPerBand = (height + bands - 1) / bands;
+    pool->ParallelFor(bands, [&](int band) {
+        int first = band * rowsPerBand;
+        int rows = std::min(rowsPerBand, height - first);
+        if (rows > 0)
+            ConvertRgbCropToBgrx(src, srcStride, srcWidth, srcHeight, crop, dst, dstStride, width, height, first,
+                                 rows, privacy);
+    });
+}
+
+} // namespace kndi
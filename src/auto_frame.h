@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "privacy_mask.h"
+#include "thread_pool.h"
+
+namespace kndi {
+
+// Virtual camera that follows the subject: the foreground is found in the
+// depth image and the RGB output is cropped to it and scaled to a fixed size.
+struct AutoFrameSettings {
+    int width = 640;            // Size of the framed RGB output.
+    int height = 360;
+    float nearMm = 500.0f;      // Depth range in which anything counts as the subject.
+    float farMm = 3000.0f;
+    float margin = 0.15f;       // Room around the subject, as a share of its size.
+    int smoothingMs = 500;      // Time constant of the camera's movement.
+};
+
+// Widest framed output; the conversion keeps its per-column tables on the stack.
+constexpr int kMaxAutoFrameWidth = 1920;
+
+// Region of the source image, in pixels.
+struct CropRect {
+    float x, y, width, height;
+};
+
+class AutoFramer {
+public:
+    // Depth is sampled on a grid of one pixel in kGridStep x kGridStep.
+    static constexpr int kGridStep = 8;
+
+    AutoFramer(const AutoFrameSettings& settings, int depthWidth, int depthHeight, int videoWidth,
+               int videoHeight);
+
+    const AutoFrameSettings& Settings() const { return settings; }
+
+    // Track the subject in a raw 11-bit depth frame (`stride` in bytes).
+    // Called on the capture thread for every depth frame of the active Kinect.
+    void Update(const uint16_t* depth, int stride, int64_t timestampNs);
+
+    // Region of the video frame to send, with the output's aspect ratio.
+    // Starts as the whole frame; safe to call from any thread.
+    CropRect Crop() const;
+
+private:
+    // Tightest output-shaped crop around the subject, or the whole frame if
+    // there is none.
+    CropRect Target(const uint16_t* depth, int stride);
+    CropRect Fit(float centreX, float centreY, float height) const;
+
+    AutoFrameSettings settings;
+    int depthWidth;
+    int depthHeight;
+    int videoWidth;
+    int videoHeight;
+    float aspect;                    // Output width / height.
+    uint16_t nearRaw;                // Raw disparity range of [nearMm, farMm].
+    uint16_t farRaw;
+    std::vector<int> columnCounts;   // Subject samples per grid column / row.
+    std::vector<int> rowCounts;
+    CropRect goal;                   // Where the camera is heading. Capture thread only.
+    int64_t lastNs;                  // Capture thread only.
+    mutable std::mutex mutex;
+    CropRect current;                // Guarded by `mutex`.
+};
+
+// 24-bit RGB inside `crop` of a srcWidth x srcHeight frame, scaled to
+// width x height BGRX with bilinear filtering. Only output rows
+// [firstRow, firstRow + rows) are written, so bands can run in parallel.
+// Output pixels sampled from a hidden `privacy` block get its colour.
+void ConvertRgbCropToBgrx(const uint8_t* src, int srcStride, int srcWidth, int srcHeight, const CropRect& crop,
+                          uint8_t* dst, int dstStride, int width, int height, int firstRow, int rows,
+                          const PrivacyBlocks* privacy = nullptr);
+
+// ConvertRgbCropToBgrx over the whole output, in row bands on `pool` (may
+// be nullptr).
+void RunCropConversion(ThreadPool* pool, const uint8_t* src, int srcStride, int srcWidth, int srcHeight,
+                       const CropRect& crop, uint8_t* dst, int dstStride, int width, int height,
+                       const PrivacyBlocks* privacy = nullptr);
+
+} // namespace kndi
@@ -0,0 +1,84 @@
+#include "camera_model.h"
+
+#include <fstream>
+#include <sstream>
+
+namespace kndi {
+
+Intrinsics KinectDepthIntrinsics(int width, int height)
+{
+    float sx = width / 640.0f;
+    float sy = height / 480.0f;
+    Intrinsics intrinsics;
+    intrinsics.fx = 594.214f * sx;
+    intrinsics.fy = 591.041f * sy;
+    intrinsics.cx = 339.308f * sx;
+    intrinsics.cy = 242.739f * sy;
+    return intrinsics;
+}
+
+Pose Pose::Identity()
+{
+    Pose pose = {
+        { 1.0f, 0.0f, 0.0f,
+          0.0f, 1.0f, 0.0f,
+          0.0f, 0.0f, 1.0f },
+        { 0.0f, 0.0f, 0.0f }
+    };
+    return pose;
+}
+
+void BuildRayTable(const Intrinsics& intrinsics, const Pose& pose, int width, int height,
+                   std::vector<float>& rays)
+{
+    rays.resize(static_cast<size_t>(width) * height * 3);
+    const float* r = pose.rotation;
+    float* out = rays.data();
+    for (int y = 0; y < height; y++) {
+        float ry = (y - intrinsics.cy) / intrinsics.fy;
+        for (int x = 0; x < width; x++) {
+            float rx = (x - intrinsics.cx) / intrinsics.fx;
+            out[0] = r[0] * rx + r[1] * ry + r[2];
+            out[1] = r[3] * rx + r[4] * ry + r[5];
+            out[2] = r[6] * rx + r[7] * ry + r[8];
+            out += 3;
+        }
+    }
+}
+
+bool LoadPoses(const std::string& path, std::map<std::string, Pose>& poses, std::string& error)
+{
+    std::ifstream file(path.c_str());
+    if (!file) {
+        error = "cannot open " + path;
+        return false;
+    }
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        std::istringstream fields(line);
+        std::string name;
+        if (!(fields >> name) || name[0] == '#')
+            continue;
+        float m[12];
+        for (int i = 0; i < 12; i++) {
+            if (!(fields >> m[i])) {
+                std::ostringstream message;
+                message << path << ":" << lineNumber << ": expected 12 numbers after \"" << name << "\"";
+                error = message.str();
+                return false;
+            }
+        }
+        Pose pose;
+        for (int row = 0; row < 3; row++) {
+            for (int col = 0; col < 3; col++)
+                pose.rotation[row * 3 + col] = m[row * 4 + col];
+            pose.translation[row] = m[row * 4 + 3];
+        }
+        poses[name] = pose;
+    }
+    return true;
+}
+
+} // namespace kndi
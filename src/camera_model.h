@@ -0,0 +1,41 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace kndi {
+
+// Pinhole intrinsics in pixels. Camera axes: x right, y down, z forward.
+struct Intrinsics {
+    float fx, fy, cx, cy;
+};
+
+// Kinect v1 depth camera intrinsics (Burrus calibration at 640x480),
+// scaled to the given resolution.
+Intrinsics KinectDepthIntrinsics(int width, int height);
+
+// Rigid transform from camera to world coordinates, in millimetres:
+// world = rotation * camera + translation (rotation is row-major 3x3).
+struct Pose {
+    float rotation[9];
+    float translation[3];
+
+    static Pose Identity();
+};
+
+// Per-pixel viewing rays rotated into world orientation, 3 floats per pixel:
+// rays[i] = R * ((x - cx) / fx, (y - cy) / fy, 1). A pixel at depth z mm is
+// then at z * rays[i] + translation in world coordinates, so back-projection
+// costs three multiply-adds per pixel. Computed once per device.
+void BuildRayTable(const Intrinsics& intrinsics, const Pose& pose, int width, int height,
+                   std::vector<float>& rays);
+
+// Read named poses from a text file with one pose per line:
+//   <name> r00 r01 r02 tx r10 r11 r12 ty r20 r21 r22 tz
+// i.e. the 3x4 camera-to-world matrix in row-major order, translation in
+// millimetres. Blank lines and lines starting with '#' are ignored. Names
+// are Kinect indices ("0", "1", ...) or other labels such as "virtual".
+bool LoadPoses(const std::string& path, std::map<std::string, Pose>& poses, std::string& error);
+
+} // namespace kndi
@@ -0,0 +1,448 @@
+#include "colour_lut.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+  #define KNDI_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  #include <arm_neon.h>
+  #define KNDI_NEON 1
+#endif
+
+#include "convert.h"
+#include "planner.h"
+
+namespace kndi {
+
+constexpr int ColourLut::kMinSize;
+constexpr int ColourLut::kMaxSize;
+
+ColourLut::ColourLut(const std::string& title, int size, const std::vector<float>& rgb,
+                     const float domainMin[3], const float domainMax[3])
+    : title(title), size(size), entries(static_cast<size_t>(size) * size * size * 4, 0)
+{
+    size_t count = static_cast<size_t>(size) * size * size;
+    for (size_t i = 0; i < count; i++) {
+        // Stored B, G, R.
+        for (int c = 0; c < 3; c++) {
+            float value = std::min(1.0f, std::max(0.0f, rgb[i * 3 + c]));
+            entries[i * 4 + 2 - c] = static_cast<int16_t>(std::lround(value * 255.0f * 16.0f));
+        }
+    }
+    const uint32_t steps[3] = { 4, static_cast<uint32_t>(size) * 4, static_cast<uint32_t>(size) * size * 4 };
+    for (int c = 0; c < 3; c++) {
+        for (int level = 0; level < 256; level++) {
+            float x = (level / 255.0f - domainMin[c]) / (domainMax[c] - domainMin[c]);
+            x = std::min(1.0f, std::max(0.0f, x));
+            long position = std::lround(x * (size - 1) * 256.0f);
+            int corner = static_cast<int>(position >> 8);
+            int fraction = static_cast<int>(position & 255);
+            // The top level interpolates fully towards the last corner.
+            if (corner >= size - 1) {
+                corner = size - 2;
+                fraction = 256;
+            }
+            offsets[c][level] = corner * steps[c];
+            fractions[c][level] = static_cast<uint16_t>(fraction);
+        }
+    }
+}
+
+static bool ParseNumber(const std::string& text, float& value)
+{
+    char* end = nullptr;
+    value = std::strtof(text.c_str(), &end);
+    return end && end != text.c_str() && *end == '\0' && std::isfinite(value);
+}
+
+ColourLut* ColourLut::Load(const std::string& path, std::string& error)
+{
+    std::ifstream file(path.c_str());
+    if (!file) {
+        error = "cannot open " + path;
+        return nullptr;
+    }
+    std::string title;
+    int size = 0;
+    float domainMin[3] = { 0.0f, 0.0f, 0.0f };
+    float domainMax[3] = { 1.0f, 1.0f, 1.0f };
+    std::vector<float> rgb;
+    std::string line;
+    int lineNumber = 0;
+    auto fail = [&](const std::string& reason) -> ColourLut* {
+        std::ostringstream message;
+        message << path << ":";
+        if (lineNumber > 0)
+            message << lineNumber << ":";
+        message << " " << reason;
+        error = message.str();
+        return nullptr;
+    };
+    while (std::getline(file, line)) {
+        lineNumber++;
+        std::istringstream fields(line);
+        std::string word;
+        if (!(fields >> word) || word[0] == '#')
+            continue;
+        float value;
+        if (ParseNumber(word, value)) {
+            if (size == 0)
+                return fail("table data before LUT_3D_SIZE");
+            float green, blue;
+            if (!(fields >> green >> blue))
+                return fail("expected three numbers");
+            if (rgb.size() >= static_cast<size_t>(size) * size * size * 3)
+                return fail("more than LUT_3D_SIZE³ entries");
+            rgb.push_back(value);
+            rgb.push_back(green);
+            rgb.push_back(blue);
+        } else if (word == "TITLE") {
+            std::getline(fields, title);
+            title.erase(0, title.find_first_not_of(" \t\""));
+            title.erase(title.find_last_not_of(" \t\"\r") + 1);
+        } else if (word == "LUT_3D_SIZE") {
+            if (!(fields >> size) || size < kMinSize || size > kMaxSize)
+                return fail("LUT_3D_SIZE must be 2-65");
+            rgb.reserve(static_cast<size_t>(size) * size * size * 3);
+        } else if (word == "LUT_1D_SIZE") {
+            return fail("1D LUTs are not supported");
+        } else if (word == "DOMAIN_MIN" || word == "DOMAIN_MAX") {
+            float* domain = word == "DOMAIN_MIN" ? domainMin : domainMax;
+            if (!(fields >> domain[0] >> domain[1] >> domain[2]))
+                return fail("expected three numbers after " + word);
+        } else if (word == "LUT_3D_INPUT_RANGE") {
+            float low, high;
+            if (!(fields >> low >> high))
+                return fail("expected two numbers after LUT_3D_INPUT_RANGE");
+            std::fill(domainMin, domainMin + 3, low);
+            std::fill(domainMax, domainMax + 3, high);
+        }
+        // Other keywords are tool specific and do not change the table.
+    }
+    // What is missing is not on any one line.
+    lineNumber = 0;
+    if (size == 0)
+        return fail("no LUT_3D_SIZE");
+    if (rgb.size() != static_cast<size_t>(size) * size * size * 3)
+        return fail("expected " + std::to_string(size * size * size) + " entries, found " +
+                    std::to_string(rgb.size() / 3));
+    for (int c = 0; c < 3; c++) {
+        if (!(domainMax[c] > domainMin[c]))
+            return fail("DOMAIN_MAX must be above DOMAIN_MIN");
+    }
+    if (title.empty())
+        title = path.substr(path.find_last_of("/\\") + 1);
+    return new ColourLut(title, size, rgb, domainMin, domainMax);
+}
+
+// The four corners of the tetrahedron of the lattice cell that holds a
+// pixel, and their weights (sum 256): from the cell's lower corner along
+// the channels in order of decreasing fraction to its upper corner.
+struct Tetrahedron {
+    const int16_t* corners[4];
+    int weights[4];
+};
+
+static inline void Locate(const int16_t* base, const uint32_t* steps, int fr, int fg, int fb, Tetrahedron& t)
+{
+    uint32_t first, second;
+    int f1, f2, f3;
+    if (fr >= fg) {
+        if (fg >= fb) {
+            first = steps[0]; second = steps[1]; f1 = fr; f2 = fg; f3 = fb;
+        } else if (fr >= fb) {
+            first = steps[0]; second = steps[2]; f1 = fr; f2 = fb; f3 = fg;
+        } else {
+            first = steps[2]; second = steps[0]; f1 = fb; f2 = fr; f3 = fg;
+        }
+    } else {
+        if (fr >= fb) {
+            first = steps[1]; second = steps[0]; f1 = fg; f2 = fr; f3 = fb;
+        } else if (fg >= fb) {
+            first = steps[1]; second = steps[2]; f1 = fg; f2 = fb; f3 = fr;
+        } else {
+            first = steps[2]; second = steps[1]; f1 = fb; f2 = fg; f3 = fr;
+        }
+    }
+    t.corners[0] = base;
+    t.corners[1] = base + first;
+    t.corners[2] = base + first + second;
+    t.corners[3] = base + steps[0] + steps[1] + steps[2];
+    t.weights[0] = 256 - f1;
+    t.weights[1] = f1 - f2;
+    t.weights[2] = f2 - f3;
+    t.weights[3] = f3;
+}
+
+template <int kInBytes, int kRed, int kBlue, bool kSimd>
+void ColourLut::Rows(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride, int width, int height) const
+{
+    const int16_t* lut = entries.data();
+    const uint32_t steps[3] = { 4, static_cast<uint32_t>(size) * 4, static_cast<uint32_t>(size) * size * 4 };
+    auto locate = [&](const uint8_t* pixel, Tetrahedron& t) {
+        int r = pixel[kRed];
+        int g = pixel[1];
+        int b = pixel[kBlue];
+        Locate(lut + offsets[0][r] + offsets[1][g] + offsets[2][b], steps, fractions[0][r], fractions[1][g],
+               fractions[2][b], t);
+    };
+    for (int y = 0; y < height; y++) {
+        const uint8_t* in = src + static_cast<size_t>(y) * srcStride;
+        uint8_t* out = dst + static_cast<size_t>(y) * dstStride;
+        int x = 0;
+#if defined(KNDI_SSE2)
+        if (kSimd) {
+            // Corners interleaved in pairs, so one multiply-add per pair
+            // gives B, G, R and pad as 32-bit sums. All four pixels are
+            // read before they are written, for grading in place.
+            const __m128i round = _mm_set1_epi32(1 << 11);
+            const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xff000000u));
+            for (; x + 4 <= width; x += 4) {
+                __m128i sums[4];
+                for (int p = 0; p < 4; p++) {
+                    Tetrahedron t;
+                    locate(in + (x + p) * kInBytes, t);
+                    __m128i c01 = _mm_unpacklo_epi16(
+                        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(t.corners[0])),
+                        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(t.corners[1])));
+                    __m128i c23 = _mm_unpacklo_epi16(
+                        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(t.corners[2])),
+                        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(t.corners[3])));
+                    __m128i w01 = _mm_set1_epi32(t.weights[0] | (t.weights[1] << 16));
+                    __m128i w23 = _mm_set1_epi32(t.weights[2] | (t.weights[3] << 16));
+                    __m128i sum = _mm_add_epi32(_mm_madd_epi16(c01, w01), _mm_madd_epi16(c23, w23));
+                    sums[p] = _mm_srai_epi32(_mm_add_epi32(sum, round), 12);
+                }
+                __m128i bgrx = _mm_packus_epi16(_mm_packs_epi32(sums[0], sums[1]), _mm_packs_epi32(sums[2], sums[3]));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x * 4), _mm_or_si128(bgrx, alpha));
+            }
+        }
+#elif defined(KNDI_NEON)
+        if (kSimd) {
+            const uint8x8_t alpha = vreinterpret_u8_u32(vdup_n_u32(0xff000000u));
+            for (; x + 2 <= width; x += 2) {
+                uint16x4_t halves[2];
+                for (int p = 0; p < 2; p++) {
+                    Tetrahedron t;
+                    locate(in + (x + p) * kInBytes, t);
+                    int32x4_t sum = vmull_n_s16(vld1_s16(t.corners[0]), static_cast<int16_t>(t.weights[0]));
+                    sum = vmlal_n_s16(sum, vld1_s16(t.corners[1]), static_cast<int16_t>(t.weights[1]));
+                    sum = vmlal_n_s16(sum, vld1_s16(t.corners[2]), static_cast<int16_t>(t.weights[2]));
+                    sum = vmlal_n_s16(sum, vld1_s16(t.corners[3]), static_cast<int16_t>(t.weights[3]));
+                    halves[p] = vqrshrun_n_s32(sum, 12);
+                }
+                vst1_u8(out + x * 4, vorr_u8(vqmovn_u16(vcombine_u16(halves[0], halves[1])), alpha));
+            }
+        }
+#endif
+        for (; x < width; x++) {
+            Tetrahedron t;
+            locate(in + x * kInBytes, t);
+            for (int c = 0; c < 3; c++) {
+                int sum = t.weights[0] * t.corners[0][c] + t.weights[1] * t.corners[1][c] +
+                          t.weights[2] * t.corners[2][c] + t.weights[3] * t.corners[3][c];
+                out[x * 4 + c] = static_cast<uint8_t>((sum + (1 << 11)) >> 12);
+            }
+            out[x * 4 + 3] = 255;
+        }
+    }
+}
+
+void ColourLut::Convert(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride, int width, int height) const
+{
+    Rows<3, 0, 2, true>(src, srcStride, dst, dstStride, width, height);
+}
+
+void ColourLut::Grade(uint8_t* bgrx, int stride, int width, int height) const
+{
+    Rows<4, 2, 0, true>(bgrx, stride, bgrx, stride, width, height);
+}
+
+void ColourLut::ConvertReference(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride, int width,
+                                 int height) const
+{
+    Rows<3, 0, 2, false>(src, srcStride, dst, dstStride, width, height);
+}
+
+// Run `rows(first, count)` over `height` rows in bands on `pool`.
+template <typename Rows>
+static void ForEachBand(ThreadPool* pool, int height, const Rows& rows)
+{
+    int bands = pool ? std::min(pool->Size(), height) : 1;
+    if (bands <= 1) {
+        rows(0, height);
+        return;
+    }
+    int rowsPerBand = (height + bands - 1) / bands;
+    pool->ParallelFor(bands, [&](int band) {
+        int first = band * rowsPerBand;
+        int count = std::min(rowsPerBand, height - first);
+        if (count > 0)
+            rows(first, count);
+    });
+}
+
+void RunGradedConversion(ThreadPool* pool, const ColourLut& lut, const uint8_t* src, int srcStride, uint8_t* dst,
+                         int dstStride, int width, int height, const RoiMask* roi)
+{
+    if (roi && (roi->IsFull() || roi->Width() != width || roi->Height() != height))
+        roi = nullptr;
+    ForEachBand(pool, height, [&](int first, int rows) {
+        if (!roi) {
+            lut.Convert(src + static_cast<size_t>(first) * srcStride, srcStride,
+                        dst + static_cast<size_t>(first) * dstStride, dstStride, width, rows);
+            return;
+        }
+        roi->ForEachSpan(first, rows, [&](int y, int begin, int end) {
+            lut.Convert(src + static_cast<size_t>(y) * srcStride + begin * 3, srcStride,
+                        dst + static_cast<size_t>(y) * dstStride + begin * 4, dstStride, end - begin, 1);
+        });
+    });
+}
+
+void RunGrade(ThreadPool* pool, const ColourLut& lut, uint8_t* bgrx, int stride, int width, int height)
+{
+    ForEachBand(pool, height, [&](int first, int rows) {
+        lut.Grade(bgrx + static_cast<size_t>(first) * stride, stride, width, rows);
+    });
+}
+
+// ---------------------------------------------------------------------------
+// Benchmark
+// ---------------------------------------------------------------------------
+
+// A warm, contrasty look that also moves colours between channels, so the
+// table is not separable: an S-curve, 15% less saturation, a warm shift.
+static void SyntheticLook(float r, float g, float b, float* out)
+{
+    float in[3] = { r, g, b };
+    float luma = 0.2126f * r + 0.7152f * g + 0.0722f * b;
+    const float warmth[3] = { 0.03f, 0.01f, -0.03f };
+    for (int c = 0; c < 3; c++) {
+        float v = luma + (in[c] - luma) * 0.85f;
+        v = v * v * (3.0f - 2.0f * v) * 0.6f + v * 0.4f;
+        out[c] = std::min(1.0f, std::max(0.0f, v + warmth[c]));
+    }
+}
+
+static std::vector<float> SyntheticTable(int size)
+{
+    std::vector<float> rgb;
+    rgb.reserve(static_cast<size_t>(size) * size * size * 3);
+    for (int b = 0; b < size; b++) {
+        for (int g = 0; g < size; g++) {
+            for (int r = 0; r < size; r++) {
+                float out[3];
+                SyntheticLook(r / (size - 1.0f), g / (size - 1.0f), b / (size - 1.0f), out);
+                rgb.insert(rgb.end(), out, out + 3);
+            }
+        }
+    }
+    return rgb;
+}
+
+// Tetrahedral interpolation of `rgb` (as given to ColourLut, whole domain)
+// in double precision, in levels.
+static void FloatLookUp(const std::vector<float>& rgb, int size, const uint8_t* pixel, double* out)
+{
+    double position[3];
+    int corner[3];
+    for (int c = 0; c < 3; c++) {
+        position[c] = pixel[c] / 255.0 * (size - 1);
+        corner[c] = std::min(size - 2, static_cast<int>(position[c]));
+        position[c] -= corner[c];
+    }
+    auto at = [&](int r, int g, int b, int c) {
+        return static_cast<double>(rgb[((static_cast<size_t>(b) * size + g) * size + r) * 3 + c]);
+    };
+    // Visit the channels in order of decreasing fraction.
+    int order[3] = { 0, 1, 2 };
+    std::sort(order, order + 3, [&](int a, int b) { return position[a] > position[b]; });
+    int walk[3] = { corner[0], corner[1], corner[2] };
+    double weights[5] = { 1.0, position[order[0]], position[order[1]], position[order[2]], 0.0 };
+    double sum[3] = { 0.0, 0.0, 0.0 };
+    for (int step = 0; step < 4; step++) {
+        if (step > 0)
+            walk[order[step - 1]]++;
+        for (int c = 0; c < 3; c++)
+            sum[c] += (weights[step] - weights[step + 1]) * at(walk[0], walk[1], walk[2], c);
+    }
+    for (int c = 0; c < 3; c++)
+        out[c] = std::min(1.0, std::max(0.0, sum[c])) * 255.0;
+}
+
+void BenchmarkColourLut(ThreadPool& pool, int width, int height, std::string& report)
+{
+    // Smooth ramps over every hue with some texture.
+    std::vector<uint8_t> rgb(static_cast<size_t>(width) * height * 3);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            uint8_t* pixel = &rgb[(static_cast<size_t>(y) * width + x) * 3];
+            pixel[0] = static_cast<uint8_t>(x * 255 / std::max(1, width - 1));
+            pixel[1] = static_cast<uint8_t>(y * 255 / std::max(1, height - 1));
+            pixel[2] = static_cast<uint8_t>((x * 7 + y * 13) & 255);
+        }
+    }
+    std::vector<uint8_t> bgrx(static_cast<size_t>(width) * height * 4);
+    int srcStride = width * 3;
+    int dstStride = width * 4;
+
+    // The plain conversion the grade replaces: the fastest kernel here.
+    const char* plainName = "";
+    double plainMs = 0.0;
+    for (const ConvertVariant& variant : ConvertVariants(KNDI_STREAM_RGB)) {
+        double ms = MeasureMs([&] { variant.kernel(rgb.data(), srcStride, bgrx.data(), dstStride, width, height); });
+        if (!*plainName || ms < plainMs) {
+            plainName = variant.name;
+            plainMs = ms;
+        }
+    }
+#if defined(KNDI_SSE2)
+    const char* simd = "sse2";
+#elif defined(KNDI_NEON)
+    const char* simd = "neon";
+#else
+    const char* simd = "portable";
+#endif
+
+    char line[240];
+    std::snprintf(line, sizeof(line),
+                  "Colour LUT grading, %dx%d RGB -> BGRX, ms per frame (plain conversion [%s]: %.3f ms):\n"
+                  "  LUT          portable   %-8s   %-8s x%-2d  max error vs float\n",
+                  width, height, plainName, plainMs, simd, simd, pool.Size());
+    report = line;
+    const int sizes[2] = { 17, 33 };
+    const float domainMin[3] = { 0.0f, 0.0f, 0.0f };
+    const float domainMax[3] = { 1.0f, 1.0f, 1.0f };
+    for (int size : sizes) {
+        std::vector<float> table = SyntheticTable(size);
+        ColourLut lut("synthetic", size, table, domainMin, domainMax);
+        double reference = MeasureMs([&] {
+            lut.ConvertReference(rgb.data(), srcStride, bgrx.data(), dstStride, width, height);
+        });
+        double single = MeasureMs([&] {
+            RunGradedConversion(nullptr, lut, rgb.data(), srcStride, bgrx.data(), dstStride, width, height);
+        });
+        double parallel = MeasureMs([&] {
+            RunGradedConversion(&pool, lut, rgb.data(), srcStride, bgrx.data(), dstStride, width, height);
+        });
+        double maxError = 0.0;
+        for (size_t i = 0; i < static_cast<size_t>(width) * height; i++) {
+            double expected[3];
+            FloatLookUp(table, size, &rgb[i * 3], expected);
+            for (int c = 0; c < 3; c++)
+                maxError = std::max(maxError, std::fabs(bgrx[i * 4 + 2 - c] - expected[c]));
+        }
+        std::snprintf(line, sizeof(line), "  %2dx%2dx%2d   %8.3f   %8.3f   %8.3f     %.2f levels\n", size, size,
+                      size, reference, single, parallel, maxError);
+        report += line;
+    }
+}
+
+} // namespace kndi
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "roi.h"
+#include "thread_pool.h"
+
+namespace kndi {
+
+// A 3D colour lookup table, applied to 8-bit RGB with tetrahedral
+// interpolation in fixed point. Lattice entries are kept as B, G, R and a
+// pad in 8.4 fixed point (16-bit), so each of the four corners of a
+// pixel's tetrahedron is one 8-byte load; the weights are in 1/256ths and
+// add up to 256. Where each input level falls in the lattice (corner and
+// fraction, per channel) is tabulated at load time, DOMAIN_MIN/MAX
+// included. The weighted sums take two multiply-adds per pixel with SSE2
+// (four with NEON); output matches the portable path bit for bit, and
+// float interpolation of the same table to within one level.
+class ColourLut {
+public:
+    static constexpr int kMinSize = 2;
+    static constexpr int kMaxSize = 65;
+
+    // `rgb` holds size³ entries of three values in 0-1 (clamped), red
+    // changing fastest, then green, then blue, as in a .cube file.
+    ColourLut(const std::string& title, int size, const std::vector<float>& rgb,
+              const float domainMin[3], const float domainMax[3]);
+
+    // Read an Adobe / Resolve .cube file (LUT_3D_SIZE 2-65; TITLE,
+    // DOMAIN_MIN, DOMAIN_MAX and LUT_3D_INPUT_RANGE are understood).
+    // Returns nullptr with the reason in `error` if it cannot be used.
+    static ColourLut* Load(const std::string& path, std::string& error);
+
+    const std::string& Title() const { return title; }
+    int Size() const { return size; }
+
+    // 24-bit RGB → graded BGRX (X = 255) in one pass: the lookup takes the
+    // place of the channel shuffle. Strides are in bytes.
+    void Convert(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride, int width, int height) const;
+    // Grade BGRX in place, for output the conversion did not write through
+    // the table (cropped, masked or turned).
+    void Grade(uint8_t* bgrx, int stride, int width, int height) const;
+    // Convert() without SIMD, for the benchmark.
+    void ConvertReference(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride, int width,
+                          int height) const;
+
+private:
+    template <int kInBytes, int kRed, int kBlue, bool kSimd>
+    void Rows(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride, int width, int height) const;
+
+    std::string title;
+    int size;
+    std::vector<int16_t> entries;   // size³ x (B, G, R, 0), 8.4 fixed point.
+    // Per channel and input level: the lower corner's offset in `entries`
+    // and the fraction towards the next corner, 0-256.
+    uint32_t offsets[3][256];
+    uint16_t fractions[3][256];
+};
+
+// Convert a 24-bit RGB frame to graded BGRX in row bands on `pool` (may
+// be nullptr). With a partial `roi` of the frame's size only the spans
+// inside it are written.
+void RunGradedConversion(ThreadPool* pool, const ColourLut& lut, const uint8_t* src, int srcStride, uint8_t* dst,
+                         int dstStride, int width, int height, const RoiMask* roi = nullptr);
+// Grade a BGRX frame in place, in row bands on `pool` (may be nullptr).
+void RunGrade(ThreadPool* pool, const ColourLut& lut, uint8_t* bgrx, int stride, int width, int height);
+
+// Time a plain RGB → BGRX conversion against graded ones through
+// synthetic 17³ and 33³ tables on a width x height frame, portable and
+// SIMD, on one thread and on `pool`, and check the fixed-point output
+// against float interpolation. The table goes in `report`.
+void BenchmarkColourLut(ThreadPool& pool, int width, int height, std::string& report);
+
+} // namespace kndi
@@ -0,0 +1,255 @@
+#include "config.h"
+
+#include <cstdlib>
+#include <sstream>
+
+#include "kinect_ndi.h"
+
+namespace kndi {
+
+static bool ParseInt(const std::string& value, long minValue, long maxValue, long& out)
+{
+    if (value.empty())
+        return false;
+    char* end = nullptr;
+    long parsed = std::strtol(value.c_str(), &end, 10);
+    if (*end != '\0' || parsed < minValue || parsed > maxValue)
+        return false;
+    out = parsed;
+    return true;
+}
+
+static bool ParseFloat(const std::string& value, float minValue, float maxValue, float& out)
+{
+    if (value.empty())
+        return false;
+    char* end = nullptr;
+    float parsed = std::strtof(value.c_str(), &end);
+    if (*end != '\0' || !(parsed >= minValue && parsed <= maxValue))
+        return false;
+    out = parsed;
+    return true;
+}
+
+// Split "a<sep>b<sep>..." into its fields.
+static std::vector<std::string> Split(const std::string& value, char separator)
+{
+    std::vector<std::string> fields;
+    std::istringstream stream(value);
+    std::string field;
+    while (std::getline(stream, field, separator))
+        fields.push_back(field);
+    return fields;
+}
+
+int ApplyOption(PipelineConfig& config, const std::string& key, const std::string& value)
+{
+    long number = 0;
+    if (key == "pool_frames") {
+        // Two buffers are always in flight (one filling, one latest).
+        if (!ParseInt(value, 2, 64, number))
+            return KNDI_ERROR_INVALID;
+        config.poolFrames = static_cast<size_t>(number);
+    } else if (key == "reconnect_delay_ms") {
+        if (!ParseInt(value, 0, 600000, number))
+            return KNDI_ERROR_INVALID;
+        config.reconnectDelayMs = static_cast<int>(number);
+    } else if (key == "standby_device") {
+        if (!ParseInt(value, -1, 255, number))
+            return KNDI_ERROR_INVALID;
+        config.standbyDeviceIndex = static_cast<int>(number);
+    } else if (key == "standby_streaming") {
+        if (!ParseInt(value, 0, 1, number))
+            return KNDI_ERROR_INVALID;
+        config.standbyStreaming = number != 0;
+    } else if (key == "stall_timeout_ms") {
+        if (!ParseInt(value, 1, 60000, number))
+            return KNDI_ERROR_INVALID;
+        config.stallTimeoutMs = static_cast<int>(number);
+    } else if (key == "fusion_devices") {
+        std::vector<int> devices;
+        for (const std::string& field : Split(value, ',')) {
+            if (!ParseInt(field, 0, 255, number))
+                return KNDI_ERROR_INVALID;
+            devices.push_back(static_cast<int>(number));
+        }
+        config.fusionDevices = devices;
+    } else if (key == "poses_file") {
+        config.posesFile = value;
+    } else if (key == "fusion_view") {
+        if (value != "top" && value != "camera")
+            return KNDI_ERROR_INVALID;
+        config.fusion.topDown = value == "top";
+    } else if (key == "fusion_size") {
+        std::vector<std::string> size = Split(value, 'x');
+        long width = 0;
+        if (size.size() != 2 || !ParseInt(size[0], 16, 4096, width) || !ParseInt(size[1], 16, 4096, number))
+            return KNDI_ERROR_INVALID;
+        config.fusion.width = static_cast<int>(width);
+        config.fusion.height = static_cast<int>(number);
+    } else if (key == "fusion_cell_mm") {
+        if (!ParseFloat(value, 0.1f, 1000.0f, config.fusion.cellMm))
+            return KNDI_ERROR_INVALID;
+    } else if (key == "fusion_origin_mm") {
+        std::vector<std::string> origin = Split(value, ',');
+        float x = 0.0f, y = 0.0f;
+        if (origin.size() != 2 || !ParseFloat(origin[0], -1e6f, 1e6f, x) || !ParseFloat(origin[1], -1e6f, 1e6f, y))
+            return KNDI_ERROR_INVALID;
+        config.fusion.originXMm = x;
+        config.fusion.originYMm = y;
+    } else if (key == "fusion_top_mm") {
+        if (!ParseFloat(value, -1e6f, 1e6f, config.fusion.topMm))
+            return KNDI_ERROR_INVALID;
+    } else if (key == "fusion_cloud_step") {
+        if (!ParseInt(value, 0, 64, number))
+            return KNDI_ERROR_INVALID;
+        config.fusion.cloudStep = static_cast<int>(number);
+    } else if (key == "threads") {
+        if (!ParseInt(value, 0, 256, number))
+            return KNDI_ERROR_INVALID;
+        config.threads = static_cast<int>(number);
+    } else if (key == "plan_check") {
+        if (!ParseInt(value, 0, 1, number))
+            return KNDI_ERROR_INVALID;
+        config.planCheck = number != 0;
+    } else if (key == "tuning_file") {
+        config.tuningFile = value;
+    } else if (key == "retune") {
+        if (!ParseInt(value, 0, 1, number))
+            return KNDI_ERROR_INVALID;
+        config.retune = number != 0;
+    } else if (key == "flight_recorder_frames") {
+        if (!ParseInt(value, 0, 1 << 22, number))
+            return KNDI_ERROR_INVALID;
+        config.flightRecorderFrames = static_cast<size_t>(number);
+    } else if (key == "flight_recorder_dir") {
+        config.flightRecorderDir = value;
+    } else if (key == "flight_recorder_signal") {
+        if (!ParseInt(value, 0, 1, number))
+            return KNDI_ERROR_INVALID;
+        config.flightRecorderSignal = number != 0;
+    } else if (key == "roi") {
+        if (!ParseRoi(value, config.roi))
+            return KNDI_ERROR_INVALID;
+    } else if (key == "depth_filter") {
+        // Sobel would replace depth with edges; it is only benchmarked.
+        DepthFilter filter;
+        if (!ParseDepthFilter(value, filter) || filter == DepthFilter::Sobel)
+            return KNDI_ERROR_INVALID;
+        config.depthFilter = filter;
+    } else if (key == "depth_filter_layout") {
+        if (!ParseDepthLayout(value, config.depthFilterLayout))
+            return KNDI_ERROR_INVALID;
+    } else if (key == "video_denoise") {
+        if (!ParseInt(value, 0, 1, number))
+            return KNDI_ERROR_INVALID;
+        config.videoDenoise = number != 0;
+    } else if (key == "video_denoise_strength") {
+        if (!ParseFloat(value, 0.0f, 0.95f, config.videoDenoiseStrength))
+            return KNDI_ERROR_INVALID;
+    } else if (key == "video_denoise_threshold") {
+        if (!ParseInt(value, 1, 255, number))
+            return KNDI_ERROR_INVALID;
+        config.videoDenoiseThreshold = static_cast<int>(number);
+    } else if (key == "volume_crop") {
+        // Empty turns it off.
+        if (!value.empty() && !ParseVolumeBox(value, config.volumeBox))
+            return KNDI_ERROR_INVALID;
+        config.volumeCrop = !value.empty();
+    } else if (key == "volume_crop_mode") {
+        if (value != "clear" && value != "key")
+            return KNDI_ERROR_INVALID;
+        config.volumeCropMode = value == "key" ? VolumeCropMode::Key : VolumeCropMode::Clear;
+    } else if (key == "privacy") {
+        if (!ParsePrivacyMode(value, config.privacy))
+            return KNDI_ERROR_INVALID;
+    } else if (key == "privacy_far_mm") {
+        if (!ParseFloat(value, 300.0f, 10000.0f, config.privacyFarMm))
+            return KNDI_ERROR_INVALID;
+    } else if (key == "colour_lut") {
+        config.colourLutFile = value;
+    } else if (key == "mesh") {
+        if (!ParseInt(value, 0, 1, number))
+            return KNDI_ERROR_INVALID;
+        config.mesh = number != 0;
+    } else if (key == "mesh_tolerance") {
+        if (!ParseInt(value, 0, 64, number))
+            return KNDI_ERROR_INVALID;
+        config.meshSettings.tolerance = static_cast<int>(number);
+    } else if (key == "mesh_max_jump") {
+        if (!ParseFloat(value, 0.005f, 1.0f, config.meshSettings.maxJump))
+            return KNDI_ERROR_INVALID;
+    } else if (key == "planes") {
+        if (!ParseInt(value, 0, 1, number))
+            return KNDI_ERROR_INVALID;
+        config.planes = number != 0;
+    } else if (key == "planes_interval") {
+        if (!ParseInt(value, 1, 300, number))
+            return KNDI_ERROR_INVALID;
+        config.planeSettings.intervalFrames = static_cast<int>(number);
+    } else if (key == "planes_tolerance_mm") {
+        if (!ParseFloat(value, 1.0f, 200.0f, config.planeSettings.toleranceMm))
+            return KNDI_ERROR_INVALID;
+    } else if (key == "planes_max") {
+        if (!ParseInt(value, 1, PlaneFinder::kMaxPlanes, number))
+            return KNDI_ERROR_INVALID;
+        config.planeSettings.maxPlanes = static_cast<int>(number);
+    } else if (key == "orientation") {
+        if (!ParseOrientation(value, config.orientation))
+            return KNDI_ERROR_INVALID;
+    } else if (key == "auto_frame") {
+        if (!ParseInt(value, 0, 1, number))
+            return KNDI_ERROR_INVALID;
+        config.autoFrame = number != 0;
+    } else if (key == "auto_frame_size") {
+        std::vector<std::string> size = Split(value, 'x');
+        long width = 0;
+        if (size.size() != 2 || !ParseInt(size[0], 16, kMaxAutoFrameWidth, width) ||
+            !ParseInt(size[1], 16, 1080, number))
+            return KNDI_ERROR_INVALID;
+        config.framing.width = static_cast<int>(width);
+        config.framing.height = static_cast<int>(number);
+    } else if (key == "auto_frame_range_mm") {
+        std::vector<std::string> range = Split(value, ',');
+        float nearMm = 0.0f, farMm = 0.0f;
+        if (range.size() != 2 || !ParseFloat(range[0], 0.0f, 10000.0f, nearMm) ||
+            !ParseFloat(range[1], 0.0f, 10000.0f, farMm) || nearMm >= farMm)
+            return KNDI_ERROR_INVALID;
+        config.framing.nearMm = nearMm;
+        config.framing.farMm = farMm;
+    } else if (key == "auto_frame_margin") {
+        if (!ParseFloat(value, 0.0f, 2.0f, config.framing.margin))
+            return KNDI_ERROR_INVALID;
+    } else if (key == "auto_frame_smoothing_ms") {
+        if (!ParseInt(value, 0, 60000, number))
+            return KNDI_ERROR_INVALID;
+        config.framing.smoothingMs = static_cast<int>(number);
+    } else if (key == "replay_dir") {
+        config.replayDir = value;
+    } else if (key == "realtime_memory") {
+        if (!ParseInt(value, 0, 1, number))
+            return KNDI_ERROR_INVALID;
+        config.realtimeMemory = number != 0;
+    } else if (key == "usb_placement") {
+        if (!ParseInt(value, 0, 1, number))
+            return KNDI_ERROR_INVALID;
+        config.usbPlacement = number != 0;
+    } else if (key == "stats_interval_ms") {
+        if (!ParseInt(value, 0, 60000, number) || (number > 0 && number < 100))
+            return KNDI_ERROR_INVALID;
+#ifndef __linux__
+        if (number > 0)
+            return KNDI_ERROR_UNSUPPORTED;
+#endif
+        config.statsIntervalMs = static_cast<int>(number);
+    } else if (key == "watchdog_ms") {
+        if (!ParseInt(value, 0, 600000, number))
+            return KNDI_ERROR_INVALID;
+        config.watchdogMs = static_cast<int>(number);
+    } else {
+        return KNDI_ERROR_UNSUPPORTED;
+    }
+    return KNDI_OK;
+}
+
+} // namespace kndi
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "auto_frame.h"
+#include "convert.h"
+#include "depth_mesh.h"
+#include "depth_filter.h"
+#include "fusion.h"
+#include "plane_finder.h"
+#include "privacy_mask.h"
+#include "roi.h"
+#include "volume_crop.h"
+
+namespace kndi {
+
+// Everything that shapes a pipeline. Set through kndi_set_streams() and
+// kndi_set_option(); read by the capture loop when it (re)connects.
+struct PipelineConfig {
+    int deviceIndex = 0;
+    unsigned streams = 0;          // kndi_stream bitmask.
+    size_t poolFrames = 4;         // Buffers per stream in the frame pool.
+    int reconnectDelayMs = 5000;   // Wait between reconnection attempts.
+
+    // Hot standby: a second Kinect kept open that takes over the same sinks
+    // when the active one delivers nothing for `stallTimeoutMs` (a few
+    // seconds while it waits for its first frame). A warm standby must be
+    // delivering itself to take over.
+    int standbyDeviceIndex = -1;   // -1 disables failover.
+    bool standbyStreaming = true;  // Keep the standby streaming (warm) or just open.
+    int stallTimeoutMs = 40;       // A little over one 30 fps frame interval.
+
+    // Multi-Kinect fusion: further Kinects whose depth is merged with this
+    // one's. Poses come from `posesFile` (see LoadPoses).
+    std::vector<int> fusionDevices;
+    std::string posesFile;
+    FusionSettings fusion;
+
+    int threads = 0;               // Worker threads for parallel stages (0 = all cores).
+    bool planCheck = true;         // Estimate the CPU cost at start and warn if over budget.
+
+    // Conversion kernel tuning cache (see KernelTuner). Empty uses the
+    // per-user cache file, "none" tunes on every start without saving.
+    std::string tuningFile;
+    bool retune = false;           // Benchmark again instead of using the cache (once).
+
+    // Flight recorder: ring of per-frame timing records, dumped as CSV on
+    // disconnect, watchdog, failover, SIGUSR1 or request.
+    size_t flightRecorderFrames = 32768; // About 3 minutes of RGB + depth; 0 disables.
+    std::string flightRecorderDir;       // Empty: the temp directory.
+    bool flightRecorderSignal = false;   // Dump on SIGUSR1 (installs a process-wide handler).
+    int watchdogMs = 1000;               // Silence on the active Kinect that triggers a dump.
+
+    // Region of interest in every Kinect's 640x480 frames; stages skip the
+    // pixels outside it. Empty: the whole frame.
+    std::vector<RoiPolygon> roi;
+
+    // Neighbourhood filter run on every depth frame before the sinks and
+    // fusion see it, and the layout it walks the frame in.
+    DepthFilter depthFilter = DepthFilter::None;
+    DepthLayout depthFilterLayout = DepthLayout::Rows;
+
+    // Motion-adaptive temporal filter run on every RGB or IR frame before
+    // the sinks see it (see VideoDenoiser).
+    bool videoDenoise = false;
+    float videoDenoiseStrength = 0.75f;   // Weight of the history, 0-0.95.
+    int videoDenoiseThreshold = 20;       // Change in levels that counts as motion.
+
+    // Oriented box in the streaming Kinect's camera space; its depth
+    // outside is cleared (or keyed out of the NDI depth source).
+    bool volumeCrop = false;
+    VolumeBox volumeBox;
+    VolumeCropMode volumeCropMode = VolumeCropMode::Clear;
+
+    // Hide RGB blocks whose depth is farther than `privacyFarMm` (or has
+    // no reading), e.g. passers-by behind the subject. Needs RGB and depth.
+    PrivacyMode privacy = PrivacyMode::Off;
+    float privacyFarMm = 2000.0f;
+
+    // 3D LUT (.cube file) the RGB NDI output is graded through, inside its
+    // conversion to BGRX (see ColourLut). Empty: no grading.
+    std::string colourLutFile;
+
+    // Triangle mesh of the streaming Kinect's depth, sent as the
+    // KNDI_STREAM_MESH stream (see DepthMesher).
+    bool mesh = false;
+    MeshSettings meshSettings;
+
+    // Floor, walls and other dominant planes of the streaming Kinect's
+    // depth, for kndi_get_planes() and as NDI metadata (see PlaneFinder).
+    bool planes = false;
+    PlaneSettings planeSettings;
+
+    // Turn of the RGB, IR and depth NDI output, done inside the conversion
+    // to BGRX, for Kinects mounted sideways or upside down.
+    Orientation orientation = Orientation::None;
+
+    // Virtual camera that crops the RGB output to the subject found in
+    // depth and scales it to a fixed size. Needs the RGB and depth streams.
+    bool autoFrame = false;
+    AutoFrameSettings framing;
+
+    std::string replayDir;               // Replay buffer saves; empty: the temp directory.
+
+    // Prefault every frame buffer at start and lock the process in RAM
+    // (mlockall), so the capture path never page-faults. Without the
+    // privilege only the frame pools are locked, or nothing.
+    bool realtimeMemory = false;
+
+    // Pin each Kinect's capture thread to a core local to its USB
+    // controller, away from the other Kinects and controllers' interrupts,
+    // and the conversion workers to the remaining local cores (see
+    // UsbPlacement). Linux only.
+    bool usbPlacement = false;
+
+    // Counters published to shared memory for kinect-ndi-top, read from
+    // the flight recorder; 0 disables. Linux only.
+#ifdef __linux__
+    int statsIntervalMs = 1000;
+#else
+    int statsIntervalMs = 0;
+#endif
+};
+
+// Apply one key/value option. Returns KNDI_OK, KNDI_ERROR_INVALID for a bad
+// value or KNDI_ERROR_UNSUPPORTED for an unknown key (or one this platform
+// lacks).
+int ApplyOption(PipelineConfig& config, const std::string& key, const std::string& value);
+
+} // namespace kndi
@@ -0,0 +1,371 @@
+#include "convert.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "depth_units.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+  #include <immintrin.h>
+  #define KNDI_X86_SIMD 1
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  #include <arm_neon.h>
+  #define KNDI_NEON 1
+#endif
+
+namespace kndi {
+
+void ConvertRgbToBgrx(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride,
+                      int width, int height)
+{
+    for (int y = 0; y < height; y++) {
+        const uint8_t* in = src + y * srcStride;
+        uint8_t* out = dst + y * dstStride;
+        for (int x = 0; x < width; x++) {
+            out[x * 4 + 0] = in[x * 3 + 2]; // Blue
+            out[x * 4 + 1] = in[x * 3 + 1]; // Green
+            out[x * 4 + 2] = in[x * 3 + 0]; // Red
+            out[x * 4 + 3] = 255;           // Unused (X)
+        }
+    }
+}
+
+void ConvertIrToBgrx(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride,
+                     int width, int height)
+{
+    for (int y = 0; y < height; y++) {
+        const uint8_t* in = src + y * srcStride;
+        uint8_t* out = dst + y * dstStride;
+        for (int x = 0; x < width; x++) {
+            uint8_t gray = in[x];
+            out[x * 4 + 0] = gray;
+            out[x * 4 + 1] = gray;
+            out[x * 4 + 2] = gray;
+            out[x * 4 + 3] = 255;
+        }
+    }
+}
+
+void ConvertDepthToBgrx(const uint16_t* src, int srcStride, uint8_t* dst, int dstStride,
+                        int width, int height)
+{
+    for (int y = 0; y < height; y++) {
+        const uint16_t* in = reinterpret_cast<const uint16_t*>(
+            reinterpret_cast<const uint8_t*>(src) + y * srcStride);
+        uint8_t* out = dst + y * dstStride;
+        for (int x = 0; x < width; x++) {
+            uint8_t gray = static_cast<uint8_t>((in[x] * 255) / 2047);
+            out[x * 4 + 0] = gray;
+            out[x * 4 + 1] = gray;
+            out[x * 4 + 2] = gray;
+            out[x * 4 + 3] = 255;
+        }
+    }
+}
+
+void ConvertMillimetresToBgrx(const uint16_t* src, int srcStride, uint8_t* dst, int dstStride,
+                              int width, int height)
+{
+    for (int y = 0; y < height; y++) {
+        const uint16_t* in = reinterpret_cast<const uint16_t*>(
+            reinterpret_cast<const uint8_t*>(src) + y * srcStride);
+        uint8_t* out = dst + y * dstStride;
+        for (int x = 0; x < width; x++) {
+            uint8_t gray = static_cast<uint8_t>(std::min(in[x] >> 5, 255));
+            out[x * 4 + 0] = gray;
+            out[x * 4 + 1] = gray;
+            out[x * 4 + 2] = gray;
+            out[x * 4 + 3] = 255;
+        }
+    }
+}
+
+void KeyInvalidDepth(const uint16_t* src, int srcStride, uint8_t* dst, int dstStride,
+                     int width, int height)
+{
+    for (int y = 0; y < height; y++) {
+        const uint16_t* in = reinterpret_cast<const uint16_t*>(
+            reinterpret_cast<const uint8_t*>(src) + y * srcStride);
+        uint8_t* out = dst + y * dstStride;
+        for (int x = 0; x < width; x++)
+            out[x * 4 + 3] = in[x] == kRawDepthInvalid ? 0 : 255;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Kernel variants. Each is a drop-in replacement for the reference kernel of
+// its stream above; the "word" variants build a whole BGRX pixel in a 32-bit
+// register (little-endian hosts only), the SIMD ones process 16 pixels per
+// step with a scalar tail.
+// ---------------------------------------------------------------------------
+
+static const uint32_t kAlpha = 0xFF000000u;
+
+static bool IsLittleEndian()
+{
+    const uint16_t probe = 1;
+    uint8_t first;
+    std::memcpy(&first, &probe, 1);
+    return first == 1;
+}
+
+static inline uint32_t Load32(const uint8_t* p)
+{
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+}
+
+static inline void Store32(uint8_t* p, uint32_t v)
+{
+    std::memcpy(p, &v, 4);
+}
+
+static inline uint32_t Bgrx(uint32_t r, uint32_t g, uint32_t b)
+{
+    return b | (g << 8) | (r << 16) | kAlpha;
+}
+
+static void RgbReference(const void* src, int srcStride, uint8_t* dst, int dstStride, int width, int height)
+{
+    ConvertRgbToBgrx(static_cast<const uint8_t*>(src), srcStride, dst, dstStride, width, height);
+}
+
+static void RgbWord(const void* src, int srcStride, uint8_t* dst, int dstStride, int width, int height)
+{
+    for (int y = 0; y < height; y++) {
+        const uint8_t* in = static_cast<const uint8_t*>(src) + y * srcStride;
+        uint8_t* out = dst + y * dstStride;
+        int x = 0;
+        // Four pixels (12 bytes) in three word loads.
+        for (; x + 4 <= width; x += 4, in += 12, out += 16) {
+            uint32_t w0 = Load32(in), w1 = Load32(in + 4), w2 = Load32(in + 8);
+            Store32(out + 0, Bgrx(w0 & 0xFF, (w0 >> 8) & 0xFF, (w0 >> 16) & 0xFF));
+            Store32(out + 4, Bgrx(w0 >> 24, w1 & 0xFF, (w1 >> 8) & 0xFF));
+            Store32(out + 8, Bgrx((w1 >> 16) & 0xFF, w1 >> 24, w2 & 0xFF));
+            Store32(out + 12, Bgrx((w2 >> 8) & 0xFF, (w2 >> 16) & 0xFF, w2 >> 24));
+        }
+        for (; x < width; x++, in += 3, out += 4)
+            Store32(out, Bgrx(in[0], in[1], in[2]));
+    }
+}
+
+static void IrReference(const void* src, int srcStride, uint8_t* dst, int dstStride, int width, int height)
+{
+    ConvertIrToBgrx(static_cast<const uint8_t*>(src), srcStride, dst, dstStride, width, height);
+}
+
+static void IrWord(const void* src, int srcStride, uint8_t* dst, int dstStride, int width, int height)
+{
+    for (int y = 0; y < height; y++) {
+        const uint8_t* in = static_cast<const uint8_t*>(src) + y * srcStride;
+        uint8_t* out = dst + y * dstStride;
+        for (int x = 0; x < width; x++)
+            Store32(out + x * 4, in[x] * 0x010101u | kAlpha);
+    }
+}
+
+static void DepthReference(const void* src, int srcStride, uint8_t* dst, int dstStride, int width, int height)
+{
+    ConvertDepthToBgrx(static_cast<const uint16_t*>(src), srcStride, dst, dstStride, width, height);
+}
+
+namespace {
+
+// Whole BGRX pixels for every 11-bit value, same mapping as the reference.
+struct DepthPixelTable {
+    uint32_t pixel[2048];
+
+    DepthPixelTable()
+    {
+        for (uint32_t v = 0; v < 2048; v++)
+            pixel[v] = ((v * 255) / 2047) * 0x010101u | kAlpha;
+    }
+};
+
+} // namespace
+
+static void DepthLut(const void* src, int srcStride, uint8_t* dst, int dstStride, int width, int height)
+{
+    static const DepthPixelTable table;
+    for (int y = 0; y < height; y++) {
+        const uint16_t* in = reinterpret_cast<const uint16_t*>(static_cast<const uint8_t*>(src) + y * srcStride);
+        uint8_t* out = dst + y * dstStride;
+        for (int x = 0; x < width; x++)
+            Store32(out + x * 4, table.pixel[in[x] & 2047]);
+    }
+}
+
+static void MillimetresReference(const void* src, int srcStride, uint8_t* dst, int dstStride, int width, int height)
+{
+    ConvertMillimetresToBgrx(static_cast<const uint16_t*>(src), srcStride, dst, dstStride, width, height);
+}
+
+static void MillimetresWord(const void* src, int srcStride, uint8_t* dst, int dstStride, int width, int height)
+{
+    for (int y = 0; y < height; y++) {
+        const uint16_t* in = reinterpret_cast<const uint16_t*>(static_cast<const uint8_t*>(src) + y * srcStride);
+        uint8_t* out = dst + y * dstStride;
+        for (int x = 0; x < width; x++) {
+            uint32_t gray = std::min(in[x] >> 5, 255);
+            Store32(out + x * 4, gray * 0x010101u | kAlpha);
+        }
+    }
+}
+
+#ifdef KNDI_X86_SIMD
+__attribute__((target("ssse3")))
+static void RgbSsse3(const void* src, int srcStride, uint8_t* dst, int dstStride, int width, int height)
+{
+    const __m128i shuffle = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+    const __m128i alpha = _mm_set1_epi32(static_cast<int>(kAlpha));
+    for (int y = 0; y < height; y++) {
+        const uint8_t* in = static_cast<const uint8_t*>(src) + y * srcStride;
+        uint8_t* out = dst + y * dstStride;
+        int x = 0;
+        // 16-byte loads of which 12 are used: stop early enough not to
+        // read past the row.
+        for (; x + 6 <= width; x += 4) {
+            __m128i rgb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + x * 3));
+            __m128i bgrx = _mm_or_si128(_mm_shuffle_epi8(rgb, shuffle), alpha);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x * 4), bgrx);
+        }
+        for (; x < width; x++)
+            Store32(out + x * 4, Bgrx(in[x * 3], in[x * 3 + 1], in[x * 3 + 2]));
+    }
+}
+
+__attribute__((target("sse2")))
+static void IrSse2(const void* src, int srcStride, uint8_t* dst, int dstStride, int width, int height)
+{
+    const __m128i alpha = _mm_set1_epi32(static_cast<int>(kAlpha));
+    for (int y = 0; y < height; y++) {
+        const uint8_t* in = static_cast<const uint8_t*>(src) + y * srcStride;
+        uint8_t* out = dst + y * dstStride;
+        int x = 0;
+        for (; x + 16 <= width; x += 16) {
+            __m128i gray = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + x));
+            __m128i lo = _mm_unpacklo_epi8(gray, gray);
+            __m128i hi = _mm_unpackhi_epi8(gray, gray);
+            __m128i* o = reinterpret_cast<__m128i*>(out + x * 4);
+            _mm_storeu_si128(o + 0, _mm_or_si128(_mm_unpacklo_epi16(lo, lo), alpha));
+            _mm_storeu_si128(o + 1, _mm_or_si128(_mm_unpackhi_epi16(lo, lo), alpha));
+            _mm_storeu_si128(o + 2, _mm_or_si128(_mm_unpacklo_epi16(hi, hi), alpha));
+            _mm_storeu_si128(o + 3, _mm_or_si128(_mm_unpackhi_epi16(hi, hi), alpha));
+        }
+        for (; x < width; x++)
+            Store32(out + x * 4, in[x] * 0x010101u | kAlpha);
+    }
+}
+#endif
+
+#ifdef KNDI_NEON
+static void RgbNeon(const void* src, int srcStride, uint8_t* dst, int dstStride, int width, int height)
+{
+    for (int y = 0; y < height; y++) {
+        const uint8_t* in = static_cast<const uint8_t*>(src) + y * srcStride;
+        uint8_t* out = dst + y * dstStride;
+        int x = 0;
+        for (; x + 16 <= width; x += 16) {
+            uint8x16x3_t rgb = vld3q_u8(in + x * 3);
+            uint8x16x4_t bgrx;
+            bgrx.val[0] = rgb.val[2];
+            bgrx.val[1] = rgb.val[1];
+            bgrx.val[2] = rgb.val[0];
+            bgrx.val[3] = vdupq_n_u8(255);
+            vst4q_u8(out + x * 4, bgrx);
+        }
+        for (; x < width; x++)
+            Store32(out + x * 4, Bgrx(in[x * 3], in[x * 3 + 1], in[x * 3 + 2]));
+    }
+}
+
+static void IrNeon(const void* src, int srcStride, uint8_t* dst, int dstStride, int width, int height)
+{
+    for (int y = 0; y < height; y++) {
+        const uint8_t* in = static_cast<const uint8_t*>(src) + y * srcStride;
+        uint8_t* out = dst + y * dstStride;
+        int x = 0;
+        for (; x + 16 <= width; x += 16) {
+            uint8x16_t gray = vld1q_u8(in + x);
+            uint8x16x4_t bgrx;
+            bgrx.val[0] = gray;
+            bgrx.val[1] = gray;
+            bgrx.val[2] = gray;
+            bgrx.val[3] = vdupq_n_u8(255);
+            vst4q_u8(out + x * 4, bgrx);
+        }
+        for (; x < width; x++)
+            Store32(out + x * 4, in[x] * 0x010101u | kAlpha);
+    }
+}
+#endif
+
+std::vector<ConvertVariant> ConvertVariants(kndi_stream stream)
+{
+    std::vector<ConvertVariant> variants;
+    bool words = IsLittleEndian();
+    switch (stream) {
+    case KNDI_STREAM_RGB:
+        variants.push_back(ConvertVariant{ "scalar", RgbReference });
+        if (words)
+            variants.push_back(ConvertVariant{ "word", RgbWord });
+#ifdef KNDI_X86_SIMD
+        if (__builtin_cpu_supports("ssse3"))
+            variants.push_back(ConvertVariant{ "ssse3", RgbSsse3 });
+#endif
+#ifdef KNDI_NEON
+        variants.push_back(ConvertVariant{ "neon", RgbNeon });
+#endif
+        break;
+    case KNDI_STREAM_IR:
+        variants.push_back(ConvertVariant{ "scalar", IrReference });
+        if (words)
+            variants.push_back(ConvertVariant{ "word", IrWord });
+#ifdef KNDI_X86_SIMD
+        if (__builtin_cpu_supports("sse2"))
+            variants.push_back(ConvertVariant{ "sse2", IrSse2 });
+#endif
+#ifdef KNDI_NEON
+        variants.push_back(ConvertVariant{ "neon", IrNeon });
+#endif
+        break;
+    case KNDI_STREAM_DEPTH:
+        variants.push_back(ConvertVariant{ "arithmetic", DepthReference });
+        if (words)
+            variants.push_back(ConvertVariant{ "lut", DepthLut });
+        break;
+    case KNDI_STREAM_FUSED_DEPTH:
+        variants.push_back(ConvertVariant{ "scalar", MillimetresReference });
+        if (words)
+            variants.push_back(ConvertVariant{ "word", MillimetresWord });
+        break;
+    case KNDI_STREAM_POINT_CLOUD:
+    case KNDI_STREAM_MESH:
+        break;
+    }
+    return variants;
+}
+
+static const char* const kOrientationNames[] = {
+    "none", "mirror", "flip", "rotate90", "rotate180", "rotate270"
+};
+
+bool ParseOrientation(const std::string& name, Orientation& out)
+{
+    for (int i = 0; i < 6; i++) {
+        if (name == kOrientationNames[i]) {
+            out = static_cast<Orientation>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* OrientationName(Orientation orientation)
+{
+    return kOrientationNames[static_cast<int>(orientation)];
+}
+
+} // namespace kndi
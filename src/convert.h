@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "kinect_ndi.h"
+
+namespace kndi {
+
+// Kinect → BGRX conversion kernels used by the NDI sink. `dst` must hold
+// width * height * 4 bytes; strides are in bytes.
+
+// 24-bit RGB → BGRX.
+void ConvertRgbToBgrx(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride,
+                      int width, int height);
+
+// 8-bit IR, replicated into B, G and R.
+void ConvertIrToBgrx(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride,
+                     int width, int height);
+
+// 11-bit depth (0–2047) mapped to 8-bit grayscale.
+void ConvertDepthToBgrx(const uint16_t* src, int srcStride, uint8_t* dst, int dstStride,
+                        int width, int height);
+
+// Depth in millimetres mapped to 8-bit grayscale at 32 mm per step (about
+// 8 m of range); 0 (no data) stays black.
+void ConvertMillimetresToBgrx(const uint16_t* src, int srcStride, uint8_t* dst, int dstStride,
+                              int width, int height);
+
+// Alpha of converted 11-bit depth: 0 where there is no reading
+// (kRawDepthInvalid), 255 elsewhere, for sending BGRA. Colours are kept.
+void KeyInvalidDepth(const uint16_t* src, int srcStride, uint8_t* dst, int dstStride,
+                     int width, int height);
+
+// Common signature of all conversion kernels; `src` holds uint8_t or
+// uint16_t samples depending on the stream.
+typedef void (*ConvertKernel)(const void* src, int srcStride, uint8_t* dst, int dstStride,
+                              int width, int height);
+
+struct ConvertVariant {
+    const char* name;
+    ConvertKernel kernel;
+};
+
+// Implementations of the BGRX conversion for `stream` that run on this CPU,
+// the portable reference first. All produce identical output; which one is
+// fastest depends on the host, so the kernel tuner picks among them.
+std::vector<ConvertVariant> ConvertVariants(kndi_stream stream);
+
+// How converted frames are turned relative to the Kinect image, for sensors
+// mounted sideways or upside down. Mirror swaps left and right, flip top
+// and bottom; rotations are clockwise.
+enum class Orientation { None, Mirror, Flip, Rotate90, Rotate180, Rotate270 };
+
+// "none", "mirror", "flip", "rotate90", "rotate180" or "rotate270".
+bool ParseOrientation(const std::string& name, Orientation& out);
+const char* OrientationName(Orientation orientation);
+
+// True if the output of `orientation` is height wide and width high.
+inline bool SwapsAxes(Orientation orientation)
+{
+    return orientation == Orientation::Rotate90 || orientation == Orientation::Rotate270;
+}
+
+} // namespace kndi
@@ -0,0 +1,79 @@
+#include "depth_codec.h"
+
+namespace kndi {
+
+size_t CompressDepth(const uint16_t* src, int stride, int width, int height, uint8_t* dst)
+{
+    uint8_t* out = dst;
+    int previous = 0;
+    int run = 0;
+    for (int y = 0; y < height; y++) {
+        const uint16_t* row = reinterpret_cast<const uint16_t*>(
+            reinterpret_cast<const uint8_t*>(src) + static_cast<size_t>(y) * stride);
+        for (int x = 0; x < width; x++) {
+            int value = row[x];
+            if (value == previous) {
+                if (++run == 63) {
+                    *out++ = static_cast<uint8_t>(0xBF + run);
+                    run = 0;
+                }
+                continue;
+            }
+            if (run) {
+                *out++ = static_cast<uint8_t>(0xBF + run);
+                run = 0;
+            }
+            int delta = value - previous;
+            if (delta >= -64 && delta < 64) {
+                *out++ = static_cast<uint8_t>(delta + 64);
+            } else if (value < 0x4000) {
+                *out++ = static_cast<uint8_t>(0x80 | (value >> 8));
+                *out++ = static_cast<uint8_t>(value);
+            } else {
+                *out++ = 0xFF;
+                *out++ = static_cast<uint8_t>(value);
+                *out++ = static_cast<uint8_t>(value >> 8);
+            }
+            previous = value;
+        }
+    }
+    if (run)
+        *out++ = static_cast<uint8_t>(0xBF + run);
+    return static_cast<size_t>(out - dst);
+}
+
+bool DecompressDepth(const uint8_t* src, size_t bytes, uint16_t* dst, size_t samples)
+{
+    const uint8_t* in = src;
+    const uint8_t* end = src + bytes;
+    size_t written = 0;
+    int previous = 0;
+    while (in < end) {
+        uint8_t code = *in++;
+        if (code < 0x80) {
+            previous += code - 64;
+        } else if (code < 0xC0) {
+            if (in == end)
+                return false;
+            previous = (code & 0x3F) << 8 | *in++;
+        } else if (code < 0xFF) {
+            size_t run = code - 0xBF;
+            if (samples - written < run)
+                return false;
+            for (size_t i = 0; i < run; i++)
+                dst[written++] = static_cast<uint16_t>(previous);
+            continue;
+        } else {
+            if (end - in < 2)
+                return false;
+            previous = in[0] | in[1] << 8;
+            in += 2;
+        }
+        if (written == samples)
+            return false;
+        dst[written++] = static_cast<uint16_t>(previous);
+    }
+    return written == samples;
+}
+
+} // namespace kndi
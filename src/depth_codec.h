@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace kndi {
+
+// Fast lossless codec for uint16 depth images. Each sample is coded against
+// the previous one in raster order, one code byte at a time:
+//   0x00-0x7F  difference of (byte - 64), i.e. -64..63
+//   0x80-0xBF  14-bit value: (byte & 0x3F) << 8 | next byte
+//   0xC0-0xFE  the previous value repeated (byte - 0xBF) times, 1..63
+//   0xFF       16-bit value, next two bytes little-endian
+// Kinect depth is mostly smooth surfaces and runs of "no reading", so a
+// 640x480 frame typically shrinks 3-6x.
+
+// Worst-case compressed size of `samples` depth values.
+inline size_t MaxCompressedDepthBytes(size_t samples)
+{
+    return samples * 3;
+}
+
+// Compress `width` x `height` samples (rows `stride` bytes apart) into
+// `dst`, which must hold MaxCompressedDepthBytes(width * height). Returns
+// the compressed size.
+size_t CompressDepth(const uint16_t* src, int stride, int width, int height, uint8_t* dst);
+
+// Decode into `samples` contiguous values. Returns false if `src` is
+// truncated or does not hold exactly that many samples.
+bool DecompressDepth(const uint8_t* src, size_t bytes, uint16_t* dst, size_t samples);
+
+} // namespace kndi
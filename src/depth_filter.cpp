@@ -0,0 +1,540 @@
+#include "depth_filter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+  #define KNDI_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  #include <arm_neon.h>
+  #define KNDI_NEON 1
+#endif
+
+#include "depth_units.h"
+#include "planner.h"
+
+namespace kndi {
+
+static const char* const kFilterNames[] = { "none", "median", "bilateral", "sobel" };
+static const char* const kLayoutNames[] = { "rows", "tiled8", "tiled16" };
+
+bool ParseDepthFilter(const std::string& name, DepthFilter& out)
+{
+    for (int i = 0; i < 4; i++) {
+        if (name == kFilterNames[i]) {
+            out = static_cast<DepthFilter>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* DepthFilterName(DepthFilter filter)
+{
+    return kFilterNames[static_cast<int>(filter)];
+}
+
+bool ParseDepthLayout(const std::string& name, DepthLayout& out)
+{
+    for (int i = 0; i < 3; i++) {
+        if (name == kLayoutNames[i]) {
+            out = static_cast<DepthLayout>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* DepthLayoutName(DepthLayout layout)
+{
+    return kLayoutNames[static_cast<int>(layout)];
+}
+
+static int TileSize(DepthLayout layout)
+{
+    return layout == DepthLayout::Tiled16 ? 16 : 8;
+}
+
+static inline const uint16_t* Row(const uint16_t* image, int stride, int y)
+{
+    return reinterpret_cast<const uint16_t*>(reinterpret_cast<const uint8_t*>(image) + static_cast<size_t>(y) * stride);
+}
+
+static inline uint16_t* Row(uint16_t* image, int stride, int y)
+{
+    return reinterpret_cast<uint16_t*>(reinterpret_cast<uint8_t*>(image) + static_cast<size_t>(y) * stride);
+}
+
+// ---------------------------------------------------------------------------
+// Tiled layout
+// ---------------------------------------------------------------------------
+
+void TiledDepth::Resize(int newWidth, int newHeight, int newTile)
+{
+    width = newWidth;
+    height = newHeight;
+    tile = newTile;
+    tilesX = (width + tile - 1) / tile;
+    tilesY = (height + tile - 1) / tile;
+    samples.resize(static_cast<size_t>(tilesX) * tilesY * tile * tile);
+}
+
+void TiledDepth::FromRows(ThreadPool* pool, const uint16_t* src, int stride)
+{
+    // Padding repeats the last column and row, so a filter reading it sees
+    // the same values as one clamping at the frame edge.
+    auto tileRow = [&](int ty) {
+        for (int r = 0; r < tile; r++) {
+            const uint16_t* in = Row(src, stride, std::min(ty * tile + r, height - 1));
+            for (int tx = 0; tx < tilesX; tx++) {
+                uint16_t* out = TileAt(tx, ty) + r * tile;
+                int columns = std::min(tile, width - tx * tile);
+                std::memcpy(out, in + tx * tile, columns * sizeof(uint16_t));
+                std::fill(out + columns, out + tile, in[width - 1]);
+            }
+        }
+    };
+    if (pool && pool->Size() > 1)
+        pool->ParallelFor(tilesY, tileRow);
+    else
+        for (int ty = 0; ty < tilesY; ty++)
+            tileRow(ty);
+}
+
+void TiledDepth::ToRows(ThreadPool* pool, uint16_t* dst, int stride) const
+{
+    auto tileRow = [&](int ty) {
+        int rows = std::min(tile, height - ty * tile);
+        for (int r = 0; r < rows; r++) {
+            uint16_t* out = Row(dst, stride, ty * tile + r);
+            for (int tx = 0; tx < tilesX; tx++) {
+                int columns = std::min(tile, width - tx * tile);
+                std::memcpy(out + tx * tile, TileAt(tx, ty) + r * tile, columns * sizeof(uint16_t));
+            }
+        }
+    };
+    if (pool && pool->Size() > 1)
+        pool->ParallelFor(tilesY, tileRow);
+    else
+        for (int ty = 0; ty < tilesY; ty++)
+            tileRow(ty);
+}
+
+// ---------------------------------------------------------------------------
+// Filters. Each one computes the output pixels [begin, end) of a row from
+// row pointers to its 2 * kRadius + 1 neighbouring rows, read at columns
+// begin - kRadius to end + kRadius; the drivers below supply those rows
+// from either layout. The median has SIMD versions (raw depth fits in 15
+// bits, so SSE2's signed 16-bit min/max order it).
+// ---------------------------------------------------------------------------
+
+namespace {
+
+struct MedianOp {
+    static const int kRadius = 1;
+
+    void operator()(const uint16_t* const* rows, uint16_t* out, int begin, int end) const
+    {
+        const uint16_t* r0 = rows[0];
+        const uint16_t* r1 = rows[1];
+        const uint16_t* r2 = rows[2];
+        int x = begin;
+#if defined(KNDI_SSE2)
+        for (; x + 8 <= end; x += 8) {
+            __m128i p[9];
+            for (int i = 0; i < 3; i++) {
+                p[i * 3 + 0] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[i] + x - 1));
+                p[i * 3 + 1] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[i] + x));
+                p[i * 3 + 2] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[i] + x + 1));
+            }
+            Network(p);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), p[4]);
+        }
+#elif defined(KNDI_NEON)
+        for (; x + 8 <= end; x += 8) {
+            uint16x8_t p[9];
+            for (int i = 0; i < 3; i++) {
+                p[i * 3 + 0] = vld1q_u16(rows[i] + x - 1);
+                p[i * 3 + 1] = vld1q_u16(rows[i] + x);
+                p[i * 3 + 2] = vld1q_u16(rows[i] + x + 1);
+            }
+            Network(p);
+            vst1q_u16(out + x, p[4]);
+        }
+#endif
+        for (; x < end; x++) {
+            uint16_t p[9] = {
+                r0[x - 1], r0[x], r0[x + 1],
+                r1[x - 1], r1[x], r1[x + 1],
+                r2[x - 1], r2[x], r2[x + 1]
+            };
+            Network(p);
+            out[x] = p[4];
+        }
+    }
+
+    // 19 compare-exchanges leave the median of nine in p[4] (Paeth).
+    template <typename T>
+    static void Network(T* p)
+    {
+        Order(p[1], p[2]); Order(p[4], p[5]); Order(p[7], p[8]);
+        Order(p[0], p[1]); Order(p[3], p[4]); Order(p[6], p[7]);
+        Order(p[1], p[2]); Order(p[4], p[5]); Order(p[7], p[8]);
+        Order(p[0], p[3]); Order(p[5], p[8]); Order(p[4], p[7]);
+        Order(p[3], p[6]); Order(p[1], p[4]); Order(p[2], p[5]);
+        Order(p[4], p[7]); Order(p[4], p[2]); Order(p[6], p[4]);
+        Order(p[4], p[2]);
+    }
+
+    static void Order(uint16_t& a, uint16_t& b)
+    {
+        uint16_t low = std::min(a, b);
+        b = std::max(a, b);
+        a = low;
+    }
+#if defined(KNDI_SSE2)
+    static void Order(__m128i& a, __m128i& b)
+    {
+        __m128i low = _mm_min_epi16(a, b);
+        b = _mm_max_epi16(a, b);
+        a = low;
+    }
+#elif defined(KNDI_NEON)
+    static void Order(uint16x8_t& a, uint16x8_t& b)
+    {
+        uint16x8_t low = vminq_u16(a, b);
+        b = vmaxq_u16(a, b);
+        a = low;
+    }
+#endif
+};
+
+// Integer weights: spatial sigma 1.5 pixels, range sigma 6 raw units (about
+// 1 cm at 1.5 m); neighbours further than kRangeTaps units apart get none.
+// Most neighbours of a pixel on a surface fall in range, so the branch on
+// it predicts well.
+struct BilateralOp {
+    static const int kRadius = 2;
+    static const int kRangeTaps = 24;
+
+    uint16_t spatial[25];
+    uint16_t range[kRangeTaps];
+
+    BilateralOp()
+    {
+        for (int dy = -2; dy <= 2; dy++) {
+            for (int dx = -2; dx <= 2; dx++)
+                spatial[(dy + 2) * 5 + dx + 2] =
+                    static_cast<uint16_t>(std::lround(16.0 * std::exp(-(dx * dx + dy * dy) / (2.0 * 1.5 * 1.5))));
+        }
+        for (int d = 0; d < kRangeTaps; d++)
+            range[d] = static_cast<uint16_t>(std::lround(64.0 * std::exp(-(d * d) / (2.0 * 6.0 * 6.0))));
+    }
+
+    void operator()(const uint16_t* const* rows, uint16_t* out, int begin, int end) const
+    {
+        for (int x = begin; x < end; x++) {
+            int centre = rows[2][x];
+            if (centre >= kRawDepthInvalid) {
+                out[x] = static_cast<uint16_t>(centre);
+                continue;
+            }
+            uint32_t sum = 0;
+            uint32_t weights = 0;
+            for (int dy = 0; dy < 5; dy++) {
+                const uint16_t* row = rows[dy] + x - 2;
+                for (int dx = 0; dx < 5; dx++) {
+                    int value = row[dx];
+                    int difference = std::abs(value - centre);
+                    if (difference >= kRangeTaps || value >= kRawDepthInvalid)
+                        continue;
+                    uint32_t weight = static_cast<uint32_t>(spatial[dy * 5 + dx]) * range[difference];
+                    sum += weight * value;
+                    weights += weight;
+                }
+            }
+            // The centre always counts, so `weights` is never 0.
+            out[x] = static_cast<uint16_t>((sum + weights / 2) / weights);
+        }
+    }
+};
+
+struct SobelOp {
+    static const int kRadius = 1;
+
+    void operator()(const uint16_t* const* rows, uint16_t* out, int begin, int end) const
+    {
+        const uint16_t* r0 = rows[0];
+        const uint16_t* r1 = rows[1];
+        const uint16_t* r2 = rows[2];
+        for (int x = begin; x < end; x++) {
+            int gx = (r0[x + 1] + 2 * r1[x + 1] + r2[x + 1]) - (r0[x - 1] + 2 * r1[x - 1] + r2[x - 1]);
+            int gy = (r2[x - 1] + 2 * r2[x] + r2[x + 1]) - (r0[x - 1] + 2 * r0[x] + r0[x + 1]);
+            out[x] = static_cast<uint16_t>(std::abs(gx) + std::abs(gy));
+        }
+    }
+};
+
+} // namespace
+
+// Row-major driver for rows [first, first + rows). Interior pixels read the
+// image directly; the few at the left and right edges go through a small
+// patch with the edge pixels repeated.
+template <typename Op>
+static void FilterRowBand(const Op& op, const uint16_t* src, int srcStride, uint16_t* dst, int dstStride,
+                          int width, int height, int first, int rows)
+{
+    const int radius = Op::kRadius;
+    const int taps = 2 * radius + 1;
+    const uint16_t* neighbours[taps];
+    uint16_t patch[taps][taps];
+    const uint16_t* patchRows[taps];
+    for (int i = 0; i < taps; i++)
+        patchRows[i] = patch[i];
+
+    for (int y = first; y < first + rows; y++) {
+        for (int i = 0; i < taps; i++)
+            neighbours[i] = Row(src, srcStride, std::min(std::max(y - radius + i, 0), height - 1));
+        uint16_t* out = Row(dst, dstStride, y);
+        int interiorEnd = std::max(radius, width - radius);
+        op(neighbours, out, radius, interiorEnd);
+        for (int x = 0; x < width; x++) {
+            if (x == radius && interiorEnd > radius)
+                x = interiorEnd;
+            for (int i = 0; i < taps; i++) {
+                for (int j = 0; j < taps; j++)
+                    patch[i][j] = neighbours[i][std::min(std::max(x - radius + j, 0), width - 1)];
+            }
+            op(patchRows, out + x - radius, radius, radius + 1);
+        }
+    }
+}
+
+template <typename Op>
+static void FilterRowsWith(const Op& op, ThreadPool* pool, const uint16_t* src, int srcStride, uint16_t* dst,
+                           int dstStride, int width, int height)
+{
+    int bands = pool ? std::min(pool->Size(), height) : 1;
+    if (bands <= 1) {
+        FilterRowBand(op, src, srcStride, dst, dstStride, width, height, 0, height);
+        return;
+    }
+    int rowsPerBand = (height + bands - 1) / bands;
+    pool->ParallelFor(bands, [&](int band) {
+        int first = band * rowsPerBand;
+        int rows = std::min(rowsPerBand, height - first);
+        if (rows > 0)
+            FilterRowBand(op, src, srcStride, dst, dstStride, width, height, first, rows);
+    });
+}
+
+// Tiled driver for one row of tiles. Each tile is filtered from a window
+// of (tile + 2 * radius)^2 samples gathered from it and its neighbours;
+// the padded tiles already repeat the right and bottom edges, so only the
+// window's reads past the padded image are clamped.
+template <typename Op>
+static void FilterTileRow(const Op& op, const TiledDepth& src, TiledDepth& dst, int ty)
+{
+    const int radius = Op::kRadius;
+    const int taps = 2 * radius + 1;
+    const int tile = src.Tile();
+    const int windowWidth = tile + 2 * radius;
+    uint16_t window[(16 + 4) * (16 + 4)];
+    const uint16_t* neighbours[taps];
+    int paddedHeight = src.TilesY() * tile;
+
+    for (int tx = 0; tx < src.TilesX(); tx++) {
+        for (int wy = 0; wy < windowWidth; wy++) {
+            int y = std::min(std::max(ty * tile - radius + wy, 0), paddedHeight - 1);
+            int tileY = y / tile;
+            int offset = (y % tile) * tile;
+            const uint16_t* middle = src.TileAt(tx, tileY) + offset;
+            const uint16_t* left = tx > 0 ? src.TileAt(tx - 1, tileY) + offset : nullptr;
+            const uint16_t* right = tx + 1 < src.TilesX() ? src.TileAt(tx + 1, tileY) + offset : nullptr;
+            uint16_t* out = window + wy * windowWidth;
+            for (int j = 0; j < radius; j++) {
+                out[j] = left ? left[tile - radius + j] : middle[0];
+                out[radius + tile + j] = right ? right[j] : middle[tile - 1];
+            }
+            std::memcpy(out + radius, middle, tile * sizeof(uint16_t));
+        }
+        uint16_t* out = dst.TileAt(tx, ty);
+        for (int r = 0; r < tile; r++) {
+            for (int i = 0; i < taps; i++)
+                neighbours[i] = window + (r + i) * windowWidth + radius;
+            op(neighbours, out + r * tile, 0, tile);
+        }
+    }
+}
+
+template <typename Op>
+static void FilterTilesWith(const Op& op, ThreadPool* pool, const TiledDepth& src, TiledDepth& dst)
+{
+    if (pool && pool->Size() > 1) {
+        pool->ParallelFor(src.TilesY(), [&](int ty) { FilterTileRow(op, src, dst, ty); });
+        return;
+    }
+    for (int ty = 0; ty < src.TilesY(); ty++)
+        FilterTileRow(op, src, dst, ty);
+}
+
+static const BilateralOp& Bilateral()
+{
+    static const BilateralOp op;
+    return op;
+}
+
+void FilterDepthRows(DepthFilter filter, ThreadPool* pool, const uint16_t* src, int srcStride,
+                     uint16_t* dst, int dstStride, int width, int height)
+{
+    switch (filter) {
+    case DepthFilter::None:
+        for (int y = 0; y < height; y++)
+            std::memcpy(Row(dst, dstStride, y), Row(src, srcStride, y), width * sizeof(uint16_t));
+        break;
+    case DepthFilter::Median:
+        FilterRowsWith(MedianOp(), pool, src, srcStride, dst, dstStride, width, height);
+        break;
+    case DepthFilter::Bilateral:
+        FilterRowsWith(Bilateral(), pool, src, srcStride, dst, dstStride, width, height);
+        break;
+    case DepthFilter::Sobel:
+        FilterRowsWith(SobelOp(), pool, src, srcStride, dst, dstStride, width, height);
+        break;
+    }
+}
+
+void FilterDepthTiles(DepthFilter filter, ThreadPool* pool, const TiledDepth& src, TiledDepth& dst)
+{
+    dst.Resize(src.Width(), src.Height(), src.Tile());
+    switch (filter) {
+    case DepthFilter::None:
+        dst = src;
+        break;
+    case DepthFilter::Median:
+        FilterTilesWith(MedianOp(), pool, src, dst);
+        break;
+    case DepthFilter::Bilateral:
+        FilterTilesWith(Bilateral(), pool, src, dst);
+        break;
+    case DepthFilter::Sobel:
+        FilterTilesWith(SobelOp(), pool, src, dst);
+        break;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Pipeline stage
+// ---------------------------------------------------------------------------
+
+DepthFilterStage::DepthFilterStage(DepthFilter filter, DepthLayout layout, int width, int height)
+    : filter(filter), layout(layout), width(width), height(height)
+{
+    if (layout == DepthLayout::Rows) {
+        scratch.resize(static_cast<size_t>(width) * height);
+    } else {
+        tiledIn.Resize(width, height, TileSize(layout));
+        tiledOut.Resize(width, height, TileSize(layout));
+    }
+}
+
+void DepthFilterStage::Apply(ThreadPool* pool, uint16_t* depth, int stride)
+{
+    if (filter == DepthFilter::None)
+        return;
+    if (layout == DepthLayout::Rows) {
+        FilterDepthRows(filter, pool, depth, stride, scratch.data(), width * 2, width, height);
+        for (int y = 0; y < height; y++)
+            std::memcpy(Row(depth, stride, y), scratch.data() + static_cast<size_t>(y) * width, width * 2);
+        return;
+    }
+    tiledIn.FromRows(pool, depth, stride);
+    FilterDepthTiles(filter, pool, tiledIn, tiledOut);
+    tiledOut.ToRows(pool, depth, stride);
+}
+
+// ---------------------------------------------------------------------------
+// Benchmark
+// ---------------------------------------------------------------------------
+
+void BenchmarkDepthFilters(ThreadPool& pool, int width, int height, std::string& report)
+{
+    // Smooth surfaces with steps, noise and holes, like a room in raw depth.
+    std::vector<uint16_t> depth(static_cast<size_t>(width) * height);
+    uint32_t noise = 12345;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            noise = noise * 1664525u + 1013904223u;
+            int value = 600 + (x * 300) / width + ((x / 80 + y / 60) % 3) * 60 + static_cast<int>(noise >> 29);
+            if ((noise >> 20) % 50 == 0)
+                value = kRawDepthInvalid;
+            depth[static_cast<size_t>(y) * width + x] = static_cast<uint16_t>(value);
+        }
+    }
+    std::vector<uint16_t> rowsOut(depth.size());
+    std::vector<uint16_t> tiledBack(depth.size());
+    const DepthLayout layouts[] = { DepthLayout::Tiled8, DepthLayout::Tiled16 };
+
+    // The header's numbers have no fixed width, so it is not formatted
+    // into `line`.
+    report = "Depth filters on " + std::to_string(width) + "x" + std::to_string(height) +
+             " (ms per frame, 1 thread / " + std::to_string(pool.Size()) + " threads; tiled times include\n"
+             "converting in and out of the layout):\n"
+             "  filter                  rows            tiled8           tiled16  fastest\n";
+    char line[200];
+    for (int tile : { 8, 16 }) {
+        TiledDepth in;
+        in.Resize(width, height, tile);
+        double oneMs[2];
+        for (int threads = 0; threads < 2; threads++) {
+            ThreadPool* workers = threads ? &pool : nullptr;
+            oneMs[threads] = MeasureMs([&] {
+                in.FromRows(workers, depth.data(), width * 2);
+                in.ToRows(workers, tiledBack.data(), width * 2);
+            });
+        }
+        std::snprintf(line, sizeof(line), "  layout conversion %2dx%-2d in + out %6.3f / %6.3f\n", tile, tile,
+                      oneMs[0], oneMs[1]);
+        report += line;
+    }
+
+    bool identical = true;
+    for (DepthFilter filter : { DepthFilter::Median, DepthFilter::Bilateral, DepthFilter::Sobel }) {
+        double ms[3][2];
+        for (int threads = 0; threads < 2; threads++) {
+            ThreadPool* workers = threads ? &pool : nullptr;
+            ms[0][threads] = MeasureMs([&] {
+                FilterDepthRows(filter, workers, depth.data(), width * 2, rowsOut.data(), width * 2, width, height);
+            });
+            for (int i = 0; i < 2; i++) {
+                TiledDepth in;
+                TiledDepth out;
+                in.Resize(width, height, TileSize(layouts[i]));
+                ms[i + 1][threads] = MeasureMs([&] {
+                    in.FromRows(workers, depth.data(), width * 2);
+                    FilterDepthTiles(filter, workers, in, out);
+                    out.ToRows(workers, tiledBack.data(), width * 2);
+                });
+                // Same pixels whatever the layout.
+                if (tiledBack != rowsOut)
+                    identical = false;
+            }
+        }
+        int fastest = 0;
+        for (int i = 1; i < 3; i++) {
+            if (std::min(ms[i][0], ms[i][1]) < std::min(ms[fastest][0], ms[fastest][1]))
+                fastest = i;
+        }
+        std::snprintf(line, sizeof(line), "  %-10s %8.3f / %6.3f %8.3f / %6.3f %8.3f / %6.3f  %s\n",
+                      DepthFilterName(filter), ms[0][0], ms[0][1], ms[1][0], ms[1][1], ms[2][0], ms[2][1],
+                      DepthLayoutName(static_cast<DepthLayout>(fastest)));
+        report += line;
+    }
+    if (!identical)
+        report += "  WARNING: tiled and row-major output differ.\n";
+}
+
+} // namespace kndi
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "thread_pool.h"
+
+namespace kndi {
+
+// Neighbourhood filters on raw 11-bit depth. Frame borders are extended by
+// repeating the edge pixels.
+enum class DepthFilter {
+    None,
+    Median,      // 3x3 median; no reading (kRawDepthInvalid) counts as far,
+                 // so speckle is removed and isolated holes are filled.
+    Bilateral,   // 5x5 edge-preserving smoothing over the valid neighbours;
+                 // pixels with no reading stay that way.
+    Sobel        // 3x3 gradient magnitude |gx| + |gy|, for edge detection.
+};
+
+// How a filter walks the depth image. Row-major is the libfreenect layout;
+// the tiled layouts keep each 8x8 or 16x16 block contiguous, so a filter's
+// vertical neighbours are a few hundred bytes away instead of a row apart.
+enum class DepthLayout { Rows, Tiled8, Tiled16 };
+
+// "none", "median", "bilateral" or "sobel".
+bool ParseDepthFilter(const std::string& name, DepthFilter& out);
+const char* DepthFilterName(DepthFilter filter);
+// "rows", "tiled8" or "tiled16".
+bool ParseDepthLayout(const std::string& name, DepthLayout& out);
+const char* DepthLayoutName(DepthLayout layout);
+
+// Depth image stored as square tiles of `tile` pixels, tiles in row-major
+// order and pixels row-major within a tile. Partial tiles at the right and
+// bottom edges are padded to full size.
+class TiledDepth {
+public:
+    TiledDepth() : width(0), height(0), tile(0), tilesX(0), tilesY(0) {}
+
+    void Resize(int width, int height, int tile);
+
+    int Width() const { return width; }
+    int Height() const { return height; }
+    int Tile() const { return tile; }
+    int TilesX() const { return tilesX; }
+    int TilesY() const { return tilesY; }
+
+    uint16_t* TileAt(int tx, int ty) { return samples.data() + (static_cast<size_t>(ty) * tilesX + tx) * tile * tile; }
+    const uint16_t* TileAt(int tx, int ty) const
+    {
+        return samples.data() + (static_cast<size_t>(ty) * tilesX + tx) * tile * tile;
+    }
+
+    // Convert from and to a row-major image (`stride` in bytes), one row of
+    // tiles per work item on `pool` (may be nullptr).
+    void FromRows(ThreadPool* pool, const uint16_t* src, int stride);
+    void ToRows(ThreadPool* pool, uint16_t* dst, int stride) const;
+
+private:
+    int width;
+    int height;
+    int tile;
+    int tilesX;
+    int tilesY;
+    std::vector<uint16_t> samples;
+};
+
+// Filter a row-major image into `dst` (same size, strides in bytes), in row
+// bands on `pool`.
+void FilterDepthRows(DepthFilter filter, ThreadPool* pool, const uint16_t* src, int srcStride,
+                     uint16_t* dst, int dstStride, int width, int height);
+// Filter a tiled image into `dst`, resized to match; one row of tiles per
+// work item on `pool`.
+void FilterDepthTiles(DepthFilter filter, ThreadPool* pool, const TiledDepth& src, TiledDepth& dst);
+
+// Depth filter stage of the pipeline: filters a depth frame in place using
+// the chosen layout, with scratch buffers sized once.
+class DepthFilterStage {
+public:
+    DepthFilterStage(DepthFilter filter, DepthLayout layout, int width, int height);
+
+    DepthFilter Filter() const { return filter; }
+    DepthLayout Layout() const { return layout; }
+
+    // `depth` is width x height samples, `stride` bytes apart.
+    void Apply(ThreadPool* pool, uint16_t* depth, int stride);
+
+private:
+    DepthFilter filter;
+    DepthLayout layout;
+    int width;
+    int height;
+    std::vector<uint16_t> scratch;   // Row-major output.
+    TiledDepth tiledIn;
+    TiledDepth tiledOut;
+};
+
+// Time every filter in every layout on a synthetic frame of this size (one
+// thread, then `pool`), including the conversions in and out of the tiled
+// layouts, and describe the results in `report`.
+void BenchmarkDepthFilters(ThreadPool& pool, int width, int height, std::string& report);
+
+} // namespace kndi
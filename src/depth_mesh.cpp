@@ -0,0 +1,306 @@
+#include "depth_mesh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+
+#include "camera_model.h"
+#include "depth_units.h"
+#include "kinect_ndi.h"
+
+namespace kndi {
+
+constexpr int DepthMesher::kCell;
+constexpr int DepthMesher::kTileCells;
+
+// Quadtree levels per tile: cells of 1, 2, 4 and 8 (= kTileCells) cells.
+static constexpr int kLevels = 4;
+static constexpr int kTileVertices = (DepthMesher::kTileCells + 1) * (DepthMesher::kTileCells + 1);
+static constexpr int kTileLeaves = DepthMesher::kTileCells * DepthMesher::kTileCells;
+// A leaf of n x n cells is at most 2n^2 triangles: two per base cell, or
+// a fan over at most 4n edge vertices.
+static constexpr int kTileTriangles = 2 * kTileLeaves;
+
+// Run `fn(i)` for i in [0, count), on `pool` if it has workers.
+template <typename F>
+static void ForEach(ThreadPool* pool, int count, F fn)
+{
+    if (pool && pool->Size() > 1)
+        pool->ParallelFor(count, fn);
+    else
+        for (int i = 0; i < count; i++)
+            fn(i);
+}
+
+DepthMesher::DepthMesher(const MeshSettings& settings, int width, int height)
+    : settings(settings), width(width), height(height), cellsX((width - 1) / kCell), cellsY((height - 1) / kCell),
+      gridWidth(cellsX + 1), gridHeight(cellsY + 1), tilesX((cellsX + kTileCells - 1) / kTileCells),
+      tilesY((cellsY + kTileCells - 1) / kTileCells)
+{
+    // Vertex indices are 16-bit: 19200 grid vertices at 640x480.
+    size_t vertices = static_cast<size_t>(gridWidth) * gridHeight;
+    Intrinsics intrinsics = KinectDepthIntrinsics(width, height);
+    rayX.resize(vertices);
+    rayY.resize(vertices);
+    for (int gy = 0; gy < gridHeight; gy++) {
+        for (int gx = 0; gx < gridWidth; gx++) {
+            rayX[gy * gridWidth + gx] = (gx * kCell - intrinsics.cx) / intrinsics.fx;
+            rayY[gy * gridWidth + gx] = (gy * kCell - intrinsics.cy) / intrinsics.fy;
+        }
+    }
+    samples.assign(vertices, kRawDepthInvalid);
+    mm.assign(vertices, 0);
+    used.assign(vertices, 0);
+    index.assign(vertices, 0);
+    size_t tiles = static_cast<size_t>(tilesX) * tilesY;
+    tileSamples.assign(tiles * kTileVertices, 0);
+    tileBuilt.assign(tiles, 0);
+    leaves.assign(tiles * kTileLeaves, Leaf());
+    leafCounts.assign(tiles, 0);
+    triangles.assign(tiles * kTileTriangles * 3, 0);
+    triangleCounts.assign(tiles, 0);
+}
+
+size_t DepthMesher::MaxBytes() const
+{
+    return sizeof(kndi_mesh_header) + samples.size() * 3 * sizeof(int16_t) +
+           static_cast<size_t>(cellsX) * cellsY * 2 * 3 * sizeof(uint16_t);
+}
+
+void DepthMesher::SampleRows(const uint16_t* depth, int stride, int firstRow, int rows)
+{
+    const uint16_t* millimetres = RawDepthToMillimetres();
+    for (int gy = firstRow; gy < firstRow + rows; gy++) {
+        const uint16_t* row = reinterpret_cast<const uint16_t*>(
+            reinterpret_cast<const uint8_t*>(depth) + static_cast<size_t>(gy) * kCell * stride);
+        for (int gx = 0; gx < gridWidth; gx++) {
+            uint16_t raw = row[gx * kCell] & 2047;
+            samples[gy * gridWidth + gx] = raw;
+            mm[gy * gridWidth + gx] = millimetres[raw];
+        }
+    }
+}
+
+bool DepthMesher::Flat(int x, int y, int size) const
+{
+    // Compare size^2 * sample with the bilinear fit of the corners, in
+    // integers.
+    const uint16_t* corner = samples.data() + static_cast<size_t>(y) * gridWidth + x;
+    int z00 = corner[0];
+    int z10 = corner[size];
+    int z01 = corner[size * gridWidth];
+    int z11 = corner[size * gridWidth + size];
+    int limit = settings.tolerance * size * size;
+    for (int j = 0; j <= size; j++) {
+        const uint16_t* row = corner + static_cast<size_t>(j) * gridWidth;
+        for (int i = 0; i <= size; i++) {
+            int fit = (z00 * (size - i) + z10 * i) * (size - j) + (z01 * (size - i) + z11 * i) * j;
+            if (std::abs(row[i] * size * size - fit) > limit)
+                return false;
+        }
+    }
+    return true;
+}
+
+// Leaves of the quadtree below cell (cx, cy) of `level`: the largest solid
+// cells, and every base cell of the tile otherwise.
+template <typename F>
+static void EmitLeaves(const uint8_t solid[kLevels][DepthMesher::kTileCells][DepthMesher::kTileCells], int level,
+                       int cx, int cy, int cellsX, int cellsY, F emit)
+{
+    int size = 1 << level;
+    if (cx * size >= cellsX || cy * size >= cellsY)
+        return;
+    if (level == 0 || solid[level][cy][cx]) {
+        emit(cx * size, cy * size, size);
+        return;
+    }
+    for (int child = 0; child < 4; child++)
+        EmitLeaves(solid, level - 1, cx * 2 + (child & 1), cy * 2 + (child >> 1), cellsX, cellsY, emit);
+}
+
+void DepthMesher::MergeTile(int tile)
+{
+    int x0 = (tile % tilesX) * kTileCells;
+    int y0 = (tile / tilesX) * kTileCells;
+    int nx = std::min(kTileCells, cellsX - x0);
+    int ny = std::min(kTileCells, cellsY - y0);
+    uint16_t* kept = tileSamples.data() + static_cast<size_t>(tile) * kTileVertices;
+
+    if (tileBuilt[tile]) {
+        bool moved = false;
+        for (int j = 0; j <= ny && !moved; j++) {
+            const uint16_t* row = samples.data() + static_cast<size_t>(y0 + j) * gridWidth + x0;
+            for (int i = 0; i <= nx; i++) {
+                uint16_t before = kept[j * (kTileCells + 1) + i];
+                bool validNow = row[i] != kRawDepthInvalid;
+                bool validBefore = before != kRawDepthInvalid;
+                if (validNow != validBefore || std::abs(row[i] - before) > settings.tolerance) {
+                    moved = true;
+                    break;
+                }
+            }
+        }
+        if (!moved)
+            return;
+    }
+    for (int j = 0; j <= ny; j++) {
+        const uint16_t* row = samples.data() + static_cast<size_t>(y0 + j) * gridWidth + x0;
+        std::memcpy(kept + j * (kTileCells + 1), row, (nx + 1) * sizeof(uint16_t));
+    }
+
+    // A base cell is solid when all its corners have a reading; a larger
+    // one when its four children are solid and the depth under it is flat.
+    uint8_t solid[kLevels][kTileCells][kTileCells];
+    std::memset(solid, 0, sizeof(solid));
+    for (int cy = 0; cy < ny; cy++) {
+        for (int cx = 0; cx < nx; cx++) {
+            size_t at = static_cast<size_t>(y0 + cy) * gridWidth + x0 + cx;
+            solid[0][cy][cx] = mm[at] && mm[at + 1] && mm[at + gridWidth] && mm[at + gridWidth + 1];
+        }
+    }
+    for (int level = 1; level < kLevels && settings.tolerance > 0; level++) {
+        int size = 1 << level;
+        for (int cy = 0; (cy + 1) * size <= ny; cy++) {
+            for (int cx = 0; (cx + 1) * size <= nx; cx++) {
+                const uint8_t (*children)[kTileCells] = solid[level - 1];
+                solid[level][cy][cx] = children[cy * 2][cx * 2] && children[cy * 2][cx * 2 + 1] &&
+                                       children[cy * 2 + 1][cx * 2] && children[cy * 2 + 1][cx * 2 + 1] &&
+                                       Flat(x0 + cx * size, y0 + cy * size, size);
+            }
+        }
+    }
+
+    Leaf* out = leaves.data() + static_cast<size_t>(tile) * kTileLeaves;
+    int count = 0;
+    EmitLeaves(solid, kLevels - 1, 0, 0, nx, ny, [&](int x, int y, int size) {
+        Leaf leaf = { static_cast<uint16_t>(x0 + x), static_cast<uint16_t>(y0 + y), static_cast<uint16_t>(size) };
+        out[count++] = leaf;
+    });
+    leafCounts[tile] = count;
+    tileBuilt[tile] = 1;
+}
+
+int DepthMesher::TriangulateTile(int tile)
+{
+    const Leaf* tileLeaves = leaves.data() + static_cast<size_t>(tile) * kTileLeaves;
+    uint16_t* out = triangles.data() + static_cast<size_t>(tile) * kTileTriangles * 3;
+    int count = 0;
+    // Base cells may straddle an edge between objects; drop their
+    // triangles that do, or that lack a reading.
+    auto addChecked = [&](size_t a, size_t b, size_t c) {
+        if (!used[a] || !used[b] || !used[c])
+            return;
+        int nearest = std::min(mm[a], std::min(mm[b], mm[c]));
+        int farthest = std::max(mm[a], std::max(mm[b], mm[c]));
+        if (farthest - nearest > settings.maxJump * nearest)
+            return;
+        out[count * 3 + 0] = index[a];
+        out[count * 3 + 1] = index[b];
+        out[count * 3 + 2] = index[c];
+        count++;
+    };
+    for (int l = 0; l < leafCounts[tile]; l++) {
+        const Leaf& leaf = tileLeaves[l];
+        size_t c0 = static_cast<size_t>(leaf.y) * gridWidth + leaf.x;
+        size_t c1 = c0 + leaf.size;
+        size_t c2 = c1 + static_cast<size_t>(leaf.size) * gridWidth;
+        size_t c3 = c0 + static_cast<size_t>(leaf.size) * gridWidth;
+        if (leaf.size == 1) {
+            // Split along the diagonal with the smaller depth step, or the
+            // one whose ends both have a reading.
+            bool diagonal02 = used[c0] && used[c2];
+            bool diagonal13 = used[c1] && used[c3];
+            bool along02 = diagonal02 && (!diagonal13 || std::abs(mm[c0] - mm[c2]) <= std::abs(mm[c1] - mm[c3]));
+            if (along02) {
+                addChecked(c0, c1, c2);
+                addChecked(c0, c2, c3);
+            } else {
+                addChecked(c0, c1, c3);
+                addChecked(c1, c2, c3);
+            }
+            continue;
+        }
+        // Flat, and every vertex has a reading: fan from the centre round
+        // the corners and the vertices smaller neighbours put on the edges.
+        size_t centre = c0 + static_cast<size_t>(leaf.size / 2) * (gridWidth + 1);
+        uint16_t previous = index[c0];
+        auto fanTo = [&](size_t vertex) {
+            out[count * 3 + 0] = index[centre];
+            out[count * 3 + 1] = previous;
+            out[count * 3 + 2] = index[vertex];
+            previous = index[vertex];
+            count++;
+        };
+        const size_t corners[4] = { c0, c1, c2, c3 };
+        const std::ptrdiff_t steps[4] = { 1, gridWidth, -1, -gridWidth };
+        for (int edge = 0; edge < 4; edge++) {
+            for (int k = 1; k < leaf.size; k++) {
+                size_t vertex = corners[edge] + k * steps[edge];
+                if (used[vertex])
+                    fanTo(vertex);
+            }
+            fanTo(corners[(edge + 1) % 4]);
+        }
+    }
+    return count;
+}
+
+size_t DepthMesher::Build(ThreadPool* pool, const uint16_t* depth, int stride, uint8_t* out)
+{
+    int bands = pool ? std::min(pool->Size(), gridHeight) : 1;
+    int rowsPerBand = (gridHeight + bands - 1) / bands;
+    ForEach(pool, bands, [&](int band) {
+        int first = band * rowsPerBand;
+        int rows = std::min(rowsPerBand, gridHeight - first);
+        if (rows > 0)
+            SampleRows(depth, stride, first, rows);
+    });
+    int tiles = tilesX * tilesY;
+    ForEach(pool, tiles, [&](int tile) { MergeTile(tile); });
+
+    // Vertices: every leaf corner with a reading, numbered in grid order.
+    std::fill(used.begin(), used.end(), 0);
+    for (int tile = 0; tile < tiles; tile++) {
+        const Leaf* tileLeaves = leaves.data() + static_cast<size_t>(tile) * kTileLeaves;
+        for (int l = 0; l < leafCounts[tile]; l++) {
+            const Leaf& leaf = tileLeaves[l];
+            size_t c0 = static_cast<size_t>(leaf.y) * gridWidth + leaf.x;
+            size_t corners[4] = { c0, c0 + leaf.size, c0 + static_cast<size_t>(leaf.size) * gridWidth,
+                                  c0 + static_cast<size_t>(leaf.size) * (gridWidth + 1) };
+            for (size_t corner : corners)
+                used[corner] = mm[corner] != 0;
+            if (leaf.size > 1)
+                used[c0 + static_cast<size_t>(leaf.size / 2) * (gridWidth + 1)] = 1;
+        }
+    }
+    kndi_mesh_header header;
+    int16_t* vertices = reinterpret_cast<int16_t*>(out + sizeof(header));
+    uint16_t count = 0;
+    for (size_t i = 0; i < used.size(); i++) {
+        if (!used[i])
+            continue;
+        float z = mm[i];
+        vertices[count * 3 + 0] = static_cast<int16_t>(std::lround(rayX[i] * z));
+        vertices[count * 3 + 1] = static_cast<int16_t>(std::lround(rayY[i] * z));
+        vertices[count * 3 + 2] = static_cast<int16_t>(mm[i]);
+        index[i] = count++;
+    }
+
+    ForEach(pool, tiles, [&](int tile) { triangleCounts[tile] = TriangulateTile(tile); });
+    uint8_t* indices = out + sizeof(header) + static_cast<size_t>(count) * 3 * sizeof(int16_t);
+    size_t written = 0;
+    for (int tile = 0; tile < tiles; tile++) {
+        size_t bytes = static_cast<size_t>(triangleCounts[tile]) * 3 * sizeof(uint16_t);
+        std::memcpy(indices + written, triangles.data() + static_cast<size_t>(tile) * kTileTriangles * 3, bytes);
+        written += bytes;
+    }
+    header.vertex_count = count;
+    header.triangle_count = static_cast<uint32_t>(written / (3 * sizeof(uint16_t)));
+    std::memcpy(out, &header, sizeof(header));
+    return static_cast<size_t>(indices - out) + written;
+}
+
+} // namespace kndi
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "thread_pool.h"
+
+namespace kndi {
+
+struct MeshSettings {
+    // Most a merged cell's raw disparity may stray from the bilinear fit of
+    // its corners. Planes in space are planes in disparity, so this is the
+    // flatness test; 0 keeps the full grid.
+    int tolerance = 2;
+    // Depth difference within a triangle, as a share of its distance, that
+    // is taken as an edge between objects; such triangles are dropped.
+    float maxJump = 0.05f;
+};
+
+// Triangle mesh of raw depth frames, in the layout of KNDI_STREAM_MESH: a
+// kndi_mesh_header, int16 x, y, z per vertex (millimetres, depth camera
+// space) and three uint16 vertex indices per triangle.
+//
+// Vertices sit on a grid of one pixel in kCell x kCell. The grid is split
+// into tiles of kTileCells x kTileCells cells, and within each tile a
+// quadtree merges 2x2 groups of cells into one while the depth they cover
+// is flat, up to the whole tile; merged cells are fanned from their centre
+// through every vertex on their edges, so neighbours of different size meet
+// without cracks. A tile whose samples all stay within `tolerance` of the
+// frame it was last merged on keeps its quadtree, so sensor noise neither
+// costs the merge again nor makes a still scene's triangles flicker.
+// Tiles run in parallel; every buffer is allocated in the constructor.
+class DepthMesher {
+public:
+    static constexpr int kCell = 4;
+    static constexpr int kTileCells = 8;
+
+    DepthMesher(const MeshSettings& settings, int width, int height);
+
+    const MeshSettings& Settings() const { return settings; }
+    // Largest mesh, header included, in bytes.
+    size_t MaxBytes() const;
+
+    // Mesh a width x height raw depth frame (`stride` in bytes) into `out`,
+    // at least MaxBytes() long. Returns the bytes written. Tiles run on
+    // `pool` (may be nullptr). Not thread safe.
+    size_t Build(ThreadPool* pool, const uint16_t* depth, int stride, uint8_t* out);
+
+private:
+    // A leaf of a tile's quadtree: a square of `size` cells at grid vertex
+    // (x, y).
+    struct Leaf {
+        uint16_t x, y;
+        uint16_t size;
+    };
+
+    // Sample the grid rows [firstRow, firstRow + rows).
+    void SampleRows(const uint16_t* depth, int stride, int firstRow, int rows);
+    // Rebuild the quadtree of `tile` if its samples moved.
+    void MergeTile(int tile);
+    // Emit the triangles of `tile`'s leaves; returns how many.
+    int TriangulateTile(int tile);
+    bool Flat(int x, int y, int size) const;
+
+    MeshSettings settings;
+    int width;
+    int height;
+    int cellsX;
+    int cellsY;
+    int gridWidth;                    // cellsX + 1 vertices per grid row.
+    int gridHeight;
+    int tilesX;
+    int tilesY;
+    std::vector<float> rayX;          // Per grid vertex: x / z and y / z.
+    std::vector<float> rayY;
+    std::vector<uint16_t> samples;    // Raw disparity per grid vertex.
+    std::vector<uint16_t> mm;         // Millimetres per grid vertex; 0 for no reading.
+    std::vector<uint8_t> used;        // Grid vertex is a leaf corner with a reading.
+    std::vector<uint16_t> index;      // Its vertex index in the output.
+    // Per tile: the samples its quadtree was built from, its leaves and its
+    // triangles, at fixed capacities.
+    std::vector<uint16_t> tileSamples;
+    std::vector<uint8_t> tileBuilt;
+    std::vector<Leaf> leaves;
+    std::vector<int> leafCounts;
+    std::vector<uint16_t> triangles;
+    std::vector<int> triangleCounts;
+};
+
+} // namespace kndi
@@ -0,0 +1,760 @@
+#include "depth_server.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include "depth_codec.h"
+#include "flight_recorder.h"
+
+#ifdef __linux__
+  #include <arpa/inet.h>
+  #include <errno.h>
+  #include <fcntl.h>
+  #include <netdb.h>
+  #include <netinet/in.h>
+  #include <netinet/tcp.h>
+  #include <pthread.h>
+  #include <sys/epoll.h>
+  #include <sys/eventfd.h>
+  #include <sys/socket.h>
+  #include <sys/uio.h>
+  #include <sys/un.h>
+  #include <time.h>
+  #include <unistd.h>
+#endif
+
+namespace kndi {
+
+// Frames a packet can be shared by at once: one per subscriber mid-frame
+// and the newest of each stream, beyond which frames are dropped for all.
+static constexpr size_t kPackets = 8;
+// A subscriber that takes no bytes for this long is disconnected.
+static constexpr int64_t kStallTimeoutNs = 2000000000;
+
+static int64_t NowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static size_t PayloadCapacity(size_t pixels, bool compress)
+{
+    return compress ? MaxCompressedDepthBytes(pixels) : pixels * sizeof(uint16_t);
+}
+
+#ifdef __linux__
+
+// Tags for the server's own descriptors in epoll events; clients are tagged
+// with their Client.
+static char listenTag;
+static char wakeTag;
+
+static int ListenUnix(const std::string& path)
+{
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Depth server: invalid socket path \"" << path << "\"." << std::endl;
+        return -1;
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    // A socket file left behind by an earlier run would make bind() fail.
+    unlink(path.c_str());
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+        std::cerr << "Depth server: cannot listen on " << path << ": " << std::strerror(errno) << std::endl;
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int ListenTcp(const std::string& host, const std::string& port)
+{
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+    addrinfo* found = nullptr;
+    int error = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &found);
+    if (error != 0) {
+        std::cerr << "Depth server: cannot resolve " << host << ":" << port << ": " << gai_strerror(error)
+                  << std::endl;
+        return -1;
+    }
+    int fd = -1;
+    for (addrinfo* info = found; info && fd < 0; info = info->ai_next) {
+        fd = socket(info->ai_family, info->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, info->ai_protocol);
+        if (fd < 0)
+            continue;
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(fd, info->ai_addr, info->ai_addrlen) != 0 || listen(fd, 16) != 0) {
+            error = errno;
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(found);
+    if (fd < 0)
+        std::cerr << "Depth server: cannot listen on " << host << ":" << port << ": " << std::strerror(error)
+                  << std::endl;
+    return fd;
+}
+
+DepthServer* DepthServer::Create(unsigned streams, const std::string& address, bool compress)
+{
+    int listenFd = -1;
+    std::string unixPath;
+    if (address.compare(0, 5, "unix:") == 0) {
+        unixPath = address.substr(5);
+        listenFd = ListenUnix(unixPath);
+    } else {
+        // "tcp:port", "tcp:host:port" or the same without "tcp:". Loopback
+        // unless a host is given: subscribers are meant to be local.
+        std::string rest = address.compare(0, 4, "tcp:") == 0 ? address.substr(4) : address;
+        size_t colon = rest.rfind(':');
+        std::string host = colon == std::string::npos ? "127.0.0.1" : rest.substr(0, colon);
+        std::string port = colon == std::string::npos ? rest : rest.substr(colon + 1);
+        if (host.size() > 2 && host.front() == '[' && host.back() == ']')
+            host = host.substr(1, host.size() - 2);
+        if (host == "*")
+            host.clear();
+        listenFd = ListenTcp(host, port);
+    }
+    if (listenFd < 0)
+        return nullptr;
+
+    int wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event listenEvent;
+    listenEvent.events = EPOLLIN;
+    listenEvent.data.ptr = &listenTag;
+    epoll_event wakeEvent;
+    wakeEvent.events = EPOLLIN;
+    wakeEvent.data.ptr = &wakeTag;
+    if (wakeFd < 0 || epollFd < 0 || epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &listenEvent) != 0 ||
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &wakeEvent) != 0) {
+        std::cerr << "Depth server: cannot set up epoll: " << std::strerror(errno) << std::endl;
+        if (wakeFd >= 0)
+            close(wakeFd);
+        if (epollFd >= 0)
+            close(epollFd);
+        close(listenFd);
+        if (!unixPath.empty())
+            unlink(unixPath.c_str());
+        return nullptr;
+    }
+    return new DepthServer(streams, compress, listenFd, wakeFd, epollFd, unixPath);
+}
+
+DepthServer::DepthServer(unsigned streams, bool compress, int listenFd, int wakeFd, int epollFd,
+                         const std::string& unixPath)
+    : streams(streams), compress(compress), listenFd(listenFd), wakeFd(wakeFd), epollFd(epollFd),
+      unixPath(unixPath), published(0), subscribers(0), framesSent(0), framesSkipped(0),
+      packetsExhausted(0), stopping(false)
+{
+    thread = std::thread(&DepthServer::ServerLoop, this);
+}
+
+DepthServer::~DepthServer()
+{
+    stopping = true;
+    uint64_t one = 1;
+    if (write(wakeFd, &one, sizeof(one)) < 0) {
+        // The counter cannot overflow; the loop also wakes on its own.
+    }
+    thread.join();
+    for (std::unique_ptr<Client>& client : clients) {
+        if (client->fd >= 0)
+            Close(*client, "server closed");
+    }
+    close(epollFd);
+    close(wakeFd);
+    close(listenFd);
+    if (!unixPath.empty())
+        unlink(unixPath.c_str());
+}
+
+void DepthServer::Accept()
+{
+    for (;;) {
+        sockaddr_storage addr;
+        socklen_t length = sizeof(addr);
+        int fd = accept4(listenFd, reinterpret_cast<sockaddr*>(&addr), &length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            // EAGAIN: nothing left to accept; anything else (out of
+            // descriptors) is retried on the next wake-up.
+            return;
+        }
+        std::unique_ptr<Client> client(new Client);
+        client->fd = fd;
+        client->sent = 0;
+        client->skipped = 0;
+        client->frames = 0;
+        client->progressNs = NowNs();
+        client->watchingWrites = false;
+        char name[INET6_ADDRSTRLEN] = "local";
+        if (addr.ss_family == AF_INET || addr.ss_family == AF_INET6) {
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            const void* ip = addr.ss_family == AF_INET
+                                 ? static_cast<const void*>(&reinterpret_cast<sockaddr_in*>(&addr)->sin_addr)
+                                 : static_cast<const void*>(&reinterpret_cast<sockaddr_in6*>(&addr)->sin6_addr);
+            inet_ntop(addr.ss_family, ip, name, sizeof(name));
+            uint16_t port = ntohs(addr.ss_family == AF_INET ? reinterpret_cast<sockaddr_in*>(&addr)->sin_port
+                                                            : reinterpret_cast<sockaddr_in6*>(&addr)->sin6_port);
+            client->peer = std::string(name) + ":" + std::to_string(port);
+        } else {
+            client->peer = name;
+        }
+        {
+            // Start with the next frame published, not one already sent out.
+            std::lock_guard<std::mutex> lock(mutex);
+            client->lastSerial = published;
+        }
+        epoll_event event;
+        event.events = EPOLLIN | EPOLLRDHUP;
+        event.data.ptr = client.get();
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            close(fd);
+            continue;
+        }
+        std::cerr << "Depth server: subscriber " << client->peer << " connected." << std::endl;
+        clients.push_back(std::move(client));
+        subscribers++;
+    }
+}
+
+void DepthServer::TakeNext(Client& client, int64_t nowNs)
+{
+    // Frames of both streams are offered in publication order; a subscriber
+    // that fell behind gets the newest of each.
+    std::shared_ptr<Packet>* next = nullptr;
+    for (std::shared_ptr<Packet>& packet : latest) {
+        if (packet && packet->serial > client.lastSerial && (!next || packet->serial < (*next)->serial))
+            next = &packet;
+    }
+    if (!next)
+        return;
+    uint64_t passed = (*next)->serial - client.lastSerial - 1;
+    client.skipped += passed;
+    framesSkipped += passed;
+    client.current = *next;
+    client.sent = 0;
+    client.lastSerial = (*next)->serial;
+    client.progressNs = nowNs;
+}
+
+void DepthServer::WatchWrites(Client& client, bool watch)
+{
+    if (client.watchingWrites == watch)
+        return;
+    epoll_event event;
+    event.events = EPOLLIN | EPOLLRDHUP;
+    if (watch)
+        event.events |= EPOLLOUT;
+    event.data.ptr = &client;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, client.fd, &event);
+    client.watchingWrites = watch;
+}
+
+bool DepthServer::Flush(Client& client, int64_t nowNs)
+{
+    while (client.current) {
+        const Packet& packet = *client.current;
+        const size_t headerBytes = sizeof(packet.header);
+        const size_t total = headerBytes + packet.header.payloadBytes;
+        // Header and payload go out together from the shared packet.
+        iovec parts[2];
+        int count = 0;
+        if (client.sent < headerBytes) {
+            parts[count].iov_base = const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(&packet.header)) + client.sent;
+            parts[count++].iov_len = headerBytes - client.sent;
+            parts[count].iov_base = const_cast<uint8_t*>(packet.payload.data());
+            parts[count++].iov_len = packet.header.payloadBytes;
+        } else {
+            parts[count].iov_base = const_cast<uint8_t*>(packet.payload.data()) + (client.sent - headerBytes);
+            parts[count++].iov_len = total - client.sent;
+        }
+        msghdr message;
+        std::memset(&message, 0, sizeof(message));
+        message.msg_iov = parts;
+        message.msg_iovlen = count;
+        // sendmsg() rather than writev() for MSG_NOSIGNAL: a subscriber
+        // going away must not raise SIGPIPE in the host process.
+        ssize_t written = sendmsg(client.fd, &message, MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                WatchWrites(client, true);
+                return true;
+            }
+            return false;
+        }
+        client.sent += static_cast<size_t>(written);
+        client.progressNs = nowNs;
+        if (client.sent < total)
+            continue;
+        client.frames++;
+        framesSent++;
+        std::lock_guard<std::mutex> lock(mutex);
+        client.current.reset();
+        TakeNext(client, nowNs);
+    }
+    WatchWrites(client, false);
+    return true;
+}
+
+void DepthServer::Close(Client& client, const char* reason)
+{
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, client.fd, nullptr);
+    close(client.fd);
+    client.fd = -1;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        client.current.reset();
+    }
+    subscribers--;
+    std::cerr << "Depth server: subscriber " << client.peer << " " << reason << " after " << client.frames
+              << " frames (" << client.skipped << " skipped)." << std::endl;
+}
+
+void DepthServer::ServerLoop()
+{
+    SetCurrentThreadName("kndi-depth-srv");
+    epoll_event events[32];
+    while (!stopping) {
+        int count = epoll_wait(epollFd, events, 32, 250);
+        int64_t now = NowNs();
+        for (int i = 0; i < count; i++) {
+            void* tag = events[i].data.ptr;
+            if (tag == &listenTag) {
+                Accept();
+                continue;
+            }
+            if (tag == &wakeTag) {
+                uint64_t posted;
+                if (read(wakeFd, &posted, sizeof(posted)) < 0) {
+                    // Already drained.
+                }
+                continue;
+            }
+            Client& client = *static_cast<Client*>(tag);
+            if (client.fd < 0)
+                continue;
+            uint32_t flags = events[i].events;
+            if (flags & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+                Close(client, "disconnected");
+                continue;
+            }
+            if (flags & EPOLLIN) {
+                // Nothing is expected from subscribers; drain and ignore.
+                char ignored[256];
+                ssize_t got;
+                while ((got = recv(client.fd, ignored, sizeof(ignored), 0)) > 0) {
+                }
+                if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                    Close(client, "disconnected");
+                    continue;
+                }
+            }
+            if ((flags & EPOLLOUT) && !Flush(client, now))
+                Close(client, "disconnected");
+        }
+
+        // Hand new frames to idle subscribers and write what their sockets
+        // take right away; the rest goes out on EPOLLOUT.
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (std::unique_ptr<Client>& client : clients) {
+                if (client->fd >= 0 && !client->current)
+                    TakeNext(*client, now);
+            }
+        }
+        for (std::unique_ptr<Client>& client : clients) {
+            if (client->fd < 0 || !client->current)
+                continue;
+            if (client->sent == 0 && !client->watchingWrites && !Flush(*client, now))
+                Close(*client, "disconnected");
+            else if (client->current && now - client->progressNs > kStallTimeoutNs)
+                Close(*client, "stalled, disconnected");
+        }
+        clients.erase(std::remove_if(clients.begin(), clients.end(),
+                                     [](const std::unique_ptr<Client>& client) { return client->fd < 0; }),
+                      clients.end());
+    }
+}
+
+#else // !__linux__
+
+DepthServer* DepthServer::Create(unsigned, const std::string&, bool)
+{
+    std::cerr << "Depth server: only available on Linux." << std::endl;
+    return nullptr;
+}
+
+DepthServer::~DepthServer() {}
+
+#endif // __linux__
+
+void DepthServer::Allocate(size_t capacity)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (packets.size() == kPackets && packets.front()->payload.size() >= capacity)
+        return;
+    // Packets still being sent keep their old buffers until they are done.
+    packets.clear();
+    for (size_t i = 0; i < kPackets; i++) {
+        std::shared_ptr<Packet> packet = std::make_shared<Packet>();
+        packet->payload.assign(capacity, 0);
+        packet->serial = 0;
+        packets.push_back(packet);
+    }
+}
+
+void DepthServer::Configure(const PlanContext& context, KernelTuner&, ThreadPool&)
+{
+    size_t capacity = 0;
+    for (kndi_stream stream : { KNDI_STREAM_DEPTH, KNDI_STREAM_FUSED_DEPTH }) {
+        const StreamShape& shape = context.Shape(stream);
+        if ((streams & stream) && shape.framesPerSecond > 0.0)
+            capacity = std::max(capacity, PayloadCapacity(static_cast<size_t>(shape.width) * shape.height, compress));
+    }
+    // Meshes are sent as they are.
+    const StreamShape& mesh = context.Shape(KNDI_STREAM_MESH);
+    if ((streams & KNDI_STREAM_MESH) && mesh.framesPerSecond > 0.0)
+        capacity = std::max(capacity, mesh.maxBytes);
+    if (capacity > 0)
+        Allocate(capacity);
+}
+
+void DepthServer::Consume(const kndi_frame& frame)
+{
+    // Nothing to do until someone listens.
+    if (subscribers.load(std::memory_order_relaxed) == 0)
+        return;
+    bool mesh = frame.stream == KNDI_STREAM_MESH;
+    size_t pixels = static_cast<size_t>(frame.width) * frame.height;
+    size_t rawBytes = mesh ? frame.size : pixels * sizeof(uint16_t);
+    std::shared_ptr<Packet> packet;
+    {
+        // A packet only the free list refers to is not being sent.
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const std::shared_ptr<Packet>& candidate : packets) {
+            if (candidate.use_count() == 1) {
+                packet = candidate;
+                break;
+            }
+        }
+    }
+    if (!packet || packet->payload.size() < (mesh ? rawBytes : PayloadCapacity(pixels, compress))) {
+        packetsExhausted++;
+        return;
+    }
+
+    ReplaySink::FrameHeader& header = packet->header;
+    header.stream = frame.stream;
+    header.deviceIndex = frame.device_index;
+    header.width = frame.width;
+    header.height = frame.height;
+    header.bytesPerPixel = frame.bytes_per_pixel;
+    header.deviceTimestamp = frame.device_timestamp;
+    header.hostTimestampNs = frame.host_timestamp_ns;
+    header.sequence = frame.sequence;
+    header.codec = ReplaySink::Raw;
+    header.payloadBytes = static_cast<uint32_t>(rawBytes);
+    const uint8_t* src = static_cast<const uint8_t*>(frame.data);
+    size_t compressed = compress && !mesh ? CompressDepth(static_cast<const uint16_t*>(frame.data), frame.stride,
+                                                 frame.width, frame.height, packet->payload.data())
+                                 : rawBytes;
+    if (compressed < rawBytes) {
+        header.codec = ReplaySink::DepthDelta;
+        header.payloadBytes = static_cast<uint32_t>(compressed);
+    } else if (mesh || static_cast<size_t>(frame.stride) == frame.width * sizeof(uint16_t)) {
+        std::memcpy(packet->payload.data(), src, rawBytes);
+    } else {
+        size_t rowBytes = frame.width * sizeof(uint16_t);
+        for (int y = 0; y < frame.height; y++)
+            std::memcpy(&packet->payload[y * rowBytes], src + static_cast<size_t>(y) * frame.stride, rowBytes);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        packet->serial = ++published;
+        latest[mesh ? 2 : frame.stream == KNDI_STREAM_FUSED_DEPTH ? 1 : 0] = packet;
+    }
+#ifdef __linux__
+    uint64_t one = 1;
+    if (write(wakeFd, &one, sizeof(one)) < 0) {
+        // Only fails when the counter is saturated, i.e. already signalled.
+    }
+#endif
+}
+
+void DepthServer::Plan(const PlanContext& context, Planner& planner) const
+{
+    for (kndi_stream stream : { KNDI_STREAM_DEPTH, KNDI_STREAM_FUSED_DEPTH }) {
+        const StreamShape& shape = context.Shape(stream);
+        if (!(streams & stream) || shape.framesPerSecond <= 0.0)
+            continue;
+        size_t pixels = static_cast<size_t>(shape.width) * shape.height;
+        size_t rawBytes = pixels * sizeof(uint16_t);
+        std::shared_ptr<std::vector<uint16_t>> src = std::make_shared<std::vector<uint16_t>>(pixels);
+        std::shared_ptr<std::vector<uint8_t>> dst =
+            std::make_shared<std::vector<uint8_t>>(PayloadCapacity(pixels, compress));
+        for (size_t i = 0; i < pixels; i++)
+            (*src)[i] = static_cast<uint16_t>(700 + (i % shape.width) / 4 + (static_cast<uint32_t>(i * 2654435761u) >> 30));
+
+        // Only the copy into the shared packet runs on the capture thread;
+        // sending is the server thread's.
+        PlanStage stage;
+        stage.name = std::string("Depth server ") + StreamKey(stream) + (compress ? " (compressed)" : "");
+        stage.framesPerSecond = shape.framesPerSecond;
+        stage.bytesPerFrame = 2 * rawBytes;
+        int width = shape.width;
+        int height = shape.height;
+        if (compress)
+            stage.run = [src, dst, width, height] {
+                CompressDepth(src->data(), width * 2, width, height, dst->data());
+            };
+        else
+            stage.run = [src, dst, rawBytes] { std::memcpy(dst->data(), src->data(), rawBytes); };
+        planner.Add(stage);
+    }
+    const StreamShape& mesh = context.Shape(KNDI_STREAM_MESH);
+    if ((streams & KNDI_STREAM_MESH) && mesh.framesPerSecond > 0.0) {
+        // Timed at the largest mesh; most are a fraction of it.
+        size_t bytes = mesh.maxBytes;
+        std::shared_ptr<std::vector<uint8_t>> src = std::make_shared<std::vector<uint8_t>>(bytes, 1);
+        std::shared_ptr<std::vector<uint8_t>> dst = std::make_shared<std::vector<uint8_t>>(bytes);
+        PlanStage stage;
+        stage.name = "Depth server mesh";
+        stage.framesPerSecond = mesh.framesPerSecond;
+        stage.bytesPerFrame = 2 * bytes;
+        stage.run = [src, dst, bytes] { std::memcpy(dst->data(), src->data(), bytes); };
+        planner.Add(stage);
+    }
+    PlanStage send;
+    send.name = "Depth server send";
+    planner.Add(send);
+}
+
+#ifdef __linux__
+
+namespace {
+
+// Benchmark client: reads frames until the server closes the connection.
+struct BenchSubscriber {
+    int fd = -1;
+    std::thread thread;
+    // Per phase: 0 paced, 1 flood.
+    uint64_t frames[2] = { 0, 0 };
+    uint64_t bytes[2] = { 0, 0 };
+    double latencySumMs = 0.0;
+    double latencyMaxMs = 0.0;
+};
+
+bool ReadFully(int fd, void* dst, size_t bytes)
+{
+    uint8_t* out = static_cast<uint8_t*>(dst);
+    while (bytes > 0) {
+        ssize_t got = recv(fd, out, bytes, 0);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return false;
+        out += got;
+        bytes -= static_cast<size_t>(got);
+    }
+    return true;
+}
+
+int ConnectUnix(const std::string& path)
+{
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), std::min(path.size(), sizeof(addr.sun_path) - 1));
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+double ThreadCpuMs(pthread_t thread)
+{
+    clockid_t clock;
+    timespec now;
+    if (pthread_getcpuclockid(thread, &clock) != 0 || clock_gettime(clock, &now) != 0)
+        return 0.0;
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+} // namespace
+
+// Sequence numbers of the flood phase start here, so subscribers can tell
+// the phases apart.
+static constexpr uint64_t kFloodSequence = 1000000;
+
+bool DepthServer::Benchmark(int subscriberCount, bool compress, std::string& report)
+{
+    const int width = 640;
+    const int height = 480;
+    const int pacedFrames = 150;
+    std::string path = TimestampedPath("", "bench-" + std::to_string(getpid()), ".sock");
+    std::unique_ptr<DepthServer> server(Create(KNDI_STREAM_DEPTH, "unix:" + path, compress));
+    if (!server) {
+        report = "Depth server benchmark: cannot listen on " + path + "\n";
+        return false;
+    }
+    server->Allocate(PayloadCapacity(static_cast<size_t>(width) * height, compress));
+
+    std::vector<std::unique_ptr<BenchSubscriber>> readers;
+    for (int i = 0; i < subscriberCount; i++) {
+        std::unique_ptr<BenchSubscriber> reader(new BenchSubscriber);
+        reader->fd = ConnectUnix(path);
+        if (reader->fd < 0)
+            break;
+        BenchSubscriber* self = reader.get();
+        reader->thread = std::thread([self] {
+            std::vector<uint8_t> payload;
+            ReplaySink::FrameHeader header;
+            while (ReadFully(self->fd, &header, sizeof(header))) {
+                payload.resize(header.payloadBytes);
+                if (!ReadFully(self->fd, payload.data(), payload.size()))
+                    break;
+                int phase = header.sequence >= kFloodSequence ? 1 : 0;
+                self->frames[phase]++;
+                self->bytes[phase] += sizeof(header) + header.payloadBytes;
+                if (phase == 0) {
+                    double latencyMs = (NowNs() - header.hostTimestampNs) / 1e6;
+                    self->latencySumMs += latencyMs;
+                    self->latencyMaxMs = std::max(self->latencyMaxMs, latencyMs);
+                }
+            }
+        });
+        readers.push_back(std::move(reader));
+    }
+    // Connected but never reads: must not hold up the others.
+    int stalled = ConnectUnix(path);
+    int expected = static_cast<int>(readers.size()) + (stalled >= 0 ? 1 : 0);
+    for (int i = 0; i < 200 && server->subscribers.load() < expected; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    // Synthetic scene: a sloped surface with sensor noise.
+    std::vector<uint16_t> depth(static_cast<size_t>(width) * height);
+    kndi_frame frame;
+    std::memset(&frame, 0, sizeof(frame));
+    frame.stream = KNDI_STREAM_DEPTH;
+    frame.width = width;
+    frame.height = height;
+    frame.stride = width * 2;
+    frame.bytes_per_pixel = 2;
+    frame.data = depth.data();
+    uint32_t noise = 1;
+    auto produce = [&](uint64_t sequence) {
+        for (size_t i = 0; i < depth.size(); i++) {
+            noise = noise * 1664525u + 1013904223u;
+            depth[i] = static_cast<uint16_t>(700 + (i % width) / 4 + (sequence % 32) + (noise >> 30));
+        }
+        frame.sequence = sequence;
+        frame.host_timestamp_ns = NowNs();
+        int64_t start = NowNs();
+        server->Consume(frame);
+        return (NowNs() - start) / 1e6;
+    };
+
+    // Paced like a Kinect.
+    double consumeMs = 0.0;
+    double serverStartMs = ThreadCpuMs(server->thread.native_handle());
+    std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+    for (int i = 1; i <= pacedFrames; i++) {
+        next += std::chrono::microseconds(33333);
+        std::this_thread::sleep_until(next);
+        consumeMs += produce(static_cast<uint64_t>(i));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    double serverPacedMs = ThreadCpuMs(server->thread.native_handle()) - serverStartMs;
+    bool stalledDropped = server->subscribers.load() < expected;
+
+    // As fast as the producer can go, for one second.
+    uint64_t flooded = 0;
+    uint64_t exhaustedBefore = server->packetsExhausted.load();
+    int64_t floodEnd = NowNs() + 1000000000;
+    while (NowNs() < floodEnd)
+        produce(kFloodSequence + flooded++);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    uint64_t exhausted = server->packetsExhausted.load() - exhaustedBefore;
+
+    server.reset();
+    for (std::unique_ptr<BenchSubscriber>& reader : readers) {
+        reader->thread.join();
+        close(reader->fd);
+    }
+    if (stalled >= 0)
+        close(stalled);
+
+    uint64_t pacedMin = UINT64_MAX, floodMin = UINT64_MAX, floodTotal = 0, bytesTotal = 0, pacedTotal = 0;
+    double latencySum = 0.0, latencyMax = 0.0;
+    for (const std::unique_ptr<BenchSubscriber>& reader : readers) {
+        pacedMin = std::min(pacedMin, reader->frames[0]);
+        pacedTotal += reader->frames[0];
+        floodMin = std::min(floodMin, reader->frames[1]);
+        floodTotal += reader->frames[1];
+        bytesTotal += reader->bytes[1];
+        latencySum += reader->latencySumMs;
+        latencyMax = std::max(latencyMax, reader->latencyMaxMs);
+    }
+    size_t count = std::max<size_t>(readers.size(), 1);
+    if (readers.empty())
+        pacedMin = floodMin = 0;
+
+    char line[256];
+    report.clear();
+    std::snprintf(line, sizeof(line), "Depth server benchmark: %d subscribers on a Unix socket (+1 that never reads), %dx%d %s depth\n",
+                  static_cast<int>(readers.size()), width, height, compress ? "compressed" : "raw");
+    report += line;
+    std::snprintf(line, sizeof(line), "  30 fps, %d frames: capture thread %.3f ms/frame, server thread %.3f ms/frame\n",
+                  pacedFrames, consumeMs / pacedFrames, serverPacedMs / pacedFrames);
+    report += line;
+    std::snprintf(line, sizeof(line), "    received per subscriber: min %llu of %d, latency mean %.2f ms, max %.2f ms\n",
+                  static_cast<unsigned long long>(pacedMin), pacedFrames,
+                  pacedTotal ? latencySum / pacedTotal : 0.0, latencyMax);
+    report += line;
+    std::snprintf(line, sizeof(line), "  Flood, 1 s: %llu frames offered, %llu dropped for all (no free packet)\n",
+                  static_cast<unsigned long long>(flooded), static_cast<unsigned long long>(exhausted));
+    report += line;
+    std::snprintf(line, sizeof(line), "    received per subscriber: min %llu, mean %.0f fps, %.0f MB/s in total\n",
+                  static_cast<unsigned long long>(floodMin), static_cast<double>(floodTotal) / count,
+                  bytesTotal / 1e6);
+    report += line;
+    std::snprintf(line, sizeof(line), "  Subscriber that never reads: %s\n",
+                  stalledDropped ? "disconnected after the stall timeout" : "still connected");
+    report += line;
+    return !readers.empty();
+}
+
+#else // !__linux__
+
+bool DepthServer::Benchmark(int, bool, std::string& report)
+{
+    report = "Depth server benchmark: only available on Linux.\n";
+    return false;
+}
+
+#endif // __linux__
+
+} // namespace kndi
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "replay_sink.h"
+#include "sink.h"
+
+namespace kndi {
+
+// Streams raw depth frames, and depth meshes, to local subscribers over TCP
+// or a Unix socket.
+//
+// Consume() copies (or losslessly compresses) each frame once into one of a
+// few reference-counted packets and wakes the server thread, which hands
+// the newest packet to every subscriber that is not still busy with an
+// earlier one and writes header and payload with one vectored send per
+// socket. A slow subscriber skips frames instead of holding up capture or
+// the other subscribers, and one that makes no progress for two seconds is
+// disconnected.
+//
+// Each frame on the wire is a ReplaySink::FrameHeader (48 bytes,
+// little-endian, the same as in .knr files) followed by `payloadBytes` of
+// 16-bit depth, or of the DepthDelta codec from depth_codec.h; meshes are
+// sent as they are (kndi_mesh_header and its buffers). Subscribers
+// never send anything; the server ignores what they do send.
+//
+// Linux only (epoll); Create() fails elsewhere.
+class DepthServer : public Sink {
+public:
+    // Listen on `address`: "unix:/path", "tcp:port" (loopback only) or
+    // "tcp:host:port". Returns nullptr (with the reason on stderr) if the
+    // address cannot be used.
+    static DepthServer* Create(unsigned streams, const std::string& address, bool compress);
+    ~DepthServer() override;
+
+    DepthServer(const DepthServer&) = delete;
+    DepthServer& operator=(const DepthServer&) = delete;
+
+    unsigned Streams() const override { return streams; }
+    void Consume(const kndi_frame& frame) override;
+    void Configure(const PlanContext& context, KernelTuner& tuner, ThreadPool& pool) override;
+    void Plan(const PlanContext& context, Planner& planner) const override;
+
+    // Serve synthetic 640x480 depth at 30 fps, then as fast as possible, to
+    // `subscribers` local Unix-socket clients plus one that never reads, and
+    // write their frame rate, latency and drops to `report`.
+    static bool Benchmark(int subscribers, bool compress, std::string& report);
+
+private:
+    struct Packet {
+        ReplaySink::FrameHeader header;
+        std::vector<uint8_t> payload;
+        uint64_t serial;              // Order of publication.
+    };
+
+    struct Client {
+        int fd;
+        std::string peer;
+        std::shared_ptr<Packet> current;   // Being sent, or null when idle.
+        size_t sent;                  // Bytes of `current` written so far.
+        uint64_t lastSerial;          // Newest packet taken.
+        uint64_t skipped;             // Packets published but passed over.
+        uint64_t frames;
+        int64_t progressNs;           // Last successful write.
+        bool watchingWrites;          // EPOLLOUT registered.
+    };
+
+    DepthServer(unsigned streams, bool compress, int listenFd, int wakeFd, int epollFd,
+                const std::string& unixPath);
+
+    // Size the packets for payloads of up to `capacity` bytes.
+    void Allocate(size_t capacity);
+    void ServerLoop();
+    void Accept();
+    // Give an idle client the oldest packet it has not seen yet. Called
+    // with `mutex` held.
+    void TakeNext(Client& client, int64_t nowNs);
+    // Write as much of the client's packets as the socket takes; false if
+    // the client is gone.
+    bool Flush(Client& client, int64_t nowNs);
+    void WatchWrites(Client& client, bool watch);
+    void Close(Client& client, const char* reason);
+
+    unsigned streams;
+    bool compress;
+    int listenFd;
+    int wakeFd;                       // eventfd: a packet was published.
+    int epollFd;
+    std::string unixPath;             // Removed on destruction.
+
+    std::mutex mutex;                 // Guards packet references and `latest`.
+    std::vector<std::shared_ptr<Packet>> packets;
+    std::shared_ptr<Packet> latest[3];    // Newest depth, fused depth and mesh packet.
+    uint64_t published;
+
+    std::vector<std::unique_ptr<Client>> clients;   // Server thread only.
+    std::atomic<int> subscribers;
+    std::atomic<uint64_t> framesSent;
+    std::atomic<uint64_t> framesSkipped;     // Published but not sent to a subscriber.
+    std::atomic<uint64_t> packetsExhausted;  // Frames dropped for everyone.
+
+    std::atomic<bool> stopping;
+    std::thread thread;
+};
+
+} // namespace kndi
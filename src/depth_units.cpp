@@ -0,0 +1,36 @@
+#include "depth_units.h"
+
+#include <cmath>
+
+namespace kndi {
+
+// Usable Kinect v1 range; readings outside it are noise.
+static constexpr double kMinDepthMm = 300.0;
+static constexpr double kMaxDepthMm = 10000.0;
+
+namespace {
+
+struct DepthTable {
+    uint16_t mm[2048];
+
+    DepthTable()
+    {
+        // Stephane Magnenat's fit of the disparity → distance curve.
+        for (int raw = 0; raw < 2048; raw++) {
+            double metres = 0.1236 * std::tan(raw / 2842.5 + 1.1863);
+            double millimetres = metres * 1000.0;
+            bool valid = raw < kRawDepthInvalid && millimetres >= kMinDepthMm && millimetres <= kMaxDepthMm;
+            mm[raw] = valid ? static_cast<uint16_t>(millimetres + 0.5) : 0;
+        }
+    }
+};
+
+} // namespace
+
+const uint16_t* RawDepthToMillimetres()
+{
+    static const DepthTable table;
+    return table.mm;
+}
+
+} // namespace kndi
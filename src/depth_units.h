@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+
+namespace kndi {
+
+// Raw 11-bit Kinect disparity value reported for pixels with no reading.
+constexpr uint16_t kRawDepthInvalid = 2047;
+
+// 2048-entry table mapping raw 11-bit disparity to millimetres along the
+// optical axis (0 = no reading / out of range). Built once on first use.
+const uint16_t* RawDepthToMillimetres();
+
+} // namespace kndi
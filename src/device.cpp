@@ -0,0 +1,228 @@
+#include "device.h"
+
+#include <chrono>
+#include <iostream>
+
+namespace kndi {
+
+freenect_frame_mode VideoMode(kndi_stream stream)
+{
+    return freenect_find_video_mode(FREENECT_RESOLUTION_MEDIUM,
+        stream == KNDI_STREAM_IR ? FREENECT_VIDEO_IR_8BIT : FREENECT_VIDEO_RGB);
+}
+
+freenect_frame_mode DepthMode()
+{
+    return freenect_find_depth_mode(FREENECT_RESOLUTION_MEDIUM, FREENECT_DEPTH_11BIT);
+}
+
+// Kinect frame counter ticks (60 MHz) per frame at 30 fps.
+static constexpr uint32_t kTicksPerFrame = 2000000;
+
+static int64_t HostNowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Device::Device(int index)
+    : index(index), dev(nullptr), streaming(false)
+{
+    video = StreamState();
+    depth = StreamState();
+}
+
+Device::~Device()
+{
+    Close();
+}
+
+void Device::ResetStream(StreamState& state)
+{
+    if (state.filling)
+        FramePool::Release(state.filling);
+    if (state.latest)
+        FramePool::Release(state.latest);
+    state.filling = nullptr;
+    state.latest = nullptr;
+    state.pool = nullptr;
+}
+
+int Device::ConfigureStream(StreamState& state)
+{
+    state.filling = state.pool->Acquire();
+    if (!state.filling) {
+        std::cerr << "No free frame buffer to start streaming." << std::endl;
+        return -1;
+    }
+    if (state.stream == KNDI_STREAM_DEPTH) {
+        freenect_set_depth_callback(dev, DepthCallback);
+        if (freenect_set_depth_mode(dev, state.mode) < 0) {
+            std::cerr << "Could not set the depth mode." << std::endl;
+            return -1;
+        }
+        freenect_set_depth_buffer(dev, state.filling->storage);
+    } else {
+        freenect_set_video_callback(dev, VideoCallback);
+        if (freenect_set_video_mode(dev, state.mode) < 0) {
+            std::cerr << "Could not set the video mode." << std::endl;
+            return -1;
+        }
+        freenect_set_video_buffer(dev, state.filling->storage);
+    }
+    return 0;
+}
+
+int Device::Open(freenect_context* ctx, unsigned streams, FramePool* videoPool, FramePool* depthPool)
+{
+    if (freenect_open_device(ctx, &dev, index) < 0) {
+        std::cerr << "Could not open Kinect device " << index << "." << std::endl;
+        dev = nullptr;
+        return -1;
+    }
+    freenect_set_user(dev, this);
+
+    video = StreamState();
+    depth = StreamState();
+    if (streams & KNDI_STREAM_VIDEO) {
+        video.stream = (streams & KNDI_STREAM_IR) ? KNDI_STREAM_IR : KNDI_STREAM_RGB;
+        video.mode = VideoMode(video.stream);
+        video.pool = videoPool;
+        if (ConfigureStream(video) < 0) {
+            Close();
+            return -1;
+        }
+    }
+    if (streams & KNDI_STREAM_DEPTH) {
+        depth.stream = KNDI_STREAM_DEPTH;
+        depth.mode = DepthMode();
+        depth.pool = depthPool;
+        if (ConfigureStream(depth) < 0) {
+            Close();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int Device::StartStreams()
+{
+    if (!dev)
+        return -1;
+    if (streaming)
+        return 0;
+    // IMPORTANT: Start the video stream.
+    if (video.pool && freenect_start_video(dev) < 0) {
+        std::cerr << "Could not start the video stream." << std::endl;
+        return -1;
+    }
+    // IMPORTANT: Start the depth stream.
+    if (depth.pool && freenect_start_depth(dev) < 0) {
+        std::cerr << "Could not start the depth stream." << std::endl;
+        if (video.pool)
+            freenect_stop_video(dev);
+        return -1;
+    }
+    streaming = true;
+    return 0;
+}
+
+void Device::StopStreams()
+{
+    if (!dev || !streaming)
+        return;
+    if (video.pool)
+        freenect_stop_video(dev);
+    if (depth.pool)
+        freenect_stop_depth(dev);
+    streaming = false;
+    video.timed = false;
+    depth.timed = false;
+    // A frame completed just before stopping is stale by now.
+    if (video.latest) {
+        FramePool::Release(video.latest);
+        video.latest = nullptr;
+    }
+    if (depth.latest) {
+        FramePool::Release(depth.latest);
+        depth.latest = nullptr;
+    }
+}
+
+void Device::Close()
+{
+    if (dev) {
+        StopStreams();
+        freenect_close_device(dev);
+        dev = nullptr;
+    }
+    ResetStream(video);
+    ResetStream(depth);
+}
+
+void Device::OnFrame(StreamState& state, uint32_t timestamp)
+{
+    if (state.timed) {
+        uint32_t ticks = timestamp - state.lastTimestamp;
+        uint32_t frames = (ticks + kTicksPerFrame / 2) / kTicksPerFrame;
+        if (frames > 1)
+            state.lost += frames - 1;
+    }
+    state.received++;
+    state.lastTimestamp = timestamp;
+    state.timed = true;
+    FrameBuffer* done = state.filling;
+    FrameBuffer* next = state.pool->Acquire();
+    if (!next) {
+        // Every buffer is held by consumers: drop this frame and let
+        // libfreenect overwrite the same buffer.
+        state.dropped++;
+        return;
+    }
+    state.filling = next;
+    if (state.stream == KNDI_STREAM_DEPTH)
+        freenect_set_depth_buffer(dev, next->storage);
+    else
+        freenect_set_video_buffer(dev, next->storage);
+
+    int bytesPerPixel = (state.mode.data_bits_per_pixel + state.mode.padding_bits_per_pixel + 7) / 8;
+    kndi_frame& frame = done->frame;
+    frame.stream = state.stream;
+    frame.device_index = index;
+    frame.width = state.mode.width;
+    frame.height = state.mode.height;
+    frame.bytes_per_pixel = bytesPerPixel;
+    frame.stride = state.mode.width * bytesPerPixel;
+    frame.data = done->storage;
+    frame.size = static_cast<size_t>(state.mode.bytes);
+    frame.device_timestamp = timestamp;
+    frame.host_timestamp_ns = HostNowNs();
+    frame.sequence = state.sequence++;
+
+    if (state.latest) {
+        FramePool::Release(state.latest);
+        state.dropped++;
+    }
+    state.latest = done;
+}
+
+FrameBuffer* Device::Take(StreamState& state)
+{
+    FrameBuffer* frame = state.latest;
+    state.latest = nullptr;
+    return frame;
+}
+
+void Device::VideoCallback(freenect_device* dev, void* /*video*/, uint32_t timestamp)
+{
+    Device* self = static_cast<Device*>(freenect_get_user(dev));
+    self->OnFrame(self->video, timestamp);
+}
+
+void Device::DepthCallback(freenect_device* dev, void* /*depth*/, uint32_t timestamp)
+{
+    Device* self = static_cast<Device*>(freenect_get_user(dev));
+    self->OnFrame(self->depth, timestamp);
+}
+
+} // namespace kndi
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+
+#include <libfreenect.h>
+
+#include "frame_pool.h"
+
+namespace kndi {
+
+// Frame modes used for each stream (medium resolution, as before).
+freenect_frame_mode VideoMode(kndi_stream stream);
+freenect_frame_mode DepthMode();
+
+// One Kinect. libfreenect captures straight into FramePool buffers; each
+// callback hands the filled buffer to a one-slot mailbox and re-arms the
+// device with a fresh buffer, so frames reach consumers without a copy.
+// All methods and callbacks run on the capture thread.
+class Device {
+public:
+    explicit Device(int index);
+    ~Device();
+
+    Device(const Device&) = delete;
+    Device& operator=(const Device&) = delete;
+
+    // Open the device on `ctx` and configure the requested streams. Returns
+    // < 0 on failure, in which case the device is left closed.
+    int Open(freenect_context* ctx, unsigned streams, FramePool* videoPool, FramePool* depthPool);
+    void Close();
+    bool IsOpen() const { return dev != nullptr; }
+    int Index() const { return index; }
+
+    // Start / stop the configured streams. An open device that is not
+    // streaming is a cold-ish standby: no USB bandwidth, fast to start.
+    int StartStreams();
+    void StopStreams();
+    bool IsStreaming() const { return streaming; }
+
+    // Hand over the most recent complete frame (one reference), or nullptr.
+    FrameBuffer* TakeVideo() { return Take(video); }
+    FrameBuffer* TakeDepth() { return Take(depth); }
+
+    // Frames lost because the pool was exhausted or a newer frame arrived
+    // before the previous one was dispatched.
+    uint64_t DroppedFrames() const { return video.dropped + depth.dropped; }
+    // Frames libfreenect completed, and frames missing between them by the
+    // Kinect's frame counter: libfreenect discards a frame that lost USB
+    // packets, so these are frames lost on the bus.
+    uint64_t ReceivedFrames() const { return video.received + depth.received; }
+    uint64_t LostFrames() const { return video.lost + depth.lost; }
+
+private:
+    struct StreamState {
+        kndi_stream stream;
+        freenect_frame_mode mode;
+        FramePool* pool;
+        FrameBuffer* filling;  // Buffer libfreenect is writing into.
+        FrameBuffer* latest;   // Last complete frame, not yet dispatched.
+        uint64_t sequence;
+        uint64_t dropped;
+        uint64_t received;
+        uint64_t lost;
+        uint32_t lastTimestamp;  // Of the previous frame, if `timed`.
+        bool timed;              // Cleared when streaming stops.
+    };
+
+    static void VideoCallback(freenect_device* dev, void* video, uint32_t timestamp);
+    static void DepthCallback(freenect_device* dev, void* depth, uint32_t timestamp);
+
+    void OnFrame(StreamState& state, uint32_t timestamp);
+    int ConfigureStream(StreamState& state);
+    static FrameBuffer* Take(StreamState& state);
+    static void ResetStream(StreamState& state);
+
+    int index;
+    freenect_device* dev;
+    bool streaming;
+    StreamState video;
+    StreamState depth;
+};
+
+} // namespace kndi
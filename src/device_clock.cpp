@@ -0,0 +1,141 @@
+#include "device_clock.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace kndi {
+
+// Host ns per tick of the nominal 60 MHz counter.
+static constexpr double kNominalSlope = 1e9 / 60e6;
+// Frames per block; half a second of one 30 fps stream.
+static constexpr int kBlockFrames = 15;
+// Blocks before the first estimate (four seconds).
+static constexpr size_t kMinBlocks = 8;
+// Larger estimated drift means the counter is not what it seems (or the
+// host clock is being slewed hard); leave timestamps unmapped.
+static constexpr double kMaxDriftPpm = 2000.0;
+// A counter step outside (0, 5 s] means the device restarted.
+static constexpr int64_t kMaxStepTicks = 5 * 60000000LL;
+// Weight of the newest frame in the jitter estimate (about ten seconds).
+static constexpr double kJitterWeight = 1.0 / 300.0;
+
+DeviceClock::DeviceClock(size_t window)
+    : window(std::max(window, kMinBlocks)), ticks(this->window), hosts(this->window),
+      residuals(this->window), sorted(this->window), locked(false), driftPpm(0.0),
+      jitterUs(0.0), frames(0)
+{
+    Reset();
+}
+
+void DeviceClock::Reset()
+{
+    count = 0;
+    head = 0;
+    lastTimestamp = 0;
+    unwrapped = 0;
+    started = false;
+    blockFrames = 0;
+    blockTick = 0;
+    blockHost = 0;
+    blockOffset = 0.0;
+    referenceTick = 0;
+    referenceHost = 0;
+    slope = kNominalSlope;
+    intercept = 0.0;
+    residualMean = 0.0;
+    residualSquare = 0.0;
+    locked = false;
+    frames = 0;
+}
+
+bool DeviceClock::Fit(double limit)
+{
+    double n = 0.0, sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+    for (size_t i = 0; i < count; i++) {
+        if (residuals[i] > limit)
+            continue;
+        double x = static_cast<double>(ticks[i] - referenceTick);
+        double y = static_cast<double>(hosts[i] - referenceHost);
+        n += 1.0;
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+    }
+    double denominator = n * sxx - sx * sx;
+    if (n < kMinBlocks / 2 || denominator <= 0.0)
+        return false;
+    slope = (n * sxy - sx * sy) / denominator;
+    intercept = (sy - slope * sx) / n;
+    return true;
+}
+
+void DeviceClock::Refit()
+{
+    // Around the newest block for precision.
+    size_t newest = (head + window - 1) % window;
+    referenceTick = ticks[newest];
+    referenceHost = hosts[newest];
+    std::fill(residuals.begin(), residuals.begin() + count, 0.0);
+    if (!Fit(std::numeric_limits<double>::infinity())) {
+        locked = false;
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        double x = static_cast<double>(ticks[i] - referenceTick);
+        double y = static_cast<double>(hosts[i] - referenceHost);
+        residuals[i] = y - (intercept + slope * x);
+    }
+    std::copy(residuals.begin(), residuals.begin() + count, sorted.begin());
+    std::nth_element(sorted.begin(), sorted.begin() + count / 2, sorted.begin() + count);
+    if (!Fit(sorted[count / 2])) {
+        locked = false;
+        return;
+    }
+    double drift = (kNominalSlope / slope - 1.0) * 1e6;
+    driftPpm = drift;
+    locked = std::fabs(drift) <= kMaxDriftPpm;
+}
+
+int64_t DeviceClock::Update(uint32_t deviceTimestamp, int64_t hostNs)
+{
+    if (started) {
+        int64_t step = static_cast<int32_t>(deviceTimestamp - lastTimestamp);
+        if (step <= 0 || step > kMaxStepTicks)
+            Reset();
+        else
+            unwrapped += step;
+    }
+    started = true;
+    lastTimestamp = deviceTimestamp;
+    frames++;
+
+    // Keep the least delayed frame of the block.
+    double offset = static_cast<double>(hostNs) - kNominalSlope * static_cast<double>(unwrapped);
+    if (blockFrames == 0 || offset < blockOffset) {
+        blockTick = unwrapped;
+        blockHost = hostNs;
+        blockOffset = offset;
+    }
+    if (++blockFrames == kBlockFrames) {
+        ticks[head] = blockTick;
+        hosts[head] = blockHost;
+        head = (head + 1) % window;
+        count = std::min(count + 1, window);
+        blockFrames = 0;
+        if (count >= kMinBlocks)
+            Refit();
+    }
+    if (!locked)
+        return 0;
+
+    double mapped = intercept + slope * static_cast<double>(unwrapped - referenceTick);
+    double residual = static_cast<double>(hostNs - referenceHost) - mapped;
+    residualMean += kJitterWeight * (residual - residualMean);
+    residualSquare += kJitterWeight * (residual * residual - residualSquare);
+    jitterUs = std::sqrt(std::max(0.0, residualSquare - residualMean * residualMean)) / 1000.0;
+    return referenceHost + static_cast<int64_t>(std::llround(mapped));
+}
+
+} // namespace kndi
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace kndi {
+
+// Maps a Kinect's 60 MHz frame counter onto the host monotonic clock.
+//
+// Host receive times carry USB and scheduling latency that is never
+// negative, so the frame that arrived first relative to the nominal rate in
+// each half second is the best witness of the device clock. The line
+// through those minima over the last minute is fitted by least squares,
+// refitted without the ones above the median residual (blocks in which
+// every frame was held up), and gives the device clock's drift and the
+// lowest-latency host time of each frame, without receive jitter.
+//
+// The synced times stamp frames (NDI timecodes, OSC/TUIO time tags, the
+// flight recorder); nothing is paced on them. Frames are still sent, and
+// never dropped or repeated, as they arrive, since holding them back to
+// the synced timeline would add latency to every frame.
+//
+// Update() is called from one capture thread; the statistics may be read
+// from any thread.
+class DeviceClock {
+public:
+    // `window` half-second blocks are fitted (128: about a minute).
+    explicit DeviceClock(size_t window = 128);
+
+    // Forget all frames (the device counter restarts on reconnect).
+    void Reset();
+
+    // Add a frame and return its device timestamp mapped to host time, or
+    // 0 until enough frames are in for a stable estimate.
+    int64_t Update(uint32_t deviceTimestamp, int64_t hostNs);
+
+    bool Locked() const { return locked.load(); }
+    // Device clock rate relative to its nominal 60 MHz as seen by the host,
+    // in parts per million (positive: the device counter runs fast).
+    double DriftPpm() const { return driftPpm.load(); }
+    // RMS spread of the host receive times around the fitted line.
+    double JitterUs() const { return jitterUs.load(); }
+    // Frames since the last reset.
+    uint64_t Frames() const { return frames.load(); }
+
+private:
+    // Least-squares line through the block minima whose residual from the
+    // current line is at most `limit`; false if there are too few.
+    bool Fit(double limit);
+    // Refit the line after a block was added.
+    void Refit();
+
+    size_t window;
+    std::vector<int64_t> ticks;     // Block minima: unwrapped device counter, ring of `window`.
+    std::vector<int64_t> hosts;     // Block minima: host receive times, same ring.
+    std::vector<double> residuals;  // From the first fit, aligned with the ring.
+    std::vector<double> sorted;     // Scratch for the median.
+    size_t count;
+    size_t head;
+    uint32_t lastTimestamp;
+    int64_t unwrapped;
+    bool started;
+
+    // Current block: frame with the smallest host - nominal time.
+    int blockFrames;
+    int64_t blockTick;
+    int64_t blockHost;
+    double blockOffset;
+
+    // Per-frame residual moments (exponentially weighted) for the jitter.
+    double residualMean;
+    double residualSquare;
+
+    // Fitted line host = intercept + slope * (tick - referenceTick), around
+    // the newest frame for precision.
+    int64_t referenceTick;
+    int64_t referenceHost;
+    double slope;                   // Host ns per device tick.
+    double intercept;
+
+    std::atomic<bool> locked;
+    std::atomic<double> driftPpm;
+    std::atomic<double> jitterUs;
+    std::atomic<uint64_t> frames;
+};
+
+} // namespace kndi
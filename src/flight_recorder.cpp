@@ -0,0 +1,200 @@
+#include "flight_recorder.h"
+
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+
+#include "planner.h"
+
+namespace kndi {
+
+static const char* EventName(FlightEvent event)
+{
+    switch (event) {
+    case FlightEvent::Frame:      return "frame";
+    case FlightEvent::Connect:    return "connect";
+    case FlightEvent::Disconnect: return "disconnect";
+    case FlightEvent::Failover:   return "failover";
+    case FlightEvent::Watchdog:   return "watchdog";
+    case FlightEvent::Drop:       return "drop";
+    case FlightEvent::Dump:       return "dump";
+    }
+    return "unknown";
+}
+
+FlightRecorder::FlightRecorder(size_t capacity)
+    : ring(capacity ? new Slot[capacity]() : nullptr), capacity(capacity), head(0),
+      dumping(false), lastDumpOk(true)
+{
+}
+
+FlightRecorder::~FlightRecorder()
+{
+    WaitForDump();
+}
+
+void FlightRecorder::Add(const FlightRecord& record)
+{
+    if (!capacity)
+        return;
+    uint64_t index = head.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = ring[index % capacity];
+    // Seqlock-style: readers ignore a slot whose stamp changed while they
+    // copied it.
+    slot.stamp.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.record = record;
+    slot.stamp.store(index + 1, std::memory_order_release);
+}
+
+void FlightRecorder::AddEvent(FlightEvent event, int device, int64_t nowNs)
+{
+    FlightRecord record = FlightRecord();
+    record.captureNs = nowNs;
+    record.device = static_cast<int16_t>(device);
+    record.event = event;
+    Add(record);
+}
+
+// Newest records that may still be being written (one per capture thread
+// and derived stream, with a wide margin).
+static constexpr uint64_t kInFlightRecords = 64;
+
+void FlightRecorder::Read(uint64_t& cursor, std::vector<FlightRecord>& out) const
+{
+    if (!capacity)
+        return;
+    uint64_t end = head.load(std::memory_order_acquire);
+    uint64_t index = std::max(cursor, end > capacity ? end - capacity : 0);
+    for (; index < end; index++) {
+        const Slot& slot = ring[index % capacity];
+        uint64_t before = slot.stamp.load(std::memory_order_acquire);
+        // A recent slot without its stamp is still being written; an old
+        // one is being overwritten by a writer that lapped the reader.
+        if (before < index + 1 && end - index <= kInFlightRecords)
+            break;
+        FlightRecord record = slot.record;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t after = slot.stamp.load(std::memory_order_relaxed);
+        if (before == index + 1 && after == before)
+            out.push_back(record);
+    }
+    cursor = index;
+}
+
+bool FlightRecorder::Dump(const std::string& path, const std::string& reason)
+{
+    if (!capacity)
+        return false;
+    std::lock_guard<std::mutex> lock(dumpMutex);
+    if (dumping)
+        return false;
+    if (dumpThread.joinable())
+        dumpThread.join();
+
+    // Snapshot on the calling thread (a plain copy); format and write in
+    // the background.
+    uint64_t cursor = 0;
+    std::shared_ptr<std::vector<FlightRecord>> records = std::make_shared<std::vector<FlightRecord>>();
+    records->reserve(capacity);
+    Read(cursor, *records);
+
+    dumping = true;
+    dumpThread = std::thread([this, records, path, reason] {
+        bool ok = false;
+        if (FILE* file = std::fopen(path.c_str(), "w")) {
+            std::fprintf(file, "# kinect-ndi flight recorder: %s, %zu records\n",
+                         reason.c_str(), records->size());
+            std::fprintf(file, "event,stream,device,active,sequence,device_timestamp,capture_ns,"
+                               "synced_us,deliver_us,dispatch_us,done_us,pool_in_use,dropped\n");
+            for (const FlightRecord& r : *records) {
+                // Stage times relative to the capture callback.
+                double synced = r.syncedNs ? (r.syncedNs - r.captureNs) / 1000.0 : 0.0;
+                double deliver = r.deliverNs ? (r.deliverNs - r.captureNs) / 1000.0 : 0.0;
+                double dispatch = r.dispatchNs ? (r.dispatchNs - r.captureNs) / 1000.0 : 0.0;
+                double done = r.doneNs ? (r.doneNs - r.captureNs) / 1000.0 : 0.0;
+                std::fprintf(file, "%s,%s,%d,%d,%llu,%u,%lld,%.1f,%.1f,%.1f,%.1f,%u,%u\n",
+                             EventName(r.event), r.stream ? StreamKey(static_cast<kndi_stream>(r.stream)) : "",
+                             r.device, r.active ? 1 : 0,
+                             static_cast<unsigned long long>(r.sequence), r.deviceTimestamp,
+                             static_cast<long long>(r.captureNs), synced, deliver, dispatch, done,
+                             static_cast<unsigned>(r.poolInUse), r.dropped);
+            }
+            ok = std::fclose(file) == 0;
+        }
+        if (ok)
+            std::cerr << "Flight recorder (" << reason << "): wrote " << records->size()
+                      << " records to " << path << std::endl;
+        else
+            std::cerr << "Flight recorder: could not write " << path << std::endl;
+        lastDumpOk = ok;
+        dumping = false;
+    });
+    return true;
+}
+
+bool FlightRecorder::WaitForDump()
+{
+    std::lock_guard<std::mutex> lock(dumpMutex);
+    if (dumpThread.joinable())
+        dumpThread.join();
+    return lastDumpOk;
+}
+
+std::string TimestampedPath(const std::string& directory, const std::string& name,
+                            const std::string& extension)
+{
+    std::time_t now = std::time(nullptr);
+    std::tm local;
+#ifdef _WIN32
+    localtime_s(&local, &now);
+#else
+    localtime_r(&now, &local);
+#endif
+    char stamp[32];
+    std::strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &local);
+    std::string path = directory;
+    if (path.empty()) {
+#ifdef _WIN32
+        const char* temp = std::getenv("TEMP");
+#else
+        const char* temp = std::getenv("TMPDIR");
+#endif
+        path = temp && *temp ? temp : "/tmp";
+    }
+    return path + "/kinect-ndi-" + name + "-" + stamp + extension;
+}
+
+std::string FlightRecorder::DumpPath(const std::string& directory, const std::string& reason)
+{
+    return TimestampedPath(directory, "flight", "-" + reason + ".csv");
+}
+
+static volatile std::sig_atomic_t signalRequested = 0;
+
+#ifdef SIGUSR1
+static void OnDumpSignal(int)
+{
+    signalRequested = 1;
+}
+#endif
+
+void FlightRecorder::InstallSignalHandler()
+{
+#ifdef SIGUSR1
+    std::signal(SIGUSR1, OnDumpSignal);
+#endif
+}
+
+bool FlightRecorder::RequestedBySignal()
+{
+    if (!signalRequested)
+        return false;
+    signalRequested = 0;
+    return true;
+}
+
+} // namespace kndi
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace kndi {
+
+// What a flight record describes.
+enum class FlightEvent : uint8_t {
+    Frame,        // A frame went through the pipeline (or was discarded).
+    Connect,      // A Kinect connected and started streaming.
+    Disconnect,   // A streaming Kinect was lost.
+    Failover,     // A standby took over the sinks.
+    Watchdog,     // The active Kinect delivered nothing for watchdog_ms.
+    Drop,         // A derived frame was skipped (no free pool buffer).
+    Dump          // The ring was dumped.
+};
+
+// One fixed-size entry in the ring. Timestamps are host monotonic ns; 0
+// means the stage was not reached.
+struct FlightRecord {
+    int64_t captureNs;        // libfreenect callback (frame host timestamp).
+    int64_t syncedNs;         // Device timestamp on the host clock (0: not locked).
+    int64_t deliverNs;        // Taken from the device by the capture loop.
+    int64_t dispatchNs;       // Sinks started (after the dispatch lock).
+    int64_t doneNs;           // Sinks finished.
+    uint64_t sequence;        // Per-stream frame counter.
+    uint32_t deviceTimestamp; // Kinect 60 MHz counter.
+    uint32_t dropped;         // Frames the device has dropped since connecting.
+    uint16_t poolInUse;       // Buffers of the frame's pool in use (queue depth).
+    uint16_t stream;          // kndi_stream, 0 for events.
+    int16_t device;           // Kinect index, -1 for merged frames.
+    FlightEvent event;
+    bool active;              // Frame reached the sinks (not a standby frame).
+};
+
+// "<directory>/kinect-ndi-<name>-<YYYYmmdd-HHMMSS><extension>" with the
+// wall-clock time; an empty `directory` means the temp directory.
+std::string TimestampedPath(const std::string& directory, const std::string& name,
+                            const std::string& extension);
+
+// Fixed-size in-memory ring of the most recent flight records, written from
+// the capture threads without locks or allocation. Dump() snapshots the
+// ring and writes it as CSV on a background thread, so it may be called
+// from a capture thread.
+class FlightRecorder {
+public:
+    // `capacity` records (0 disables recording).
+    explicit FlightRecorder(size_t capacity);
+    ~FlightRecorder();
+
+    FlightRecorder(const FlightRecorder&) = delete;
+    FlightRecorder& operator=(const FlightRecorder&) = delete;
+
+    bool Enabled() const { return capacity > 0; }
+    size_t Capacity() const { return capacity; }
+
+    void Add(const FlightRecord& record);
+    void AddEvent(FlightEvent event, int device, int64_t nowNs);
+
+    // Append the records added since `cursor` (oldest first) to `out` and
+    // advance `cursor` past them. Records already overwritten are skipped;
+    // reading stops at one still being written, to resume there. Lock-free,
+    // so a reader never holds up the capture threads.
+    void Read(uint64_t& cursor, std::vector<FlightRecord>& out) const;
+
+    // Write the records currently in the ring to `path` (oldest first).
+    // Returns false if the recorder is disabled or a dump is still running.
+    bool Dump(const std::string& path, const std::string& reason);
+    // Wait for a running dump to finish; returns whether it succeeded.
+    bool WaitForDump();
+
+    // File name for a dump in `directory` (empty: the temp directory),
+    // stamped with the wall-clock time.
+    static std::string DumpPath(const std::string& directory, const std::string& reason);
+
+    // Route SIGUSR1 to RequestedBySignal() (POSIX only; no-op elsewhere).
+    static void InstallSignalHandler();
+    // True once after SIGUSR1 was received.
+    static bool RequestedBySignal();
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> stamp;  // Index + 1 of the record held, 0 while written.
+        FlightRecord record;
+    };
+
+    std::unique_ptr<Slot[]> ring;
+    size_t capacity;
+    std::atomic<uint64_t> head;
+
+    std::mutex dumpMutex;
+    std::thread dumpThread;
+    std::atomic<bool> dumping;
+    std::atomic<bool> lastDumpOk;
+};
+
+} // namespace kndi
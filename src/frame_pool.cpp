@@ -0,0 +1,110 @@
+#include "frame_pool.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "realtime_memory.h"
+
+namespace kndi {
+
+// Buffers are aligned for SIMD loads and so that rows never split cache lines
+// more than necessary.
+static constexpr size_t kBufferAlignment = 64;
+
+static uint8_t* AllocateAligned(size_t bytes)
+{
+    size_t rounded = (bytes + kBufferAlignment - 1) / kBufferAlignment * kBufferAlignment;
+#ifdef _WIN32
+    void* ptr = _aligned_malloc(rounded, kBufferAlignment);
+#else
+    void* ptr = nullptr;
+    if (posix_memalign(&ptr, kBufferAlignment, rounded) != 0)
+        ptr = nullptr;
+#endif
+    if (!ptr)
+        throw std::bad_alloc();
+    return static_cast<uint8_t*>(ptr);
+}
+
+static void FreeAligned(uint8_t* ptr)
+{
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    std::free(ptr);
+#endif
+}
+
+FramePool::FramePool(size_t slots, size_t bytesPerFrame)
+    : bytesPerFrame(bytesPerFrame)
+{
+    buffers.reserve(slots);
+    for (size_t i = 0; i < slots; i++) {
+        FrameBuffer* buffer = new FrameBuffer;
+        std::memset(&buffer->frame, 0, sizeof(buffer->frame));
+        buffer->refs.store(0);
+        buffer->pool = this;
+        buffer->storage = AllocateAligned(bytesPerFrame);
+        buffer->capacity = bytesPerFrame;
+        buffer->frame.data = buffer->storage;
+        buffers.push_back(buffer);
+    }
+}
+
+FramePool::~FramePool()
+{
+    for (FrameBuffer* buffer : buffers) {
+        FreeAligned(buffer->storage);
+        delete buffer;
+    }
+}
+
+FrameBuffer* FramePool::Acquire()
+{
+    for (FrameBuffer* buffer : buffers) {
+        int expected = 0;
+        if (buffer->refs.compare_exchange_strong(expected, 1, std::memory_order_acquire))
+            return buffer;
+    }
+    return nullptr;
+}
+
+size_t FramePool::InUse() const
+{
+    size_t used = 0;
+    for (const FrameBuffer* buffer : buffers)
+        used += buffer->refs.load(std::memory_order_relaxed) > 0 ? 1 : 0;
+    return used;
+}
+
+void FramePool::Prefault()
+{
+    for (FrameBuffer* buffer : buffers)
+        PrefaultMemory(buffer->storage, buffer->capacity);
+}
+
+bool FramePool::Lock()
+{
+    bool locked = true;
+    for (FrameBuffer* buffer : buffers)
+        locked = LockMemory(buffer->storage, buffer->capacity) && locked;
+    return locked;
+}
+
+void FramePool::Retain(FrameBuffer* buffer)
+{
+    buffer->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FramePool::Release(FrameBuffer* buffer)
+{
+    buffer->refs.fetch_sub(1, std::memory_order_release);
+}
+
+FrameBuffer* FramePool::FromFrame(const kndi_frame* frame)
+{
+    return reinterpret_cast<FrameBuffer*>(const_cast<kndi_frame*>(frame));
+}
+
+} // namespace kndi
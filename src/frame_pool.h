@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "kinect_ndi.h"
+
+namespace kndi {
+
+class FramePool;
+
+// One pool slot. `frame` must stay the first member so a kndi_frame handed
+// out through the C API can be mapped back to its slot.
+struct FrameBuffer {
+    kndi_frame frame;
+    std::atomic<int> refs;
+    FramePool* pool;
+    uint8_t* storage;
+    size_t capacity;
+};
+
+// Fixed set of preallocated frame buffers shared between libfreenect (which
+// writes into them directly) and consumers. Slots are reference counted and
+// recycled when the last reference is dropped; nothing is allocated after
+// construction.
+class FramePool {
+public:
+    FramePool(size_t slots, size_t bytesPerFrame);
+    ~FramePool();
+
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    // Returns a free slot holding one reference, or nullptr if all are in use.
+    FrameBuffer* Acquire();
+
+    size_t Slots() const { return buffers.size(); }
+    size_t BytesPerFrame() const { return bytesPerFrame; }
+    // Buffers currently referenced (filling, queued or held by consumers).
+    size_t InUse() const;
+
+    // Touch every page of every buffer so none faults on first use.
+    void Prefault();
+    // Lock every buffer in RAM; false if any could not be locked.
+    bool Lock();
+
+    static void Retain(FrameBuffer* buffer);
+    static void Release(FrameBuffer* buffer);
+    static FrameBuffer* FromFrame(const kndi_frame* frame);
+
+private:
+    std::vector<FrameBuffer*> buffers;
+    size_t bytesPerFrame;
+};
+
+} // namespace kndi
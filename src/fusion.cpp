@@ -0,0 +1,192 @@
+#include "fusion.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "depth_units.h"
+
+namespace kndi {
+
+static constexpr uint16_t kEmpty = 0xFFFF;
+
+DepthFusion::DepthFusion(const FusionSettings& settings, const std::vector<Pose>& poses,
+                         const Pose& virtualPose, int depthWidth, int depthHeight, const RoiMask& roi)
+    : settings(settings), depthWidth(depthWidth), depthHeight(depthHeight), roi(roi)
+{
+    if (this->roi.Width() != depthWidth || this->roi.Height() != depthHeight)
+        this->roi.Compile(std::vector<RoiPolygon>(), depthWidth, depthHeight);
+    int step = std::max(settings.cloudStep, 1);
+    maxPointsPerDevice = settings.cloudStep > 0
+        ? static_cast<size_t>((depthWidth + step - 1) / step) * ((depthHeight + step - 1) / step)
+        : 0;
+
+    Intrinsics depthIntrinsics = KinectDepthIntrinsics(depthWidth, depthHeight);
+    for (const Pose& pose : poses) {
+        std::unique_ptr<Input> input(new Input);
+        input->pose = pose;
+        BuildRayTable(depthIntrinsics, pose, depthWidth, depthHeight, input->rays);
+        input->zbuffer.resize(static_cast<size_t>(settings.width) * settings.height);
+        inputs.push_back(std::move(input));
+    }
+    frames.resize(inputs.size(), nullptr);
+
+    // world → virtual camera = R^T * (p - t).
+    virtualIntrinsics = KinectDepthIntrinsics(settings.width, settings.height);
+    const float* r = virtualPose.rotation;
+    const float* t = virtualPose.translation;
+    for (int row = 0; row < 3; row++) {
+        for (int col = 0; col < 3; col++)
+            worldToVirtual[row * 4 + col] = r[col * 3 + row];
+        worldToVirtual[row * 4 + 3] = -(r[0 * 3 + row] * t[0] + r[1 * 3 + row] * t[1] + r[2 * 3 + row] * t[2]);
+    }
+}
+
+DepthFusion::~DepthFusion()
+{
+    for (const std::unique_ptr<Input>& input : inputs) {
+        if (input->latest)
+            FramePool::Release(input->latest);
+    }
+}
+
+void DepthFusion::Submit(int device, FrameBuffer* depth)
+{
+    Input& input = *inputs[device];
+    FrameBuffer* previous;
+    {
+        std::lock_guard<std::mutex> lock(input.mutex);
+        previous = input.latest;
+        input.latest = depth;
+    }
+    if (previous)
+        FramePool::Release(previous);
+}
+
+size_t DepthFusion::Project(Input& input, const uint16_t* raw, float* cloud)
+{
+    const uint16_t* toMm = RawDepthToMillimetres();
+    const float* rays = input.rays.data();
+    const float tx = input.pose.translation[0];
+    const float ty = input.pose.translation[1];
+    const float tz = input.pose.translation[2];
+    const int outWidth = settings.width;
+    const int outHeight = settings.height;
+    uint16_t* zbuffer = input.zbuffer.data();
+    std::fill(input.zbuffer.begin(), input.zbuffer.end(), kEmpty);
+
+    const float invCell = 1.0f / settings.cellMm;
+    const float* v = worldToVirtual;
+    const Intrinsics& vi = virtualIntrinsics;
+    const int step = settings.cloudStep;
+    size_t points = 0;
+
+    roi.ForEachSpan(0, depthHeight, [&](int y, int begin, int end) {
+        const uint16_t* row = raw + static_cast<size_t>(y) * depthWidth;
+        const float* ray = rays + (static_cast<size_t>(y) * depthWidth + begin) * 3;
+        bool cloudRow = cloud && step > 0 && y % step == 0;
+        for (int x = begin; x < end; x++, ray += 3) {
+            uint16_t mm = toMm[row[x] & 2047];
+            if (!mm)
+                continue;
+            float z = mm;
+            float wx = z * ray[0] + tx;
+            float wy = z * ray[1] + ty;
+            float wz = z * ray[2] + tz;
+
+            if (cloudRow && x % step == 0) {
+                cloud[points * 3 + 0] = wx;
+                cloud[points * 3 + 1] = wy;
+                cloud[points * 3 + 2] = wz;
+                points++;
+            }
+
+            float u, w, distance;
+            if (settings.topDown) {
+                u = (wx - settings.originXMm) * invCell;
+                w = (wy - settings.originYMm) * invCell;
+                distance = settings.topMm - wz;
+            } else {
+                float cx = v[0] * wx + v[1] * wy + v[2] * wz + v[3];
+                float cy = v[4] * wx + v[5] * wy + v[6] * wz + v[7];
+                distance = v[8] * wx + v[9] * wy + v[10] * wz + v[11];
+                if (distance < 1.0f)
+                    continue;
+                u = vi.fx * cx / distance + vi.cx;
+                w = vi.fy * cy / distance + vi.cy;
+            }
+            if (u < 0.0f || w < 0.0f || u >= outWidth || w >= outHeight)
+                continue;
+            if (distance < 1.0f || distance >= kEmpty)
+                continue;
+            uint16_t value = static_cast<uint16_t>(distance);
+            uint16_t& cell = zbuffer[static_cast<int>(w) * outWidth + static_cast<int>(u)];
+            if (value < cell)
+                cell = value;
+        }
+    });
+    return points;
+}
+
+size_t DepthFusion::Fuse(ThreadPool& pool, int64_t nowNs, uint16_t* merged, float* cloud)
+{
+    // Pin each device's latest frame for the duration of the pass.
+    const int64_t staleNs = static_cast<int64_t>(settings.staleMs) * 1000000;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        frames[i] = nullptr;
+        std::lock_guard<std::mutex> lock(inputs[i]->mutex);
+        FrameBuffer* latest = inputs[i]->latest;
+        if (latest && nowNs - latest->frame.host_timestamp_ns <= staleNs) {
+            FramePool::Retain(latest);
+            frames[i] = latest;
+        }
+    }
+
+    // One task per device: back-project into its own z-buffer and its own
+    // slice of the cloud.
+    pool.ParallelFor(static_cast<int>(inputs.size()), [&](int i) {
+        Input& input = *inputs[i];
+        if (!frames[i]) {
+            std::fill(input.zbuffer.begin(), input.zbuffer.end(), kEmpty);
+            input.points = 0;
+            return;
+        }
+        const uint16_t* raw = static_cast<const uint16_t*>(frames[i]->frame.data);
+        input.points = Project(input, raw, cloud ? cloud + i * maxPointsPerDevice * 3 : nullptr);
+    });
+
+    for (FrameBuffer* frame : frames) {
+        if (frame)
+            FramePool::Release(frame);
+    }
+
+    // Min-merge the z-buffers in row bands.
+    const int bandRows = 16;
+    const int bands = (settings.height + bandRows - 1) / bandRows;
+    const size_t devices = inputs.size();
+    pool.ParallelFor(bands, [&](int band) {
+        size_t begin = static_cast<size_t>(band) * bandRows * settings.width;
+        size_t end = std::min(begin + static_cast<size_t>(bandRows) * settings.width,
+                              static_cast<size_t>(settings.width) * settings.height);
+        for (size_t p = begin; p < end; p++) {
+            uint16_t nearest = kEmpty;
+            for (size_t d = 0; d < devices; d++)
+                nearest = std::min(nearest, inputs[d]->zbuffer[p]);
+            merged[p] = nearest == kEmpty ? 0 : nearest;
+        }
+    });
+
+    // Close the gaps between the per-device cloud slices.
+    size_t total = 0;
+    if (!cloud)
+        return total;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        size_t points = inputs[i]->points;
+        float* slice = cloud + i * maxPointsPerDevice * 3;
+        if (points && slice != cloud + total * 3)
+            std::memmove(cloud + total * 3, slice, points * 3 * sizeof(float));
+        total += points;
+    }
+    return total;
+}
+
+} // namespace kndi
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "camera_model.h"
+#include "frame_pool.h"
+#include "roi.h"
+#include "thread_pool.h"
+
+namespace kndi {
+
+// Output of the multi-Kinect fusion stage. World coordinates are in
+// millimetres with Z up (X/Y span the floor).
+struct FusionSettings {
+    bool topDown = true;       // Orthographic view from above, else a virtual pinhole camera.
+    int width = 512;           // Merged depth image size.
+    int height = 512;
+    float cellMm = 10.0f;      // Top-down: world size of one output pixel.
+    float originXMm = -2560.0f; // Top-down: world X/Y at output pixel (0, 0);
+    float originYMm = -2560.0f; // columns follow +X, rows follow +Y.
+    float topMm = 3000.0f;     // Top-down: height of the virtual overhead camera.
+    int cloudStep = 4;         // Point cloud keeps every Nth pixel in x and y (0 = none).
+    int staleMs = 200;         // Devices with older depth are left out.
+};
+
+// Merges depth from several Kinects into one depth image (millimetres,
+// 0 = empty, nearest surface wins) and a world-space point cloud. Each
+// device's depth is back-projected through its precomputed ray table into
+// its own z-buffer on the thread pool; the z-buffers are then min-merged in
+// row bands.
+class DepthFusion {
+public:
+    // `poses[i]` is the camera-to-world pose of device i; `virtualPose` is
+    // the pose of the virtual camera (unused for top-down). Only depth
+    // pixels inside `roi` are projected.
+    DepthFusion(const FusionSettings& settings, const std::vector<Pose>& poses,
+                const Pose& virtualPose, int depthWidth, int depthHeight, const RoiMask& roi);
+    ~DepthFusion();
+
+    DepthFusion(const DepthFusion&) = delete;
+    DepthFusion& operator=(const DepthFusion&) = delete;
+
+    const FusionSettings& Settings() const { return settings; }
+    int Devices() const { return static_cast<int>(inputs.size()); }
+    // Points per fused cloud at most (3 floats each).
+    size_t MaxCloudPoints() const { return maxPointsPerDevice * inputs.size(); }
+
+    // Hand over the latest raw 11-bit depth frame of `device` (takes over one
+    // reference). May be called from any capture thread.
+    void Submit(int device, FrameBuffer* depth);
+
+    // Fuse the latest frames into `merged` (width * height uint16) and
+    // `cloud` (MaxCloudPoints() * 3 floats, or nullptr to skip the cloud).
+    // Returns the number of points. One caller at a time.
+    size_t Fuse(ThreadPool& pool, int64_t nowNs, uint16_t* merged, float* cloud);
+
+private:
+    struct Input {
+        std::mutex mutex;
+        FrameBuffer* latest = nullptr;
+        Pose pose;
+        std::vector<float> rays;
+        std::vector<uint16_t> zbuffer;
+        size_t points = 0;
+    };
+
+    // Points go to `cloud` unless it is nullptr; returns how many.
+    size_t Project(Input& input, const uint16_t* raw, float* cloud);
+
+    FusionSettings settings;
+    int depthWidth;
+    int depthHeight;
+    RoiMask roi;
+    size_t maxPointsPerDevice;
+    Intrinsics virtualIntrinsics;
+    float worldToVirtual[12];  // Inverse of the virtual camera pose, 3x4.
+    std::vector<std::unique_ptr<Input>> inputs;
+    std::vector<FrameBuffer*> frames;   // Pinned by Fuse(), one per input.
+};
+
+} // namespace kndi
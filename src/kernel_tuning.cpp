@@ -0,0 +1,446 @@
+#include "kernel_tuning.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#ifdef _WIN32
+  #include <direct.h>
+#else
+  #include <sys/stat.h>
+#endif
+
+#include "planner.h"
+
+namespace kndi {
+
+namespace {
+
+// Where the converted pixel of source (x, y) goes: origin + x * stepX +
+// y * stepY bytes into the destination.
+struct Placement {
+    ptrdiff_t origin;
+    ptrdiff_t stepX;
+    ptrdiff_t stepY;
+};
+
+} // namespace
+
+static Placement Place(Orientation orientation, int width, int height, int dstStride)
+{
+    ptrdiff_t right = static_cast<ptrdiff_t>(width - 1) * 4;
+    ptrdiff_t bottom = static_cast<ptrdiff_t>(height - 1);
+    switch (orientation) {
+    case Orientation::None:      break;
+    case Orientation::Mirror:    return Placement{ right, -4, dstStride };
+    case Orientation::Flip:      return Placement{ bottom * dstStride, 4, -dstStride };
+    case Orientation::Rotate90:  return Placement{ bottom * 4, dstStride, -4 };
+    case Orientation::Rotate180: return Placement{ bottom * dstStride + right, -4, -dstStride };
+    case Orientation::Rotate270: return Placement{ static_cast<ptrdiff_t>(width - 1) * dstStride, -dstStride, 4 };
+    }
+    return Placement{ 0, 4, dstStride };
+}
+
+// Rotated frames are converted a tile at a time into a buffer that stays in
+// L1 and copied from there to their turned place, each tile column as a run
+// of kTile pixels of one destination row, so both sides of the copy are
+// cache friendly.
+static const int kTile = 32;
+
+static inline void Store32(uint8_t* p, uint32_t v)
+{
+    std::memcpy(p, &v, 4);
+}
+
+// Copy a converted tile (rows kTile pixels apart) to `out`, where its
+// first pixel goes in a rotated frame.
+static void Scatter(const uint8_t* tile, int columns, int rows, uint8_t* out, const Placement& place)
+{
+    const uint32_t* in = reinterpret_cast<const uint32_t*>(tile);
+    // Rotated: tile columns become destination rows, four at a time.
+    int c = 0;
+    for (; c + 4 <= columns; c += 4) {
+        uint8_t* row0 = out + c * place.stepX;
+        uint8_t* row1 = row0 + place.stepX;
+        uint8_t* row2 = row1 + place.stepX;
+        uint8_t* row3 = row2 + place.stepX;
+        for (int r = 0; r < rows; r++) {
+            const uint32_t* pixels = in + r * kTile + c;
+            ptrdiff_t offset = r * place.stepY;
+            Store32(row0 + offset, pixels[0]);
+            Store32(row1 + offset, pixels[1]);
+            Store32(row2 + offset, pixels[2]);
+            Store32(row3 + offset, pixels[3]);
+        }
+    }
+    for (; c < columns; c++) {
+        uint8_t* row = out + c * place.stepX;
+        for (int r = 0; r < rows; r++)
+            Store32(row + r * place.stepY, in[r * kTile + c]);
+    }
+}
+
+// Reverse the pixels [begin, end) of a BGRX row.
+static void ReverseRow(uint8_t* row, int begin, int end)
+{
+    uint32_t* pixels = reinterpret_cast<uint32_t*>(row);
+    std::reverse(pixels + begin, pixels + end);
+}
+
+// Convert rows [first, first + rows), whole or span by span.
+static void ConvertRows(const KernelChoice& choice, const void* src, int srcStride, uint8_t* dst,
+                        const Placement& place, int width, int first, int rows, const RoiMask* roi)
+{
+    const uint8_t* source = static_cast<const uint8_t*>(src);
+    // Pool frames are packed, so the stride gives the sample size.
+    int srcBytes = srcStride / width;
+    if (place.stepX == 4) {
+        // Rows stay rows in order (or bottom-up, with a negative stride):
+        // the kernel writes them in place.
+        uint8_t* origin = dst + place.origin;
+        int dstStride = static_cast<int>(place.stepY);
+        if (!roi) {
+            choice.variant.kernel(source + static_cast<size_t>(first) * srcStride, srcStride,
+                                  origin + first * place.stepY, dstStride, width, rows);
+            return;
+        }
+        roi->ForEachSpan(first, rows, [&](int y, int begin, int end) {
+            choice.variant.kernel(source + static_cast<size_t>(y) * srcStride + begin * srcBytes, srcStride,
+                                  origin + y * place.stepY + begin * 4, dstStride, end - begin, 1);
+        });
+        return;
+    }
+    if (place.stepX == -4) {
+        // Mirrored: each row is converted into its destination row, then
+        // reversed there while it is still in L1.
+        uint8_t* origin = dst + place.origin - static_cast<ptrdiff_t>(width - 1) * 4;
+        int dstStride = static_cast<int>(place.stepY);
+        if (!roi) {
+            for (int y = first; y < first + rows; y++) {
+                uint8_t* row = origin + y * place.stepY;
+                choice.variant.kernel(source + static_cast<size_t>(y) * srcStride, srcStride, row, dstStride,
+                                      width, 1);
+                ReverseRow(row, 0, width);
+            }
+            return;
+        }
+        roi->ForEachSpan(first, rows, [&](int y, int begin, int end) {
+            // The span lands at the mirrored columns [width - end, width - begin).
+            uint8_t* row = origin + y * place.stepY;
+            choice.variant.kernel(source + static_cast<size_t>(y) * srcStride + begin * srcBytes, srcStride,
+                                  row + (width - end) * 4, dstStride, end - begin, 1);
+            ReverseRow(row, width - end, width - begin);
+        });
+        return;
+    }
+
+    alignas(64) uint8_t tile[kTile * kTile * 4];
+    if (!roi) {
+        for (int y = first; y < first + rows; y += kTile) {
+            int tileRows = std::min(kTile, first + rows - y);
+            for (int x = 0; x < width; x += kTile) {
+                int tileColumns = std::min(kTile, width - x);
+                choice.variant.kernel(source + static_cast<size_t>(y) * srcStride + x * srcBytes, srcStride,
+                                      tile, kTile * 4, tileColumns, tileRows);
+                Scatter(tile, tileColumns, tileRows, dst + place.origin + x * place.stepX + y * place.stepY,
+                        place);
+            }
+        }
+        return;
+    }
+    roi->ForEachSpan(first, rows, [&](int y, int begin, int end) {
+        for (int x = begin; x < end; x += kTile) {
+            int tileColumns = std::min(kTile, end - x);
+            choice.variant.kernel(source + static_cast<size_t>(y) * srcStride + x * srcBytes, srcStride,
+                                  tile, kTile * 4, tileColumns, 1);
+            Scatter(tile, tileColumns, 1, dst + place.origin + x * place.stepX + y * place.stepY, place);
+        }
+    });
+}
+
+void RunConversion(const KernelChoice& choice, ThreadPool* pool, const void* src, int srcStride,
+                   uint8_t* dst, int dstStride, int width, int height, const RoiMask* roi,
+                   Orientation orientation)
+{
+    if (roi && (roi->IsFull() || roi->Width() != width || roi->Height() != height))
+        roi = nullptr;
+    Placement place = Place(orientation, width, height, dstStride);
+    if (choice.bands <= 1 || !pool || pool->Size() == 1) {
+        ConvertRows(choice, src, srcStride, dst, place, width, 0, height, roi);
+        return;
+    }
+    int rowsPerBand = (height + choice.bands - 1) / choice.bands;
+    // Whole tiles per band, so bands of a rotated frame do not share
+    // destination cache lines.
+    if (place.stepX != 4)
+        rowsPerBand = (rowsPerBand + kTile - 1) / kTile * kTile;
+    pool->ParallelFor(choice.bands, [&](int band) {
+        int first = band * rowsPerBand;
+        int rows = std::min(rowsPerBand, height - first);
+        if (rows <= 0)
+            return;
+        ConvertRows(choice, src, srcStride, dst, place, width, first, rows, roi);
+    });
+}
+
+static int BytesPerSample(kndi_stream stream)
+{
+    switch (stream) {
+    case KNDI_STREAM_RGB:         return 3;
+    case KNDI_STREAM_IR:          return 1;
+    case KNDI_STREAM_DEPTH:       return 2;
+    case KNDI_STREAM_FUSED_DEPTH: return 2;
+    case KNDI_STREAM_POINT_CLOUD: return 12;
+    case KNDI_STREAM_MESH:        return 1;
+    }
+    return 1;
+}
+
+static std::string WithoutSpaces(std::string text)
+{
+    text.erase(0, text.find_first_not_of(" \t"));
+    text.erase(text.find_last_not_of(" \t\r\n") + 1);
+    std::replace(text.begin(), text.end(), ' ', '_');
+    std::replace(text.begin(), text.end(), '\t', '_');
+    return text;
+}
+
+std::string HostSignature()
+{
+    std::string model;
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line)) {
+        size_t colon = line.find(':');
+        if (colon == std::string::npos)
+            continue;
+        std::string key = WithoutSpaces(line.substr(0, colon));
+        // x86 reports "model name"; Raspberry Pi kernels "Model" / "Hardware".
+        if (key == "model_name" || key == "Model" || (key == "Hardware" && model.empty())) {
+            model = WithoutSpaces(line.substr(colon + 1));
+            if (key != "Hardware")
+                break;
+        }
+    }
+    if (model.empty())
+        model = "unknown-cpu";
+    return model + "/" + std::to_string(std::max(1u, std::thread::hardware_concurrency())) + "t";
+}
+
+std::string DefaultTuningPath()
+{
+#ifdef _WIN32
+    const char* base = std::getenv("LOCALAPPDATA");
+    if (!base)
+        return std::string();
+    return std::string(base) + "\\kinect-ndi\\kernels.txt";
+#else
+    const char* cache = std::getenv("XDG_CACHE_HOME");
+    if (cache && *cache)
+        return std::string(cache) + "/kinect-ndi/kernels.txt";
+    const char* home = std::getenv("HOME");
+    if (!home)
+        return std::string();
+    return std::string(home) + "/.cache/kinect-ndi/kernels.txt";
+#endif
+}
+
+// Create every missing directory leading up to `path`.
+static void MakeParentDirectories(const std::string& path)
+{
+    for (size_t i = 1; i < path.size(); i++) {
+        if (path[i] != '/' && path[i] != '\\')
+            continue;
+        std::string dir = path.substr(0, i);
+#ifdef _WIN32
+        _mkdir(dir.c_str());
+#else
+        mkdir(dir.c_str(), 0755);
+#endif
+    }
+}
+
+void KernelTuner::Begin(const std::string& cachePath, bool retuneAll, ThreadPool& workerPool)
+{
+    path = cachePath;
+    pool = &workerPool;
+    retune = retuneAll;
+    host = HostSignature();
+    entries.clear();
+    if (path.empty())
+        return;
+
+    std::ifstream file(path.c_str());
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        Entry entry;
+        char separator = 0;
+        if (!(fields >> entry.host) || entry.host[0] == '#')
+            continue;
+        if (!(fields >> entry.stream >> entry.width >> separator >> entry.height >> entry.variant
+                     >> entry.bands >> entry.ms) || separator != 'x')
+            continue;
+        entry.used = false;
+        entry.tuned = false;
+        entries.push_back(entry);
+    }
+}
+
+KernelChoice KernelTuner::Choose(kndi_stream stream, int width, int height)
+{
+    std::vector<ConvertVariant> variants = ConvertVariants(stream);
+    KernelChoice choice = { variants.empty() ? ConvertVariant{ "none", nullptr } : variants[0], 1 };
+    if (variants.empty() || width <= 0 || height <= 0)
+        return choice;
+
+    Entry* found = nullptr;
+    for (Entry& entry : entries) {
+        if (entry.host == host && entry.stream == StreamKey(stream) &&
+            entry.width == width && entry.height == height) {
+            found = &entry;
+            break;
+        }
+    }
+    // Variants missing from this build (or CPU) invalidate the cached choice.
+    const ConvertVariant* variant = nullptr;
+    if (found && !(retune && !found->tuned)) {
+        for (const ConvertVariant& candidate : variants) {
+            if (found->variant == candidate.name)
+                variant = &candidate;
+        }
+    }
+    if (found && !variant) {
+        entries.erase(entries.begin() + (found - entries.data()));
+        found = nullptr;
+    }
+    if (!found) {
+        entries.push_back(Tune(stream, width, height));
+        found = &entries.back();
+        for (const ConvertVariant& candidate : variants) {
+            if (found->variant == candidate.name)
+                variant = &candidate;
+        }
+    }
+    found->used = true;
+    choice.variant = *variant;
+    choice.bands = found->bands;
+    return choice;
+}
+
+KernelTuner::Entry KernelTuner::Tune(kndi_stream stream, int width, int height)
+{
+    // Synthetic frame covering the stream's value range.
+    int srcStride = width * BytesPerSample(stream);
+    std::vector<uint8_t> src(static_cast<size_t>(srcStride) * height);
+    if (BytesPerSample(stream) == 2) {
+        uint16_t* samples = reinterpret_cast<uint16_t*>(src.data());
+        uint16_t range = stream == KNDI_STREAM_DEPTH ? 2048 : 10000;
+        for (size_t i = 0; i < src.size() / 2; i++)
+            samples[i] = static_cast<uint16_t>((i * 7) % range);
+    } else {
+        for (size_t i = 0; i < src.size(); i++)
+            src[i] = static_cast<uint8_t>(i * 7);
+    }
+    int dstStride = width * 4;
+    std::vector<uint8_t> reference(static_cast<size_t>(dstStride) * height);
+    std::vector<uint8_t> dst(reference.size());
+
+    std::vector<ConvertVariant> variants = ConvertVariants(stream);
+    variants[0].kernel(src.data(), srcStride, reference.data(), dstStride, width, height);
+
+    Entry best;
+    best.host = host;
+    best.stream = StreamKey(stream);
+    best.width = width;
+    best.height = height;
+    best.variant = variants[0].name;
+    best.bands = 1;
+    best.ms = 1e9;
+    best.used = false;
+    best.tuned = true;
+
+    // Single-threaded pass to pick the kernel...
+    for (const ConvertVariant& variant : variants) {
+        std::fill(dst.begin(), dst.end(), 0);
+        variant.kernel(src.data(), srcStride, dst.data(), dstStride, width, height);
+        if (dst != reference) {
+            std::cerr << "Kernel " << StreamKey(stream) << "/" << variant.name
+                      << " does not match the reference output; skipped." << std::endl;
+            continue;
+        }
+        double ms = MeasureMs([&] {
+            variant.kernel(src.data(), srcStride, dst.data(), dstStride, width, height);
+        }, 10.0);
+        if (ms < best.ms) {
+            best.ms = ms;
+            best.variant = variant.name;
+        }
+    }
+
+    // ...then the row-band split on the worker pool.
+    KernelChoice choice = { variants[0], 1 };
+    for (const ConvertVariant& variant : variants) {
+        if (best.variant == variant.name)
+            choice.variant = variant;
+    }
+    for (int bands = 2; pool && pool->Size() > 1 && bands <= 2 * pool->Size() && bands <= height; bands *= 2) {
+        choice.bands = bands;
+        double ms = MeasureMs([&] {
+            RunConversion(choice, pool, src.data(), srcStride, dst.data(), dstStride, width, height);
+        }, 10.0);
+        if (ms < best.ms) {
+            best.ms = ms;
+            best.bands = bands;
+        }
+    }
+    return best;
+}
+
+std::string KernelTuner::Finish()
+{
+    bool tunedAny = false;
+    std::string summary;
+    char line[160];
+    for (const Entry& entry : entries) {
+        if (entry.tuned)
+            tunedAny = true;
+        if (!entry.used)
+            continue;
+        std::snprintf(line, sizeof(line), "  %-12s %4dx%-4d %-10s %d band%s  %.2f ms%s\n",
+                      entry.stream.c_str(), entry.width, entry.height, entry.variant.c_str(),
+                      entry.bands, entry.bands == 1 ? " " : "s", entry.ms,
+                      entry.tuned ? "" : "  (cached)");
+        summary += line;
+    }
+    if (!summary.empty())
+        summary = "Conversion kernels for " + host + ":\n" + summary;
+
+    if (tunedAny && !path.empty()) {
+        MakeParentDirectories(path);
+        std::ofstream file(path.c_str(), std::ios::trunc);
+        if (!file) {
+            std::cerr << "Could not write kernel tuning cache " << path << "." << std::endl;
+        } else {
+            file << "# kinect-ndi kernel tuning: host stream size variant bands ms\n";
+            for (const Entry& entry : entries) {
+                file << entry.host << ' ' << entry.stream << ' ' << entry.width << 'x' << entry.height
+                     << ' ' << entry.variant << ' ' << entry.bands << ' ' << entry.ms << '\n';
+            }
+        }
+    }
+    for (Entry& entry : entries) {
+        entry.tuned = false;
+        entry.used = false;
+    }
+    retune = false;
+    return summary;
+}
+
+} // namespace kndi
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "convert.h"
+#include "roi.h"
+#include "thread_pool.h"
+
+namespace kndi {
+
+// Conversion kernel and row-band split picked for one stream.
+struct KernelChoice {
+    ConvertVariant variant;
+    int bands;                 // Row bands converted in parallel on the worker pool.
+};
+
+// Run `choice` over a whole frame, splitting the rows into bands on `pool`.
+// With a partial `roi` of the frame's size only the spans inside it are
+// converted; pixels outside are left as they are in `dst`. `width` and
+// `height` are the source's; with an `orientation` other than None each
+// pixel is written straight to its turned place in `dst`, whose rows
+// (`dstStride` bytes apart) are `height` pixels long for the rotations by
+// 90 and 270 degrees.
+void RunConversion(const KernelChoice& choice, ThreadPool* pool, const void* src, int srcStride,
+                   uint8_t* dst, int dstStride, int width, int height, const RoiMask* roi = nullptr,
+                   Orientation orientation = Orientation::None);
+
+// Picks the fastest conversion kernel and band count per stream and frame
+// size on this host. Choices are benchmarked on first use and cached in a
+// small text file keyed by host, so later starts reuse them:
+//   <host> <stream> <width>x<height> <variant> <bands> <ms>
+class KernelTuner {
+public:
+    KernelTuner() : pool(nullptr), retune(false) {}
+
+    // Load cached choices from `path` (empty: no cache). With `retune` every
+    // stream chosen until Finish() is benchmarked again.
+    void Begin(const std::string& path, bool retune, ThreadPool& pool);
+    // Fastest kernel for `stream` frames of this size; benchmarked the first
+    // time a stream and size is seen on this host.
+    KernelChoice Choose(kndi_stream stream, int width, int height);
+    // Save newly tuned choices and return a summary of the chosen variants
+    // (empty if nothing was chosen).
+    std::string Finish();
+
+private:
+    struct Entry {
+        std::string host;
+        std::string stream;
+        int width;
+        int height;
+        std::string variant;
+        int bands;
+        double ms;
+        bool used;
+        bool tuned;
+    };
+
+    Entry Tune(kndi_stream stream, int width, int height);
+
+    std::string path;
+    ThreadPool* pool;
+    bool retune;
+    std::string host;
+    std::vector<Entry> entries;
+};
+
+// Per-user cache file: $XDG_CACHE_HOME/kinect-ndi/kernels.txt, falling back
+// to ~/.cache (%LOCALAPPDATA% on Windows).
+std::string DefaultTuningPath();
+
+// CPU model and hardware thread count, without spaces.
+std::string HostSignature();
+
+} // namespace kndi
@@ -0,0 +1,307 @@
+// C API entry points; thin forwarding onto kndi::Pipeline.
+
+#include "kinect_ndi.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <string>
+
+#include "colour_lut.h"
+#include "depth_filter.h"
+#include "depth_server.h"
+#include "marker_tracker.h"
+#include "frame_pool.h"
+#include "ndi_sink.h"
+#include "pipeline.h"
+#include "replay_sink.h"
+#include "sink.h"
+#include "touch_surface.h"
+#include "video_denoise.h"
+
+struct kndi_pipeline {
+    explicit kndi_pipeline(int deviceIndex) : impl(deviceIndex) {}
+    kndi::Pipeline impl;
+};
+
+// Copy `text` into the caller's buffer, truncated and always terminated.
+static void CopyReport(const std::string& text, char* report, size_t size)
+{
+    if (!report || size == 0)
+        return;
+    size_t length = std::min(text.size(), size - 1);
+    std::memcpy(report, text.data(), length);
+    report[length] = '\0';
+}
+
+extern "C" {
+
+int kndi_version(void)
+{
+    return KNDI_API_VERSION;
+}
+
+const char* kndi_error_string(int error)
+{
+    switch (error) {
+    case KNDI_OK:                return "ok";
+    case KNDI_ERROR_INVALID:     return "invalid argument";
+    case KNDI_ERROR_STATE:       return "not allowed while the pipeline is running or its frames are held";
+    case KNDI_ERROR_NDI:         return "NDI runtime or sender unavailable";
+    case KNDI_ERROR_THREAD:      return "could not start capture thread";
+    case KNDI_ERROR_UNSUPPORTED: return "unsupported option";
+    case KNDI_ERROR_BUDGET:      return "estimated cost exceeds the frame budget";
+    case KNDI_ERROR_IO:          return "file could not be written";
+    }
+    return "unknown error";
+}
+
+kndi_pipeline* kndi_open(int device_index)
+{
+    if (device_index < 0)
+        return nullptr;
+    return new (std::nothrow) kndi_pipeline(device_index);
+}
+
+void kndi_close(kndi_pipeline* pipeline)
+{
+    delete pipeline;
+}
+
+int kndi_set_streams(kndi_pipeline* pipeline, unsigned streams)
+{
+    if (!pipeline)
+        return KNDI_ERROR_INVALID;
+    return pipeline->impl.SetStreams(streams);
+}
+
+int kndi_set_option(kndi_pipeline* pipeline, const char* key, const char* value)
+{
+    if (!pipeline || !key || !value)
+        return KNDI_ERROR_INVALID;
+    return pipeline->impl.SetOption(key, value);
+}
+
+int kndi_add_frame_callback(kndi_pipeline* pipeline, unsigned streams,
+                            kndi_frame_callback callback, void* user)
+{
+    if (!pipeline || !callback || streams == 0)
+        return KNDI_ERROR_INVALID;
+    return pipeline->impl.AddSink(new kndi::CallbackSink(streams, callback, user));
+}
+
+int kndi_add_ndi_sink(kndi_pipeline* pipeline, unsigned streams, const char* ndi_name)
+{
+    if (!pipeline || streams == 0 || (streams & ~KNDI_STREAM_ALL) ||
+        (streams & (KNDI_STREAM_POINT_CLOUD | KNDI_STREAM_MESH)))
+        return KNDI_ERROR_INVALID;
+    if (pipeline->impl.IsRunning())
+        return KNDI_ERROR_STATE;
+    kndi::NdiSink* sink = kndi::NdiSink::Create(streams, ndi_name);
+    if (!sink)
+        return KNDI_ERROR_NDI;
+    return pipeline->impl.AddSink(sink);
+}
+
+int kndi_add_replay_sink(kndi_pipeline* pipeline, unsigned streams, size_t memory_bytes, int seconds)
+{
+    if (!pipeline || streams == 0 || (streams & ~KNDI_STREAM_ALL) ||
+        (streams & (KNDI_STREAM_POINT_CLOUD | KNDI_STREAM_MESH)) ||
+        memory_bytes == 0 || seconds <= 0 || seconds > 3600)
+        return KNDI_ERROR_INVALID;
+    if (pipeline->impl.IsRunning())
+        return KNDI_ERROR_STATE;
+    return pipeline->impl.AddReplaySink(new kndi::ReplaySink(streams, memory_bytes, seconds));
+}
+
+int kndi_save_replay(kndi_pipeline* pipeline, const char* path)
+{
+    if (!pipeline)
+        return KNDI_ERROR_INVALID;
+    return pipeline->impl.SaveReplay(path ? path : "");
+}
+
+int kndi_add_depth_server(kndi_pipeline* pipeline, unsigned streams, const char* address, int compressed)
+{
+    if (!pipeline || !address || !*address || streams == 0 ||
+        (streams & ~(KNDI_STREAM_DEPTH | KNDI_STREAM_FUSED_DEPTH | KNDI_STREAM_MESH)))
+        return KNDI_ERROR_INVALID;
+    if (pipeline->impl.IsRunning())
+        return KNDI_ERROR_STATE;
+#ifndef __linux__
+    return KNDI_ERROR_UNSUPPORTED;
+#else
+    kndi::DepthServer* sink = kndi::DepthServer::Create(streams, address, compressed != 0);
+    if (!sink)
+        return KNDI_ERROR_IO;
+    return pipeline->impl.AddSink(sink);
+#endif
+}
+
+int kndi_add_marker_tracker(kndi_pipeline* pipeline, const char* address, int threshold, int min_pixels,
+                            int max_pixels, int use_depth)
+{
+    if (!pipeline || !address || !*address || threshold < 1 || threshold > 255 || min_pixels < 1 ||
+        max_pixels < min_pixels)
+        return KNDI_ERROR_INVALID;
+    if (pipeline->impl.IsRunning())
+        return KNDI_ERROR_STATE;
+#ifdef _WIN32
+    (void)use_depth;
+    return KNDI_ERROR_UNSUPPORTED;
+#else
+    kndi::MarkerSettings settings;
+    settings.threshold = threshold;
+    settings.minPixels = min_pixels;
+    settings.maxPixels = max_pixels;
+    settings.depth = use_depth != 0;
+    kndi::MarkerTracker* sink = kndi::MarkerTracker::Create(address, settings);
+    if (!sink)
+        return KNDI_ERROR_IO;
+    return pipeline->impl.AddSink(sink);
+#endif
+}
+
+int kndi_add_touch_surface(kndi_pipeline* pipeline, const char* address, float min_mm, float max_mm)
+{
+    if (!pipeline || !address || !*address || !(min_mm >= 0.0f) || !(max_mm > min_mm) || max_mm > 500.0f)
+        return KNDI_ERROR_INVALID;
+    if (pipeline->impl.IsRunning())
+        return KNDI_ERROR_STATE;
+#ifdef _WIN32
+    return KNDI_ERROR_UNSUPPORTED;
+#else
+    kndi::TouchSettings settings;
+    settings.minMm = min_mm;
+    settings.maxMm = max_mm;
+    kndi::TouchSurface* sink = kndi::TouchSurface::Create(address, settings);
+    if (!sink)
+        return KNDI_ERROR_IO;
+    return pipeline->impl.AddSink(sink);
+#endif
+}
+
+int kndi_benchmark_depth_server(int subscribers, int compressed, char* report, size_t report_size)
+{
+    if (subscribers < 1 || subscribers > 256)
+        return KNDI_ERROR_INVALID;
+#ifndef __linux__
+    (void)compressed;
+    (void)report;
+    (void)report_size;
+    return KNDI_ERROR_UNSUPPORTED;
+#else
+    std::string text;
+    bool ok = kndi::DepthServer::Benchmark(subscribers, compressed != 0, text);
+    CopyReport(text, report, report_size);
+    return ok ? KNDI_OK : KNDI_ERROR_IO;
+#endif
+}
+
+int kndi_benchmark_depth_filters(int width, int height, int threads, char* report, size_t report_size)
+{
+    if (width < 16 || height < 16 || width > 4096 || height > 4096 || threads < 0 || threads > 256)
+        return KNDI_ERROR_INVALID;
+    kndi::ThreadPool pool(threads);
+    std::string text;
+    kndi::BenchmarkDepthFilters(pool, width, height, text);
+    CopyReport(text, report, report_size);
+    return KNDI_OK;
+}
+
+int kndi_benchmark_video_denoise(int width, int height, int threads, float strength, int threshold,
+                                 char* report, size_t report_size)
+{
+    if (width < 16 || height < 16 || width > 4096 || height > 4096 || threads < 0 || threads > 256 ||
+        !(strength >= 0.0f && strength <= 0.95f) || threshold < 1 || threshold > 255)
+        return KNDI_ERROR_INVALID;
+    kndi::ThreadPool pool(threads);
+    std::string text;
+    kndi::BenchmarkVideoDenoise(pool, width, height, strength, threshold, text);
+    CopyReport(text, report, report_size);
+    return KNDI_OK;
+}
+
+int kndi_benchmark_colour_lut(int width, int height, int threads, char* report, size_t report_size)
+{
+    if (width < 16 || height < 16 || width > 4096 || height > 4096 || threads < 0 || threads > 256)
+        return KNDI_ERROR_INVALID;
+    kndi::ThreadPool pool(threads);
+    std::string text;
+    kndi::BenchmarkColourLut(pool, width, height, text);
+    CopyReport(text, report, report_size);
+    return KNDI_OK;
+}
+
+int kndi_plan(kndi_pipeline* pipeline, char* report, size_t report_size)
+{
+    if (!pipeline)
+        return KNDI_ERROR_INVALID;
+    std::string text;
+    int ret = pipeline->impl.Plan(text);
+    CopyReport(text, report, report_size);
+    return ret;
+}
+
+int kndi_start(kndi_pipeline* pipeline)
+{
+    if (!pipeline)
+        return KNDI_ERROR_INVALID;
+    return pipeline->impl.Start();
+}
+
+int kndi_run(kndi_pipeline* pipeline)
+{
+    if (!pipeline)
+        return KNDI_ERROR_INVALID;
+    return pipeline->impl.Run();
+}
+
+void kndi_stop(kndi_pipeline* pipeline)
+{
+    if (pipeline)
+        pipeline->impl.Stop();
+}
+
+int kndi_get_clock_stats(kndi_pipeline* pipeline, int device_index, kndi_stream stream,
+                         kndi_clock_stats* stats)
+{
+    if (!pipeline || !stats || !(stream & KNDI_STREAM_CAPTURE))
+        return KNDI_ERROR_INVALID;
+    return pipeline->impl.ClockStats(device_index, stream, *stats);
+}
+
+int kndi_get_usb_stats(kndi_pipeline* pipeline, int device_index, kndi_usb_stats* stats)
+{
+    if (!pipeline || !stats)
+        return KNDI_ERROR_INVALID;
+    return pipeline->impl.UsbStats(device_index, *stats);
+}
+
+int kndi_get_planes(kndi_pipeline* pipeline, kndi_plane* planes, int capacity, int* count)
+{
+    if (!pipeline || !count || capacity < 0 || (!planes && capacity > 0))
+        return KNDI_ERROR_INVALID;
+    return pipeline->impl.Planes(planes, capacity, *count);
+}
+
+int kndi_dump_flight_recorder(kndi_pipeline* pipeline, const char* path)
+{
+    if (!pipeline)
+        return KNDI_ERROR_INVALID;
+    return pipeline->impl.DumpFlightRecorder(path ? path : "");
+}
+
+void kndi_frame_retain(const kndi_frame* frame)
+{
+    if (frame)
+        kndi::FramePool::Retain(kndi::FramePool::FromFrame(frame));
+}
+
+void kndi_frame_release(const kndi_frame* frame)
+{
+    if (frame)
+        kndi::FramePool::Release(kndi::FramePool::FromFrame(frame));
+}
+
+} // extern "C"
@@ -0,0 +1,365 @@
+#include "marker_tracker.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+  #define KNDI_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  #include <arm_neon.h>
+  #define KNDI_NEON 1
+#endif
+
+#include "camera_model.h"
+#include "depth_units.h"
+#include "osc.h"
+
+namespace kndi {
+
+constexpr int MarkerDetector::kMaxMarkers;
+constexpr int MarkerDetector::kMaxLabels;
+
+// Widest window, in pixels either side of the centroid, searched for depth.
+static constexpr int kMaxDepthRadius = 12;
+
+MarkerDetector::MarkerDetector(const MarkerSettings& settings, int width, int height)
+    : settings(settings), width(width), height(height), chosen(kMaxLabels)
+{
+    // At most one run per two pixels of a row.
+    runs[0].resize(width / 2 + 1);
+    runs[1].resize(width / 2 + 1);
+    parents.resize(kMaxLabels);
+    moments.resize(kMaxLabels);
+}
+
+int MarkerDetector::Find(int label)
+{
+    while (parents[label] != label) {
+        parents[label] = parents[parents[label]];
+        label = parents[label];
+    }
+    return label;
+}
+
+// First x in [x, width) with row[x] >= threshold, or width.
+static int NextLit(const uint8_t* row, int x, int width, uint8_t threshold)
+{
+#if defined(KNDI_SSE2)
+    // max(v, t) == v exactly where v >= t.
+    const __m128i bound = _mm_set1_epi8(static_cast<char>(threshold));
+    for (; x + 16 <= width; x += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v, bound), v)))
+            break;
+    }
+#elif defined(KNDI_NEON)
+    const uint8x16_t bound = vdupq_n_u8(threshold);
+    for (; x + 16 <= width; x += 16) {
+        uint64x2_t lit = vreinterpretq_u64_u8(vcgeq_u8(vld1q_u8(row + x), bound));
+        if (vgetq_lane_u64(lit, 0) | vgetq_lane_u64(lit, 1))
+            break;
+    }
+#endif
+    while (x < width && row[x] < threshold)
+        x++;
+    return x;
+}
+
+int MarkerDetector::Detect(const uint8_t* ir, int stride, Marker* out, bool& overflow)
+{
+    const uint8_t threshold = static_cast<uint8_t>(std::min(255, std::max(1, settings.threshold)));
+    const int bias = threshold - 1;   // Weights start at 1 for a pixel at the threshold.
+    int labels = 0;
+    int previousRuns = 0;
+    overflow = false;
+    for (int y = 0; y < height && !overflow; y++) {
+        const uint8_t* row = ir + static_cast<size_t>(y) * stride;
+        const std::vector<Run>& previous = runs[(y + 1) & 1];
+        std::vector<Run>& current = runs[y & 1];
+        int currentRuns = 0;
+        int p = 0;
+        for (int x = NextLit(row, 0, width, threshold); x < width; x = NextLit(row, x, width, threshold)) {
+            int x0 = x;
+            int64_t weight = 0;
+            int64_t weightX = 0;
+            for (; x < width && row[x] >= threshold; x++) {
+                int w = row[x] - bias;
+                weight += w;
+                weightX += static_cast<int64_t>(w) * x;
+            }
+            int x1 = x - 1;
+
+            // Join the previous row's runs that touch this one, diagonals
+            // included; they are sorted, so the scan resumes where the last
+            // run left it.
+            while (p < previousRuns && previous[p].x1 < x0 - 1)
+                p++;
+            int label = -1;
+            for (int q = p; q < previousRuns && previous[q].x0 <= x1 + 1; q++) {
+                int root = Find(previous[q].label);
+                if (label < 0) {
+                    label = root;
+                } else if (root != label) {
+                    parents[std::max(root, label)] = std::min(root, label);
+                    label = std::min(root, label);
+                }
+            }
+            if (label < 0) {
+                if (labels == kMaxLabels) {
+                    overflow = true;
+                    break;
+                }
+                label = labels++;
+                parents[label] = label;
+                moments[label] = Moments();
+            }
+            Moments& m = moments[label];
+            m.weight += weight;
+            m.weightX += weightX;
+            m.weightY += weight * y;
+            m.pixels += x1 - x0 + 1;
+            Run run = { x0, x1, label };
+            current[currentRuns++] = run;
+        }
+        previousRuns = currentRuns;
+    }
+
+    // Fold every label into its root, children after their roots: a root
+    // always has the smallest label of its set.
+    for (int label = 0; label < labels; label++) {
+        int root = Find(label);
+        if (root == label)
+            continue;
+        Moments& m = moments[root];
+        m.weight += moments[label].weight;
+        m.weightX += moments[label].weightX;
+        m.weightY += moments[label].weightY;
+        m.pixels += moments[label].pixels;
+    }
+    int count = 0;
+    for (int label = 0; label < labels; label++) {
+        const Moments& m = moments[label];
+        if (parents[label] == label && m.pixels >= settings.minPixels && m.pixels <= settings.maxPixels)
+            chosen[count++] = label;
+    }
+    if (count > kMaxMarkers) {
+        std::nth_element(chosen.begin(), chosen.begin() + kMaxMarkers, chosen.begin() + count,
+                         [this](int a, int b) { return moments[a].weight > moments[b].weight; });
+        count = kMaxMarkers;
+    }
+    for (int i = 0; i < count; i++) {
+        const Moments& m = moments[chosen[i]];
+        Marker& marker = out[i];
+        marker.u = static_cast<float>(static_cast<double>(m.weightX) / m.weight);
+        marker.v = static_cast<float>(static_cast<double>(m.weightY) / m.weight);
+        marker.pixels = m.pixels;
+        marker.x = marker.y = marker.z = 0.0f;
+    }
+    return count;
+}
+
+void MarkerDetector::LookUpDepth(const uint16_t* depth, int stride, int width, int height, Marker* markers,
+                                 int count)
+{
+    const uint16_t* toMm = RawDepthToMillimetres();
+    Intrinsics intrinsics = KinectDepthIntrinsics(width, height);
+    uint16_t samples[(2 * kMaxDepthRadius + 1) * (2 * kMaxDepthRadius + 1)];
+    for (int i = 0; i < count; i++) {
+        Marker& marker = markers[i];
+        // The blob's radius plus the offset between the IR and depth images.
+        int radius = std::min(kMaxDepthRadius,
+                              static_cast<int>(std::sqrt(marker.pixels / 3.14159f)) + 4);
+        int cx = static_cast<int>(std::lround(marker.u));
+        int cy = static_cast<int>(std::lround(marker.v));
+        int found = 0;
+        for (int y = std::max(0, cy - radius); y <= std::min(height - 1, cy + radius); y++) {
+            const uint16_t* row = reinterpret_cast<const uint16_t*>(reinterpret_cast<const uint8_t*>(depth) +
+                                                                    static_cast<size_t>(y) * stride);
+            for (int x = std::max(0, cx - radius); x <= std::min(width - 1, cx + radius); x++) {
+                if (row[x] < kRawDepthInvalid && toMm[row[x]])
+                    samples[found++] = row[x];
+            }
+        }
+        marker.x = marker.y = marker.z = 0.0f;
+        if (!found)
+            continue;
+        std::nth_element(samples, samples + found / 2, samples + found);
+        float z = toMm[samples[found / 2]];
+        marker.x = (marker.u - intrinsics.cx) / intrinsics.fx * z;
+        marker.y = (marker.v - intrinsics.cy) / intrinsics.fy * z;
+        marker.z = z;
+    }
+}
+
+// Most bytes Encode() writes: bundle header, the frame message (44, with its
+// size) and the marker messages (60 each).
+static constexpr size_t kMaxPacket = 16 + 44 + 60 * MarkerDetector::kMaxMarkers;
+
+size_t MarkerTracker::Encode(const kndi_frame& frame, const Marker* markers, int count,
+                             std::vector<uint8_t>& packet)
+{
+    int64_t timeNs = frame.synced_timestamp_ns ? frame.synced_timestamp_ns : frame.host_timestamp_ns;
+    OscWriter osc(packet);
+    osc.BeginBundle(OscTimeTag(timeNs));
+    osc.BeginMessage("/kinect/frame", ",ihi");
+    osc.Int32(frame.device_index);
+    osc.Int64(timeNs);
+    osc.Int32(count);
+    osc.EndMessage();
+    for (int i = 0; i < count; i++) {
+        const Marker& marker = markers[i];
+        osc.BeginMessage("/kinect/marker", ",iffifff");
+        osc.Int32(i);
+        osc.Float(marker.u);
+        osc.Float(marker.v);
+        osc.Int32(marker.pixels);
+        osc.Float(marker.x);
+        osc.Float(marker.y);
+        osc.Float(marker.z);
+        osc.EndMessage();
+    }
+    return osc.Size();
+}
+
+MarkerTracker* MarkerTracker::Create(const std::string& address, const MarkerSettings& settings)
+{
+    int fd = OpenUdpSender(address, "Marker tracker");
+    return fd < 0 ? nullptr : new MarkerTracker(fd, settings);
+}
+
+MarkerTracker::MarkerTracker(int fd, const MarkerSettings& settings)
+    : fd(fd), settings(settings), markers(MarkerDetector::kMaxMarkers), packet(kMaxPacket), depthWidth(0),
+      depthHeight(0), warnedOverflow(false), framesSent(0), sendErrors(0)
+{
+}
+
+MarkerTracker::~MarkerTracker()
+{
+    CloseUdpSender(fd);
+}
+
+unsigned MarkerTracker::Streams() const
+{
+    return settings.depth ? KNDI_STREAM_IR | KNDI_STREAM_DEPTH : KNDI_STREAM_IR;
+}
+
+void MarkerTracker::Configure(const PlanContext& context, KernelTuner&, ThreadPool&)
+{
+    const StreamShape& ir = context.Shape(KNDI_STREAM_IR);
+    detector.reset(ir.framesPerSecond > 0.0 ? new MarkerDetector(settings, ir.width, ir.height) : nullptr);
+    const StreamShape& shape = context.Shape(KNDI_STREAM_DEPTH);
+    if (settings.depth && shape.framesPerSecond > 0.0) {
+        depth.assign(static_cast<size_t>(shape.width) * shape.height, kRawDepthInvalid);
+        depthWidth = 0;
+        depthHeight = 0;
+    }
+}
+
+void MarkerTracker::Consume(const kndi_frame& frame)
+{
+    if (frame.stream == KNDI_STREAM_DEPTH) {
+        size_t pixels = static_cast<size_t>(frame.width) * frame.height;
+        if (pixels > depth.size())
+            return;
+        for (int y = 0; y < frame.height; y++)
+            std::memcpy(&depth[static_cast<size_t>(y) * frame.width],
+                        static_cast<const uint8_t*>(frame.data) + static_cast<size_t>(y) * frame.stride,
+                        static_cast<size_t>(frame.width) * sizeof(uint16_t));
+        depthWidth = frame.width;
+        depthHeight = frame.height;
+        return;
+    }
+    if (frame.stream != KNDI_STREAM_IR || !detector)
+        return;
+    bool overflow = false;
+    int count = detector->Detect(static_cast<const uint8_t*>(frame.data), frame.stride, markers.data(), overflow);
+    if (overflow && !warnedOverflow) {
+        std::cerr << "Marker tracker: too many bright blobs in the IR image (sunlight or a lamp?); "
+                  << "markers below them are missed. Raise the threshold." << std::endl;
+        warnedOverflow = true;
+    }
+    if (depthWidth > 0)
+        MarkerDetector::LookUpDepth(depth.data(), depthWidth * 2, depthWidth, depthHeight, markers.data(), count);
+    size_t size = Encode(frame, markers.data(), count, packet);
+    if (SendDatagram(fd, packet, size))
+        framesSent++;
+    else
+        sendErrors++;
+}
+
+// Synthetic dark IR frame with projector speckle and `markers` round
+// markers of different sizes, for the planner.
+static void SyntheticIr(std::vector<uint8_t>& ir, int width, int height, int markers)
+{
+    uint32_t noise = 1;
+    for (size_t i = 0; i < ir.size(); i++) {
+        noise = noise * 1664525u + 1013904223u;
+        // Background of 20-80 with a bright speckle dot every ~250 pixels.
+        ir[i] = static_cast<uint8_t>((noise >> 24) < 1 ? 230 : 20 + (noise >> 26));
+    }
+    for (int m = 0; m < markers; m++) {
+        float cx = width * (m + 0.5f) / markers + 0.3f;
+        float cy = height * (0.3f + 0.4f * (m % 2)) + 0.6f;
+        float radius = 2.0f + m % 4;
+        for (int y = static_cast<int>(cy - radius - 2); y <= static_cast<int>(cy + radius + 2); y++) {
+            for (int x = static_cast<int>(cx - radius - 2); x <= static_cast<int>(cx + radius + 2); x++) {
+                float d = std::sqrt((x - cx) * (x - cx) + (y - cy) * (y - cy));
+                if (x >= 0 && y >= 0 && x < width && y < height && d < radius + 1.0f)
+                    ir[static_cast<size_t>(y) * width + x] =
+                        static_cast<uint8_t>(std::min(255.0f, 255.0f - 60.0f * std::max(0.0f, d - radius + 1.0f)));
+            }
+        }
+    }
+}
+
+void MarkerTracker::Plan(const PlanContext& context, Planner& planner) const
+{
+    const StreamShape& ir = context.Shape(KNDI_STREAM_IR);
+    if (ir.framesPerSecond <= 0.0)
+        return;
+    int width = ir.width;
+    int height = ir.height;
+    std::shared_ptr<std::vector<uint8_t>> frame =
+        std::make_shared<std::vector<uint8_t>>(static_cast<size_t>(width) * height);
+    SyntheticIr(*frame, width, height, 8);
+    std::shared_ptr<MarkerDetector> detector = std::make_shared<MarkerDetector>(settings, width, height);
+    std::shared_ptr<std::vector<Marker>> found = std::make_shared<std::vector<Marker>>(MarkerDetector::kMaxMarkers);
+    std::shared_ptr<std::vector<uint8_t>> out = std::make_shared<std::vector<uint8_t>>(kMaxPacket);
+    const StreamShape& shape = context.Shape(KNDI_STREAM_DEPTH);
+    bool useDepth = settings.depth && shape.framesPerSecond > 0.0;
+    std::shared_ptr<std::vector<uint16_t>> depthFrame = std::make_shared<std::vector<uint16_t>>(
+        useDepth ? static_cast<size_t>(shape.width) * shape.height : 0, static_cast<uint16_t>(800));
+    int depthWidth = shape.width;
+    int depthHeight = shape.height;
+
+    PlanStage stage;
+    stage.name = "IR marker tracking (OSC)";
+    stage.framesPerSecond = ir.framesPerSecond;
+    stage.bytesPerFrame = frame->size();
+    stage.run = [frame, detector, found, out, depthFrame, useDepth, width, depthWidth, depthHeight] {
+        bool overflow = false;
+        int count = detector->Detect(frame->data(), width, found->data(), overflow);
+        if (useDepth)
+            MarkerDetector::LookUpDepth(depthFrame->data(), depthWidth * 2, depthWidth, depthHeight, found->data(),
+                                        count);
+        kndi_frame header = kndi_frame();
+        Encode(header, found->data(), count, *out);
+    };
+    planner.Add(stage);
+    if (useDepth) {
+        std::shared_ptr<std::vector<uint16_t>> copy = std::make_shared<std::vector<uint16_t>>(depthFrame->size());
+        PlanStage depthStage;
+        depthStage.name = "IR marker depth copy";
+        depthStage.framesPerSecond = shape.framesPerSecond;
+        depthStage.bytesPerFrame = 2 * depthFrame->size() * sizeof(uint16_t);
+        depthStage.run = [depthFrame, copy] {
+            std::memcpy(copy->data(), depthFrame->data(), depthFrame->size() * sizeof(uint16_t));
+        };
+        planner.Add(depthStage);
+    }
+}
+
+} // namespace kndi
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "sink.h"
+
+namespace kndi {
+
+struct MarkerSettings {
+    int threshold = 200;     // IR level (0-255) at and above which a pixel is lit.
+    int minPixels = 4;       // Smaller blobs are projector speckle or hot pixels.
+    int maxPixels = 4000;    // Larger blobs are lamps, windows or specular surfaces.
+    bool depth = true;       // Look up each marker's depth in the latest depth frame.
+};
+
+// A bright blob in the IR image. Pixel centres are at integer coordinates.
+struct Marker {
+    float u, v;              // Centroid in IR pixels, weighted by brightness above the threshold.
+    int pixels;
+    float x, y, z;           // Depth camera space in millimetres; all 0 without depth.
+};
+
+// Finds retroreflective markers in 8-bit IR frames. One pass over the image
+// labels runs of lit pixels, joining each to the overlapping runs of the row
+// above (8-connected) through a union-find of labels, and accumulates the
+// brightness moments per label as it goes; spans of 16 dark pixels are
+// skipped with one SIMD compare, so a mostly dark frame costs little more
+// than reading it. Every buffer is allocated in the constructor.
+class MarkerDetector {
+public:
+    // Most markers reported per frame (the brightest are kept).
+    static constexpr int kMaxMarkers = 64;
+    // Most blobs, of any size, followed in one frame; a frame with more
+    // (sunlight, a lamp) is cut short.
+    static constexpr int kMaxLabels = 4096;
+
+    MarkerDetector(const MarkerSettings& settings, int width, int height);
+
+    const MarkerSettings& Settings() const { return settings; }
+
+    // Markers of an IR frame (`stride` in bytes) into `out` (kMaxMarkers
+    // long); returns how many. Sets `overflow` if the frame had too many
+    // blobs to follow them all.
+    int Detect(const uint8_t* ir, int stride, Marker* out, bool& overflow);
+
+    // Fill in x, y, z of `markers` from a raw depth frame of the same
+    // camera: the median of the readings in a window around each blob, as a
+    // retroreflector itself usually reads as no depth. The depth image is
+    // offset from the IR image by a few pixels, which the window covers.
+    static void LookUpDepth(const uint16_t* depth, int stride, int width, int height, Marker* markers, int count);
+
+private:
+    struct Run {
+        int x0, x1;          // Inclusive.
+        int label;
+    };
+    struct Moments {
+        int64_t weight;
+        int64_t weightX;
+        int64_t weightY;
+        int pixels;
+    };
+
+    int Find(int label);
+
+    MarkerSettings settings;
+    int width;
+    int height;
+    std::vector<Run> runs[2];          // This row's and the previous row's runs.
+    std::vector<int> parents;
+    std::vector<Moments> moments;
+    std::vector<int> chosen;           // Labels of the blobs that qualify.
+};
+
+// Sends the markers of every IR frame as one OSC bundle over UDP:
+//   /kinect/frame  ,ihi      Kinect index, frame time (host monotonic ns), marker count
+//   /kinect/marker ,iffifff  index, u, v, pixels, x, y, z (mm, 0 without depth)
+// The bundle's time tag is the frame's capture time on the wall clock.
+// Sending never blocks; with nobody listening datagrams are dropped.
+// Not available on Windows (Create() fails).
+class MarkerTracker : public Sink {
+public:
+    // Send to `address`: "host:port", or "port" for 127.0.0.1. Returns
+    // nullptr (with the reason on stderr) if it cannot be resolved.
+    static MarkerTracker* Create(const std::string& address, const MarkerSettings& settings);
+    ~MarkerTracker() override;
+
+    MarkerTracker(const MarkerTracker&) = delete;
+    MarkerTracker& operator=(const MarkerTracker&) = delete;
+
+    unsigned Streams() const override;
+    void Consume(const kndi_frame& frame) override;
+    void Configure(const PlanContext& context, KernelTuner& tuner, ThreadPool& pool) override;
+    void Plan(const PlanContext& context, Planner& planner) const override;
+
+private:
+    MarkerTracker(int fd, const MarkerSettings& settings);
+
+    // Encode `count` markers of a frame as an OSC bundle into `packet`;
+    // returns its size.
+    static size_t Encode(const kndi_frame& frame, const Marker* markers, int count, std::vector<uint8_t>& packet);
+
+    int fd;
+    MarkerSettings settings;
+    std::unique_ptr<MarkerDetector> detector;   // Sized for the IR stream in Configure().
+    std::vector<Marker> markers;
+    std::vector<uint8_t> packet;
+    std::vector<uint16_t> depth;     // Latest depth frame, copied; empty until one arrives.
+    int depthWidth;
+    int depthHeight;
+    bool warnedOverflow;
+    std::atomic<uint64_t> framesSent;
+    std::atomic<uint64_t> sendErrors;
+};
+
+} // namespace kndi
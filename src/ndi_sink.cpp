@@ -0,0 +1,457 @@
+#include "ndi_sink.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+#include "auto_frame.h"
+#include "convert.h"
+
+namespace kndi {
+
+// NDIlib_initialize/NDIlib_destroy are process wide; keep them paired across
+// any number of sinks and pipelines.
+static std::mutex ndiRuntimeMutex;
+static int ndiRuntimeUsers = 0;
+
+static bool AcquireNdiRuntime()
+{
+    std::lock_guard<std::mutex> lock(ndiRuntimeMutex);
+    if (ndiRuntimeUsers == 0 && !NDIlib_initialize()) {
+        std::cerr << "NDI initialization failed – please ensure the NDI runtime is installed." << std::endl;
+        return false;
+    }
+    ndiRuntimeUsers++;
+    return true;
+}
+
+static void ReleaseNdiRuntime()
+{
+    std::lock_guard<std::mutex> lock(ndiRuntimeMutex);
+    if (--ndiRuntimeUsers == 0)
+        NDIlib_destroy();
+}
+
+static const char* StreamLabel(kndi_stream stream)
+{
+    switch (stream) {
+    case KNDI_STREAM_RGB:   return "RGB";
+    case KNDI_STREAM_IR:    return "IR";
+    case KNDI_STREAM_DEPTH: return "Depth";
+    case KNDI_STREAM_FUSED_DEPTH: return "Fused Depth";
+    case KNDI_STREAM_POINT_CLOUD:
+    case KNDI_STREAM_MESH: break;
+    }
+    return "Unknown";
+}
+
+const char* NdiSink::DefaultName(kndi_stream stream)
+{
+    switch (stream) {
+    case KNDI_STREAM_RGB:   return "Kinect RGB Stream";
+    case KNDI_STREAM_IR:    return "Kinect IR Stream";
+    case KNDI_STREAM_DEPTH: return "Kinect Depth Stream";
+    case KNDI_STREAM_FUSED_DEPTH: return "Kinect Fused Depth Stream";
+    case KNDI_STREAM_POINT_CLOUD:
+    case KNDI_STREAM_MESH: break;
+    }
+    return "Kinect Stream";
+}
+
+NdiSink* NdiSink::Create(unsigned streams, const char* ndiName)
+{
+    if (!AcquireNdiRuntime())
+        return nullptr;
+
+    NdiSink* sink = new NdiSink;
+    sink->streams = streams;
+    const kndi_stream all[] = {
+        KNDI_STREAM_RGB, KNDI_STREAM_IR, KNDI_STREAM_DEPTH, KNDI_STREAM_FUSED_DEPTH
+    };
+    int requested = 0;
+    for (kndi_stream stream : all)
+        requested += (streams & stream) ? 1 : 0;
+
+    for (kndi_stream stream : all) {
+        if (!(streams & stream))
+            continue;
+        // A user supplied name is used as is for a single stream and
+        // suffixed with the stream label when one sink carries several.
+        std::string name = ndiName ? ndiName : DefaultName(stream);
+        if (ndiName && requested > 1)
+            name += std::string(" (") + StreamLabel(stream) + ")";
+
+        NDIlib_send_create_t ndiSendDesc;
+        std::memset(&ndiSendDesc, 0, sizeof(ndiSendDesc));
+        ndiSendDesc.p_ndi_name = name.c_str();
+        NDIlib_send_instance_t instance = NDIlib_send_create(&ndiSendDesc);
+        if (!instance) {
+            std::cerr << "Failed to create NDI sender \"" << name << "\"." << std::endl;
+            delete sink;
+            return nullptr;
+        }
+        // Reference kernel until Configure() picks the tuned one.
+        KernelChoice conversion = { ConvertVariants(stream)[0], 1 };
+        Sender sender = { stream, instance, conversion, nullptr, Orientation::None, nullptr, false, nullptr,
+                          PrivacyBlocks(), nullptr, std::vector<uint8_t>() };
+        sink->senders.push_back(sender);
+    }
+    return sink;
+}
+
+NdiSink::~NdiSink()
+{
+    for (const Sender& sender : senders)
+        NDIlib_send_destroy(sender.instance);
+    ReleaseNdiRuntime();
+}
+
+// ROI of `stream` frames if it leaves anything out.
+static const RoiMask* PartialRoi(const PlanContext& context, kndi_stream stream)
+{
+    const StreamShape& shape = context.Shape(stream);
+    const RoiMask* roi = context.roi;
+    if (!(stream & KNDI_STREAM_CAPTURE) || !roi || roi->IsFull() ||
+        roi->Width() != shape.width || roi->Height() != shape.height)
+        return nullptr;
+    return roi;
+}
+
+// Orientation of `stream`'s output; fused depth has its own virtual view.
+static Orientation StreamOrientation(const PlanContext& context, kndi_stream stream)
+{
+    return (stream & KNDI_STREAM_CAPTURE) ? context.orientation : Orientation::None;
+}
+
+// Auto-framing tracker cropping `stream`, if any; it follows RGB only.
+static const AutoFramer* StreamFramer(const PlanContext& context, kndi_stream stream)
+{
+    return stream == KNDI_STREAM_RGB ? context.framer : nullptr;
+}
+
+// Privacy mask of `stream`, if any; it masks RGB only.
+static const PrivacyMask* StreamPrivacy(const PlanContext& context, kndi_stream stream)
+{
+    return stream == KNDI_STREAM_RGB ? context.privacy : nullptr;
+}
+
+// Colour LUT grading `stream`, if any; it grades RGB only.
+static const ColourLut* StreamLut(const PlanContext& context, kndi_stream stream)
+{
+    return stream == KNDI_STREAM_RGB ? context.colourLut : nullptr;
+}
+
+// Whether `stream` is sent with the keyed-out volume crop as alpha.
+static bool StreamKeyed(const PlanContext& context, kndi_stream stream)
+{
+    return stream == KNDI_STREAM_DEPTH && context.keyDepth;
+}
+
+// Alpha of a converted depth frame from its raw samples, in row bands.
+static void RunKey(ThreadPool* pool, const kndi_frame& frame, uint8_t* dst)
+{
+    const uint16_t* depth = static_cast<const uint16_t*>(frame.data);
+    int bands = pool ? std::min(pool->Size(), frame.height) : 1;
+    int rowsPerBand = (frame.height + bands - 1) / bands;
+    auto band = [&](int index) {
+        int first = index * rowsPerBand;
+        int rows = std::min(rowsPerBand, frame.height - first);
+        if (rows > 0)
+            KeyInvalidDepth(reinterpret_cast<const uint16_t*>(reinterpret_cast<const uint8_t*>(depth) +
+                                                              static_cast<size_t>(first) * frame.stride),
+                            frame.stride, dst + static_cast<size_t>(first) * frame.width * 4, frame.width * 4,
+                            frame.width, rows);
+    };
+    if (bands > 1)
+        pool->ParallelFor(bands, band);
+    else
+        band(0);
+}
+
+void NdiSink::Convert(Sender& sender, const kndi_frame& frame, int outputWidth, int outputHeight)
+{
+    size_t frameSize = static_cast<size_t>(outputWidth) * outputHeight * 4;
+    if (sender.bgrx.size() != frameSize)
+        sender.bgrx.assign(frameSize, 0);
+    const uint8_t* rgb = static_cast<const uint8_t*>(frame.data);
+    if (sender.privacy) {
+        sender.privacy->Snapshot(frame.host_timestamp_ns, sender.blocks);
+        ComputePrivacyColours(pool, sender.privacy->Mode(), rgb, frame.stride, frame.width, frame.height,
+                              sender.blocks);
+    }
+    if (sender.framer) {
+        // Crop, scale and convert in one pass; the full frame is never written.
+        RunCropConversion(pool, rgb, frame.stride, frame.width, frame.height, sender.framer->Crop(),
+                          sender.bgrx.data(), outputWidth * 4, outputWidth, outputHeight,
+                          sender.privacy ? &sender.blocks : nullptr);
+        // Every output pixel was written, so grading it in place is safe.
+        if (sender.lut)
+            RunGrade(pool, *sender.lut, sender.bgrx.data(), outputWidth * 4, outputWidth, outputHeight);
+        return;
+    }
+    if (sender.privacy) {
+        RunPrivateConversion(pool, sender.conversion.variant.kernel, rgb, frame.stride, sender.bgrx.data(),
+                             outputWidth * 4, frame.width, frame.height, sender.blocks);
+        if (sender.lut)
+            RunGrade(pool, *sender.lut, sender.bgrx.data(), outputWidth * 4, outputWidth, outputHeight);
+        return;
+    }
+    if (sender.lut) {
+        // The lookup replaces the tuned kernel's channel shuffle.
+        RunGradedConversion(pool, *sender.lut, rgb, frame.stride, sender.bgrx.data(), outputWidth * 4, frame.width,
+                            frame.height, sender.roi);
+        return;
+    }
+    RunConversion(sender.conversion, pool, frame.data, frame.stride, sender.bgrx.data(), outputWidth * 4,
+                  frame.width, frame.height, sender.roi, sender.orientation);
+    if (sender.keyed)
+        RunKey(pool, frame, sender.bgrx.data());
+}
+
+// Longest PlaneMetadata(), so formatting it never allocates.
+static constexpr size_t kMaxPlaneMetadata = 64 + 192 * PlaneFinder::kMaxPlanes;
+
+void NdiSink::Configure(const PlanContext& context, KernelTuner& tuner, ThreadPool& workers)
+{
+    pool = &workers;
+    planes = context.planes;
+    if (planes)
+        metadata.reserve(kMaxPlaneMetadata);
+    for (Sender& sender : senders) {
+        const StreamShape& shape = context.Shape(sender.stream);
+        if (shape.framesPerSecond > 0.0)
+            sender.conversion = tuner.Choose(sender.stream, shape.width, shape.height);
+        // A new ROI leaves stale pixels outside it; start from black again.
+        // Turning it differently leaves them too.
+        // Privacy masking writes every block, so it takes over from the ROI.
+        const RoiMask* roi = StreamPrivacy(context, sender.stream) ? nullptr : PartialRoi(context, sender.stream);
+        Orientation orientation = StreamOrientation(context, sender.stream);
+        if (roi || sender.roi || orientation != sender.orientation)
+            sender.bgrx.clear();
+        sender.roi = roi;
+        sender.orientation = orientation;
+        sender.framer = StreamFramer(context, sender.stream);
+        sender.keyed = StreamKeyed(context, sender.stream);
+        sender.privacy = StreamPrivacy(context, sender.stream);
+        sender.lut = StreamLut(context, sender.stream);
+        // Allocated (and touched) now rather than on the first frame.
+        size_t frameSize = sender.framer
+            ? static_cast<size_t>(sender.framer->Settings().width) * sender.framer->Settings().height * 4
+            : static_cast<size_t>(shape.width) * shape.height * 4;
+        if (shape.framesPerSecond > 0.0 && sender.bgrx.size() != frameSize)
+            sender.bgrx.assign(frameSize, 0);
+    }
+}
+
+// NDI timecode (100 ns units, UTC) of a frame. Frames with a locked device
+// clock carry their jitter-free capture time; the monotonic to UTC offset
+// is refreshed once a second so NTP adjustments are followed.
+int64_t NdiSink::Timecode(const kndi_frame& frame)
+{
+    if (!frame.synced_timestamp_ns)
+        return NDIlib_send_timecode_synthesize;
+    if (frame.synced_timestamp_ns - utcOffsetTakenNs > 1000000000 || !utcOffsetTakenNs) {
+        int64_t monotonic = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        int64_t utc = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        utcOffsetNs = utc - monotonic;
+        utcOffsetTakenNs = frame.synced_timestamp_ns;
+    }
+    return (frame.synced_timestamp_ns + utcOffsetNs) / 100;
+}
+
+// <kinect_planes><plane id="2" kind="floor" nx="0.0004" ny="-0.9663" nz="-0.2573"
+// d="1200.1" rms="2.4" inliers="1619"/>...</kinect_planes>, as in kndi_plane.
+const char* NdiSink::PlaneMetadata()
+{
+    Plane found[PlaneFinder::kMaxPlanes];
+    int count = planes->Planes(found);
+    metadata = "<kinect_planes>";
+    for (int i = 0; i < count; i++) {
+        char element[192];
+        std::snprintf(element, sizeof(element),
+                      "<plane id=\"%d\" kind=\"%s\" nx=\"%.4f\" ny=\"%.4f\" nz=\"%.4f\" d=\"%.1f\" rms=\"%.1f\" "
+                      "inliers=\"%d\"/>",
+                      found[i].id, PlaneKindName(found[i].kind), found[i].normal[0], found[i].normal[1],
+                      found[i].normal[2], found[i].distanceMm, found[i].rmsMm, found[i].inliers);
+        metadata += element;
+    }
+    metadata += "</kinect_planes>";
+    return metadata.c_str();
+}
+
+void NdiSink::Consume(const kndi_frame& frame)
+{
+    for (Sender& sender : senders) {
+        if (sender.stream != frame.stream)
+            continue;
+        bool swap = SwapsAxes(sender.orientation);
+        int width = swap ? frame.height : frame.width;
+        int height = swap ? frame.width : frame.height;
+        if (sender.framer) {
+            width = sender.framer->Settings().width;
+            height = sender.framer->Settings().height;
+        }
+        Convert(sender, frame, width, height);
+
+        NDIlib_video_frame_v2_t videoFrame;
+        std::memset(&videoFrame, 0, sizeof(videoFrame));
+        videoFrame.xres = width;
+        videoFrame.yres = height;
+        videoFrame.FourCC = sender.keyed ? NDIlib_FourCC_type_BGRA : NDIlib_FourCC_type_BGRX;
+        videoFrame.frame_rate_N = 30;
+        videoFrame.frame_rate_D = 1;
+        videoFrame.picture_aspect_ratio = static_cast<float>(width) / height;
+        videoFrame.frame_format_type = NDIlib_frame_format_type_progressive;
+        videoFrame.timecode = Timecode(frame);
+        videoFrame.p_data = sender.bgrx.data();
+        videoFrame.line_stride_in_bytes = width * 4;
+        if (planes)
+            videoFrame.p_metadata = PlaneMetadata();
+        NDIlib_send_send_video_v2(sender.instance, &videoFrame);
+    }
+}
+
+void NdiSink::Plan(const PlanContext& context, Planner& planner) const
+{
+    for (const Sender& sender : senders) {
+        const StreamShape& shape = context.Shape(sender.stream);
+        if (shape.framesPerSecond <= 0.0)
+            continue;
+        // Synthetic frame of the real size; the kernels do not branch on content.
+        kndi_frame frame;
+        std::memset(&frame, 0, sizeof(frame));
+        frame.stream = sender.stream;
+        frame.width = shape.width;
+        frame.height = shape.height;
+        frame.bytes_per_pixel = shape.bytesPerPixel;
+        frame.stride = shape.width * shape.bytesPerPixel;
+        // Only the ROI's share of the frame is read and written.
+        const PrivacyMask* privacy = StreamPrivacy(context, sender.stream);
+        const RoiMask* roi = privacy ? nullptr : PartialRoi(context, sender.stream);
+        double share = roi ? static_cast<double>(roi->Pixels()) / (static_cast<size_t>(frame.width) * frame.height) : 1.0;
+        size_t srcBytes = static_cast<size_t>(frame.stride) * frame.height;
+        size_t dstBytes = static_cast<size_t>(frame.width) * frame.height * 4;
+        std::shared_ptr<std::vector<uint8_t>> src = std::make_shared<std::vector<uint8_t>>(srcBytes, 0x40);
+        std::shared_ptr<std::vector<uint8_t>> dst = std::make_shared<std::vector<uint8_t>>(dstBytes);
+        frame.data = src->data();
+
+        // Timed with the left half of the frame hidden.
+        std::shared_ptr<PrivacyBlocks> blocks;
+        std::string masked;
+        if (privacy) {
+            blocks = std::make_shared<PrivacyBlocks>();
+            blocks->blocksX = privacy->BlocksX();
+            blocks->blocksY = privacy->BlocksY();
+            for (int by = 0; by < blocks->blocksY; by++)
+                for (int bx = 0; bx < blocks->blocksX; bx++)
+                    blocks->visible.push_back(bx * 2 >= blocks->blocksX ? 1 : 0);
+            masked = std::string(" privacy ") + PrivacyModeName(privacy->Mode());
+        }
+        PrivacyMode privacyMode = privacy ? privacy->Mode() : PrivacyMode::Off;
+
+        // The lookup's cost follows the colours, so grading is timed on
+        // varied ones.
+        const ColourLut* lut = StreamLut(context, sender.stream);
+        std::string lutSize;
+        if (lut) {
+            lutSize = std::to_string(lut->Size());
+            lutSize = "graded " + lutSize + "x" + lutSize + "x" + lutSize;
+            for (size_t i = 0; i < src->size(); i++)
+                (*src)[i] = static_cast<uint8_t>(i * 7 + i / frame.stride * 3);
+        }
+
+        const AutoFramer* framer = StreamFramer(context, sender.stream);
+        if (framer) {
+            // Timed on a crop of half the frame, a typical framing; the
+            // cost follows the output size, not the crop's.
+            int width = framer->Settings().width;
+            int height = framer->Settings().height;
+            CropRect crop = { frame.width * 0.25f, frame.height * 0.25f, frame.width * 0.5f, frame.height * 0.5f };
+            std::shared_ptr<std::vector<uint8_t>> out =
+                std::make_shared<std::vector<uint8_t>>(static_cast<size_t>(width) * height * 4);
+            PlanStage convert;
+            convert.name = std::string("NDI convert ") + StreamLabel(sender.stream) + " [crop " +
+                           std::to_string(width) + "x" + std::to_string(height) + "]" + masked;
+            if (lut)
+                convert.name += " " + lutSize;
+            convert.framesPerSecond = shape.framesPerSecond;
+            convert.bytesPerFrame = out->size() + static_cast<size_t>(width) * height * 3 * 2;
+            ThreadPool* workers = pool;
+            convert.run = [frame, src, out, crop, width, height, workers, blocks, privacyMode, lut] {
+                const uint8_t* rgb = static_cast<const uint8_t*>(frame.data);
+                if (blocks)
+                    ComputePrivacyColours(workers, privacyMode, rgb, frame.stride, frame.width, frame.height, *blocks);
+                RunCropConversion(workers, rgb, frame.stride, frame.width, frame.height, crop, out->data(), width * 4,
+                                  width, height, blocks.get());
+                if (lut)
+                    RunGrade(workers, *lut, out->data(), width * 4, width, height);
+            };
+            planner.Add(convert);
+
+            PlanStage send;
+            send.name = std::string("NDI send ") + StreamLabel(sender.stream);
+            planner.Add(send);
+            continue;
+        }
+
+        Orientation orientation = StreamOrientation(context, sender.stream);
+        int dstStride = (SwapsAxes(orientation) ? frame.height : frame.width) * 4;
+
+        PlanStage convert;
+        // Graded in the conversion itself unless masked.
+        bool fused = lut && !blocks;
+        convert.name = std::string("NDI convert ") + StreamLabel(sender.stream) +
+                       " [" + (fused ? lutSize : std::string(sender.conversion.variant.name)) + "]";
+        if (orientation != Orientation::None)
+            convert.name += std::string(" ") + OrientationName(orientation);
+        convert.name += masked;
+        if (lut && !fused)
+            convert.name += " " + lutSize;
+        convert.framesPerSecond = shape.framesPerSecond;
+        convert.bytesPerFrame = static_cast<size_t>((srcBytes + dstBytes) * share);
+        KernelChoice conversion = sender.conversion;
+        ThreadPool* workers = pool;
+        convert.run = [frame, src, dst, conversion, workers, roi, orientation, dstStride, blocks, privacyMode, lut] {
+            const uint8_t* rgb = static_cast<const uint8_t*>(frame.data);
+            if (blocks) {
+                ComputePrivacyColours(workers, privacyMode, rgb, frame.stride, frame.width, frame.height, *blocks);
+                RunPrivateConversion(workers, conversion.variant.kernel, rgb, frame.stride, dst->data(), dstStride,
+                                     frame.width, frame.height, *blocks);
+                if (lut)
+                    RunGrade(workers, *lut, dst->data(), dstStride, frame.width, frame.height);
+                return;
+            }
+            if (lut) {
+                RunGradedConversion(workers, *lut, rgb, frame.stride, dst->data(), dstStride, frame.width,
+                                    frame.height, roi);
+                return;
+            }
+            RunConversion(conversion, workers, frame.data, frame.stride,
+                          dst->data(), dstStride, frame.width, frame.height, roi, orientation);
+        };
+        planner.Add(convert);
+
+        if (StreamKeyed(context, sender.stream)) {
+            PlanStage key;
+            key.name = std::string("NDI key ") + StreamLabel(sender.stream);
+            key.framesPerSecond = shape.framesPerSecond;
+            key.bytesPerFrame = srcBytes + dstBytes;
+            key.run = [frame, src, dst, workers] {
+                RunKey(workers, frame, dst->data());
+            };
+            planner.Add(key);
+        }
+
+        PlanStage send;
+        send.name = std::string("NDI send ") + StreamLabel(sender.stream);
+        planner.Add(send);
+    }
+}
+
+} // namespace kndi
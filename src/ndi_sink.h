@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <Processing.NDI.Lib.h>
+
+#include "sink.h"
+
+namespace kndi {
+
+// Converts frames to BGRX and sends them as an NDI source. One sender per
+// stream, created up front so the source stays visible across reconnects.
+class NdiSink : public Sink {
+public:
+    // Returns nullptr if the NDI runtime or sender could not be created.
+    static NdiSink* Create(unsigned streams, const char* ndiName);
+    ~NdiSink() override;
+
+    unsigned Streams() const override { return streams; }
+    void Consume(const kndi_frame& frame) override;
+    void Configure(const PlanContext& context, KernelTuner& tuner, ThreadPool& pool) override;
+    void Plan(const PlanContext& context, Planner& planner) const override;
+
+    static const char* DefaultName(kndi_stream stream);
+
+private:
+    struct Sender {
+        kndi_stream stream;
+        NDIlib_send_instance_t instance;
+        KernelChoice conversion;
+        const RoiMask* roi;            // Partial ROI of this stream, else nullptr.
+        Orientation orientation;       // Applied while converting.
+        const AutoFramer* framer;      // Crops and scales this stream, else nullptr.
+        bool keyed;                    // Sent as BGRA, transparent where depth has no reading.
+        const PrivacyMask* privacy;    // Hides background blocks of this stream, else nullptr.
+        PrivacyBlocks blocks;          // This frame's mask, reused across frames.
+        const ColourLut* lut;          // Grades this stream, else nullptr.
+        // Outside the ROI the buffer keeps the black it was allocated with,
+        // so only the spans inside are written per frame.
+        std::vector<uint8_t> bgrx;
+    };
+
+    NdiSink() : streams(0), pool(nullptr), planes(nullptr), utcOffsetNs(0), utcOffsetTakenNs(0) {}
+    void Convert(Sender& sender, const kndi_frame& frame, int outputWidth, int outputHeight);
+    int64_t Timecode(const kndi_frame& frame);
+    // The tracked planes as the frame's XML metadata, in `metadata`.
+    const char* PlaneMetadata();
+
+    unsigned streams;
+    ThreadPool* pool;
+    const PlaneFinder* planes;   // Attached to every frame as metadata, else nullptr.
+    std::string metadata;
+    std::vector<Sender> senders;
+    int64_t utcOffsetNs;       // UTC minus host monotonic time.
+    int64_t utcOffsetTakenNs;
+};
+
+} // namespace kndi
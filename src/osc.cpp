@@ -0,0 +1,174 @@
+#include "osc.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#ifndef _WIN32
+  #include <errno.h>
+  #include <fcntl.h>
+  #include <netdb.h>
+  #include <sys/socket.h>
+  #include <unistd.h>
+#endif
+
+namespace kndi {
+
+// Seconds from the NTP epoch (1900) to the Unix epoch.
+static constexpr uint64_t kNtpUnixOffset = 2208988800ULL;
+
+bool OscWriter::Fits(size_t bytes)
+{
+    if (ok && at + bytes <= packet.size())
+        return true;
+    ok = false;
+    return false;
+}
+
+void OscWriter::Put32(uint32_t value)
+{
+    packet[at++] = static_cast<uint8_t>(value >> 24);
+    packet[at++] = static_cast<uint8_t>(value >> 16);
+    packet[at++] = static_cast<uint8_t>(value >> 8);
+    packet[at++] = static_cast<uint8_t>(value);
+}
+
+void OscWriter::Int32(int32_t value)
+{
+    if (Fits(4))
+        Put32(static_cast<uint32_t>(value));
+}
+
+void OscWriter::Int64(int64_t value)
+{
+    if (Fits(8)) {
+        Put32(static_cast<uint32_t>(static_cast<uint64_t>(value) >> 32));
+        Put32(static_cast<uint32_t>(value));
+    }
+}
+
+void OscWriter::Float(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    if (Fits(4))
+        Put32(bits);
+}
+
+// OSC strings are NUL-terminated and padded to a multiple of 4 bytes.
+void OscWriter::String(const char* text)
+{
+    size_t length = std::strlen(text);
+    size_t padded = (length + 4) & ~static_cast<size_t>(3);
+    if (!Fits(padded))
+        return;
+    std::memcpy(&packet[at], text, length);
+    std::memset(&packet[at + length], 0, padded - length);
+    at += padded;
+}
+
+void OscWriter::BeginBundle(uint64_t timeTag)
+{
+    String("#bundle");
+    Int64(static_cast<int64_t>(timeTag));
+}
+
+void OscWriter::BeginMessage(const char* address, const char* tags)
+{
+    messageAt = at;
+    Int32(0);
+    String(address);
+    String(tags);
+}
+
+void OscWriter::EndMessage()
+{
+    if (!ok)
+        return;
+    size_t end = at;
+    at = messageAt;
+    Put32(static_cast<uint32_t>(end - messageAt - 4));
+    at = end;
+}
+
+uint64_t OscTimeTag(int64_t steadyNs)
+{
+    int64_t steadyNow = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    int64_t wallNow = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    uint64_t wallNs = static_cast<uint64_t>(wallNow - (steadyNow - steadyNs));
+    uint64_t seconds = wallNs / 1000000000ULL;
+    uint64_t fraction = ((wallNs % 1000000000ULL) << 32) / 1000000000ULL;
+    return ((seconds + kNtpUnixOffset) << 32) | fraction;
+}
+
+int OpenUdpSender(const std::string& address, const char* owner)
+{
+#ifdef _WIN32
+    (void)address;
+    std::cerr << owner << ": not supported on Windows." << std::endl;
+    return -1;
+#else
+    // "host:port", "[v6 host]:port" or "port".
+    size_t colon = address.rfind(':');
+    std::string host = colon == std::string::npos ? "127.0.0.1" : address.substr(0, colon);
+    std::string port = colon == std::string::npos ? address : address.substr(colon + 1);
+    if (host.size() > 2 && host.front() == '[' && host.back() == ']')
+        host = host.substr(1, host.size() - 2);
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_NUMERICSERV;
+    addrinfo* found = nullptr;
+    int error = getaddrinfo(host.c_str(), port.c_str(), &hints, &found);
+    if (error != 0) {
+        std::cerr << owner << ": cannot resolve " << address << ": " << gai_strerror(error) << std::endl;
+        return -1;
+    }
+    int fd = -1;
+    for (addrinfo* info = found; info && fd < 0; info = info->ai_next) {
+        fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+        if (fd < 0)
+            continue;
+        if (connect(fd, info->ai_addr, info->ai_addrlen) != 0) {
+            error = errno;
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(found);
+    if (fd < 0) {
+        std::cerr << owner << ": cannot send to " << address << ": " << std::strerror(error) << std::endl;
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+#endif
+}
+
+bool SendDatagram(int fd, const std::vector<uint8_t>& packet, size_t size)
+{
+#ifdef _WIN32
+    (void)fd;
+    (void)packet;
+    (void)size;
+    return false;
+#else
+    return send(fd, packet.data(), size, 0) == static_cast<ssize_t>(size);
+#endif
+}
+
+void CloseUdpSender(int fd)
+{
+#ifndef _WIN32
+    if (fd >= 0)
+        close(fd);
+#else
+    (void)fd;
+#endif
+}
+
+} // namespace kndi
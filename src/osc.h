@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace kndi {
+
+// Writes OSC 1.0 bundles (big-endian, 4-byte aligned) into a buffer sized
+// up front. Whatever would not fit is left out and Ok() turns false, so a
+// packet is never grown on the capture thread.
+class OscWriter {
+public:
+    explicit OscWriter(std::vector<uint8_t>& packet) : packet(packet), at(0), messageAt(0), ok(true) {}
+
+    // "#bundle" and its time tag (see OscTimeTag()).
+    void BeginBundle(uint64_t timeTag);
+    // Bundle element: its size, then a message with `address` and `tags`.
+    void BeginMessage(const char* address, const char* tags);
+    void EndMessage();
+    void Int32(int32_t value);
+    void Int64(int64_t value);
+    void Float(float value);
+    void String(const char* text);
+
+    size_t Size() const { return at; }
+    bool Ok() const { return ok; }
+
+private:
+    bool Fits(size_t bytes);
+    void Put32(uint32_t value);
+
+    std::vector<uint8_t>& packet;
+    size_t at;
+    size_t messageAt;
+    bool ok;
+};
+
+// OSC time tag (NTP: seconds and 2^-32 fractions since 1900) of a time on
+// the host monotonic clock, mapped to the wall clock.
+uint64_t OscTimeTag(int64_t steadyNs);
+
+// Non-blocking UDP socket connected to `address`: "host:port",
+// "[v6 host]:port" or "port" for 127.0.0.1. Returns -1, with the reason on
+// stderr after `owner`, if it cannot be resolved. Not available on Windows.
+int OpenUdpSender(const std::string& address, const char* owner);
+// Send one datagram without blocking; false if it was not sent whole.
+bool SendDatagram(int fd, const std::vector<uint8_t>& packet, size_t size);
+void CloseUdpSender(int fd);
+
+} // namespace kndi
@@ -0,0 +1,1330 @@
+#include "pipeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <system_error>
+
+#include "realtime_memory.h"
+
+namespace kndi {
+
+// Nominal Kinect frame interval, used to express failover gaps in frames.
+static constexpr double kFrameIntervalNs = 1e9 / 30.0;
+
+// How long a Kinect may take to deliver its first frame once its streams
+// start (often several hundred ms) before it counts as stalled.
+static constexpr int64_t kFirstFrameGraceNs = 3 * 1000000000LL;
+
+// Frames after a connect at which the clock estimate is logged (30 s).
+static constexpr uint64_t kClockReportFrames = 900;
+
+// Minimum spacing of automatic flight recorder dumps.
+static constexpr int64_t kAutoDumpSpacingNs = 30 * 1000000000LL;
+
+static int64_t HostNowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Pipeline::Pipeline(int deviceIndex)
+    : activeSlot(0), failovers(0), failoverFromNs(0), startedNs(0), replay(nullptr), lastAutoDumpNs(0),
+      fusedSequence(0), meshSequence(0), running(false), stopRequested(false)
+{
+    config.deviceIndex = deviceIndex;
+}
+
+Pipeline::~Pipeline()
+{
+    Stop();
+    stats.reset();
+}
+
+int Pipeline::SetStreams(unsigned streams)
+{
+    if (running)
+        return KNDI_ERROR_STATE;
+    if (streams == 0 || (streams & ~KNDI_STREAM_CAPTURE))
+        return KNDI_ERROR_INVALID;
+    // IR and RGB share the Kinect video channel.
+    if ((streams & KNDI_STREAM_IR) && (streams & KNDI_STREAM_RGB))
+        return KNDI_ERROR_INVALID;
+    config.streams = streams;
+    return KNDI_OK;
+}
+
+int Pipeline::SetOption(const std::string& key, const std::string& value)
+{
+    if (running)
+        return KNDI_ERROR_STATE;
+    return ApplyOption(config, key, value);
+}
+
+int Pipeline::AddSink(Sink* sink)
+{
+    if (running) {
+        delete sink;
+        return KNDI_ERROR_STATE;
+    }
+    sinks.push_back(std::unique_ptr<Sink>(sink));
+    return KNDI_OK;
+}
+
+int Pipeline::AddReplaySink(ReplaySink* sink)
+{
+    if (replay) {
+        delete sink;
+        return KNDI_ERROR_INVALID;
+    }
+    int ret = AddSink(sink);
+    if (ret == KNDI_OK)
+        replay = sink;
+    return ret;
+}
+
+int Pipeline::SaveReplay(const std::string& path)
+{
+    if (!replay)
+        return KNDI_ERROR_UNSUPPORTED;
+    std::string file = path.empty() ? TimestampedPath(config.replayDir, "replay", ".knr") : path;
+    return replay->Save(file) ? KNDI_OK : KNDI_ERROR_STATE;
+}
+
+int Pipeline::Prepare()
+{
+    if (running)
+        return KNDI_ERROR_STATE;
+    if (config.streams == 0)
+        return KNDI_ERROR_INVALID;
+    if (config.standbyDeviceIndex == config.deviceIndex)
+        return KNDI_ERROR_INVALID;
+    // A standby replaces the primary; fused devices add to it.
+    if (config.standbyDeviceIndex >= 0 && !config.fusionDevices.empty())
+        return KNDI_ERROR_INVALID;
+
+    std::vector<int> deviceIndices(1, config.deviceIndex);
+    if (config.standbyDeviceIndex >= 0)
+        deviceIndices.push_back(config.standbyDeviceIndex);
+    for (int index : config.fusionDevices) {
+        if (std::find(deviceIndices.begin(), deviceIndices.end(), index) == deviceIndices.end())
+            deviceIndices.push_back(index);
+    }
+
+    // The fusion stage still references the last run's depth frames.
+    fusion.reset();
+    bool sameDevices = slots.size() == deviceIndices.size();
+    for (size_t i = 0; sameDevices && i < slots.size(); i++)
+        sameDevices = slots[i]->deviceIndex == deviceIndices[i];
+    if (!sameDevices) {
+        for (const std::unique_ptr<DeviceSlot>& slot : slots) {
+            if (PoolHeld(slot->videoPool) || PoolHeld(slot->depthPool))
+                return KNDI_ERROR_STATE;
+        }
+        slots.clear();
+        for (size_t i = 0; i < deviceIndices.size(); i++) {
+            std::unique_ptr<DeviceSlot> slot(new DeviceSlot);
+            slot->id = static_cast<int>(i);
+            slot->deviceIndex = deviceIndices[i];
+            slot->ctx = nullptr;
+            slots.push_back(std::move(slot));
+        }
+    }
+
+    // Pools are sized from the frame modes and kept for the lifetime of the
+    // pipeline, so reconnects never reallocate.
+    startedNs = HostNowNs();
+    for (const std::unique_ptr<DeviceSlot>& slot : slots) {
+        if (config.streams & KNDI_STREAM_VIDEO) {
+            kndi_stream stream = (config.streams & KNDI_STREAM_IR) ? KNDI_STREAM_IR : KNDI_STREAM_RGB;
+            if (!ResizePool(slot->videoPool, static_cast<size_t>(VideoMode(stream).bytes)))
+                return KNDI_ERROR_STATE;
+        }
+        if (config.streams & KNDI_STREAM_DEPTH) {
+            if (!ResizePool(slot->depthPool, static_cast<size_t>(DepthMode().bytes)))
+                return KNDI_ERROR_STATE;
+        }
+        slot->depthFilter.reset();
+        if ((config.streams & KNDI_STREAM_DEPTH) && config.depthFilter != DepthFilter::None)
+            slot->depthFilter.reset(new DepthFilterStage(config.depthFilter, config.depthFilterLayout,
+                                                         DepthMode().width, DepthMode().height));
+        // Each Kinect keeps its own history.
+        slot->videoDenoise.reset();
+        if ((config.streams & KNDI_STREAM_VIDEO) && config.videoDenoise) {
+            freenect_frame_mode mode = VideoMode((config.streams & KNDI_STREAM_IR) ? KNDI_STREAM_IR : KNDI_STREAM_RGB);
+            slot->videoDenoise.reset(new VideoDenoiser(mode.width, mode.height, mode.bytes / (mode.width * mode.height),
+                                                       config.videoDenoiseStrength, config.videoDenoiseThreshold));
+        }
+        // Stall detection arms once a device has delivered; until then
+        // it gets the first-frame grace from start-up.
+        slot->lastFrameNs = 0;
+        slot->streamStartNs = 0;
+        slot->connectedNs = startedNs;
+        slot->watchdogFired = false;
+        slot->lostPackets = 0;
+        slot->receivedFrames = 0;
+        slot->lostFrames = 0;
+        slot->receivedBefore = 0;
+        slot->lostBefore = 0;
+        std::lock_guard<std::mutex> lock(slot->usbMutex);
+        slot->usbFound = false;
+        slot->captureCpu = -1;
+    }
+
+    if (!workers || (config.threads > 0 && workers->Size() != config.threads))
+        workers.reset(new ThreadPool(config.threads));
+    placement.reset(config.usbPlacement ? new UsbPlacement() : nullptr);
+    // The publisher reads the recorder, so it goes first and is set up
+    // again for this run's settings.
+    stats.reset();
+    if (!recorder || recorder->Capacity() != config.flightRecorderFrames)
+        recorder.reset(new FlightRecorder(config.flightRecorderFrames));
+    if (config.statsIntervalMs > 0) {
+        stats.reset(new StatsPublisher(*recorder, running, StatsName(), config.poolFrames, config.statsIntervalMs));
+        if (!stats->Start())
+            stats.reset();
+    }
+    if (config.flightRecorderSignal)
+        FlightRecorder::InstallSignalHandler();
+    freenect_frame_mode depthMode = DepthMode();
+    roi.Compile(config.roi, depthMode.width, depthMode.height);
+    int ret = PrepareFusion();
+    if (ret < 0)
+        return ret;
+    ret = PrepareVolumeCrop();
+    if (ret < 0)
+        return ret;
+    ret = PrepareAutoFrame();
+    if (ret < 0)
+        return ret;
+    ret = PreparePrivacy();
+    if (ret < 0)
+        return ret;
+    ret = PrepareColourLut();
+    if (ret < 0)
+        return ret;
+    ret = PrepareMesh();
+    if (ret < 0)
+        return ret;
+    ret = PreparePlanes();
+    if (ret < 0)
+        return ret;
+
+    // Pick the conversion kernels for this host (benchmarked once, then
+    // cached) before the planner looks at the sinks.
+    std::string tuningFile = config.tuningFile.empty() ? DefaultTuningPath() : config.tuningFile;
+    tuner.Begin(tuningFile == "none" ? std::string() : tuningFile, config.retune, *workers);
+    PlanContext context = StreamShapes();
+    for (const std::unique_ptr<Sink>& sink : sinks)
+        sink->Configure(context, tuner, *workers);
+    std::cout << tuner.Finish();
+    config.retune = false;
+    if (config.realtimeMemory)
+        PrepareRealtimeMemory();
+    return KNDI_OK;
+}
+
+// Whether the application still holds frames of `pool` (kndi_frame_retain()).
+bool Pipeline::PoolHeld(const std::unique_ptr<FramePool>& pool)
+{
+    if (!pool || pool->InUse() == 0)
+        return false;
+    std::cerr << "Retained frames must be released before the frame pools are reallocated (" << pool->InUse()
+              << " still held)." << std::endl;
+    return true;
+}
+
+bool Pipeline::ResizePool(std::unique_ptr<FramePool>& pool, size_t bytesPerFrame)
+{
+    if (pool && pool->BytesPerFrame() == bytesPerFrame && pool->Slots() == config.poolFrames)
+        return true;
+    if (PoolHeld(pool))
+        return false;
+    pool.reset(new FramePool(config.poolFrames, bytesPerFrame));
+    return true;
+}
+
+void Pipeline::PrepareRealtimeMemory()
+{
+    std::vector<FramePool*> pools;
+    for (const std::unique_ptr<DeviceSlot>& slot : slots) {
+        if (slot->videoPool)
+            pools.push_back(slot->videoPool.get());
+        if (slot->depthPool)
+            pools.push_back(slot->depthPool.get());
+    }
+    if (fusion) {
+        pools.push_back(fusedPool.get());
+        pools.push_back(cloudPool.get());
+    }
+    if (mesher)
+        pools.push_back(meshPool.get());
+    for (FramePool* pool : pools)
+        pool->Prefault();
+    // Pools allocated after mlockall are locked as they are created.
+    if (CurrentMemoryLock() == MemoryLock::All)
+        return;
+
+    std::string error;
+    if (LockAllMemory(error)) {
+        NoteMemoryLock(MemoryLock::All);
+        std::cout << "Real-time memory: buffers prefaulted, process memory locked." << std::endl;
+        return;
+    }
+    bool locked = true;
+    for (FramePool* pool : pools)
+        locked = pool->Lock() && locked;
+    if (locked) {
+        NoteMemoryLock(MemoryLock::Buffers);
+        std::cerr << "Warning: could not lock process memory: " << error
+                  << ". Only the frame pools are locked." << std::endl;
+    } else {
+        std::cerr << "Warning: could not lock memory: " << error
+                  << ". Buffers are prefaulted but may be paged out under memory pressure." << std::endl;
+    }
+}
+
+int Pipeline::PrepareFusion()
+{
+    fusion.reset();
+    if (config.fusionDevices.empty())
+        return KNDI_OK;
+    if (!(config.streams & KNDI_STREAM_DEPTH)) {
+        std::cerr << "Depth fusion needs the depth stream enabled." << std::endl;
+        return KNDI_ERROR_INVALID;
+    }
+
+    std::map<std::string, Pose> poses;
+    if (!config.posesFile.empty()) {
+        std::string error;
+        if (!LoadPoses(config.posesFile, poses, error)) {
+            std::cerr << "Could not load Kinect poses: " << error << std::endl;
+            return KNDI_ERROR_INVALID;
+        }
+    } else {
+        std::cerr << "Warning: no poses_file given, fusing all Kinects with identity poses." << std::endl;
+    }
+
+    std::vector<Pose> devicePoses;
+    for (const std::unique_ptr<DeviceSlot>& slot : slots) {
+        std::string name = std::to_string(slot->deviceIndex);
+        if (poses.empty()) {
+            devicePoses.push_back(Pose::Identity());
+        } else if (poses.count(name)) {
+            devicePoses.push_back(poses[name]);
+        } else {
+            std::cerr << "No pose for Kinect " << name << " in " << config.posesFile << "." << std::endl;
+            return KNDI_ERROR_INVALID;
+        }
+    }
+    Pose virtualPose = poses.count("virtual") ? poses["virtual"] : Pose::Identity();
+
+    freenect_frame_mode mode = DepthMode();
+    fusion.reset(new DepthFusion(config.fusion, devicePoses, virtualPose, mode.width, mode.height, roi));
+    size_t fusedBytes = static_cast<size_t>(config.fusion.width) * config.fusion.height * sizeof(uint16_t);
+    size_t cloudBytes = std::max<size_t>(fusion->MaxCloudPoints() * 3 * sizeof(float), 1);
+    if (!ResizePool(fusedPool, fusedBytes) || !ResizePool(cloudPool, cloudBytes))
+        return KNDI_ERROR_STATE;
+    return KNDI_OK;
+}
+
+int Pipeline::PrepareVolumeCrop()
+{
+    volumeCrop.reset();
+    if (!config.volumeCrop)
+        return KNDI_OK;
+    if (!(config.streams & KNDI_STREAM_DEPTH)) {
+        std::cerr << "The volume crop needs the depth stream enabled." << std::endl;
+        return KNDI_ERROR_INVALID;
+    }
+    // Keying writes the alpha of the unturned frame.
+    if (config.volumeCropMode == VolumeCropMode::Key && config.orientation != Orientation::None) {
+        std::cerr << "A keyed volume crop cannot be combined with an orientation." << std::endl;
+        return KNDI_ERROR_INVALID;
+    }
+    freenect_frame_mode depthMode = DepthMode();
+    volumeCrop.reset(new VolumeCrop(config.volumeBox, depthMode.width, depthMode.height));
+    return KNDI_OK;
+}
+
+int Pipeline::PrepareAutoFrame()
+{
+    framer.reset();
+    if (!config.autoFrame)
+        return KNDI_OK;
+    if (!(config.streams & KNDI_STREAM_RGB) || !(config.streams & KNDI_STREAM_DEPTH)) {
+        std::cerr << "Auto-framing needs the RGB and depth streams enabled." << std::endl;
+        return KNDI_ERROR_INVALID;
+    }
+    // The crop is tracked in the Kinect's own image coordinates.
+    if (config.orientation != Orientation::None) {
+        std::cerr << "Auto-framing cannot be combined with an orientation." << std::endl;
+        return KNDI_ERROR_INVALID;
+    }
+    freenect_frame_mode depthMode = DepthMode();
+    freenect_frame_mode videoMode = VideoMode(KNDI_STREAM_RGB);
+    framer.reset(new AutoFramer(config.framing, depthMode.width, depthMode.height, videoMode.width,
+                                videoMode.height));
+    return KNDI_OK;
+}
+
+int Pipeline::PreparePrivacy()
+{
+    privacy.reset();
+    if (config.privacy == PrivacyMode::Off)
+        return KNDI_OK;
+    if (!(config.streams & KNDI_STREAM_RGB) || !(config.streams & KNDI_STREAM_DEPTH)) {
+        std::cerr << "Privacy masking needs the RGB and depth streams enabled." << std::endl;
+        return KNDI_ERROR_INVALID;
+    }
+    // The blocks are masked in the Kinect's own image coordinates.
+    if (config.orientation != Orientation::None) {
+        std::cerr << "Privacy masking cannot be combined with an orientation." << std::endl;
+        return KNDI_ERROR_INVALID;
+    }
+    freenect_frame_mode depthMode = DepthMode();
+    freenect_frame_mode videoMode = VideoMode(KNDI_STREAM_RGB);
+    privacy.reset(new PrivacyMask(config.privacy, config.privacyFarMm, depthMode.width, depthMode.height,
+                                  videoMode.width, videoMode.height));
+    return KNDI_OK;
+}
+
+int Pipeline::PrepareColourLut()
+{
+    colourLut.reset();
+    if (config.colourLutFile.empty())
+        return KNDI_OK;
+    if (!(config.streams & KNDI_STREAM_RGB)) {
+        std::cerr << "Colour grading needs the RGB stream enabled." << std::endl;
+        return KNDI_ERROR_INVALID;
+    }
+    // Turned output is written in tiles, past the graded conversion.
+    if (config.orientation != Orientation::None) {
+        std::cerr << "Colour grading cannot be combined with an orientation." << std::endl;
+        return KNDI_ERROR_INVALID;
+    }
+    // Read again on every start, so an edited file is picked up.
+    std::string error;
+    colourLut.reset(ColourLut::Load(config.colourLutFile, error));
+    if (!colourLut) {
+        std::cerr << "Could not load colour LUT: " << error << std::endl;
+        return KNDI_ERROR_INVALID;
+    }
+    std::cout << "Colour LUT \"" << colourLut->Title() << "\" (" << colourLut->Size() << "x" << colourLut->Size()
+              << "x" << colourLut->Size() << ") grades the RGB output." << std::endl;
+    return KNDI_OK;
+}
+
+int Pipeline::PrepareMesh()
+{
+    mesher.reset();
+    if (!config.mesh)
+        return KNDI_OK;
+    if (!(config.streams & KNDI_STREAM_DEPTH)) {
+        std::cerr << "The depth mesh needs the depth stream enabled." << std::endl;
+        return KNDI_ERROR_INVALID;
+    }
+    freenect_frame_mode depthMode = DepthMode();
+    mesher.reset(new DepthMesher(config.meshSettings, depthMode.width, depthMode.height));
+    if (!ResizePool(meshPool, mesher->MaxBytes()))
+        return KNDI_ERROR_STATE;
+    return KNDI_OK;
+}
+
+int Pipeline::PreparePlanes()
+{
+    planes.reset();
+    if (!config.planes)
+        return KNDI_OK;
+    if (!(config.streams & KNDI_STREAM_DEPTH)) {
+        std::cerr << "Plane detection needs the depth stream enabled." << std::endl;
+        return KNDI_ERROR_INVALID;
+    }
+    freenect_frame_mode depthMode = DepthMode();
+    planes.reset(new PlaneFinder(config.planeSettings, depthMode.width, depthMode.height));
+    return KNDI_OK;
+}
+
+// Fusion stage of the configured size fed with synthetic depth, for the
+// planner. The pool is declared first so it outlives the fusion stage that
+// holds its buffers.
+struct FusionBenchmark {
+    FusionBenchmark(const FusionSettings& settings, int devices, const freenect_frame_mode& mode,
+                    const RoiMask& roi)
+        : inputs(devices, static_cast<size_t>(mode.bytes)),
+          fusion(settings, std::vector<Pose>(devices, Pose::Identity()), Pose::Identity(),
+                 mode.width, mode.height, roi),
+          merged(static_cast<size_t>(settings.width) * settings.height),
+          points(std::max<size_t>(fusion.MaxCloudPoints() * 3, 1))
+    {
+        for (int i = 0; i < devices; i++) {
+            FrameBuffer* buffer = inputs.Acquire();
+            uint16_t* raw = reinterpret_cast<uint16_t*>(buffer->storage);
+            for (int p = 0; p < mode.width * mode.height; p++)
+                raw[p] = static_cast<uint16_t>(600 + p % 400);
+            buffer->frame.data = buffer->storage;
+            buffer->frame.host_timestamp_ns = 0;
+            fusion.Submit(i, buffer);
+        }
+    }
+
+    FramePool inputs;
+    DepthFusion fusion;
+    std::vector<uint16_t> merged;
+    std::vector<float> points;
+};
+
+PlanContext Pipeline::StreamShapes() const
+{
+    PlanContext context;
+    context.roi = &roi;
+    context.orientation = config.orientation;
+    context.framer = framer.get();
+    context.keyDepth = volumeCrop && config.volumeCropMode == VolumeCropMode::Key;
+    context.privacy = privacy.get();
+    context.planes = planes.get();
+    context.colourLut = colourLut.get();
+    if (config.streams & KNDI_STREAM_VIDEO) {
+        kndi_stream stream = (config.streams & KNDI_STREAM_IR) ? KNDI_STREAM_IR : KNDI_STREAM_RGB;
+        freenect_frame_mode mode = VideoMode(stream);
+        StreamShape& shape = context.Shape(stream);
+        shape.width = mode.width;
+        shape.height = mode.height;
+        shape.bytesPerPixel = mode.bytes / (mode.width * mode.height);
+        shape.maxBytes = static_cast<size_t>(mode.bytes);
+        shape.framesPerSecond = mode.framerate;
+    }
+    freenect_frame_mode depthMode = DepthMode();
+    if (config.streams & KNDI_STREAM_DEPTH) {
+        StreamShape& shape = context.Shape(KNDI_STREAM_DEPTH);
+        shape.width = depthMode.width;
+        shape.height = depthMode.height;
+        shape.bytesPerPixel = 2;
+        shape.maxBytes = static_cast<size_t>(depthMode.width) * depthMode.height * 2;
+        shape.framesPerSecond = depthMode.framerate;
+    }
+    if (fusion) {
+        const FusionSettings& settings = fusion->Settings();
+        StreamShape& fused = context.Shape(KNDI_STREAM_FUSED_DEPTH);
+        fused.width = settings.width;
+        fused.height = settings.height;
+        fused.bytesPerPixel = 2;
+        fused.maxBytes = static_cast<size_t>(settings.width) * settings.height * 2;
+        fused.framesPerSecond = depthMode.framerate;
+        StreamShape& cloud = context.Shape(KNDI_STREAM_POINT_CLOUD);
+        cloud.width = static_cast<int>(fusion->MaxCloudPoints());
+        cloud.height = 1;
+        cloud.bytesPerPixel = 3 * sizeof(float);
+        cloud.maxBytes = fusion->MaxCloudPoints() * 3 * sizeof(float);
+        cloud.framesPerSecond = settings.cloudStep > 0 ? depthMode.framerate : 0.0;
+    }
+    if (mesher) {
+        StreamShape& mesh = context.Shape(KNDI_STREAM_MESH);
+        mesh.maxBytes = mesher->MaxBytes();
+        mesh.framesPerSecond = depthMode.framerate;
+    }
+    return context;
+}
+
+bool Pipeline::Estimate(std::string& report)
+{
+    PlanContext context = StreamShapes();
+    freenect_frame_mode depthMode = DepthMode();
+
+    Planner planner;
+    for (const std::unique_ptr<DeviceSlot>& slot : slots) {
+        if (slot->videoPool)
+            planner.AddPoolMemory(slot->videoPool->Slots() * slot->videoPool->BytesPerFrame());
+        if (slot->depthPool)
+            planner.AddPoolMemory(slot->depthPool->Slots() * slot->depthPool->BytesPerFrame());
+    }
+    if (config.depthFilter != DepthFilter::None && (config.streams & KNDI_STREAM_DEPTH)) {
+        // Once per Kinect whose depth is used: the active one and any fused.
+        int filtered = fusion ? fusion->Devices() : 1;
+        std::shared_ptr<DepthFilterStage> filter = std::make_shared<DepthFilterStage>(
+            config.depthFilter, config.depthFilterLayout, depthMode.width, depthMode.height);
+        std::shared_ptr<std::vector<uint16_t>> depth =
+            std::make_shared<std::vector<uint16_t>>(static_cast<size_t>(depthMode.width) * depthMode.height, 700);
+        ThreadPool* pool = workers.get();
+        int stride = depthMode.width * 2;
+        PlanStage stage;
+        stage.name = std::string("depth filter ") + DepthFilterName(config.depthFilter) + " (" +
+                     DepthLayoutName(config.depthFilterLayout) + ")";
+        if (filtered > 1)
+            stage.name += " x" + std::to_string(filtered);
+        stage.framesPerSecond = depthMode.framerate;
+        // Read and write the frame; the tiled layouts pass it through two
+        // more buffers.
+        size_t frameBytes = depth->size() * sizeof(uint16_t);
+        stage.bytesPerFrame = filtered * frameBytes * (config.depthFilterLayout == DepthLayout::Rows ? 4 : 6);
+        stage.run = [filter, depth, pool, stride, filtered] {
+            for (int i = 0; i < filtered; i++)
+                filter->Apply(pool, depth->data(), stride);
+        };
+        planner.Add(stage);
+    }
+    if (config.videoDenoise && (config.streams & KNDI_STREAM_VIDEO)) {
+        kndi_stream stream = (config.streams & KNDI_STREAM_IR) ? KNDI_STREAM_IR : KNDI_STREAM_RGB;
+        freenect_frame_mode mode = VideoMode(stream);
+        int stride = mode.bytes / mode.height;
+        std::shared_ptr<VideoDenoiser> denoiser = std::make_shared<VideoDenoiser>(
+            mode.width, mode.height, stride / mode.width, config.videoDenoiseStrength, config.videoDenoiseThreshold);
+        std::shared_ptr<std::vector<uint8_t>> video =
+            std::make_shared<std::vector<uint8_t>>(static_cast<size_t>(mode.bytes), 0x40);
+        std::shared_ptr<int64_t> timestampNs = std::make_shared<int64_t>(0);
+        ThreadPool* pool = workers.get();
+        PlanStage stage;
+        stage.name = std::string("video denoise ") + (stream == KNDI_STREAM_IR ? "IR" : "RGB");
+        stage.framesPerSecond = mode.framerate;
+        // Frame in and out, 16-bit history in and out.
+        stage.bytesPerFrame = static_cast<size_t>(mode.bytes) * 6;
+        stage.run = [denoiser, video, timestampNs, pool, stride] {
+            *timestampNs += 33333333;
+            denoiser->Apply(pool, video->data(), stride, *timestampNs);
+        };
+        planner.Add(stage);
+    }
+    if (volumeCrop) {
+        std::shared_ptr<std::vector<uint16_t>> depth =
+            std::make_shared<std::vector<uint16_t>>(static_cast<size_t>(depthMode.width) * depthMode.height, 700);
+        const VolumeCrop* crop = volumeCrop.get();
+        ThreadPool* pool = workers.get();
+        int stride = depthMode.width * 2;
+        PlanStage stage;
+        stage.name = "volume crop";
+        stage.framesPerSecond = depthMode.framerate;
+        // Depth in and out, three ray planes in.
+        stage.bytesPerFrame = depth->size() * sizeof(uint16_t) * 5;
+        stage.run = [crop, depth, pool, stride] {
+            crop->Apply(pool, depth->data(), stride);
+        };
+        planner.Add(stage);
+    }
+    if (privacy) {
+        freenect_frame_mode videoMode = VideoMode(KNDI_STREAM_RGB);
+        std::shared_ptr<PrivacyMask> mask = std::make_shared<PrivacyMask>(
+            config.privacy, config.privacyFarMm, depthMode.width, depthMode.height, videoMode.width, videoMode.height);
+        std::shared_ptr<std::vector<uint16_t>> depth =
+            std::make_shared<std::vector<uint16_t>>(static_cast<size_t>(depthMode.width) * depthMode.height, 700);
+        int stride = depthMode.width * 2;
+        PlanStage stage;
+        stage.name = "privacy mask (" + std::to_string(mask->BlocksX()) + "x" + std::to_string(mask->BlocksY()) +
+                     " blocks)";
+        stage.framesPerSecond = depthMode.framerate;
+        // 16 samples per block, each on its own cache line.
+        stage.bytesPerFrame = static_cast<size_t>(mask->BlocksX()) * mask->BlocksY() * 16 * 64;
+        stage.run = [mask, depth, stride] {
+            mask->Update(depth->data(), stride, 0);
+        };
+        planner.Add(stage);
+    }
+    if (mesher) {
+        planner.AddPoolMemory(meshPool->Slots() * meshPool->BytesPerFrame());
+        // Its own mesher, so planning leaves the live quadtrees alone. Runs
+        // alternate between two frames of a sloped floor with bumps, shifted
+        // against each other, so every tile is merged again.
+        std::shared_ptr<DepthMesher> bench =
+            std::make_shared<DepthMesher>(config.meshSettings, depthMode.width, depthMode.height);
+        size_t pixels = static_cast<size_t>(depthMode.width) * depthMode.height;
+        std::shared_ptr<std::vector<uint16_t>> depth = std::make_shared<std::vector<uint16_t>>(2 * pixels);
+        for (size_t i = 0; i < depth->size(); i++) {
+            int x = static_cast<int>(i % depthMode.width) + (i < pixels ? 0 : 8);
+            int y = static_cast<int>(i % pixels) / depthMode.width;
+            (*depth)[i] = static_cast<uint16_t>(700 + x / 16 + y / 8 + ((x / 64 + y / 48) % 4 == 0 ? 40 : 0));
+        }
+        std::shared_ptr<std::vector<uint8_t>> out = std::make_shared<std::vector<uint8_t>>(bench->MaxBytes());
+        std::shared_ptr<size_t> phase = std::make_shared<size_t>(0);
+        ThreadPool* pool = workers.get();
+        int width = depthMode.width;
+        PlanStage stage;
+        stage.name = "depth mesh";
+        stage.framesPerSecond = depthMode.framerate;
+        // The grid samples, each on its own cache line, and the mesh out.
+        stage.bytesPerFrame = static_cast<size_t>(depthMode.width / DepthMesher::kCell) *
+                                  (depthMode.height / DepthMesher::kCell) * 64 + bench->MaxBytes();
+        stage.run = [bench, depth, out, phase, pool, width, pixels] {
+            const uint16_t* frame = depth->data() + ((*phase)++ % 2) * pixels;
+            bench->Build(pool, frame, width * 2, out->data());
+        };
+        planner.Add(stage);
+    }
+    if (framer) {
+        // Its own tracker, so planning does not move the live crop.
+        freenect_frame_mode videoMode = VideoMode(KNDI_STREAM_RGB);
+        std::shared_ptr<AutoFramer> tracker = std::make_shared<AutoFramer>(
+            framer->Settings(), depthMode.width, depthMode.height, videoMode.width, videoMode.height);
+        std::shared_ptr<std::vector<uint16_t>> depth =
+            std::make_shared<std::vector<uint16_t>>(static_cast<size_t>(depthMode.width) * depthMode.height, 700);
+        int stride = depthMode.width * 2;
+        int gridWidth = (depthMode.width + AutoFramer::kGridStep - 1) / AutoFramer::kGridStep;
+        int gridHeight = (depthMode.height + AutoFramer::kGridStep - 1) / AutoFramer::kGridStep;
+        PlanStage stage;
+        stage.name = "auto-framing (" + std::to_string(gridWidth) + "x" + std::to_string(gridHeight) + " depth grid)";
+        stage.framesPerSecond = depthMode.framerate;
+        // One sample per grid cell, each on its own cache line.
+        stage.bytesPerFrame = static_cast<size_t>(gridWidth) * gridHeight * 64;
+        stage.run = [tracker, depth, stride] {
+            tracker->Update(depth->data(), stride, 0);
+        };
+        planner.Add(stage);
+    }
+    if (planes) {
+        // One search and the refits until the next, on a room-like frame;
+        // its own finder, so planning does not disturb the live planes.
+        const PlaneSettings& settings = planes->Settings();
+        std::shared_ptr<PlaneFinder> finder =
+            std::make_shared<PlaneFinder>(settings, depthMode.width, depthMode.height);
+        std::shared_ptr<std::vector<uint16_t>> depth = std::make_shared<std::vector<uint16_t>>();
+        SyntheticRoomDepth(depthMode.width, depthMode.height, *depth);
+        int stride = depthMode.width * 2;
+        int interval = settings.intervalFrames;
+        ThreadPool* pool = workers.get();
+        PlanStage stage;
+        stage.name = "planes (RANSAC 1 in " + std::to_string(interval) + " frames)";
+        stage.framesPerSecond = static_cast<double>(depthMode.framerate) / interval;
+        stage.bytesPerFrame = static_cast<size_t>(depthMode.width / PlaneFinder::kGridStep) *
+                                  (depthMode.height / PlaneFinder::kGridStep) * (64 + 16) * interval;
+        stage.run = [finder, depth, stride, interval, pool] {
+            for (int i = 0; i < interval; i++)
+                finder->Update(pool, depth->data(), stride, 0);
+        };
+        planner.Add(stage);
+    }
+    if (fusion) {
+        const FusionSettings& settings = fusion->Settings();
+        planner.AddPoolMemory(fusedPool->Slots() * fusedPool->BytesPerFrame() +
+                              cloudPool->Slots() * cloudPool->BytesPerFrame());
+
+        std::shared_ptr<FusionBenchmark> bench =
+            std::make_shared<FusionBenchmark>(settings, fusion->Devices(), depthMode, roi);
+        ThreadPool* pool = workers.get();
+        PlanStage fuse;
+        fuse.name = "depth fusion (" + std::to_string(fusion->Devices()) + " Kinects)";
+        fuse.framesPerSecond = depthMode.framerate;
+        // Raw depth and ray tables in, one z-buffer per device out and back
+        // in for the merge, merged image and cloud out.
+        size_t pixels = roi.Pixels();
+        size_t zbuffer = bench->merged.size() * sizeof(uint16_t);
+        fuse.bytesPerFrame = fusion->Devices() * (pixels * (sizeof(uint16_t) + 3 * sizeof(float)) + 2 * zbuffer) +
+                             zbuffer + bench->points.size() * sizeof(float);
+        fuse.run = [bench, pool] {
+            bench->fusion.Fuse(*pool, 0, bench->merged.data(), bench->points.data());
+        };
+        planner.Add(fuse);
+    }
+
+    for (const std::unique_ptr<Sink>& sink : sinks)
+        sink->Plan(context, planner);
+
+    PlanStage driver;
+    driver.name = "libfreenect unpack";
+    planner.Add(driver);
+    return planner.Estimate(report);
+}
+
+int Pipeline::Plan(std::string& report)
+{
+    int ret = Prepare();
+    if (ret < 0)
+        return ret;
+    return Estimate(report) ? KNDI_OK : KNDI_ERROR_BUDGET;
+}
+
+int Pipeline::Start()
+{
+    int ret = Prepare();
+    if (ret < 0)
+        return ret;
+    if (config.planCheck) {
+        std::string report;
+        if (!Estimate(report))
+            std::cerr << report;
+    }
+    activeSlot = 0;
+    failoverFromNs = 0;
+    stopRequested = false;
+    // Threads from a previous run that was not stopped explicitly (this
+    // clears `running`, so it is set afterwards).
+    JoinThreads();
+    running = true;
+    try {
+        for (const std::unique_ptr<DeviceSlot>& slot : slots)
+            slot->thread = std::thread(&Pipeline::CaptureLoop, this, std::ref(*slot));
+    } catch (const std::system_error&) {
+        Stop();
+        return KNDI_ERROR_THREAD;
+    }
+    return KNDI_OK;
+}
+
+int Pipeline::Run()
+{
+    int ret = Start();
+    if (ret < 0)
+        return ret;
+    {
+        std::unique_lock<std::mutex> lock(stopMutex);
+        stopCondition.wait(lock, [this] { return stopRequested.load(); });
+    }
+    JoinThreads();
+    return KNDI_OK;
+}
+
+void Pipeline::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(stopMutex);
+        stopRequested = true;
+    }
+    stopCondition.notify_all();
+    JoinThreads();
+}
+
+void Pipeline::JoinThreads()
+{
+    std::lock_guard<std::mutex> lock(joinMutex);
+    bool joinedAll = true;
+    for (const std::unique_ptr<DeviceSlot>& slot : slots) {
+        // A sink calling kndi_stop() from a capture thread cannot join itself.
+        if (slot->thread.get_id() == std::this_thread::get_id())
+            joinedAll = false;
+        else if (slot->thread.joinable())
+            slot->thread.join();
+    }
+    if (joinedAll)
+        running = false;
+}
+
+bool Pipeline::WaitUnlessStopped(int ms)
+{
+    // Wake up every 100 ms so a SIGUSR1 dump is not held up by a reconnect
+    // wait.
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(ms);
+    std::unique_lock<std::mutex> lock(stopMutex);
+    while (!stopCondition.wait_until(lock, std::min(deadline, Clock::now() + std::chrono::milliseconds(100)),
+                                     [this] { return stopRequested.load(); })) {
+        if (FlightRecorder::RequestedBySignal()) {
+            lock.unlock();
+            DumpFlightRecorder(std::string(), "signal");
+            lock.lock();
+        }
+        if (Clock::now() >= deadline)
+            return true;
+    }
+    return false;
+}
+
+bool Pipeline::Connect(DeviceSlot& slot)
+{
+    // Initialize the Kinect context.
+    if (freenect_init(&slot.ctx, nullptr) < 0) {
+        std::cerr << "freenect_init() failed. No Kinect found." << std::endl;
+        slot.ctx = nullptr;
+        return false;
+    }
+    WatchPacketLoss(slot.ctx, &slot.lostPackets);
+    slot.device.reset(new Device(slot.deviceIndex));
+    if (slot.device->Open(slot.ctx, config.streams, slot.videoPool.get(), slot.depthPool.get()) < 0) {
+        Disconnect(slot);
+        return false;
+    }
+    PlaceOnUsb(slot);
+    return true;
+}
+
+void Pipeline::Disconnect(DeviceSlot& slot)
+{
+    if (slot.device) {
+        slot.receivedBefore += slot.device->ReceivedFrames();
+        slot.lostBefore += slot.device->LostFrames();
+        slot.receivedFrames = slot.receivedBefore;
+        slot.lostFrames = slot.lostBefore;
+    }
+    slot.device.reset();
+    if (slot.ctx) {
+        UnwatchPacketLoss(slot.ctx);
+        freenect_shutdown(slot.ctx);
+        slot.ctx = nullptr;
+    }
+}
+
+void Pipeline::PlaceOnUsb(DeviceSlot& slot)
+{
+    // libfreenect numbers Kinects in the order it lists their attributes.
+    std::string serial;
+    freenect_device_attributes* attributes = nullptr;
+    if (freenect_list_device_attributes(slot.ctx, &attributes) > slot.deviceIndex) {
+        freenect_device_attributes* entry = attributes;
+        for (int i = 0; entry && i < slot.deviceIndex; i++)
+            entry = entry->next;
+        if (entry && entry->camera_serial)
+            serial = entry->camera_serial;
+    }
+    freenect_free_device_attributes(attributes);
+
+    UsbLocation usb;
+    bool found = LocateKinect(serial, slot.deviceIndex, usb);
+    int cpu = -1;
+    if (found && placement) {
+        cpu = placement->Place(slot.deviceIndex, usb);
+        if (cpu >= 0 && !PinCurrentThread(std::vector<int>(1, cpu)))
+            cpu = -1;
+        std::vector<int> workerCpus = placement->WorkerCpus();
+        if (!workerCpus.empty())
+            workers->PinWorkers(workerCpus);
+        std::cout << "Kinect " << slot.deviceIndex << " on " << DescribeUsbLocation(usb) << ". Capture thread on "
+                  << (cpu >= 0 ? "CPU " + std::to_string(cpu) : std::string("any CPU (could not pin)"))
+                  << (workerCpus.empty() ? std::string() : ", workers on CPUs " + FormatCpuList(workerCpus)) << "."
+                  << std::endl;
+        for (const std::string& other : placement->SharedInterrupts(usb))
+            std::cerr << "Warning: USB controllers " << usb.controller << " and " << other
+                      << " interrupt the same CPU; spread them with /proc/irq/<n>/smp_affinity_list." << std::endl;
+    } else if (placement) {
+        std::cerr << "Kinect " << slot.deviceIndex << " not found in /sys/bus/usb; its threads are not placed."
+                  << std::endl;
+    }
+    std::lock_guard<std::mutex> lock(slot.usbMutex);
+    slot.usbFound = found;
+    slot.usb = usb;
+    slot.captureCpu = cpu;
+}
+
+// Flight record for a frame picked up at `deliverNs`.
+static FlightRecord FrameRecord(FrameBuffer* buffer, int64_t deliverNs)
+{
+    const kndi_frame& frame = buffer->frame;
+    FlightRecord record = FlightRecord();
+    record.captureNs = frame.host_timestamp_ns;
+    record.syncedNs = frame.synced_timestamp_ns;
+    record.deliverNs = deliverNs;
+    record.sequence = frame.sequence;
+    record.deviceTimestamp = frame.device_timestamp;
+    record.poolInUse = static_cast<uint16_t>(buffer->pool->InUse());
+    record.stream = static_cast<uint16_t>(frame.stream);
+    record.device = static_cast<int16_t>(frame.device_index);
+    record.event = FlightEvent::Frame;
+    return record;
+}
+
+void Pipeline::Deliver(DeviceSlot& slot, FrameBuffer* buffer)
+{
+    if (!buffer)
+        return;
+    kndi_frame& frame = buffer->frame;
+    slot.lastFrameNs = frame.host_timestamp_ns;
+    slot.watchdogFired = false;
+    DeviceClock& clock = frame.stream == KNDI_STREAM_DEPTH ? slot.depthClock : slot.videoClock;
+    frame.synced_timestamp_ns = clock.Update(frame.device_timestamp, frame.host_timestamp_ns);
+    if (clock.Frames() == kClockReportFrames && clock.Locked()) {
+        char line[160];
+        std::snprintf(line, sizeof(line), "Kinect %d %s clock: drift %+.1f ppm, jitter %.0f us.",
+                      slot.deviceIndex, StreamKey(frame.stream), clock.DriftPpm(), clock.JitterUs());
+        std::cout << line << std::endl;
+    }
+    FlightRecord record = FrameRecord(buffer, HostNowNs());
+    record.dropped = static_cast<uint32_t>(slot.device->DroppedFrames());
+    slot.receivedFrames = slot.receivedBefore + slot.device->ReceivedFrames();
+    slot.lostFrames = slot.lostBefore + slot.device->LostFrames();
+    bool fuse = fusion && frame.stream == KNDI_STREAM_DEPTH;
+    // Standby depth is not filtered; nothing reads it.
+    if (slot.depthFilter && frame.stream == KNDI_STREAM_DEPTH && (fuse || activeSlot.load() == slot.id))
+        slot.depthFilter->Apply(workers.get(), reinterpret_cast<uint16_t*>(buffer->storage), frame.stride);
+    if (slot.videoDenoise && frame.stream != KNDI_STREAM_DEPTH && activeSlot.load() == slot.id)
+        slot.videoDenoise->Apply(workers.get(), buffer->storage, frame.stride, frame.host_timestamp_ns);
+    if (frame.stream == KNDI_STREAM_DEPTH && (volumeCrop || privacy || framer || planes)) {
+        // These stages keep state across frames, and around a failover both
+        // capture threads can take themselves for the active one.
+        std::lock_guard<std::mutex> lock(stageMutex);
+        if (activeSlot.load() == slot.id) {
+            uint16_t* depth = reinterpret_cast<uint16_t*>(buffer->storage);
+            if (volumeCrop)
+                volumeCrop->Apply(workers.get(), depth, frame.stride);
+            if (privacy)
+                privacy->Update(depth, frame.stride, frame.host_timestamp_ns);
+            if (framer)
+                framer->Update(depth, frame.stride, frame.host_timestamp_ns);
+            if (planes && planes->Update(workers.get(), depth, frame.stride, frame.host_timestamp_ns))
+                ReportPlanes(slot);
+        }
+    }
+    if (fuse) {
+        FramePool::Retain(buffer);
+        fusion->Submit(slot.id, buffer);
+    }
+    if (activeSlot.load() != slot.id) {
+        // Standby frames only keep the device warm; other fused devices
+        // only feed the fusion stage.
+        recorder->Add(record);
+        FramePool::Release(buffer);
+        return;
+    }
+    // The trigger frame stays referenced by the fusion stage.
+    kndi_frame trigger = frame;
+    bool mesh = mesher && frame.stream == KNDI_STREAM_DEPTH;
+    if (mesh)
+        FramePool::Retain(buffer);
+    Dispatch(buffer, record);
+    if (mesh) {
+        {
+            std::lock_guard<std::mutex> lock(stageMutex);
+            RunMesh(trigger);
+        }
+        FramePool::Release(buffer);
+    }
+    if (fuse)
+        RunFusion(trigger);
+}
+
+void Pipeline::RunMesh(const kndi_frame& depth)
+{
+    int64_t startNs = HostNowNs();
+    FrameBuffer* buffer = meshPool->Acquire();
+    if (!buffer) {
+        // Consumers are holding every mesh; skip this one.
+        recorder->AddEvent(FlightEvent::Drop, depth.device_index, startNs);
+        return;
+    }
+    size_t bytes = mesher->Build(workers.get(), static_cast<const uint16_t*>(depth.data), depth.stride,
+                                 buffer->storage);
+    kndi_frame& frame = buffer->frame;
+    frame.stream = KNDI_STREAM_MESH;
+    frame.device_index = depth.device_index;
+    frame.width = static_cast<int>(bytes);
+    frame.height = 1;
+    frame.bytes_per_pixel = 1;
+    frame.stride = static_cast<int>(bytes);
+    frame.data = buffer->storage;
+    frame.size = bytes;
+    frame.device_timestamp = depth.device_timestamp;
+    frame.host_timestamp_ns = depth.host_timestamp_ns;
+    frame.synced_timestamp_ns = depth.synced_timestamp_ns;
+    frame.sequence = meshSequence++;
+    FlightRecord record = FrameRecord(buffer, startNs);
+    Dispatch(buffer, record);
+}
+
+void Pipeline::RunFusion(const kndi_frame& trigger)
+{
+    int64_t startNs = HostNowNs();
+    FrameBuffer* merged = fusedPool->Acquire();
+    FrameBuffer* cloud = config.fusion.cloudStep > 0 ? cloudPool->Acquire() : nullptr;
+    if (!merged) {
+        // Consumers are holding every fused frame; skip this one.
+        recorder->AddEvent(FlightEvent::Drop, -1, startNs);
+        if (cloud)
+            FramePool::Release(cloud);
+        return;
+    }
+    // Without a free cloud buffer the cloud is skipped, not computed.
+    float* points = cloud ? reinterpret_cast<float*>(cloud->storage) : nullptr;
+    size_t count = fusion->Fuse(*workers, trigger.host_timestamp_ns,
+                                reinterpret_cast<uint16_t*>(merged->storage), points);
+
+    const FusionSettings& settings = fusion->Settings();
+    kndi_frame& frame = merged->frame;
+    frame.stream = KNDI_STREAM_FUSED_DEPTH;
+    frame.device_index = -1;
+    frame.width = settings.width;
+    frame.height = settings.height;
+    frame.bytes_per_pixel = 2;
+    frame.stride = settings.width * 2;
+    frame.data = merged->storage;
+    frame.size = merged->capacity;
+    frame.device_timestamp = trigger.device_timestamp;
+    frame.host_timestamp_ns = trigger.host_timestamp_ns;
+    frame.synced_timestamp_ns = trigger.synced_timestamp_ns;
+    frame.sequence = fusedSequence;
+    FlightRecord record = FrameRecord(merged, startNs);
+    Dispatch(merged, record);
+
+    if (cloud) {
+        kndi_frame& cloudFrame = cloud->frame;
+        cloudFrame.stream = KNDI_STREAM_POINT_CLOUD;
+        cloudFrame.device_index = -1;
+        cloudFrame.width = static_cast<int>(count);
+        cloudFrame.height = 1;
+        cloudFrame.bytes_per_pixel = 3 * sizeof(float);
+        cloudFrame.stride = static_cast<int>(count * 3 * sizeof(float));
+        cloudFrame.data = cloud->storage;
+        cloudFrame.size = count * 3 * sizeof(float);
+        cloudFrame.device_timestamp = trigger.device_timestamp;
+        cloudFrame.host_timestamp_ns = trigger.host_timestamp_ns;
+        cloudFrame.synced_timestamp_ns = trigger.synced_timestamp_ns;
+        cloudFrame.sequence = fusedSequence;
+        FlightRecord cloudRecord = FrameRecord(cloud, startNs);
+        Dispatch(cloud, cloudRecord);
+    }
+    fusedSequence++;
+}
+
+void Pipeline::Dispatch(FrameBuffer* buffer, FlightRecord& record)
+{
+    std::lock_guard<std::mutex> lock(dispatchMutex);
+    record.dispatchNs = HostNowNs();
+    record.active = true;
+    const kndi_frame& frame = buffer->frame;
+    if (failoverFromNs != 0) {
+        // First frame after a failover: report the gap the sinks saw.
+        double intervals = (frame.host_timestamp_ns - failoverFromNs) / kFrameIntervalNs;
+        long lost = std::max(0L, std::lround(intervals) - 1);
+        std::cerr << "Failover gap: " << intervals << " frame intervals ("
+                  << lost << " frame(s) lost)." << std::endl;
+        failoverFromNs = 0;
+    }
+    for (const std::unique_ptr<Sink>& sink : sinks) {
+        if (sink->Streams() & frame.stream)
+            sink->Consume(frame);
+    }
+    record.doneNs = HostNowNs();
+    recorder->Add(record);
+    FramePool::Release(buffer);
+}
+
+bool Pipeline::Stalled(const DeviceSlot& slot, int64_t nowNs) const
+{
+    int64_t lastNs = slot.lastFrameNs.load();
+    if (lastNs != 0)
+        return nowNs - lastNs > static_cast<int64_t>(config.stallTimeoutMs) * 1000000;
+    // No frame yet since its streams started (or it never connected).
+    return nowNs - std::max(startedNs, slot.streamStartNs.load()) > kFirstFrameGraceNs;
+}
+
+bool Pipeline::UpdateRole(DeviceSlot& slot, int64_t nowNs)
+{
+    int active = activeSlot.load();
+    if (config.standbyDeviceIndex >= 0 && active != slot.id) {
+        int64_t stallNs = static_cast<int64_t>(config.stallTimeoutMs) * 1000000;
+        DeviceSlot& current = *slots[active];
+        // A warm standby must itself be delivering before taking over; an
+        // idle one only has to be connected.
+        int64_t lastNs = slot.lastFrameNs.load();
+        bool healthy = !config.standbyStreaming || (lastNs != 0 && nowNs - lastNs < stallNs);
+        if (healthy && Stalled(current, nowNs)) {
+            std::lock_guard<std::mutex> lock(dispatchMutex);
+            if (activeSlot.compare_exchange_strong(active, slot.id)) {
+                failovers++;
+                failoverFromNs = current.lastFrameNs.load();
+                std::cerr << "Kinect " << current.deviceIndex << " stalled; failing over to Kinect "
+                          << slot.deviceIndex << " (failover #" << failovers << ")." << std::endl;
+                recorder->AddEvent(FlightEvent::Failover, slot.deviceIndex, nowNs);
+                AutoDump("failover", nowNs);
+            }
+        }
+    }
+
+    bool wantStreaming = activeSlot.load() == slot.id || config.standbyStreaming || fusion;
+    if (wantStreaming && !slot.device->IsStreaming()) {
+        if (slot.device->StartStreams() < 0)
+            return false;
+        slot.lastFrameNs = 0;
+        slot.streamStartNs = nowNs;
+    } else if (!wantStreaming && slot.device->IsStreaming()) {
+        slot.device->StopStreams();
+        slot.streamStartNs = 0;
+    }
+    return true;
+}
+
+void Pipeline::CheckWatchdog(DeviceSlot& slot, int64_t nowNs)
+{
+    if (config.watchdogMs <= 0 || slot.watchdogFired || activeSlot.load() != slot.id ||
+        !slot.device->IsStreaming())
+        return;
+    int64_t silentSinceNs = std::max(slot.lastFrameNs.load(), slot.connectedNs);
+    if (nowNs - silentSinceNs < static_cast<int64_t>(config.watchdogMs) * 1000000)
+        return;
+    slot.watchdogFired = true;
+    std::cerr << "Watchdog: Kinect " << slot.deviceIndex << " delivered nothing for "
+              << (nowNs - silentSinceNs) / 1000000 << " ms." << std::endl;
+    recorder->AddEvent(FlightEvent::Watchdog, slot.deviceIndex, nowNs);
+    AutoDump("watchdog", nowNs);
+}
+
+void Pipeline::AutoDump(const char* reason, int64_t nowNs)
+{
+    // One incident usually trips several triggers (stall, failover,
+    // disconnect); the first dump already holds the lead-up.
+    int64_t last = lastAutoDumpNs.load();
+    if (last != 0 && nowNs - last < kAutoDumpSpacingNs)
+        return;
+    if (!lastAutoDumpNs.compare_exchange_strong(last, nowNs))
+        return;
+    DumpFlightRecorder(std::string(), reason);
+}
+
+int Pipeline::DumpFlightRecorder(const std::string& path, const char* reason)
+{
+    if (!recorder || !recorder->Enabled())
+        return KNDI_ERROR_UNSUPPORTED;
+    recorder->AddEvent(FlightEvent::Dump, -1, HostNowNs());
+    std::string file = path.empty() ? FlightRecorder::DumpPath(config.flightRecorderDir, reason) : path;
+    return recorder->Dump(file, reason) ? KNDI_OK : KNDI_ERROR_STATE;
+}
+
+std::string Pipeline::StatsName() const
+{
+    std::string name = "Kinect " + std::to_string(config.deviceIndex);
+    if (config.standbyDeviceIndex >= 0)
+        name += ", standby " + std::to_string(config.standbyDeviceIndex);
+    for (size_t i = 0; i < config.fusionDevices.size(); i++)
+        name += (i == 0 ? ", fused " : ",") + std::to_string(config.fusionDevices[i]);
+    return name;
+}
+
+int Pipeline::ClockStats(int deviceIndex, kndi_stream stream, kndi_clock_stats& stats) const
+{
+    for (const std::unique_ptr<DeviceSlot>& slot : slots) {
+        if (slot->deviceIndex != deviceIndex)
+            continue;
+        const DeviceClock& clock = stream == KNDI_STREAM_DEPTH ? slot->depthClock : slot->videoClock;
+        stats.locked = clock.Locked() ? 1 : 0;
+        stats.drift_ppm = clock.DriftPpm();
+        stats.jitter_us = clock.JitterUs();
+        stats.frames = clock.Frames();
+        return KNDI_OK;
+    }
+    return KNDI_ERROR_INVALID;
+}
+
+int Pipeline::UsbStats(int deviceIndex, kndi_usb_stats& stats) const
+{
+    for (const std::unique_ptr<DeviceSlot>& slot : slots) {
+        if (slot->deviceIndex != deviceIndex)
+            continue;
+        stats = kndi_usb_stats();
+        stats.bus = -1;
+        stats.numa_node = -1;
+        {
+            std::lock_guard<std::mutex> lock(slot->usbMutex);
+            if (slot->usbFound) {
+                stats.bus = slot->usb.bus;
+                std::snprintf(stats.port, sizeof(stats.port), "%s", slot->usb.port.c_str());
+                std::snprintf(stats.controller, sizeof(stats.controller), "%s", slot->usb.controller.c_str());
+                stats.numa_node = slot->usb.numaNode;
+                std::snprintf(stats.irq_cpus, sizeof(stats.irq_cpus), "%s", FormatCpuList(slot->usb.irqCpus).c_str());
+            }
+            stats.capture_cpu = slot->captureCpu;
+        }
+        stats.frames = slot->receivedFrames.load();
+        stats.lost_frames = slot->lostFrames.load();
+        stats.lost_packets = slot->lostPackets.load();
+        return KNDI_OK;
+    }
+    return KNDI_ERROR_INVALID;
+}
+
+int Pipeline::Planes(kndi_plane* out, int capacity, int& count) const
+{
+    count = 0;
+    if (!config.planes)
+        return KNDI_ERROR_INVALID;
+    if (!planes)
+        return KNDI_OK;
+    Plane found[PlaneFinder::kMaxPlanes];
+    int total = planes->Planes(found);
+    for (int i = 0; i < total && count < capacity; i++) {
+        kndi_plane& plane = out[count++];
+        plane.id = found[i].id;
+        plane.kind = static_cast<kndi_plane_kind>(found[i].kind);
+        std::copy(found[i].normal, found[i].normal + 3, plane.normal);
+        plane.distance_mm = found[i].distanceMm;
+        plane.rms_mm = found[i].rmsMm;
+        plane.inliers = found[i].inliers;
+        plane.timestamp_ns = found[i].timestampNs;
+    }
+    return KNDI_OK;
+}
+
+void Pipeline::ReportPlanes(const DeviceSlot& slot) const
+{
+    Plane found[PlaneFinder::kMaxPlanes];
+    int count = planes->Planes(found);
+    std::string line = "Kinect " + std::to_string(slot.deviceIndex) + " planes:";
+    for (int i = 0; i < count; i++) {
+        char text[64];
+        std::snprintf(text, sizeof(text), "%s %s %d at %.0f mm", i ? "," : "", PlaneKindName(found[i].kind),
+                      found[i].id, found[i].distanceMm);
+        line += text;
+    }
+    std::cout << line << (count ? "." : " none.") << std::endl;
+}
+
+int Pipeline::DumpFlightRecorder(const std::string& path)
+{
+    int ret = DumpFlightRecorder(path, "request");
+    if (ret < 0)
+        return ret;
+    return recorder->WaitForDump() ? KNDI_OK : KNDI_ERROR_IO;
+}
+
+void Pipeline::CaptureLoop(DeviceSlot& slot)
+{
+    SetCurrentThreadName(("kndi-capture-" + std::to_string(slot.deviceIndex)).c_str());
+    std::cout << "Starting Kinect " << slot.deviceIndex
+              << " streaming with auto-detection and reconnection..." << std::endl;
+
+    // Outer loop: attempt to (re)connect to the Kinect device.
+    while (!stopRequested) {
+        if (!Connect(slot) || !UpdateRole(slot, HostNowNs())) {
+            Disconnect(slot);
+            std::cerr << "Retrying in " << config.reconnectDelayMs / 1000.0 << " seconds..." << std::endl;
+            if (!WaitUnlessStopped(config.reconnectDelayMs))
+                break;
+            continue;
+        }
+
+        std::cout << "Kinect " << slot.deviceIndex << " connected. Streaming data..." << std::endl;
+        slot.connectedNs = HostNowNs();
+        slot.videoClock.Reset();
+        slot.depthClock.Reset();
+        slot.watchdogFired = false;
+        recorder->AddEvent(FlightEvent::Connect, slot.deviceIndex, slot.connectedNs);
+
+        // Inner loop: process Kinect events and dispatch frames. The timeout
+        // bounds how long a stop request, or a stall seen by an idle
+        // standby, can go unnoticed.
+        while (!stopRequested) {
+            timeval timeout;
+            timeout.tv_sec = 0;
+            timeout.tv_usec = slot.device->IsStreaming() ? 100000 : 5000;
+            int ret = freenect_process_events_timeout(slot.ctx, &timeout);
+            if (ret < 0) {
+                std::cerr << "Kinect " << slot.deviceIndex << " disconnected or error encountered (code "
+                          << ret << ")." << std::endl;
+                break;
+            }
+            Deliver(slot, slot.device->TakeVideo());
+            Deliver(slot, slot.device->TakeDepth());
+            int64_t nowNs = HostNowNs();
+            if (!UpdateRole(slot, nowNs))
+                break;
+            CheckWatchdog(slot, nowNs);
+            if (FlightRecorder::RequestedBySignal())
+                DumpFlightRecorder(std::string(), "signal");
+        }
+
+        // Kinect disconnected, error occurred or stop requested; clean up.
+        Disconnect(slot);
+        char line[160];
+        std::snprintf(line, sizeof(line), "Kinect %d USB loss since start: %llu of %llu frames, %llu packets.",
+                      slot.deviceIndex, static_cast<unsigned long long>(slot.lostFrames.load()),
+                      static_cast<unsigned long long>(slot.receivedFrames.load() + slot.lostFrames.load()),
+                      static_cast<unsigned long long>(slot.lostPackets.load()));
+        std::cout << line << std::endl;
+        if (stopRequested)
+            break;
+        int64_t lostNs = HostNowNs();
+        recorder->AddEvent(FlightEvent::Disconnect, slot.deviceIndex, lostNs);
+        AutoDump("disconnect", lostNs);
+        std::cerr << "Kinect " << slot.deviceIndex << " connection lost. Attempting to reconnect in "
+                  << config.reconnectDelayMs / 1000.0 << " seconds..." << std::endl;
+        if (!WaitUnlessStopped(config.reconnectDelayMs))
+            break;
+    }
+}
+
+} // namespace kndi
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <libfreenect.h>
+
+#include "auto_frame.h"
+#include "colour_lut.h"
+#include "config.h"
+#include "depth_mesh.h"
+#include "depth_filter.h"
+#include "device.h"
+#include "device_clock.h"
+#include "flight_recorder.h"
+#include "frame_pool.h"
+#include "fusion.h"
+#include "kernel_tuning.h"
+#include "plane_finder.h"
+#include "planner.h"
+#include "privacy_mask.h"
+#include "replay_sink.h"
+#include "video_denoise.h"
+#include "sink.h"
+#include "stats_publisher.h"
+#include "thread_pool.h"
+#include "usb_placement.h"
+#include "volume_crop.h"
+
+namespace kndi {
+
+// Capture pipeline behind the C API: owns one freenect context, device,
+// capture thread and set of frame pools per Kinect, plus the attached sinks.
+// Each capture thread runs its own connect / process / reconnect loop and
+// hands frames to the shared sinks.
+//
+// With a standby device configured, only the active device's frames reach
+// the sinks; the standby is kept open (and by default streaming) and takes
+// over as soon as the active device stalls or disconnects. With fusion
+// devices configured, the extra Kinects only feed the fusion stage, which
+// runs on the primary's capture thread after each of its depth frames.
+class Pipeline {
+public:
+    explicit Pipeline(int deviceIndex);
+    ~Pipeline();
+
+    Pipeline(const Pipeline&) = delete;
+    Pipeline& operator=(const Pipeline&) = delete;
+
+    int SetStreams(unsigned streams);
+    int SetOption(const std::string& key, const std::string& value);
+    // Takes ownership of `sink`.
+    int AddSink(Sink* sink);
+
+    // Dry run: estimate the per-frame cost of the configured streams, stages
+    // and sinks on this host. Returns KNDI_OK or KNDI_ERROR_BUDGET.
+    int Plan(std::string& report);
+
+    // Adds `sink` like AddSink() and makes it the target of SaveReplay().
+    int AddReplaySink(ReplaySink* sink);
+    // Start writing the replay buffer to `path` (empty: a time-stamped file
+    // in replay_dir) in the background.
+    int SaveReplay(const std::string& path);
+
+    int ClockStats(int deviceIndex, kndi_stream stream, kndi_clock_stats& stats) const;
+    int UsbStats(int deviceIndex, kndi_usb_stats& stats) const;
+    int Planes(kndi_plane* out, int capacity, int& count) const;
+
+    // Write the flight recorder ring to `path` (empty: a time-stamped file
+    // in flight_recorder_dir) and wait for the file to be written.
+    int DumpFlightRecorder(const std::string& path);
+
+    int Start();
+    int Run();
+    void Stop();
+    bool IsRunning() const { return running.load(); }
+
+private:
+    struct DeviceSlot {
+        int id;                      // Position in `slots`.
+        int deviceIndex;             // libfreenect device index.
+        std::unique_ptr<FramePool> videoPool;
+        std::unique_ptr<FramePool> depthPool;
+        std::unique_ptr<DepthFilterStage> depthFilter;   // Capture thread only once started.
+        std::unique_ptr<VideoDenoiser> videoDenoise;     // Capture thread only once started.
+        freenect_context* ctx;
+        std::unique_ptr<Device> device;
+        std::thread thread;
+        std::atomic<int64_t> lastFrameNs;     // 0 until a frame since the streams started.
+        std::atomic<int64_t> streamStartNs;   // When the streams last started, or 0.
+        DeviceClock videoClock;
+        DeviceClock depthClock;
+        int64_t connectedNs;         // Capture thread only.
+        bool watchdogFired;          // Capture thread only.
+        // USB loss since the pipeline started; the frame counts of earlier
+        // connections are kept in the `...Before` totals (capture thread only).
+        std::atomic<uint64_t> lostPackets;
+        std::atomic<uint64_t> receivedFrames;
+        std::atomic<uint64_t> lostFrames;
+        uint64_t receivedBefore;
+        uint64_t lostBefore;
+        mutable std::mutex usbMutex;
+        bool usbFound;               // Guarded by usbMutex, like the two below.
+        UsbLocation usb;
+        int captureCpu;              // Core the capture thread is pinned to, or -1.
+    };
+
+    int Prepare();
+    int PrepareFusion();
+    int PrepareAutoFrame();
+    int PrepareVolumeCrop();
+    int PreparePrivacy();
+    int PrepareColourLut();
+    int PrepareMesh();
+    int PreparePlanes();
+    // Prefault the frame pools and lock memory (realtime_memory option).
+    void PrepareRealtimeMemory();
+    // Reallocate `pool` for `bytesPerFrame` and pool_frames if its shape
+    // changed; false (with a message) while the application still holds
+    // its frames, which would be left pointing into freed memory.
+    bool ResizePool(std::unique_ptr<FramePool>& pool, size_t bytesPerFrame);
+    static bool PoolHeld(const std::unique_ptr<FramePool>& pool);
+    PlanContext StreamShapes() const;
+    bool Estimate(std::string& report);
+    void RunFusion(const kndi_frame& trigger);
+    // Mesh a depth frame of the active Kinect and dispatch it.
+    void RunMesh(const kndi_frame& depth);
+    // Print the planes after one was found or lost.
+    void ReportPlanes(const DeviceSlot& slot) const;
+    void CaptureLoop(DeviceSlot& slot);
+    bool Connect(DeviceSlot& slot);
+    void Disconnect(DeviceSlot& slot);
+    // Find a newly connected Kinect on the USB tree and, with usb_placement,
+    // pin the calling capture thread and the workers near its controller.
+    void PlaceOnUsb(DeviceSlot& slot);
+    void Deliver(DeviceSlot& slot, FrameBuffer* buffer);
+    void Dispatch(FrameBuffer* buffer, FlightRecord& record);
+    // Failover bookkeeping run on each capture thread: start / stop the
+    // device's streams for its role and take over from a stalled device.
+    // Returns false if the device failed to start streaming.
+    bool UpdateRole(DeviceSlot& slot, int64_t nowNs);
+    // Whether the active `slot` has gone quiet for long enough to be
+    // replaced.
+    bool Stalled(const DeviceSlot& slot, int64_t nowNs) const;
+    // Dump the flight recorder once when the active device stays silent.
+    void CheckWatchdog(DeviceSlot& slot, int64_t nowNs);
+    void AutoDump(const char* reason, int64_t nowNs);
+    int DumpFlightRecorder(const std::string& path, const char* reason);
+    // Name kinect-ndi-top shows for this pipeline.
+    std::string StatsName() const;
+    void JoinThreads();
+    // Sleep for `ms` unless Stop() is called first. Returns false if stopping.
+    bool WaitUnlessStopped(int ms);
+
+    PipelineConfig config;
+    std::vector<std::unique_ptr<Sink>> sinks;
+    std::vector<std::unique_ptr<DeviceSlot>> slots;
+
+    std::mutex dispatchMutex;          // Serializes sinks across capture threads.
+    std::mutex stageMutex;             // Serializes the active Kinect's shared depth stages.
+    std::atomic<int> activeSlot;       // Slot whose frames reach the sinks.
+    uint64_t failovers;                // Guarded by dispatchMutex.
+    int64_t failoverFromNs;            // Last frame before a pending failover, or 0.
+    int64_t startedNs;                 // When Prepare() ran.
+    std::mutex joinMutex;
+
+    ReplaySink* replay;                  // Owned by `sinks`.
+    std::unique_ptr<FlightRecorder> recorder;
+    std::atomic<int64_t> lastAutoDumpNs;
+    std::unique_ptr<StatsPublisher> stats;   // Reads `recorder`.
+
+    std::unique_ptr<ThreadPool> workers;
+    std::unique_ptr<UsbPlacement> placement;   // With usb_placement.
+    RoiMask roi;                         // Compiled from config.roi for the capture streams.
+    KernelTuner tuner;
+    std::unique_ptr<DepthFusion> fusion;
+    std::unique_ptr<AutoFramer> framer;   // Fed by the active Kinect's depth.
+    std::unique_ptr<VolumeCrop> volumeCrop;   // Applied to the active Kinect's depth.
+    std::unique_ptr<PrivacyMask> privacy;     // Fed by the active Kinect's depth.
+    std::unique_ptr<PlaneFinder> planes;      // Fed by the active Kinect's depth.
+    std::unique_ptr<ColourLut> colourLut;     // Read by the NDI sinks.
+    std::unique_ptr<FramePool> fusedPool;
+    std::unique_ptr<FramePool> cloudPool;
+    uint64_t fusedSequence;
+    std::unique_ptr<DepthMesher> mesher;   // Capture threads, one at a time (active Kinect).
+    std::unique_ptr<FramePool> meshPool;
+    uint64_t meshSequence;
+
+    std::atomic<bool> running;
+    std::atomic<bool> stopRequested;
+    std::mutex stopMutex;
+    std::condition_variable stopCondition;
+};
+
+} // namespace kndi
@@ -0,0 +1,447 @@
+#include "plane_finder.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "camera_model.h"
+#include "depth_units.h"
+
+namespace kndi {
+
+constexpr int PlaneFinder::kGridStep;
+constexpr int PlaneFinder::kMaxPlanes;
+constexpr int PlaneFinder::kHypotheses;
+constexpr int PlaneFinder::kScoringPoints;
+
+// Fewest points a plane may have, also as a share of the frame's points.
+static constexpr int kMinInliers = 150;
+static constexpr int kMinInlierShare = 20;       // 1 in 20.
+// Twice the area of the smallest triangle a hypothesis is built on (mm²);
+// smaller ones tilt wildly with depth noise.
+static constexpr float kMinCross = 2500.0f;
+// A plane found again within these of a tracked one keeps its id.
+static const float kSameNormal = std::cos(10.0f * 3.14159265f / 180.0f);
+static constexpr float kSameDistanceMm = 150.0f;
+// cos 30 and sin 30 degrees; see PlaneKind.
+static constexpr float kLevel = 0.866f;
+static constexpr float kUpright = 0.5f;
+
+const char* PlaneKindName(PlaneKind kind)
+{
+    switch (kind) {
+    case PlaneKind::Floor:
+        return "floor";
+    case PlaneKind::Ceiling:
+        return "ceiling";
+    case PlaneKind::Wall:
+        return "wall";
+    default:
+        return "other";
+    }
+}
+
+static PlaneKind Classify(const Plane& plane)
+{
+    // y points down and the normal faces the camera, so a floor's points up.
+    float down = plane.normal[1];
+    if (down <= -kLevel)
+        return PlaneKind::Floor;
+    if (down >= kLevel)
+        return PlaneKind::Ceiling;
+    if (std::fabs(down) <= kUpright)
+        return PlaneKind::Wall;
+    return PlaneKind::Other;
+}
+
+// Unit eigenvector of the smallest eigenvalue of the symmetric matrix `a`
+// (destroyed) by Jacobi rotations; returns the eigenvalue.
+static double SmallestEigenvector(double a[3][3], double vector[3])
+{
+    double v[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+    static const int pairs[3][2] = { { 0, 1 }, { 0, 2 }, { 1, 2 } };
+    for (int sweep = 0; sweep < 16; sweep++) {
+        double off = a[0][1] * a[0][1] + a[0][2] * a[0][2] + a[1][2] * a[1][2];
+        double diagonal = a[0][0] * a[0][0] + a[1][1] * a[1][1] + a[2][2] * a[2][2];
+        if (off <= 1e-24 * diagonal)
+            break;
+        for (const int* pair : pairs) {
+            int p = pair[0];
+            int q = pair[1];
+            if (a[p][q] == 0.0)
+                continue;
+            double theta = (a[q][q] - a[p][p]) / (2.0 * a[p][q]);
+            double t = (theta >= 0.0 ? 1.0 : -1.0) / (std::fabs(theta) + std::sqrt(theta * theta + 1.0));
+            double c = 1.0 / std::sqrt(t * t + 1.0);
+            double s = t * c;
+            for (int k = 0; k < 3; k++) {
+                double kp = a[k][p];
+                double kq = a[k][q];
+                a[k][p] = c * kp - s * kq;
+                a[k][q] = s * kp + c * kq;
+            }
+            for (int k = 0; k < 3; k++) {
+                double pk = a[p][k];
+                double qk = a[q][k];
+                a[p][k] = c * pk - s * qk;
+                a[q][k] = s * pk + c * qk;
+            }
+            for (int k = 0; k < 3; k++) {
+                double kp = v[k][p];
+                double kq = v[k][q];
+                v[k][p] = c * kp - s * kq;
+                v[k][q] = s * kp + c * kq;
+            }
+        }
+    }
+    int smallest = 0;
+    for (int i = 1; i < 3; i++) {
+        if (a[i][i] < a[smallest][smallest])
+            smallest = i;
+    }
+    for (int k = 0; k < 3; k++)
+        vector[k] = v[k][smallest];
+    return a[smallest][smallest];
+}
+
+PlaneFinder::PlaneFinder(const PlaneSettings& settings, int width, int height)
+    : settings(settings), width(width), height(height),
+      gridWidth(width / kGridStep), gridHeight(height / kGridStep),
+      tolerances(kRawDepthInvalid, 0.0f), pointCount(0), scoreCount(0), hypotheses(kHypotheses),
+      searches(0), framesSinceSearch(settings.intervalFrames), searchNext(false), nextId(1), planeCount(0),
+      publishedCount(0)
+{
+    Intrinsics intrinsics = KinectDepthIntrinsics(width, height);
+    for (int gx = 0; gx < gridWidth; gx++)
+        rayX.push_back((gx * kGridStep + kGridStep / 2 - intrinsics.cx) / intrinsics.fx);
+    for (int gy = 0; gy < gridHeight; gy++)
+        rayY.push_back((gy * kGridStep + kGridStep / 2 - intrinsics.cy) / intrinsics.fy);
+    // Depth is quantized in disparity, so the step between readings grows
+    // with the square of the distance (about 3 mm at 1 m, 45 mm at 4 m).
+    const uint16_t* mm = RawDepthToMillimetres();
+    for (int raw = 0; raw < kRawDepthInvalid; raw++) {
+        if (!mm[raw])
+            continue;
+        int step = raw + 1 < kRawDepthInvalid && mm[raw + 1] ? mm[raw + 1] - mm[raw]
+                 : raw > 0 && mm[raw - 1] ? mm[raw] - mm[raw - 1] : 0;
+        tolerances[raw] = settings.toleranceMm + step;
+    }
+    size_t points = static_cast<size_t>(gridWidth) * gridHeight;
+    pointX.resize(points);
+    pointY.resize(points);
+    pointZ.resize(points);
+    pointTolerance.resize(points);
+    remaining.reserve(points);
+    owners.resize(points);
+    scoreX.resize(kScoringPoints);
+    scoreY.resize(kScoringPoints);
+    scoreZ.resize(kScoringPoints);
+    scoreTolerance.resize(kScoringPoints);
+}
+
+void PlaneFinder::Sample(const uint16_t* depth, int stride)
+{
+    const uint16_t* mm = RawDepthToMillimetres();
+    pointCount = 0;
+    for (int gy = 0; gy < gridHeight; gy++) {
+        const uint16_t* row = reinterpret_cast<const uint16_t*>(
+            reinterpret_cast<const uint8_t*>(depth) + static_cast<size_t>(gy * kGridStep + kGridStep / 2) * stride);
+        for (int gx = 0; gx < gridWidth; gx++) {
+            uint16_t raw = row[gx * kGridStep + kGridStep / 2];
+            if (raw >= kRawDepthInvalid || !mm[raw])
+                continue;
+            float z = mm[raw];
+            pointX[pointCount] = z * rayX[gx];
+            pointY[pointCount] = z * rayY[gy];
+            pointZ[pointCount] = z;
+            pointTolerance[pointCount] = tolerances[raw];
+            pointCount++;
+        }
+    }
+}
+
+// Hypotheses [first, last) of a search round, each through three points of
+// `remaining` close together in the grid (and so likely on one surface).
+void PlaneFinder::Score(int round, int first, int last)
+{
+    int count = static_cast<int>(remaining.size());
+    int window = std::max(16, count / 8);
+    for (int h = first; h < last; h++) {
+        Hypothesis& hypothesis = hypotheses[h];
+        hypothesis.score = 0;
+        // xorshift32, seeded per hypothesis so the result does not depend
+        // on how the work was split.
+        uint32_t state = (searches * kMaxPlanes * kHypotheses + round * kHypotheses + h) * 2654435761u + 1u;
+        auto next = [&state] {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            return state;
+        };
+        int a = static_cast<int>(next() % count);
+        int b = std::min(count - 1, std::max(0, a + static_cast<int>(next() % (2 * window + 1)) - window));
+        int c = std::min(count - 1, std::max(0, a + static_cast<int>(next() % (2 * window + 1)) - window));
+        if (a == b || a == c || b == c)
+            continue;
+        a = remaining[a];
+        b = remaining[b];
+        c = remaining[c];
+        float abX = pointX[b] - pointX[a], abY = pointY[b] - pointY[a], abZ = pointZ[b] - pointZ[a];
+        float acX = pointX[c] - pointX[a], acY = pointY[c] - pointY[a], acZ = pointZ[c] - pointZ[a];
+        float nx = abY * acZ - abZ * acY;
+        float ny = abZ * acX - abX * acZ;
+        float nz = abX * acY - abY * acX;
+        float length = std::sqrt(nx * nx + ny * ny + nz * nz);
+        if (length < kMinCross)
+            continue;
+        nx /= length;
+        ny /= length;
+        nz /= length;
+        float d = -(nx * pointX[a] + ny * pointY[a] + nz * pointZ[a]);
+        int score = 0;
+        for (int i = 0; i < scoreCount; i++) {
+            float distance = nx * scoreX[i] + ny * scoreY[i] + nz * scoreZ[i] + d;
+            score += std::fabs(distance) < scoreTolerance[i];
+        }
+        hypothesis.normal[0] = nx;
+        hypothesis.normal[1] = ny;
+        hypothesis.normal[2] = nz;
+        hypothesis.distance = d;
+        hypothesis.score = score;
+    }
+}
+
+int PlaneFinder::Fit(const int* indices, int count, Plane& plane) const
+{
+    float nx = plane.normal[0], ny = plane.normal[1], nz = plane.normal[2], d = plane.distanceMm;
+    double n = 0.0;
+    double sx = 0.0, sy = 0.0, sz = 0.0;
+    double sxx = 0.0, sxy = 0.0, sxz = 0.0, syy = 0.0, syz = 0.0, szz = 0.0;
+    for (int k = 0; k < count; k++) {
+        int i = indices[k];
+        float x = pointX[i], y = pointY[i], z = pointZ[i];
+        if (std::fabs(nx * x + ny * y + nz * z + d) >= pointTolerance[i])
+            continue;
+        n += 1.0;
+        sx += x;
+        sy += y;
+        sz += z;
+        sxx += static_cast<double>(x) * x;
+        sxy += static_cast<double>(x) * y;
+        sxz += static_cast<double>(x) * z;
+        syy += static_cast<double>(y) * y;
+        syz += static_cast<double>(y) * z;
+        szz += static_cast<double>(z) * z;
+    }
+    int inliers = static_cast<int>(n);
+    if (inliers < 3)
+        return inliers;
+    double cx = sx / n, cy = sy / n, cz = sz / n;
+    double covariance[3][3] = {
+        { sxx / n - cx * cx, sxy / n - cx * cy, sxz / n - cx * cz },
+        { sxy / n - cx * cy, syy / n - cy * cy, syz / n - cy * cz },
+        { sxz / n - cx * cz, syz / n - cy * cz, szz / n - cz * cz },
+    };
+    double normal[3];
+    double variance = SmallestEigenvector(covariance, normal);
+    double distance = -(normal[0] * cx + normal[1] * cy + normal[2] * cz);
+    double sign = distance < 0.0 ? -1.0 : 1.0;
+    for (int k = 0; k < 3; k++)
+        plane.normal[k] = static_cast<float>(sign * normal[k]);
+    plane.distanceMm = static_cast<float>(sign * distance);
+    plane.rmsMm = static_cast<float>(std::sqrt(std::max(0.0, variance)));
+    plane.inliers = inliers;
+    return inliers;
+}
+
+bool PlaneFinder::Search(ThreadPool* pool, int64_t timestampNs)
+{
+    searches++;
+    Plane previous[kMaxPlanes];
+    int previousCount = planeCount;
+    std::copy(planes, planes + planeCount, previous);
+    std::fill(owners.begin(), owners.begin() + pointCount, -1);
+    int minInliers = std::max(kMinInliers, pointCount / kMinInlierShare);
+    int found = 0;
+    for (int round = 0; round < std::min(settings.maxPlanes, kMaxPlanes); round++) {
+        remaining.clear();
+        for (int i = 0; i < pointCount; i++) {
+            if (owners[i] < 0)
+                remaining.push_back(i);
+        }
+        int count = static_cast<int>(remaining.size());
+        if (count < minInliers)
+            break;
+        // Hypotheses are scored on an even spread of the points.
+        int step = (count + kScoringPoints - 1) / kScoringPoints;
+        scoreCount = 0;
+        for (int k = 0; k < count; k += step) {
+            int i = remaining[k];
+            scoreX[scoreCount] = pointX[i];
+            scoreY[scoreCount] = pointY[i];
+            scoreZ[scoreCount] = pointZ[i];
+            scoreTolerance[scoreCount] = pointTolerance[i];
+            scoreCount++;
+        }
+        int chunks = pool ? std::min(pool->Size(), kHypotheses / 32) : 1;
+        int perChunk = (kHypotheses + chunks - 1) / chunks;
+        auto chunk = [&](int index) {
+            Score(round, index * perChunk, std::min(kHypotheses, (index + 1) * perChunk));
+        };
+        if (chunks > 1)
+            pool->ParallelFor(chunks, chunk);
+        else
+            chunk(0);
+        const Hypothesis* best = &hypotheses[0];
+        for (const Hypothesis& hypothesis : hypotheses) {
+            if (hypothesis.score > best->score)
+                best = &hypothesis;
+        }
+        if (best->score < 3)
+            break;
+
+        Plane plane = Plane();
+        std::copy(best->normal, best->normal + 3, plane.normal);
+        plane.distanceMm = best->distance;
+        // Twice: a plane through three noisy points misses some of its own.
+        if (Fit(remaining.data(), count, plane) < 3 || Fit(remaining.data(), count, plane) < minInliers)
+            break;
+        for (int i : remaining) {
+            float distance = plane.normal[0] * pointX[i] + plane.normal[1] * pointY[i] +
+                             plane.normal[2] * pointZ[i] + plane.distanceMm;
+            if (std::fabs(distance) < pointTolerance[i])
+                owners[i] = round;
+        }
+        plane.kind = Classify(plane);
+        plane.timestampNs = timestampNs;
+        planes[found] = plane;
+        foundInliers[found] = plane.inliers;
+        found++;
+    }
+
+    // Planes found again keep their ids.
+    bool changed = false;
+    bool matched[kMaxPlanes] = {};
+    for (int p = 0; p < found; p++) {
+        planes[p].id = 0;
+        for (int q = 0; q < previousCount && !planes[p].id; q++) {
+            float dot = planes[p].normal[0] * previous[q].normal[0] + planes[p].normal[1] * previous[q].normal[1] +
+                        planes[p].normal[2] * previous[q].normal[2];
+            if (!matched[q] && dot > kSameNormal &&
+                std::fabs(planes[p].distanceMm - previous[q].distanceMm) < kSameDistanceMm) {
+                matched[q] = true;
+                planes[p].id = previous[q].id;
+            }
+        }
+        if (!planes[p].id) {
+            planes[p].id = nextId++;
+            changed = true;
+        }
+    }
+    for (int q = 0; q < previousCount; q++)
+        changed |= !matched[q];
+    planeCount = found;
+    return changed;
+}
+
+bool PlaneFinder::Track(int64_t timestampNs)
+{
+    int minInliers = std::max(kMinInliers, pointCount / kMinInlierShare);
+    // Each point counts for the plane it is closest to, relative to its
+    // tolerance, so planes do not pull each other in where they meet.
+    for (int i = 0; i < pointCount; i++) {
+        owners[i] = -1;
+        float closest = 1.0f;
+        for (int p = 0; p < planeCount; p++) {
+            const Plane& plane = planes[p];
+            float distance = std::fabs(plane.normal[0] * pointX[i] + plane.normal[1] * pointY[i] +
+                                       plane.normal[2] * pointZ[i] + plane.distanceMm) / pointTolerance[i];
+            if (distance < closest) {
+                closest = distance;
+                owners[i] = p;
+            }
+        }
+    }
+    bool changed = false;
+    int kept = 0;
+    for (int p = 0; p < planeCount; p++) {
+        remaining.clear();
+        for (int i = 0; i < pointCount; i++) {
+            if (owners[i] == p)
+                remaining.push_back(i);
+        }
+        Plane plane = planes[p];
+        if (Fit(remaining.data(), static_cast<int>(remaining.size()), plane) <
+            std::max(minInliers, foundInliers[p] / 2)) {
+            // Moved out of view, covered, or the Kinect was turned.
+            changed = true;
+            searchNext = true;
+            continue;
+        }
+        plane.kind = Classify(plane);
+        plane.timestampNs = timestampNs;
+        planes[kept] = plane;
+        foundInliers[kept] = foundInliers[p];
+        kept++;
+    }
+    planeCount = kept;
+    return changed;
+}
+
+void PlaneFinder::Publish()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::copy(planes, planes + planeCount, published);
+    publishedCount = planeCount;
+}
+
+bool PlaneFinder::Update(ThreadPool* pool, const uint16_t* depth, int stride, int64_t timestampNs)
+{
+    Sample(depth, stride);
+    bool changed;
+    if (searchNext || ++framesSinceSearch >= settings.intervalFrames) {
+        changed = Search(pool, timestampNs);
+        framesSinceSearch = 0;
+        searchNext = false;
+    } else {
+        changed = Track(timestampNs);
+    }
+    Publish();
+    return changed;
+}
+
+int PlaneFinder::Planes(Plane* out) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::copy(published, published + publishedCount, out);
+    return publishedCount;
+}
+
+void SyntheticRoomDepth(int width, int height, std::vector<uint16_t>& depth)
+{
+    const uint16_t* mm = RawDepthToMillimetres();
+    int first = 0;
+    while (first < kRawDepthInvalid && !mm[first])
+        first++;
+    int last = first;
+    while (last + 1 < kRawDepthInvalid && mm[last + 1])
+        last++;
+    Intrinsics intrinsics = KinectDepthIntrinsics(width, height);
+    depth.assign(static_cast<size_t>(width) * height, kRawDepthInvalid);
+    for (int y = 0; y < height; y++) {
+        float rayY = (y - intrinsics.cy) / intrinsics.fy;
+        for (int x = 0; x < width; x++) {
+            float rayX = (x - intrinsics.cx) / intrinsics.fx;
+            float z = 3500.0f;
+            if (rayY > 0.0f)
+                z = std::min(z, 1200.0f / rayY);
+            if (rayX > 0.0f)
+                z = std::min(z, 1500.0f / rayX);
+            // Nearest raw reading at or beyond z.
+            const uint16_t* raw = std::lower_bound(mm + first, mm + last + 1, static_cast<uint16_t>(z));
+            if (raw <= mm + last)
+                depth[static_cast<size_t>(y) * width + x] = static_cast<uint16_t>(raw - mm);
+        }
+    }
+}
+
+} // namespace kndi
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "thread_pool.h"
+
+namespace kndi {
+
+struct PlaneSettings {
+    int intervalFrames = 15;     // Depth frames between RANSAC searches; planes are refined in between.
+    float toleranceMm = 15.0f;   // Distance from a plane still counted as on it, besides the depth step.
+    int maxPlanes = 3;           // Largest planes reported.
+};
+
+// Floors and ceilings face within 30 degrees of straight up or down, walls
+// within 30 degrees of horizontal, with the Kinect held roughly level.
+enum class PlaneKind { Floor, Ceiling, Wall, Other };
+
+const char* PlaneKindName(PlaneKind kind);
+
+// A plane in depth camera space (millimetres; x right, y down, z forward):
+// points p on it satisfy dot(normal, p) + distanceMm = 0. The normal faces
+// the camera, so distanceMm is the camera's distance from the plane.
+struct Plane {
+    int id;                  // Kept for as long as the plane is tracked.
+    PlaneKind kind;
+    float normal[3];
+    float distanceMm;
+    float rmsMm;             // Of its inliers about the fit.
+    int inliers;             // Sampled points on it.
+    int64_t timestampNs;     // Depth frame it was last fitted to.
+};
+
+// Finds the dominant planes (floor, walls, a table) in depth. Every
+// intervalFrames depth frames a RANSAC search runs on a 1-in-kGridStep
+// grid of back-projected points: kHypotheses planes through three nearby
+// points are scored on up to kScoringPoints of them, spread over the
+// workers; the best is fitted by least squares to all its inliers, which
+// are then set aside before looking for the next plane. In between, each
+// plane is refitted to its inliers in the new frame, which follows a
+// moving Kinect, and dropped (with a search on the next frame) when most
+// of them are gone. The depth frame is read in place; every buffer is
+// allocated in the constructor.
+class PlaneFinder {
+public:
+    static constexpr int kGridStep = 8;
+    static constexpr int kMaxPlanes = 4;
+    static constexpr int kHypotheses = 256;
+    static constexpr int kScoringPoints = 1024;
+
+    PlaneFinder(const PlaneSettings& settings, int width, int height);
+
+    const PlaneSettings& Settings() const { return settings; }
+
+    // Search or refine in a raw 11-bit depth frame (`stride` in bytes).
+    // Called on the capture thread for every depth frame of the active
+    // Kinect. Returns true if a plane was found or lost.
+    bool Update(ThreadPool* pool, const uint16_t* depth, int stride, int64_t timestampNs);
+
+    // Copy the current planes (at most kMaxPlanes) into `out`, largest
+    // first; returns how many. Safe to call from any thread.
+    int Planes(Plane* out) const;
+
+private:
+    struct Hypothesis {
+        float normal[3];
+        float distance;
+        int score;
+    };
+
+    void Sample(const uint16_t* depth, int stride);
+    bool Search(ThreadPool* pool, int64_t timestampNs);
+    bool Track(int64_t timestampNs);
+    void Score(int round, int first, int last);
+    // Least-squares refit of `plane` to those of the points listed in
+    // `indices` within tolerance of it; returns how many there were. The
+    // plane is left as it was with fewer than three.
+    int Fit(const int* indices, int count, Plane& plane) const;
+    void Publish();
+
+    PlaneSettings settings;
+    int width;
+    int height;
+    int gridWidth;
+    int gridHeight;
+    std::vector<float> rayX;           // (x - cx) / fx per grid column.
+    std::vector<float> rayY;           // (y - cy) / fy per grid row.
+    std::vector<float> tolerances;     // Inlier distance per raw disparity: the setting plus one depth step.
+    // This frame's points, structure of arrays.
+    std::vector<float> pointX, pointY, pointZ, pointTolerance;
+    int pointCount;
+    std::vector<int> remaining;        // Points not yet on a found plane.
+    std::vector<float> scoreX, scoreY, scoreZ, scoreTolerance;   // Subset the hypotheses are scored on.
+    int scoreCount;
+    std::vector<Hypothesis> hypotheses;
+    std::vector<int> owners;           // Plane each point was set aside for, or -1.
+    uint32_t searches;                 // Seeds the hypotheses.
+    int framesSinceSearch;
+    bool searchNext;
+    int nextId;
+    int planeCount;                    // Capture thread only, like the two below.
+    Plane planes[kMaxPlanes];
+    int foundInliers[kMaxPlanes];      // When each plane was found.
+    mutable std::mutex mutex;
+    int publishedCount;                // Guarded by `mutex`.
+    Plane published[kMaxPlanes];
+};
+
+// A raw depth frame of a room seen by a level Kinect: a floor 1.2 m below
+// it, a wall 3.5 m ahead and one 1.5 m to the right. For benchmarks.
+void SyntheticRoomDepth(int width, int height, std::vector<uint16_t>& depth);
+
+} // namespace kndi
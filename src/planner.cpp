@@ -0,0 +1,106 @@
+#include "planner.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+namespace kndi {
+
+const char* StreamKey(kndi_stream stream)
+{
+    switch (stream) {
+    case KNDI_STREAM_RGB:         return "rgb";
+    case KNDI_STREAM_IR:          return "ir";
+    case KNDI_STREAM_DEPTH:       return "depth";
+    case KNDI_STREAM_FUSED_DEPTH: return "fused_depth";
+    case KNDI_STREAM_POINT_CLOUD: return "point_cloud";
+    case KNDI_STREAM_MESH:        return "mesh";
+    }
+    return "unknown";
+}
+
+int PlanContext::Index(kndi_stream stream)
+{
+    switch (stream) {
+    case KNDI_STREAM_RGB:         return 0;
+    case KNDI_STREAM_IR:          return 1;
+    case KNDI_STREAM_DEPTH:       return 2;
+    case KNDI_STREAM_FUSED_DEPTH: return 3;
+    case KNDI_STREAM_POINT_CLOUD: return 4;
+    case KNDI_STREAM_MESH:        return 5;
+    }
+    return 0;
+}
+
+double MeasureMs(const std::function<void()>& run, double minTotalMs)
+{
+    typedef std::chrono::steady_clock Clock;
+    run();
+    std::vector<double> samples;
+    double total = 0.0;
+    while ((total < minTotalMs || samples.size() < 3) && samples.size() < 1000) {
+        Clock::time_point start = Clock::now();
+        run();
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        samples.push_back(ms);
+        total += ms;
+    }
+    std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+    return samples[samples.size() / 2];
+}
+
+double MeasureMemoryBandwidth()
+{
+    // Well past the last-level cache of the boards this runs on.
+    const size_t bytes = 64 << 20;
+    std::vector<uint8_t> src(bytes, 1);
+    std::vector<uint8_t> dst(bytes, 0);
+    double ms = MeasureMs([&] { std::memcpy(dst.data(), src.data(), bytes); }, 50.0);
+    return ms > 0.0 ? 2.0 * bytes / (ms / 1000.0) : 0.0;
+}
+
+bool Planner::Estimate(std::string& report)
+{
+    double bandwidth = MeasureMemoryBandwidth();
+    double threadMsPerSecond = 0.0;
+    double bytesPerSecond = 0.0;
+    std::string unmeasured;
+    char line[160];
+
+    report = "Stage                              fps   ms/frame    load   MB/frame\n";
+    for (const PlanStage& stage : stages) {
+        if (!stage.run) {
+            unmeasured += unmeasured.empty() ? stage.name : ", " + stage.name;
+            continue;
+        }
+        double ms = MeasureMs(stage.run);
+        double load = ms * stage.framesPerSecond / 1000.0;
+        threadMsPerSecond += ms * stage.framesPerSecond;
+        bytesPerSecond += static_cast<double>(stage.bytesPerFrame) * stage.framesPerSecond;
+        std::snprintf(line, sizeof(line), "%-32s %5.1f %10.2f %6.1f%% %10.2f\n",
+                      stage.name.c_str(), stage.framesPerSecond, ms, load * 100.0,
+                      stage.bytesPerFrame / 1e6);
+        report += line;
+    }
+
+    double threadLoad = threadMsPerSecond / 1000.0;
+    double bandwidthShare = bandwidth > 0.0 ? bytesPerSecond / bandwidth : 0.0;
+    std::snprintf(line, sizeof(line), "Capture thread load: %.1f%% of one core (limit %.0f%%)\n",
+                  threadLoad * 100.0, kMaxThreadLoad * 100.0);
+    report += line;
+    std::snprintf(line, sizeof(line), "Memory traffic: %.0f MB/s, %.1f%% of %.1f GB/s measured (limit %.0f%%)\n",
+                  bytesPerSecond / 1e6, bandwidthShare * 100.0, bandwidth / 1e9, kMaxBandwidthShare * 100.0);
+    report += line;
+    std::snprintf(line, sizeof(line), "Frame pools: %.1f MB\n", poolBytes / 1e6);
+    report += line;
+    if (!unmeasured.empty())
+        report += "Not measured: " + unmeasured + "\n";
+
+    bool withinBudget = threadLoad <= kMaxThreadLoad && bandwidthShare <= kMaxBandwidthShare;
+    if (!withinBudget)
+        report += "Warning: the configured pipeline is unlikely to hold its frame rate on this host.\n";
+    return withinBudget;
+}
+
+} // namespace kndi
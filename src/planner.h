@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "auto_frame.h"
+#include "colour_lut.h"
+#include "convert.h"
+#include "kinect_ndi.h"
+#include "plane_finder.h"
+#include "privacy_mask.h"
+#include "roi.h"
+
+namespace kndi {
+
+// Lower-case stream name used in reports and files, e.g. "fused_depth".
+const char* StreamKey(kndi_stream stream);
+
+// Shape and rate of a stream as the pipeline will produce it.
+struct StreamShape {
+    int width = 0;             // Pixels (points for the point cloud; 0 for the mesh).
+    int height = 0;
+    int bytesPerPixel = 0;
+    size_t maxBytes = 0;       // Largest frame's payload.
+    double framesPerSecond = 0.0;
+};
+
+// Shapes of every stream the configured pipeline produces; streams that are
+// not produced have a zero rate.
+struct PlanContext {
+    StreamShape shapes[6];
+    const RoiMask* roi = nullptr;   // Region of interest of the captured streams.
+    Orientation orientation = Orientation::None;   // Of the captured streams' BGRX output.
+    const AutoFramer* framer = nullptr;            // Crops the RGB output when set.
+    bool keyDepth = false;                         // Depth with no reading is sent transparent.
+    const PrivacyMask* privacy = nullptr;          // Masks the RGB output when set.
+    const PlaneFinder* planes = nullptr;           // Sent as NDI metadata when set.
+    const ColourLut* colourLut = nullptr;          // Grades the RGB output when set.
+
+    static int Index(kndi_stream stream);
+    const StreamShape& Shape(kndi_stream stream) const { return shapes[Index(stream)]; }
+    StreamShape& Shape(kndi_stream stream) { return shapes[Index(stream)]; }
+};
+
+// One unit of per-frame work. `run` processes one frame of synthetic input
+// of the real size; stages without `run` (work done inside libfreenect, the
+// NDI runtime or user callbacks) are listed but not measured.
+struct PlanStage {
+    std::string name;
+    double framesPerSecond = 0.0;
+    size_t bytesPerFrame = 0;      // Memory read + written per frame.
+    std::function<void()> run;
+};
+
+// Median wall time of `run` in milliseconds, repeated for at least
+// `minTotalMs` (and three runs) after one warm-up call.
+double MeasureMs(const std::function<void()>& run, double minTotalMs = 25.0);
+
+// Host memory bandwidth in bytes per second (large memcpy, read + write).
+double MeasureMemoryBandwidth();
+
+// Dry-run estimate of a pipeline's per-frame cost on this host. All stages
+// run on the dispatching capture thread, so their summed load is compared
+// against one core; memory traffic is compared against the measured copy
+// bandwidth.
+class Planner {
+public:
+    // Loads above these fractions of the budget are reported as not met.
+    static constexpr double kMaxThreadLoad = 0.8;
+    static constexpr double kMaxBandwidthShare = 0.5;
+
+    void Add(PlanStage stage) { stages.push_back(std::move(stage)); }
+    void AddPoolMemory(size_t bytes) { poolBytes += bytes; }
+
+    // Calibrate every stage, write a per-stage cost table to `report` and
+    // return whether the budget is met.
+    bool Estimate(std::string& report);
+
+private:
+    std::vector<PlanStage> stages;
+    size_t poolBytes = 0;
+};
+
+} // namespace kndi
@@ -0,0 +1,184 @@
+#include "privacy_mask.h"
+
+#include <algorithm>
+
+#include "depth_units.h"
+
+namespace kndi {
+
+// Depth older than this (a few frames) no longer masks the RGB; everything
+// is hidden instead.
+static constexpr int64_t kStaleNs = 200 * 1000000LL;
+
+// Depth samples per block side; 4 x 4 per block.
+static constexpr int kSamples = 4;
+
+static const char* const kModeNames[] = { "off", "blank", "pixelate" };
+
+static const uint32_t kBlack = 0xFF000000u;
+
+bool ParsePrivacyMode(const std::string& name, PrivacyMode& out)
+{
+    for (int i = 0; i < 3; i++) {
+        if (name == kModeNames[i]) {
+            out = static_cast<PrivacyMode>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* PrivacyModeName(PrivacyMode mode)
+{
+    return kModeNames[static_cast<int>(mode)];
+}
+
+PrivacyMask::PrivacyMask(PrivacyMode mode, float farMm, int depthWidth, int depthHeight, int videoWidth,
+                         int videoHeight)
+    : mode(mode), depthWidth(depthWidth), depthHeight(depthHeight), videoWidth(videoWidth),
+      videoHeight(videoHeight), blocksX((videoWidth + kPrivacyBlock - 1) / kPrivacyBlock),
+      blocksY((videoHeight + kPrivacyBlock - 1) / kPrivacyBlock), farRaw(0),
+      foreground(static_cast<size_t>(blocksX) * blocksY), next(foreground.size()), visible(next.size(), 0),
+      updatedNs(0)
+{
+    // Disparity grows with distance: readings at or below farRaw are near.
+    const uint16_t* mm = RawDepthToMillimetres();
+    for (int raw = 0; raw < kRawDepthInvalid; raw++) {
+        if (mm[raw] && mm[raw] <= farMm)
+            farRaw = static_cast<uint16_t>(raw);
+    }
+}
+
+void PrivacyMask::Update(const uint16_t* depth, int stride, int64_t timestampNs)
+{
+    const uint16_t* mm = RawDepthToMillimetres();
+    float scaleX = static_cast<float>(depthWidth) / videoWidth;
+    float scaleY = static_cast<float>(depthHeight) / videoHeight;
+    for (int by = 0; by < blocksY; by++) {
+        for (int bx = 0; bx < blocksX; bx++) {
+            int near = 0;
+            for (int sy = 0; sy < kSamples; sy++) {
+                int y = std::min(static_cast<int>(((by * kSamples + sy) * kPrivacyBlock / kSamples +
+                                                   kPrivacyBlock / (2 * kSamples)) * scaleY), depthHeight - 1);
+                const uint16_t* row = reinterpret_cast<const uint16_t*>(
+                    reinterpret_cast<const uint8_t*>(depth) + static_cast<size_t>(y) * stride);
+                for (int sx = 0; sx < kSamples; sx++) {
+                    int x = std::min(static_cast<int>(((bx * kSamples + sx) * kPrivacyBlock / kSamples +
+                                                       kPrivacyBlock / (2 * kSamples)) * scaleX), depthWidth - 1);
+                    uint16_t raw = row[x];
+                    near += (raw <= farRaw && mm[raw]) ? 1 : 0;
+                }
+            }
+            foreground[by * blocksX + bx] = near * 2 >= kSamples * kSamples ? 1 : 0;
+        }
+    }
+    // Depth is not registered to RGB, so the silhouette can be off by the
+    // parallax between the cameras (~13 px at 1 m): a block is only shown
+    // if its neighbours are foreground too.
+    for (int by = 0; by < blocksY; by++) {
+        for (int bx = 0; bx < blocksX; bx++) {
+            uint8_t shown = 1;
+            for (int y = std::max(by - 1, 0); y <= std::min(by + 1, blocksY - 1); y++)
+                for (int x = std::max(bx - 1, 0); x <= std::min(bx + 1, blocksX - 1); x++)
+                    shown &= foreground[y * blocksX + x];
+            next[by * blocksX + bx] = shown;
+        }
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    visible.swap(next);
+    updatedNs = timestampNs;
+}
+
+void PrivacyMask::Snapshot(int64_t frameNs, PrivacyBlocks& blocks) const
+{
+    blocks.blocksX = blocksX;
+    blocks.blocksY = blocksY;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!updatedNs || frameNs - updatedNs > kStaleNs || updatedNs - frameNs > kStaleNs)
+        blocks.visible.assign(visible.size(), 0);
+    else
+        blocks.visible.assign(visible.begin(), visible.end());
+}
+
+// Average of the RGB pixels [x0, x1) x [y0, y1) as BGRX.
+static void BlockAverage(const uint8_t* src, int srcStride, int x0, int x1, int y0, int y1, uint32_t& colour)
+{
+    uint32_t sum[3] = { 0, 0, 0 };
+    for (int y = y0; y < y1; y++) {
+        const uint8_t* in = src + static_cast<size_t>(y) * srcStride + x0 * 3;
+        for (int x = 0; x < x1 - x0; x++) {
+            sum[0] += in[x * 3 + 0];
+            sum[1] += in[x * 3 + 1];
+            sum[2] += in[x * 3 + 2];
+        }
+    }
+    uint32_t count = static_cast<uint32_t>((x1 - x0) * (y1 - y0));
+    uint32_t r = (sum[0] + count / 2) / count;
+    uint32_t g = (sum[1] + count / 2) / count;
+    uint32_t b = (sum[2] + count / 2) / count;
+    colour = kBlack | (r << 16) | (g << 8) | b;
+}
+
+// Run `fn(by)` for every block row, on `pool` if it has workers.
+template <typename F>
+static void ForEachBlockRow(ThreadPool* pool, int blocksY, F fn)
+{
+    if (pool && pool->Size() > 1)
+        pool->ParallelFor(blocksY, fn);
+    else
+        for (int by = 0; by < blocksY; by++)
+            fn(by);
+}
+
+void ComputePrivacyColours(ThreadPool* pool, PrivacyMode mode, const uint8_t* src, int srcStride, int width,
+                           int height, PrivacyBlocks& blocks)
+{
+    blocks.colours.assign(blocks.visible.size(), kBlack);
+    if (mode != PrivacyMode::Pixelate)
+        return;
+    ForEachBlockRow(pool, blocks.blocksY, [&](int by) {
+        int y0 = by * kPrivacyBlock;
+        int y1 = std::min(y0 + kPrivacyBlock, height);
+        for (int bx = 0; bx < blocks.blocksX; bx++) {
+            size_t block = static_cast<size_t>(by) * blocks.blocksX + bx;
+            if (!blocks.visible[block])
+                BlockAverage(src, srcStride, bx * kPrivacyBlock, std::min((bx + 1) * kPrivacyBlock, width), y0, y1,
+                             blocks.colours[block]);
+        }
+    });
+}
+
+void RunPrivateConversion(ThreadPool* pool, ConvertKernel kernel, const uint8_t* src, int srcStride,
+                          uint8_t* dst, int dstStride, int width, int height, const PrivacyBlocks& blocks)
+{
+    ForEachBlockRow(pool, blocks.blocksY, [&](int by) {
+        int y0 = by * kPrivacyBlock;
+        int rows = std::min(kPrivacyBlock, height - y0);
+        const uint8_t* visible = blocks.visible.data() + static_cast<size_t>(by) * blocks.blocksX;
+        const uint32_t* colours = blocks.colours.data() + static_cast<size_t>(by) * blocks.blocksX;
+        int bx = 0;
+        while (bx < blocks.blocksX) {
+            if (visible[bx]) {
+                // One kernel call for the whole run of visible blocks.
+                int end = bx + 1;
+                while (end < blocks.blocksX && visible[end])
+                    end++;
+                int x0 = bx * kPrivacyBlock;
+                int x1 = std::min(end * kPrivacyBlock, width);
+                kernel(src + static_cast<size_t>(y0) * srcStride + x0 * 3, srcStride,
+                       dst + static_cast<size_t>(y0) * dstStride + x0 * 4, dstStride, x1 - x0, rows);
+                bx = end;
+                continue;
+            }
+            int x0 = bx * kPrivacyBlock;
+            int x1 = std::min(x0 + kPrivacyBlock, width);
+            for (int y = y0; y < y0 + rows; y++) {
+                uint32_t* out = reinterpret_cast<uint32_t*>(dst + static_cast<size_t>(y) * dstStride);
+                std::fill(out + x0, out + x1, colours[bx]);
+            }
+            bx++;
+        }
+    });
+}
+
+} // namespace kndi
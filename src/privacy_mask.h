@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "convert.h"
+#include "thread_pool.h"
+
+namespace kndi {
+
+// What the RGB output shows where the depth says there is no foreground.
+enum class PrivacyMode {
+    Off,
+    Blank,      // Black.
+    Pixelate    // Each hidden block filled with its average colour.
+};
+
+// "off", "blank" or "pixelate".
+bool ParsePrivacyMode(const std::string& name, PrivacyMode& out);
+const char* PrivacyModeName(PrivacyMode mode);
+
+// RGB frames are masked in square blocks of this many pixels.
+constexpr int kPrivacyBlock = 16;
+
+// Per-block visibility of one RGB frame and the colour of each hidden
+// block, as the conversions consume them.
+struct PrivacyBlocks {
+    int blocksX = 0;
+    int blocksY = 0;
+    std::vector<uint8_t> visible;    // 1 where the block is shown as captured.
+    std::vector<uint32_t> colours;   // BGRX of each hidden block.
+};
+
+// Which blocks of the RGB frame are foreground, from the latest depth frame
+// of the same Kinect. Fails closed: until depth arrives, or if it stops
+// arriving, every block is hidden.
+class PrivacyMask {
+public:
+    PrivacyMask(PrivacyMode mode, float farMm, int depthWidth, int depthHeight, int videoWidth, int videoHeight);
+
+    PrivacyMode Mode() const { return mode; }
+    int BlocksX() const { return blocksX; }
+    int BlocksY() const { return blocksY; }
+
+    // A block is foreground when at least half of its depth samples have a
+    // reading closer than farMm, and shown only when its eight neighbours
+    // are foreground too, which absorbs the depth / RGB camera parallax
+    // down to about 0.8 m. Called on the capture thread.
+    void Update(const uint16_t* depth, int stride, int64_t timestampNs);
+
+    // Visibility for an RGB frame captured at `frameNs`; everything is
+    // hidden if the depth is older than a few frames. Any thread.
+    void Snapshot(int64_t frameNs, PrivacyBlocks& blocks) const;
+
+private:
+    PrivacyMode mode;
+    int depthWidth;
+    int depthHeight;
+    int videoWidth;
+    int videoHeight;
+    int blocksX;
+    int blocksY;
+    uint16_t farRaw;                // Raw disparity of farMm.
+    std::vector<uint8_t> foreground;   // Capture thread only.
+    std::vector<uint8_t> next;      // Capture thread only.
+    mutable std::mutex mutex;
+    std::vector<uint8_t> visible;   // Guarded by `mutex`.
+    int64_t updatedNs;              // Guarded by `mutex`; 0 before the first depth frame.
+};
+
+// Fill in `blocks.colours` for the hidden blocks of a 24-bit RGB frame:
+// black, or the block's average for Pixelate. Block rows run on `pool`.
+void ComputePrivacyColours(ThreadPool* pool, PrivacyMode mode, const uint8_t* src, int srcStride, int width,
+                           int height, PrivacyBlocks& blocks);
+
+// 24-bit RGB → BGRX through `kernel`, with the hidden blocks written as
+// their colour instead, in one pass: runs of visible blocks go to the
+// kernel, hidden ones are filled. Bands of block rows run on `pool`.
+void RunPrivateConversion(ThreadPool* pool, ConvertKernel kernel, const uint8_t* src, int srcStride,
+                          uint8_t* dst, int dstStride, int width, int height, const PrivacyBlocks& blocks);
+
+} // namespace kndi
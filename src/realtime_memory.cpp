@@ -0,0 +1,105 @@
+#include "realtime_memory.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+#ifndef _WIN32
+  #include <sys/mman.h>
+  #include <sys/resource.h>
+  #include <unistd.h>
+#endif
+
+namespace kndi {
+
+static std::atomic<int> memoryLock(static_cast<int>(MemoryLock::None));
+
+const char* MemoryLockName(MemoryLock lock)
+{
+    switch (lock) {
+    case MemoryLock::None:    return "none";
+    case MemoryLock::Buffers: return "buffers";
+    case MemoryLock::All:     return "all";
+    }
+    return "none";
+}
+
+static size_t PageSize()
+{
+#ifdef _WIN32
+    return 4096;
+#else
+    static const size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return size;
+#endif
+}
+
+void PrefaultMemory(void* data, size_t bytes)
+{
+    // One write per page; volatile so the stores are not optimised away.
+    volatile uint8_t* bytesOf = static_cast<volatile uint8_t*>(data);
+    size_t page = PageSize();
+    for (size_t offset = 0; offset < bytes; offset += page)
+        bytesOf[offset] = 0;
+    if (bytes > 0)
+        bytesOf[bytes - 1] = 0;
+}
+
+bool LockMemory(void* data, size_t bytes)
+{
+#ifdef _WIN32
+    (void)data;
+    (void)bytes;
+    return false;
+#else
+    return mlock(data, bytes) == 0;
+#endif
+}
+
+bool LockAllMemory(std::string& error)
+{
+#ifdef _WIN32
+    error = "not supported on Windows";
+    return false;
+#else
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0)
+        return true;
+    int code = errno;
+    error = std::strerror(code);
+    if (code == EPERM || code == ENOMEM) {
+        struct rlimit limit;
+        if (getrlimit(RLIMIT_MEMLOCK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+            error += " (RLIMIT_MEMLOCK is " + std::to_string(limit.rlim_cur / 1024) +
+                     " KB; raise it with ulimit -l or grant CAP_IPC_LOCK)";
+    }
+    return false;
+#endif
+}
+
+MemoryLock CurrentMemoryLock()
+{
+    return static_cast<MemoryLock>(memoryLock.load());
+}
+
+void NoteMemoryLock(MemoryLock lock)
+{
+    int value = static_cast<int>(lock);
+    int current = memoryLock.load();
+    while (current < value && !memoryLock.compare_exchange_weak(current, value)) {
+    }
+}
+
+void ProcessPageFaults(uint64_t& minor, uint64_t& major)
+{
+    minor = 0;
+    major = 0;
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        minor = static_cast<uint64_t>(usage.ru_minflt);
+        major = static_cast<uint64_t>(usage.ru_majflt);
+    }
+#endif
+}
+
+} // namespace kndi
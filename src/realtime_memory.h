@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace kndi {
+
+// How much of the process is locked in RAM, so it can never be paged out.
+enum class MemoryLock {
+    None,
+    Buffers,   // Only the frame pools (mlockall was not permitted).
+    All        // mlockall: everything, including memory allocated later.
+};
+
+const char* MemoryLockName(MemoryLock lock);
+
+// Touch every page of [data, data + bytes) so it is backed by RAM now
+// rather than faulted in on first use.
+void PrefaultMemory(void* data, size_t bytes);
+
+// Lock [data, data + bytes) in RAM; false if not permitted or over the
+// RLIMIT_MEMLOCK limit.
+bool LockMemory(void* data, size_t bytes);
+
+// Lock all current and future pages of the process (mlockall); false with
+// the reason in `error` if the privilege or limit is missing.
+bool LockAllMemory(std::string& error);
+
+// Strongest lock taken so far in this process; shown in the stats.
+MemoryLock CurrentMemoryLock();
+void NoteMemoryLock(MemoryLock lock);
+
+// Minor and major page faults of the process since it started.
+void ProcessPageFaults(uint64_t& minor, uint64_t& major);
+
+} // namespace kndi
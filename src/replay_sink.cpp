@@ -0,0 +1,264 @@
+#include "replay_sink.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+#include "depth_codec.h"
+
+namespace kndi {
+
+static_assert(sizeof(ReplaySink::FrameHeader) == 48, "replay frame header must not be padded");
+
+static bool IsDepth(kndi_stream stream)
+{
+    return stream == KNDI_STREAM_DEPTH || stream == KNDI_STREAM_FUSED_DEPTH;
+}
+
+// Rows copied contiguously, dropping any stride padding.
+static void CopyRows(const kndi_frame& frame, uint8_t* dst)
+{
+    size_t rowBytes = static_cast<size_t>(frame.width) * frame.bytes_per_pixel;
+    const uint8_t* src = static_cast<const uint8_t*>(frame.data);
+    if (static_cast<size_t>(frame.stride) == rowBytes) {
+        std::memcpy(dst, src, rowBytes * frame.height);
+        return;
+    }
+    for (int y = 0; y < frame.height; y++)
+        std::memcpy(dst + y * rowBytes, src + static_cast<size_t>(y) * frame.stride, rowBytes);
+}
+
+ReplaySink::ReplaySink(unsigned streams, size_t memoryBytes, int seconds)
+    : streams(streams), memoryBytes(memoryBytes), spanNs(static_cast<int64_t>(seconds) * 1000000000),
+      first(0), next(0), writeOffset(0), savedFrom(0), skipped(0), saving(false), lastSaveOk(true)
+{
+}
+
+ReplaySink::~ReplaySink()
+{
+    WaitForSave();
+}
+
+void ReplaySink::Configure(const PlanContext& context, KernelTuner&, ThreadPool&)
+{
+    WaitForSave();
+    size_t frameRate = 0;
+    size_t largestFrame = 0;
+    size_t scratchBytes = 0;
+    for (unsigned bit = KNDI_STREAM_RGB; bit <= KNDI_STREAM_FUSED_DEPTH; bit <<= 1) {
+        kndi_stream stream = static_cast<kndi_stream>(bit);
+        const StreamShape& shape = context.Shape(stream);
+        if (!(streams & bit) || shape.framesPerSecond <= 0.0)
+            continue;
+        size_t pixels = static_cast<size_t>(shape.width) * shape.height;
+        frameRate += static_cast<size_t>(shape.framesPerSecond + 0.5);
+        largestFrame = std::max(largestFrame, pixels * shape.bytesPerPixel);
+        if (IsDepth(stream))
+            scratchBytes = std::max(scratchBytes, MaxCompressedDepthBytes(pixels));
+    }
+    // Index for every frame the time span can hold, plus slack for jitter.
+    size_t capacity = frameRate * static_cast<size_t>(spanNs / 1000000000) + 16;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (arena.size() != memoryBytes || entries.size() != capacity || scratch.size() != scratchBytes) {
+        arena.assign(memoryBytes, 0);
+        entries.assign(capacity, Entry());
+        scratch.assign(scratchBytes, 0);
+        first = next = 0;
+        writeOffset = 0;
+    }
+    if (memoryBytes < 2 * largestFrame)
+        std::cerr << "Warning: replay buffer of " << memoryBytes / 1000000
+                  << " MB holds less than two frames." << std::endl;
+}
+
+bool ReplaySink::Evict()
+{
+    if (first == next || (saving && first >= savedFrom))
+        return false;
+    first++;
+    return true;
+}
+
+bool ReplaySink::Reserve(size_t bytes, size_t& offset)
+{
+    if (bytes > arena.size())
+        return false;
+    size_t at = writeOffset;
+    if (at + bytes > arena.size()) {
+        // Wrap around: whatever lies past the write position is older than
+        // anything at the start.
+        while (first != next && Oldest().offset >= at) {
+            if (!Evict())
+                return false;
+        }
+        at = 0;
+    }
+    while (first != next && Oldest().offset >= at && Oldest().offset < at + bytes) {
+        if (!Evict())
+            return false;
+    }
+    offset = at;
+    return true;
+}
+
+void ReplaySink::Consume(const kndi_frame& frame)
+{
+    if (arena.empty())
+        return;
+    FrameHeader header;
+    header.stream = frame.stream;
+    header.deviceIndex = frame.device_index;
+    header.width = frame.width;
+    header.height = frame.height;
+    header.bytesPerPixel = frame.bytes_per_pixel;
+    header.deviceTimestamp = frame.device_timestamp;
+    header.hostTimestampNs = frame.host_timestamp_ns;
+    header.sequence = frame.sequence;
+    header.codec = Raw;
+    header.payloadBytes = static_cast<uint32_t>(static_cast<size_t>(frame.width) * frame.height *
+                                                frame.bytes_per_pixel);
+
+    // Compress outside the lock; the saver only needs it for the indices.
+    if (IsDepth(frame.stream) && scratch.size() >= MaxCompressedDepthBytes(
+                                     static_cast<size_t>(frame.width) * frame.height)) {
+        size_t bytes = CompressDepth(static_cast<const uint16_t*>(frame.data), frame.stride,
+                                     frame.width, frame.height, scratch.data());
+        if (bytes < header.payloadBytes) {
+            header.codec = DepthDelta;
+            header.payloadBytes = static_cast<uint32_t>(bytes);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    while (first != next && frame.host_timestamp_ns - Oldest().header.hostTimestampNs > spanNs) {
+        if (!Evict())
+            break;
+    }
+    size_t offset = 0;
+    if ((next - first == entries.size() && !Evict()) || !Reserve(header.payloadBytes, offset)) {
+        skipped++;
+        return;
+    }
+    if (header.codec == DepthDelta)
+        std::memcpy(&arena[offset], scratch.data(), header.payloadBytes);
+    else
+        CopyRows(frame, &arena[offset]);
+    Entry& entry = entries[next % entries.size()];
+    entry.header = header;
+    entry.offset = offset;
+    next++;
+    writeOffset = offset + header.payloadBytes;
+}
+
+bool ReplaySink::Save(const std::string& path)
+{
+    std::lock_guard<std::mutex> saveLock(saveMutex);
+    if (saving)
+        return false;
+    if (saveThread.joinable())
+        saveThread.join();
+
+    uint64_t begin;
+    uint64_t end;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (first == next)
+            return false;
+        begin = first;
+        end = next;
+        savedFrom = begin;
+        skipped = 0;
+        saving = true;
+    }
+
+    // Frames from `savedFrom` on are pinned, so their payload is read
+    // without holding the lock.
+    saveThread = std::thread([this, path, begin, end] {
+        bool ok = false;
+        uint64_t bytes = 0;
+        if (FILE* file = std::fopen(path.c_str(), "wb")) {
+            uint32_t count = static_cast<uint32_t>(end - begin);
+            ok = std::fwrite("KNDIRPL1", 8, 1, file) == 1 && std::fwrite(&count, sizeof(count), 1, file) == 1;
+            for (uint64_t index = begin; ok && index < end; index++) {
+                Entry entry;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    entry = entries[index % entries.size()];
+                }
+                ok = std::fwrite(&entry.header, sizeof(entry.header), 1, file) == 1 &&
+                     std::fwrite(&arena[entry.offset], 1, entry.header.payloadBytes, file) ==
+                         entry.header.payloadBytes;
+                bytes += entry.header.payloadBytes;
+                std::lock_guard<std::mutex> lock(mutex);
+                savedFrom = index + 1;
+            }
+            ok = std::fclose(file) == 0 && ok;
+        }
+        uint64_t left;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            left = skipped;
+            saving = false;
+        }
+        if (ok) {
+            std::cerr << "Replay: wrote " << (end - begin) << " frames (" << bytes / 1000000 << " MB) to "
+                      << path;
+            if (left)
+                std::cerr << "; " << left << " new frames were not buffered while saving";
+            std::cerr << "." << std::endl;
+        } else {
+            std::cerr << "Replay: could not write " << path << std::endl;
+        }
+        lastSaveOk = ok;
+    });
+    return true;
+}
+
+bool ReplaySink::WaitForSave()
+{
+    std::lock_guard<std::mutex> saveLock(saveMutex);
+    if (saveThread.joinable())
+        saveThread.join();
+    return lastSaveOk;
+}
+
+void ReplaySink::Plan(const PlanContext& context, Planner& planner) const
+{
+    for (unsigned bit = KNDI_STREAM_RGB; bit <= KNDI_STREAM_FUSED_DEPTH; bit <<= 1) {
+        kndi_stream stream = static_cast<kndi_stream>(bit);
+        const StreamShape& shape = context.Shape(stream);
+        if (!(streams & bit) || shape.framesPerSecond <= 0.0)
+            continue;
+        size_t pixels = static_cast<size_t>(shape.width) * shape.height;
+        size_t rawBytes = pixels * shape.bytesPerPixel;
+        std::shared_ptr<std::vector<uint8_t>> src = std::make_shared<std::vector<uint8_t>>(rawBytes);
+        std::shared_ptr<std::vector<uint8_t>> dst = std::make_shared<std::vector<uint8_t>>(
+            IsDepth(stream) ? MaxCompressedDepthBytes(pixels) : rawBytes);
+
+        PlanStage store;
+        store.name = std::string("Replay store ") + StreamKey(stream);
+        store.framesPerSecond = shape.framesPerSecond;
+        store.bytesPerFrame = 2 * rawBytes;
+        if (IsDepth(stream)) {
+            // A sloped surface with sensor noise; compression cost depends
+            // on content, unlike the conversions.
+            uint16_t* samples = reinterpret_cast<uint16_t*>(src->data());
+            for (size_t i = 0; i < pixels; i++)
+                samples[i] = static_cast<uint16_t>(700 + (i % shape.width) / 4 + (static_cast<uint32_t>(i * 2654435761u) >> 30));
+            int width = shape.width;
+            int height = shape.height;
+            store.run = [src, dst, width, height] {
+                CompressDepth(reinterpret_cast<const uint16_t*>(src->data()), width * 2, width, height,
+                              dst->data());
+            };
+        } else {
+            store.run = [src, dst] { std::memcpy(dst->data(), src->data(), src->size()); };
+        }
+        planner.Add(store);
+    }
+}
+
+} // namespace kndi
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sink.h"
+
+namespace kndi {
+
+// Pre-roll buffer: keeps the last `seconds` of frames in a fixed block of
+// RAM (depth losslessly compressed, RGB and IR as captured) so they can be
+// written to disk after something interesting happened. All memory is
+// allocated in Configure(); Consume() only copies into it, evicting the
+// oldest frames.
+//
+// Save() writes the frames held at the time of the call on a background
+// thread. Frames being saved are not evicted; if capture catches up with
+// the save, new frames are left out of the buffer until it moves on.
+//
+// File layout (little-endian): the 8-byte magic "KNDIRPL1", a uint32 frame
+// count, then per frame a FrameHeader followed by its payload.
+class ReplaySink : public Sink {
+public:
+    enum Codec : uint32_t { Raw = 0, DepthDelta = 1 };
+
+    struct FrameHeader {
+        uint32_t stream;
+        int32_t deviceIndex;
+        int32_t width;
+        int32_t height;
+        int32_t bytesPerPixel;
+        uint32_t deviceTimestamp;
+        int64_t hostTimestampNs;
+        uint64_t sequence;
+        uint32_t codec;
+        uint32_t payloadBytes;
+    };
+
+    // `memoryBytes` bounds the frame data held; `seconds` the time span.
+    ReplaySink(unsigned streams, size_t memoryBytes, int seconds);
+    ~ReplaySink() override;
+
+    unsigned Streams() const override { return streams; }
+    void Consume(const kndi_frame& frame) override;
+    void Configure(const PlanContext& context, KernelTuner& tuner, ThreadPool& pool) override;
+    void Plan(const PlanContext& context, Planner& planner) const override;
+
+    // Start writing the buffered frames to `path`. Returns false if a save
+    // is still running or nothing is buffered.
+    bool Save(const std::string& path);
+    // Wait for a running save; returns whether it succeeded.
+    bool WaitForSave();
+
+private:
+    struct Entry {
+        FrameHeader header;
+        size_t offset;         // Payload position in `arena`.
+    };
+
+    const Entry& Oldest() const { return entries[first % entries.size()]; }
+    // Make room for `bytes` of payload at `offset`; false if the frames in
+    // the way are being saved.
+    bool Reserve(size_t bytes, size_t& offset);
+    bool Evict();
+
+    unsigned streams;
+    size_t memoryBytes;
+    int64_t spanNs;
+
+    std::mutex mutex;          // Guards the ring indices against the saver.
+    std::vector<uint8_t> arena;
+    std::vector<Entry> entries;
+    std::vector<uint8_t> scratch;   // Compression output, one frame.
+    uint64_t first;            // Oldest entry held.
+    uint64_t next;             // Entry written next.
+    size_t writeOffset;
+    uint64_t savedFrom;        // While saving: oldest entry still to be written.
+    uint64_t skipped;          // Frames left out while a save held the space.
+
+    std::mutex saveMutex;
+    std::thread saveThread;
+    std::atomic<bool> saving;
+    std::atomic<bool> lastSaveOk;
+};
+
+} // namespace kndi
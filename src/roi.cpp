@@ -0,0 +1,96 @@
+#include "roi.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+
+namespace kndi {
+
+static bool ParseCoordinate(const std::string& text, float& out)
+{
+    if (text.empty())
+        return false;
+    char* end = nullptr;
+    out = std::strtof(text.c_str(), &end);
+    return *end == '\0' && std::isfinite(out) && std::fabs(out) < 65536.0f;
+}
+
+bool ParseRoi(const std::string& text, std::vector<RoiPolygon>& polygons)
+{
+    std::vector<RoiPolygon> parsed;
+    std::istringstream polygonStream(text);
+    std::string polygonText;
+    while (std::getline(polygonStream, polygonText, '|')) {
+        RoiPolygon polygon;
+        std::istringstream pointStream(polygonText);
+        std::string pointText;
+        while (std::getline(pointStream, pointText, ';')) {
+            size_t comma = pointText.find(',');
+            RoiPoint point;
+            if (comma == std::string::npos || !ParseCoordinate(pointText.substr(0, comma), point.x) ||
+                !ParseCoordinate(pointText.substr(comma + 1), point.y))
+                return false;
+            polygon.push_back(point);
+        }
+        if (polygon.size() < 3)
+            return false;
+        parsed.push_back(polygon);
+    }
+    polygons.swap(parsed);
+    return true;
+}
+
+void RoiMask::Compile(const std::vector<RoiPolygon>& polygons, int maskWidth, int maskHeight)
+{
+    width = maskWidth;
+    height = maskHeight;
+    pixels = 0;
+    rowStart.assign(1, 0);
+    spans.clear();
+
+    std::vector<float> crossings;
+    std::vector<RoiSpan> row;
+    for (int y = 0; y < height; y++) {
+        row.clear();
+        if (polygons.empty()) {
+            RoiSpan full = { 0, static_cast<uint16_t>(width) };
+            row.push_back(full);
+        }
+        // Even-odd crossings of the pixel-centre line, per polygon.
+        float centre = y + 0.5f;
+        for (const RoiPolygon& polygon : polygons) {
+            crossings.clear();
+            for (size_t i = 0; i < polygon.size(); i++) {
+                const RoiPoint& a = polygon[i];
+                const RoiPoint& b = polygon[(i + 1) % polygon.size()];
+                if ((a.y <= centre && centre < b.y) || (b.y <= centre && centre < a.y))
+                    crossings.push_back(a.x + (centre - a.y) * (b.x - a.x) / (b.y - a.y));
+            }
+            std::sort(crossings.begin(), crossings.end());
+            for (size_t i = 0; i + 1 < crossings.size(); i += 2) {
+                // Pixels whose centre x + 0.5 lies in [left, right).
+                int begin = std::max(0, static_cast<int>(std::ceil(crossings[i] - 0.5f)));
+                int end = std::min(width, static_cast<int>(std::ceil(crossings[i + 1] - 0.5f)));
+                if (begin < end) {
+                    RoiSpan span = { static_cast<uint16_t>(begin), static_cast<uint16_t>(end) };
+                    row.push_back(span);
+                }
+            }
+        }
+        // Union of the polygons' spans.
+        std::sort(row.begin(), row.end(), [](const RoiSpan& a, const RoiSpan& b) { return a.begin < b.begin; });
+        size_t rowFirst = spans.size();
+        for (const RoiSpan& span : row) {
+            if (spans.size() > rowFirst && span.begin <= spans.back().end)
+                spans.back().end = std::max(spans.back().end, span.end);
+            else
+                spans.push_back(span);
+        }
+        for (size_t i = rowFirst; i < spans.size(); i++)
+            pixels += spans[i].end - spans[i].begin;
+        rowStart.push_back(static_cast<uint32_t>(spans.size()));
+    }
+}
+
+} // namespace kndi
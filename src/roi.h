@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace kndi {
+
+struct RoiPoint {
+    float x;
+    float y;
+};
+
+typedef std::vector<RoiPoint> RoiPolygon;
+
+// Parse "x,y;x,y;x,y[|x,y;...]" (pixel coordinates, polygons separated by
+// '|', at least three points each). An empty string parses to no polygons.
+bool ParseRoi(const std::string& text, std::vector<RoiPolygon>& polygons);
+
+// Half-open run [begin, end) of pixels inside the ROI on one row.
+struct RoiSpan {
+    uint16_t begin;
+    uint16_t end;
+};
+
+// Region of interest compiled into sorted, non-overlapping spans per row, so
+// stages touch only the pixels inside it. A pixel is inside when its centre
+// lies in any of the polygons. With no polygons the mask covers the whole
+// frame (one span per row).
+class RoiMask {
+public:
+    RoiMask() : width(0), height(0), pixels(0) {}
+
+    void Compile(const std::vector<RoiPolygon>& polygons, int width, int height);
+
+    int Width() const { return width; }
+    int Height() const { return height; }
+    bool IsFull() const { return pixels == static_cast<size_t>(width) * height; }
+    // Pixels inside the ROI.
+    size_t Pixels() const { return pixels; }
+
+    const RoiSpan* RowBegin(int y) const { return spans.data() + rowStart[y]; }
+    const RoiSpan* RowEnd(int y) const { return spans.data() + rowStart[y + 1]; }
+
+    // Call `f(y, begin, end)` for every span of rows [firstRow, firstRow + rows).
+    template <typename F>
+    void ForEachSpan(int firstRow, int rows, F f) const
+    {
+        for (int y = firstRow; y < firstRow + rows; y++) {
+            for (const RoiSpan* span = RowBegin(y); span != RowEnd(y); span++)
+                f(y, static_cast<int>(span->begin), static_cast<int>(span->end));
+        }
+    }
+
+private:
+    int width;
+    int height;
+    size_t pixels;
+    std::vector<uint32_t> rowStart;   // height + 1 offsets into `spans`.
+    std::vector<RoiSpan> spans;
+};
+
+} // namespace kndi
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "kernel_tuning.h"
+#include "kinect_ndi.h"
+#include "planner.h"
+#include "thread_pool.h"
+
+namespace kndi {
+
+// Consumer of captured frames. Sinks are called on the capture thread, in
+// the order they were attached, for every frame of a stream in Streams().
+class Sink {
+public:
+    virtual ~Sink() {}
+    virtual unsigned Streams() const = 0;
+    virtual void Consume(const kndi_frame& frame) = 0;
+    // Called before streaming starts with the shapes of the streams to come;
+    // sinks that convert frames pick their kernels from `tuner` here.
+    virtual void Configure(const PlanContext&, KernelTuner&, ThreadPool&) {}
+    // Describe the per-frame work Consume() does for the startup planner.
+    virtual void Plan(const PlanContext& context, Planner& planner) const = 0;
+};
+
+// Forwards frames to a user callback registered through the C API.
+class CallbackSink : public Sink {
+public:
+    CallbackSink(unsigned streams, kndi_frame_callback callback, void* user)
+        : streams(streams), callback(callback), user(user) {}
+
+    unsigned Streams() const override { return streams; }
+    void Consume(const kndi_frame& frame) override { callback(&frame, user); }
+    void Plan(const PlanContext&, Planner& planner) const override
+    {
+        PlanStage stage;
+        stage.name = "frame callbacks";
+        planner.Add(stage);
+    }
+
+private:
+    unsigned streams;
+    kndi_frame_callback callback;
+    void* user;
+};
+
+} // namespace kndi
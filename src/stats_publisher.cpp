@@ -0,0 +1,251 @@
+#include "stats_publisher.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#ifdef _WIN32
+  #include <process.h>
+#else
+  #include <unistd.h>
+#endif
+#ifdef __linux__
+  #include <dirent.h>
+#endif
+
+#include "realtime_memory.h"
+#include "thread_pool.h"
+
+namespace kndi {
+
+static int64_t UnixNowMs()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Value below which a fraction `q` of the sorted `values` lie.
+static double Percentile(const std::vector<double>& sorted, double q)
+{
+    if (sorted.empty())
+        return 0.0;
+    size_t index = std::min(sorted.size() - 1, static_cast<size_t>(q * sorted.size()));
+    return sorted[index];
+}
+
+StatsPublisher::StatsPublisher(const FlightRecorder& recorder, const std::atomic<bool>& running,
+                               const std::string& name, size_t poolSlots, int intervalMs)
+    : recorder(recorder), running(running), intervalMs(intervalMs), cursor(0), minorFaults(0), majorFaults(0),
+      stopping(false)
+{
+    std::memset(&page, 0, sizeof(page));
+    std::memcpy(page.magic, "KNDISTAT", 8);
+    page.version = StatsPage::kVersion;
+    page.size = sizeof(StatsPage);
+#ifdef _WIN32
+    page.pid = static_cast<int32_t>(_getpid());
+#else
+    page.pid = static_cast<int32_t>(getpid());
+#endif
+    std::snprintf(page.name, sizeof(page.name), "%s", name.c_str());
+    page.startedUnixMs = UnixNowMs();
+    page.intervalMs = static_cast<uint32_t>(intervalMs);
+    page.activeDevice = -1;
+    page.poolSlots = static_cast<uint32_t>(poolSlots);
+}
+
+StatsPublisher::~StatsPublisher()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    if (thread.joinable())
+        thread.join();
+}
+
+bool StatsPublisher::Start()
+{
+    if (!segment.Create())
+        return false;
+    // Only count what happens from now on.
+    recorder.Read(cursor, records);
+    records.clear();
+    ProcessPageFaults(minorFaults, majorFaults);
+    thread = std::thread(&StatsPublisher::Loop, this);
+    return true;
+}
+
+void StatsPublisher::Loop()
+{
+    SetCurrentThreadName("kndi-stats");
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point last = Clock::now();
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        Clock::time_point now = Clock::now();
+        double seconds = std::chrono::duration<double>(now - last).count();
+        last = now;
+        lock.unlock();
+        Update(seconds);
+        segment.Publish(page);
+        lock.lock();
+        if (wake.wait_until(lock, now + std::chrono::milliseconds(intervalMs), [this] { return stopping; }))
+            break;
+    }
+}
+
+void StatsPublisher::Update(double seconds)
+{
+    records.clear();
+    recorder.Read(cursor, records);
+    for (StreamTotals& stream : totals) {
+        stream.intervalFrames = 0;
+        stream.poolInUse = 0;
+        stream.latenciesMs.clear();
+    }
+    for (const FlightRecord& record : records) {
+        switch (record.event) {
+        case FlightEvent::Frame:
+            break;
+        case FlightEvent::Connect:
+            page.connects++;
+            continue;
+        case FlightEvent::Disconnect:
+            page.disconnects++;
+            continue;
+        case FlightEvent::Failover:
+            page.failovers++;
+            continue;
+        case FlightEvent::Watchdog:
+            page.watchdogs++;
+            continue;
+        case FlightEvent::Drop:
+            page.derivedDrops++;
+            continue;
+        case FlightEvent::Dump:
+            continue;
+        }
+        std::vector<StreamTotals>::iterator stream = std::find_if(
+            totals.begin(), totals.end(), [&record](const StreamTotals& candidate) {
+                return candidate.stream == record.stream && candidate.device == record.device;
+            });
+        if (stream == totals.end()) {
+            StreamTotals added = StreamTotals();
+            added.stream = record.stream;
+            added.device = record.device;
+            stream = totals.insert(totals.end(), added);
+        }
+        stream->active = record.active;
+        stream->frames++;
+        stream->intervalFrames++;
+        stream->dropped = record.dropped;
+        stream->poolInUse = std::max<uint32_t>(stream->poolInUse, record.poolInUse);
+        if (record.active && record.doneNs) {
+            stream->latenciesMs.push_back((record.doneNs - record.captureNs) / 1e6);
+            if (record.device >= 0)
+                page.activeDevice = record.device;
+        }
+    }
+
+    page.running = running.load() ? 1 : 0;
+    page.memoryLock = static_cast<uint32_t>(CurrentMemoryLock());
+    uint64_t minor = 0;
+    uint64_t major = 0;
+    ProcessPageFaults(minor, major);
+    page.minorFaultsPerSecond = seconds > 0.0 ? (minor - minorFaults) / seconds : 0.0;
+    page.majorFaultsPerSecond = seconds > 0.0 ? (major - majorFaults) / seconds : 0.0;
+    minorFaults = minor;
+    majorFaults = major;
+    page.streamCount = static_cast<uint32_t>(std::min<size_t>(totals.size(), StatsPage::kMaxStreams));
+    for (uint32_t i = 0; i < page.streamCount; i++) {
+        StreamTotals& totalsOf = totals[i];
+        std::sort(totalsOf.latenciesMs.begin(), totalsOf.latenciesMs.end());
+        StatsStream& out = page.streams[i];
+        out.stream = totalsOf.stream;
+        out.device = totalsOf.device;
+        out.active = totalsOf.active ? 1 : 0;
+        out.poolInUse = totalsOf.poolInUse;
+        out.frames = totalsOf.frames;
+        out.dropped = totalsOf.dropped;
+        out.fps = seconds > 0.0 ? totalsOf.intervalFrames / seconds : 0.0;
+        out.latencyP50Ms = Percentile(totalsOf.latenciesMs, 0.50);
+        out.latencyP95Ms = Percentile(totalsOf.latenciesMs, 0.95);
+        out.latencyP99Ms = Percentile(totalsOf.latenciesMs, 0.99);
+        out.latencyMaxMs = totalsOf.latenciesMs.empty() ? 0.0 : totalsOf.latenciesMs.back();
+    }
+    UpdateThreads(seconds);
+    page.updatedUnixMs = UnixNowMs();
+}
+
+void StatsPublisher::UpdateThreads(double seconds)
+{
+    page.threadCount = 0;
+#ifdef __linux__
+    DIR* dir = opendir("/proc/self/task");
+    if (!dir)
+        return;
+    static const double ticksPerSecond = static_cast<double>(sysconf(_SC_CLK_TCK));
+    std::vector<ThreadSample> sampled;
+    std::vector<StatsThread> threads;
+    while (dirent* entry = readdir(dir)) {
+        int tid = std::atoi(entry->d_name);
+        if (tid <= 0)
+            continue;
+        char path[64];
+        std::snprintf(path, sizeof(path), "/proc/self/task/%d/stat", tid);
+        FILE* file = std::fopen(path, "r");
+        if (!file)
+            continue;
+        char line[512];
+        size_t length = std::fread(line, 1, sizeof(line) - 1, file);
+        std::fclose(file);
+        line[length] = '\0';
+        // "tid (name) state ppid ..."; the name may contain spaces and
+        // parentheses, so split at the last ')'.
+        char* nameBegin = std::strchr(line, '(');
+        char* nameEnd = std::strrchr(line, ')');
+        if (!nameBegin || !nameEnd || nameEnd < nameBegin)
+            continue;
+        // state ppid pgrp session tty tpgid flags minflt cminflt majflt
+        // cmajflt utime stime
+        unsigned long long minor = 0;
+        unsigned long long major = 0;
+        unsigned long long user = 0;
+        unsigned long long system = 0;
+        if (std::sscanf(nameEnd + 2, "%*c %*d %*d %*d %*d %*d %*u %llu %*u %llu %*u %llu %llu", &minor, &major,
+                        &user, &system) != 4)
+            continue;
+        ThreadSample now = { tid, user + system, minor, major };
+        sampled.push_back(now);
+
+        StatsThread sample = StatsThread();
+        sample.tid = tid;
+        std::snprintf(sample.name, sizeof(sample.name), "%.*s", static_cast<int>(nameEnd - nameBegin - 1),
+                      nameBegin + 1);
+        for (const ThreadSample& previous : threadSamples) {
+            if (previous.tid != tid || seconds <= 0.0)
+                continue;
+            sample.cpuPercent = static_cast<float>(100.0 * (now.ticks - previous.ticks) / ticksPerSecond / seconds);
+            sample.minorFaultsPerSecond = static_cast<float>((now.minorFaults - previous.minorFaults) / seconds);
+            sample.majorFaultsPerSecond = static_cast<float>((now.majorFaults - previous.majorFaults) / seconds);
+        }
+        threads.push_back(sample);
+    }
+    closedir(dir);
+    threadSamples.swap(sampled);
+
+    std::sort(threads.begin(), threads.end(),
+              [](const StatsThread& a, const StatsThread& b) { return a.cpuPercent > b.cpuPercent; });
+    page.threadCount = static_cast<uint32_t>(std::min<size_t>(threads.size(), StatsPage::kMaxThreads));
+    std::copy(threads.begin(), threads.begin() + page.threadCount, page.threads);
+#else
+    (void)seconds;
+#endif
+}
+
+} // namespace kndi
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "flight_recorder.h"
+#include "stats_segment.h"
+
+namespace kndi {
+
+// Publishes a running pipeline's counters for kinect-ndi-top. A background
+// thread wakes every interval, reads the records the capture threads added
+// to the flight recorder since its last visit (frame rates, latency
+// percentiles, drops, pool depth, connection events), samples per-thread
+// CPU time and page faults from /proc, and writes the summary to a shared-memory
+// StatsPage. The capture path does no extra work.
+class StatsPublisher {
+public:
+    // `name` identifies the sender in the monitor; `running` is the
+    // pipeline's capture state; `poolSlots` the buffers per frame pool.
+    StatsPublisher(const FlightRecorder& recorder, const std::atomic<bool>& running, const std::string& name,
+                   size_t poolSlots, int intervalMs);
+    ~StatsPublisher();
+
+    StatsPublisher(const StatsPublisher&) = delete;
+    StatsPublisher& operator=(const StatsPublisher&) = delete;
+
+    // Create the segment and start publishing; false if shared memory is
+    // unavailable.
+    bool Start();
+
+private:
+    struct StreamTotals {
+        uint32_t stream;
+        int32_t device;
+        bool active;
+        uint64_t frames;
+        uint64_t dropped;
+        uint32_t poolInUse;
+        uint64_t intervalFrames;
+        std::vector<double> latenciesMs;   // This interval.
+    };
+
+    void Loop();
+    void Update(double seconds);
+    void UpdateThreads(double seconds);
+
+    const FlightRecorder& recorder;
+    const std::atomic<bool>& running;
+    int intervalMs;
+    StatsSegment segment;
+    StatsPage page;
+    uint64_t cursor;
+    std::vector<FlightRecord> records;   // Scratch for Read().
+    std::vector<StreamTotals> totals;
+    struct ThreadSample {
+        int tid;
+        uint64_t ticks;          // CPU clock ticks.
+        uint64_t minorFaults;
+        uint64_t majorFaults;
+    };
+    std::vector<ThreadSample> threadSamples;   // At the last update.
+    uint64_t minorFaults;        // Process totals at the last update.
+    uint64_t majorFaults;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+    std::thread thread;
+};
+
+} // namespace kndi
@@ -0,0 +1,164 @@
+#include "stats_segment.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#ifdef __linux__
+  #include <dirent.h>
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <unistd.h>
+#endif
+
+namespace kndi {
+
+const char* const kStatsSegmentPrefix = "kinect-ndi-stats-";
+
+struct StatsSegment::Shared {
+    std::atomic<uint32_t> sequence;
+    uint32_t reserved;
+    StatsPage page;
+};
+
+StatsSegment::StatsSegment() : shared(nullptr) {}
+
+StatsReader::StatsReader() : shared(nullptr) {}
+
+#ifdef __linux__
+
+// Segments created by this process so far; several pipelines get one each.
+static std::atomic<int> segmentCount(0);
+
+StatsSegment::~StatsSegment()
+{
+    if (!shared)
+        return;
+    munmap(shared, sizeof(Shared));
+    shm_unlink(name.c_str());
+}
+
+bool StatsSegment::Create()
+{
+    name = "/" + std::string(kStatsSegmentPrefix) + std::to_string(getpid()) + "-" +
+           std::to_string(segmentCount++);
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "Stats: cannot create shared memory " << name << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    void* mapped = MAP_FAILED;
+    if (ftruncate(fd, sizeof(Shared)) == 0)
+        mapped = mmap(nullptr, sizeof(Shared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Stats: cannot map shared memory " << name << ": " << std::strerror(errno) << std::endl;
+        shm_unlink(name.c_str());
+        return false;
+    }
+    // Zero-filled by ftruncate, so the sequence starts even.
+    shared = static_cast<Shared*>(mapped);
+    return true;
+}
+
+void StatsSegment::Publish(const StatsPage& page)
+{
+    if (!shared)
+        return;
+    uint32_t sequence = shared->sequence.load(std::memory_order_relaxed);
+    shared->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(&shared->page, &page, sizeof(page));
+    shared->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+StatsReader::~StatsReader()
+{
+    if (shared)
+        munmap(const_cast<StatsSegment::Shared*>(shared), sizeof(StatsSegment::Shared));
+}
+
+bool StatsReader::Open(const std::string& name)
+{
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+    void* mapped = mmap(nullptr, sizeof(StatsSegment::Shared), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        return false;
+    if (shared)
+        munmap(const_cast<StatsSegment::Shared*>(shared), sizeof(StatsSegment::Shared));
+    shared = static_cast<const StatsSegment::Shared*>(mapped);
+    return true;
+}
+
+bool StatsReader::Read(StatsPage& page) const
+{
+    if (!shared)
+        return false;
+    // The writer holds the page for a memcpy once per interval, so a few
+    // retries always suffice unless it died mid-update.
+    for (int attempt = 0; attempt < 1000; attempt++) {
+        uint32_t before = shared->sequence.load(std::memory_order_acquire);
+        if (before & 1) {
+            usleep(100);
+            continue;
+        }
+        std::memcpy(&page, &shared->page, sizeof(page));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (shared->sequence.load(std::memory_order_relaxed) == before)
+            return std::memcmp(page.magic, "KNDISTAT", 8) == 0 && page.version == StatsPage::kVersion &&
+                   page.size == sizeof(StatsPage);
+    }
+    return false;
+}
+
+std::vector<std::string> StatsReader::List()
+{
+    std::vector<std::string> names;
+    if (DIR* dir = opendir("/dev/shm")) {
+        size_t prefixLength = std::strlen(kStatsSegmentPrefix);
+        while (dirent* entry = readdir(dir)) {
+            if (std::strncmp(entry->d_name, kStatsSegmentPrefix, prefixLength) == 0)
+                names.push_back(std::string("/") + entry->d_name);
+        }
+        closedir(dir);
+    }
+    return names;
+}
+
+#else // !__linux__
+
+StatsSegment::~StatsSegment() {}
+
+bool StatsSegment::Create()
+{
+    std::cerr << "Stats: shared memory segments are only available on Linux." << std::endl;
+    return false;
+}
+
+void StatsSegment::Publish(const StatsPage&) {}
+
+StatsReader::~StatsReader() {}
+
+bool StatsReader::Open(const std::string&)
+{
+    return false;
+}
+
+bool StatsReader::Read(StatsPage&) const
+{
+    return false;
+}
+
+std::vector<std::string> StatsReader::List()
+{
+    return std::vector<std::string>();
+}
+
+#endif // __linux__
+
+} // namespace kndi
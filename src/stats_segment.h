@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace kndi {
+
+// Counters of one stream of one Kinect over the last publish interval.
+struct StatsStream {
+    uint32_t stream;          // kndi_stream.
+    int32_t device;           // Kinect index, -1 for merged streams.
+    uint32_t active;          // Frames reach the sinks (not a standby).
+    uint32_t poolInUse;       // Most pool buffers in use at once (queue depth).
+    uint64_t frames;          // Since the pipeline started.
+    uint64_t dropped;         // Frames the device dropped since connecting.
+    double fps;
+    double latencyP50Ms;      // Capture callback to sinks done.
+    double latencyP95Ms;
+    double latencyP99Ms;
+    double latencyMaxMs;
+};
+
+// CPU use of one thread of the sender process over the last interval.
+struct StatsThread {
+    char name[16];
+    int32_t tid;
+    float cpuPercent;
+    float minorFaultsPerSecond;
+    float majorFaultsPerSecond;   // Faults that had to read from disk.
+};
+
+// Counters a sender publishes in its shared-memory segment. The segment
+// holds a sequence number followed by the page: the writer bumps it to odd,
+// updates the page and bumps it to even again; readers copy the page and
+// retry if it was odd or changed meanwhile, so they never block or slow
+// down the writer. Native byte order.
+struct StatsPage {
+    static constexpr uint32_t kVersion = 2;
+    static constexpr int kMaxStreams = 16;
+    static constexpr int kMaxThreads = 48;
+
+    char magic[8];            // "KNDISTAT"
+    uint32_t version;
+    uint32_t size;            // sizeof(StatsPage)
+    int32_t pid;
+    char name[64];            // Set by the sender, e.g. "Kinect 0, standby 1".
+    int64_t startedUnixMs;
+    int64_t updatedUnixMs;
+    uint32_t intervalMs;
+    uint32_t running;         // Capture threads are up.
+    int32_t activeDevice;     // Kinect whose frames reach the sinks.
+    uint32_t poolSlots;       // Buffers per frame pool.
+    uint64_t connects;
+    uint64_t disconnects;
+    uint64_t failovers;
+    uint64_t watchdogs;
+    uint64_t derivedDrops;    // Fused frames skipped for lack of a buffer.
+    double minorFaultsPerSecond;   // Whole process.
+    double majorFaultsPerSecond;
+    uint32_t memoryLock;      // MemoryLock: 0 none, 1 frame pools, 2 everything.
+    uint32_t reserved;
+    uint32_t streamCount;
+    uint32_t threadCount;
+    StatsStream streams[kMaxStreams];
+    StatsThread threads[kMaxThreads];
+};
+
+// Shared memory name prefix; segments are "/kinect-ndi-stats-<pid>-<n>"
+// (listed in /dev/shm on Linux).
+extern const char* const kStatsSegmentPrefix;
+
+// Writer side: creates the segment and removes it again on destruction.
+class StatsSegment {
+public:
+    StatsSegment();
+    ~StatsSegment();
+
+    StatsSegment(const StatsSegment&) = delete;
+    StatsSegment& operator=(const StatsSegment&) = delete;
+
+    // Create a segment for this process; false (with the reason on
+    // stderr) if shared memory is unavailable.
+    bool Create();
+    const std::string& Name() const { return name; }
+
+    // Copy `page` into the segment.
+    void Publish(const StatsPage& page);
+
+private:
+    friend class StatsReader;
+    struct Shared;
+
+    std::string name;
+    Shared* shared;
+};
+
+// Reader side: maps a segment read-only.
+class StatsReader {
+public:
+    StatsReader();
+    ~StatsReader();
+
+    StatsReader(const StatsReader&) = delete;
+    StatsReader& operator=(const StatsReader&) = delete;
+
+    bool Open(const std::string& name);
+    // Consistent copy of the page; false if the segment is not a stats
+    // page or the writer kept it busy for every attempt.
+    bool Read(StatsPage& page) const;
+
+    // Names of the stats segments on this host (Linux; empty elsewhere).
+    static std::vector<std::string> List();
+
+private:
+    const StatsSegment::Shared* shared;
+};
+
+} // namespace kndi
@@ -0,0 +1,165 @@
+#include "thread_pool.h"
+
+#include <cstdio>
+
+#ifndef _WIN32
+  #include <pthread.h>
+#endif
+#ifdef __linux__
+  #include <sched.h>
+#endif
+
+namespace kndi {
+
+void SetCurrentThreadName(const char* name)
+{
+#if defined(__APPLE__)
+    pthread_setname_np(name);
+#elif defined(__linux__)
+    char shortName[16];
+    std::snprintf(shortName, sizeof(shortName), "%s", name);
+    pthread_setname_np(pthread_self(), shortName);
+#else
+    (void)name;
+#endif
+}
+
+std::vector<int> AllowedCpus()
+{
+    std::vector<int> cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &set))
+                cpus.push_back(cpu);
+        }
+        return cpus;
+    }
+#endif
+    int count = static_cast<int>(std::thread::hardware_concurrency());
+    for (int cpu = 0; cpu < count; cpu++)
+        cpus.push_back(cpu);
+    return cpus;
+}
+
+#ifdef __linux__
+static bool PinThread(pthread_t thread, const std::vector<int>& cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    }
+    return CPU_COUNT(&set) > 0 && pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
+#endif
+
+bool PinCurrentThread(const std::vector<int>& cpus)
+{
+#ifdef __linux__
+    return PinThread(pthread_self(), cpus);
+#else
+    (void)cpus;
+    return false;
+#endif
+}
+
+ThreadPool::ThreadPool(int threads)
+    : job(nullptr), jobCount(0), nextItem(0), finishedWorkers(0), generation(0), shuttingDown(false)
+{
+    if (threads <= 0)
+        threads = static_cast<int>(std::thread::hardware_concurrency());
+    if (threads <= 0)
+        threads = 1;
+    for (int i = 1; i < threads; i++)
+        workers.push_back(std::thread(&ThreadPool::WorkerLoop, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        shuttingDown = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers)
+        worker.join();
+}
+
+bool ThreadPool::PinWorkers(const std::vector<int>& cpus)
+{
+#ifdef __linux__
+    bool pinned = true;
+    for (std::thread& worker : workers)
+        pinned = PinThread(worker.native_handle(), cpus) && pinned;
+    return pinned;
+#else
+    (void)cpus;
+    return false;
+#endif
+}
+
+void ThreadPool::RunItems()
+{
+    for (;;) {
+        int item = nextItem.fetch_add(1);
+        if (item >= jobCount)
+            break;
+        (*job)(item);
+    }
+}
+
+void ThreadPool::WorkerLoop()
+{
+    SetCurrentThreadName("kndi-worker");
+    unsigned seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return shuttingDown || generation != seen; });
+            if (shuttingDown)
+                return;
+            seen = generation;
+        }
+        RunItems();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finishedWorkers++;
+        }
+        done.notify_one();
+    }
+}
+
+void ThreadPool::ParallelFor(int count, const std::function<void(int)>& fn)
+{
+    if (count <= 0)
+        return;
+    if (workers.empty() || count == 1) {
+        for (int i = 0; i < count; i++)
+            fn(i);
+        return;
+    }
+
+    std::lock_guard<std::mutex> call(callMutex);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &fn;
+        jobCount = count;
+        nextItem = 0;
+        finishedWorkers = 0;
+        generation++;
+    }
+    wake.notify_all();
+    RunItems();
+
+    // Every worker checks in once per call, so none can still be looking at
+    // this job when the next one is posted.
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return finishedWorkers == static_cast<int>(workers.size()); });
+    job = nullptr;
+}
+
+} // namespace kndi
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace kndi {
+
+// Name the calling thread (at most 15 characters are kept) so profilers and
+// kinect-ndi-top can tell the pipeline's threads apart. No-op where
+// unsupported.
+void SetCurrentThreadName(const char* name);
+
+// CPUs the process may run on (every CPU where affinity is unsupported).
+std::vector<int> AllowedCpus();
+
+// Restrict the calling thread to `cpus`; false if not permitted or
+// unsupported (Linux only).
+bool PinCurrentThread(const std::vector<int>& cpus);
+
+// Small fixed-size worker pool for data-parallel stages (per device, per
+// row band, per tile). The calling thread takes part in the work, so a pool
+// of size 1 has no workers and runs everything inline.
+class ThreadPool {
+public:
+    // `threads` <= 0 uses the number of hardware threads.
+    explicit ThreadPool(int threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int Size() const { return static_cast<int>(workers.size()) + 1; }
+
+    // Restrict the worker threads (not callers) to `cpus`, like
+    // PinCurrentThread(); false if any could not be pinned.
+    bool PinWorkers(const std::vector<int>& cpus);
+
+    // Run fn(i) for every i in [0, count) and return when all are done.
+    // Calls from several threads are serialized; `fn` must not call back
+    // into the same pool.
+    void ParallelFor(int count, const std::function<void(int)>& fn);
+
+private:
+    void WorkerLoop();
+    void RunItems();
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(int)>* job;
+    int jobCount;
+    std::atomic<int> nextItem;
+    int finishedWorkers;
+    unsigned generation;
+    bool shuttingDown;
+    std::mutex callMutex;
+};
+
+} // namespace kndi
@@ -0,0 +1,432 @@
+#include "touch_surface.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+  #define KNDI_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  #include <arm_neon.h>
+  #define KNDI_NEON 1
+#endif
+
+#include "depth_units.h"
+#include "osc.h"
+
+namespace kndi {
+
+// Contact mask values; the clusters are the mask pixels at or above the
+// threshold.
+static constexpr uint8_t kContact = 255;
+static constexpr int kContactThreshold = 128;
+// Band of a pixel that never has contacts.
+static constexpr uint16_t kNoBand = 0x7fff;
+// Farthest a cursor moves between frames and keeps its session, as a share
+// of the image width.
+static constexpr float kMaxJump = 0.1f;
+// Largest bundle Encode() writes: the source message, alive with
+// kMaxMarkers sessions (348 bytes), a set message per cursor (56) and fseq.
+static constexpr size_t kMaxPacket = 16 + 40 + 348 + 56 * MarkerDetector::kMaxMarkers + 32;
+// Latency histogram: 10 us buckets up to 50 ms.
+static constexpr int64_t kLatencyBucketNs = 10000;
+static constexpr size_t kLatencyBuckets = 5000;
+
+static int64_t HostNowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static MarkerSettings ClusterSettings(const TouchSettings& settings)
+{
+    MarkerSettings clusters;
+    clusters.threshold = kContactThreshold;
+    clusters.minPixels = settings.minPixels;
+    clusters.maxPixels = settings.maxPixels;
+    clusters.depth = false;
+    return clusters;
+}
+
+TouchDetector::TouchDetector(const TouchSettings& settings, int width, int height)
+    : settings(settings), width(width), height(height), frames(0), learned(false), usable(0),
+      sums(static_cast<size_t>(width) * height, 0), counts(sums.size(), 0), nearest(sums.size(), 0xffff),
+      low(sums.size(), kNoBand), high(sums.size(), 0), mask(sums.size(), 0),
+      clusters(ClusterSettings(settings), width, height)
+{
+}
+
+bool TouchDetector::Learn(const uint16_t* depth, int stride)
+{
+    if (learned)
+        return true;
+    const uint16_t* mm = RawDepthToMillimetres();
+    for (int y = 0; y < height; y++) {
+        const uint16_t* row = reinterpret_cast<const uint16_t*>(reinterpret_cast<const uint8_t*>(depth) +
+                                                                static_cast<size_t>(y) * stride);
+        size_t i = static_cast<size_t>(y) * width;
+        for (int x = 0; x < width; x++, i++) {
+            uint16_t raw = row[x];
+            if (raw >= kRawDepthInvalid || !mm[raw])
+                continue;
+            sums[i] += mm[raw];
+            counts[i]++;
+            nearest[i] = std::min(nearest[i], mm[raw]);
+        }
+    }
+    if (++frames >= settings.learnFrames)
+        Finish();
+    return learned;
+}
+
+// Raw readings [first, last] with a distance, over which it rises.
+static void ValidRawRange(const uint16_t* mm, int& first, int& last)
+{
+    first = 0;
+    while (first < kRawDepthInvalid && !mm[first])
+        first++;
+    last = first;
+    while (last + 1 < kRawDepthInvalid && mm[last + 1])
+        last++;
+}
+
+void TouchDetector::Finish()
+{
+    // The disparity → millimetre table rises over its valid range, so the
+    // band's ends are found by binary search in it.
+    const uint16_t* mm = RawDepthToMillimetres();
+    int first, last;
+    ValidRawRange(mm, first, last);
+    int minCount = std::max(1, frames / 2);
+    usable = 0;
+    for (size_t i = 0; i < sums.size(); i++) {
+        low[i] = kNoBand;
+        high[i] = 0;
+        if (counts[i] < minCount)
+            continue;
+        float surface = static_cast<float>(sums[i]) / counts[i];
+        float noise = surface - nearest[i] + 1.0f;
+        float top = surface - settings.maxMm;
+        float bottom = surface - std::max(settings.minMm, noise);
+        if (bottom <= top || top < mm[first])
+            continue;
+        // First reading at or beyond `top`, last at or before `bottom`.
+        int lowRaw = static_cast<int>(
+            std::lower_bound(mm + first, mm + last + 1, static_cast<uint16_t>(std::ceil(top))) - mm);
+        int highRaw = static_cast<int>(
+            std::upper_bound(mm + first, mm + last + 1, static_cast<uint16_t>(bottom)) - mm) - 1;
+        if (highRaw < lowRaw)
+            continue;
+        low[i] = static_cast<uint16_t>(lowRaw);
+        high[i] = static_cast<uint16_t>(highRaw);
+        usable++;
+    }
+    learned = true;
+}
+
+// mask[x] = kContact where low[x] <= depth[x] <= high[x], else 0.
+static void BandPass(const uint16_t* depth, const uint16_t* low, const uint16_t* high, uint8_t* mask, int width)
+{
+    int x = 0;
+#if defined(KNDI_SSE2)
+    // Bands are at most 0x7fff, so signed compares do; readings of 0x8000
+    // and up compare below every band.
+    const __m128i ones = _mm_set1_epi16(-1);
+    for (; x + 16 <= width; x += 16) {
+        __m128i d0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(depth + x));
+        __m128i d1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(depth + x + 8));
+        __m128i outside0 = _mm_or_si128(
+            _mm_cmplt_epi16(d0, _mm_loadu_si128(reinterpret_cast<const __m128i*>(low + x))),
+            _mm_cmpgt_epi16(d0, _mm_loadu_si128(reinterpret_cast<const __m128i*>(high + x))));
+        __m128i outside1 = _mm_or_si128(
+            _mm_cmplt_epi16(d1, _mm_loadu_si128(reinterpret_cast<const __m128i*>(low + x + 8))),
+            _mm_cmpgt_epi16(d1, _mm_loadu_si128(reinterpret_cast<const __m128i*>(high + x + 8))));
+        // 0xffff packs to 0xff.
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(mask + x),
+                         _mm_packs_epi16(_mm_andnot_si128(outside0, ones), _mm_andnot_si128(outside1, ones)));
+    }
+#elif defined(KNDI_NEON)
+    for (; x + 8 <= width; x += 8) {
+        uint16x8_t d = vld1q_u16(depth + x);
+        uint16x8_t inside = vandq_u16(vcgeq_u16(d, vld1q_u16(low + x)), vcleq_u16(d, vld1q_u16(high + x)));
+        vst1_u8(mask + x, vmovn_u16(inside));
+    }
+#endif
+    for (; x < width; x++)
+        mask[x] = depth[x] >= low[x] && depth[x] <= high[x] ? kContact : 0;
+}
+
+int TouchDetector::Detect(const uint16_t* depth, int stride, Marker* out)
+{
+    if (!learned)
+        return 0;
+    for (int y = 0; y < height; y++) {
+        size_t i = static_cast<size_t>(y) * width;
+        BandPass(reinterpret_cast<const uint16_t*>(reinterpret_cast<const uint8_t*>(depth) +
+                                                   static_cast<size_t>(y) * stride),
+                 &low[i], &high[i], &mask[i], width);
+    }
+    bool overflow = false;
+    return clusters.Detect(mask.data(), width, out, overflow);
+}
+
+TouchSurface* TouchSurface::Create(const std::string& address, const TouchSettings& settings)
+{
+    int fd = OpenUdpSender(address, "Touch surface");
+    return fd < 0 ? nullptr : new TouchSurface(fd, settings);
+}
+
+TouchSurface::TouchSurface(int fd, const TouchSettings& settings)
+    : fd(fd), settings(settings), width(0), height(0), contacts(MarkerDetector::kMaxMarkers),
+      nextSession(0), lastNs(0), packet(kMaxPacket), latency(kLatencyBuckets, 0), maxLatencyNs(0),
+      framesSent(0), sendErrors(0)
+{
+    cursors.reserve(MarkerDetector::kMaxMarkers);
+    previous.reserve(MarkerDetector::kMaxMarkers);
+    matches.reserve(MarkerDetector::kMaxMarkers * MarkerDetector::kMaxMarkers);
+}
+
+// Value below which `share` of the histogram's samples lie, in ms.
+static double LatencyPercentileMs(const std::vector<uint64_t>& histogram, uint64_t total, double share)
+{
+    uint64_t rank = static_cast<uint64_t>(std::ceil(share * total));
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < histogram.size(); bucket++) {
+        seen += histogram[bucket];
+        if (seen >= rank)
+            return (bucket + 1) * kLatencyBucketNs / 1e6;
+    }
+    return histogram.size() * kLatencyBucketNs / 1e6;
+}
+
+TouchSurface::~TouchSurface()
+{
+    if (framesSent > 0) {
+        // Buckets give an upper bound, which the largest sample caps.
+        double maxMs = maxLatencyNs / 1e6;
+        char line[200];
+        std::snprintf(line, sizeof(line),
+                      "Touch surface: %llu TUIO frames; depth callback to send: median %.2f ms, "
+                      "99th percentile %.2f ms, max %.2f ms.",
+                      static_cast<unsigned long long>(framesSent),
+                      std::min(maxMs, LatencyPercentileMs(latency, framesSent, 0.5)),
+                      std::min(maxMs, LatencyPercentileMs(latency, framesSent, 0.99)), maxMs);
+        std::cerr << line;
+        if (sendErrors > 0)
+            std::cerr << " " << sendErrors << " frames could not be sent.";
+        std::cerr << std::endl;
+    }
+    CloseUdpSender(fd);
+}
+
+void TouchSurface::Configure(const PlanContext& context, KernelTuner&, ThreadPool&)
+{
+    const StreamShape& shape = context.Shape(KNDI_STREAM_DEPTH);
+    if (shape.framesPerSecond <= 0.0) {
+        detector.reset();
+        return;
+    }
+    // The surface is kept across restarts of the same shape.
+    if (!detector || shape.width != width || shape.height != height)
+        detector.reset(new TouchDetector(settings, shape.width, shape.height));
+    width = shape.width;
+    height = shape.height;
+}
+
+void TouchSurface::Track(int count, int64_t timeNs)
+{
+    previous.swap(cursors);
+    cursors.clear();
+    // Closest pairs first.
+    matches.clear();
+    for (int c = 0; c < count; c++) {
+        float x = (contacts[c].u + 0.5f) / width;
+        float y = (contacts[c].v + 0.5f) / height;
+        for (int p = 0; p < static_cast<int>(previous.size()); p++) {
+            float dx = x - previous[p].x;
+            float dy = (y - previous[p].y) * height / width;
+            float distance = std::sqrt(dx * dx + dy * dy);
+            if (distance < kMaxJump) {
+                Match match = { distance, c, p };
+                matches.push_back(match);
+            }
+        }
+    }
+    std::sort(matches.begin(), matches.end(),
+              [](const Match& a, const Match& b) { return a.distance < b.distance; });
+    int matchedCursor[MarkerDetector::kMaxMarkers];
+    bool taken[MarkerDetector::kMaxMarkers] = {};
+    std::fill(matchedCursor, matchedCursor + count, -1);
+    for (const Match& match : matches) {
+        if (matchedCursor[match.contact] < 0 && !taken[match.cursor]) {
+            matchedCursor[match.contact] = match.cursor;
+            taken[match.cursor] = true;
+        }
+    }
+
+    float seconds = lastNs ? (timeNs - lastNs) / 1e9f : 0.0f;
+    for (int c = 0; c < count; c++) {
+        Cursor cursor = Cursor();
+        cursor.x = (contacts[c].u + 0.5f) / width;
+        cursor.y = (contacts[c].v + 0.5f) / height;
+        if (matchedCursor[c] >= 0 && seconds > 0.0f) {
+            const Cursor& before = previous[matchedCursor[c]];
+            cursor.session = before.session;
+            cursor.velocityX = (cursor.x - before.x) / seconds;
+            cursor.velocityY = (cursor.y - before.y) / seconds;
+            cursor.speed = std::sqrt(cursor.velocityX * cursor.velocityX + cursor.velocityY * cursor.velocityY);
+            cursor.acceleration = (cursor.speed - before.speed) / seconds;
+        } else if (matchedCursor[c] >= 0) {
+            cursor.session = previous[matchedCursor[c]].session;
+        } else {
+            cursor.session = nextSession++;
+        }
+        cursors.push_back(cursor);
+    }
+    lastNs = timeNs;
+}
+
+size_t TouchSurface::Encode(const kndi_frame& frame)
+{
+    int64_t timeNs = frame.synced_timestamp_ns ? frame.synced_timestamp_ns : frame.host_timestamp_ns;
+    OscWriter osc(packet);
+    osc.BeginBundle(OscTimeTag(timeNs));
+    char source[32];
+    std::snprintf(source, sizeof(source), "kinect-ndi:%d", frame.device_index);
+    osc.BeginMessage("/tuio/2Dcur", ",ss");
+    osc.String("source");
+    osc.String(source);
+    osc.EndMessage();
+    char tags[4 + MarkerDetector::kMaxMarkers] = ",s";
+    std::fill(tags + 2, tags + 2 + cursors.size(), 'i');
+    tags[2 + cursors.size()] = '\0';
+    osc.BeginMessage("/tuio/2Dcur", tags);
+    osc.String("alive");
+    for (const Cursor& cursor : cursors)
+        osc.Int32(cursor.session);
+    osc.EndMessage();
+    for (const Cursor& cursor : cursors) {
+        osc.BeginMessage("/tuio/2Dcur", ",sifffff");
+        osc.String("set");
+        osc.Int32(cursor.session);
+        osc.Float(cursor.x);
+        osc.Float(cursor.y);
+        osc.Float(cursor.velocityX);
+        osc.Float(cursor.velocityY);
+        osc.Float(cursor.acceleration);
+        osc.EndMessage();
+    }
+    osc.BeginMessage("/tuio/2Dcur", ",si");
+    osc.String("fseq");
+    osc.Int32(static_cast<int32_t>(frame.sequence));
+    osc.EndMessage();
+    return osc.Ok() ? osc.Size() : 0;
+}
+
+size_t TouchSurface::Process(const kndi_frame& frame)
+{
+    const uint16_t* depth = static_cast<const uint16_t*>(frame.data);
+    int count = 0;
+    if (!detector->Learned()) {
+        // Nothing is touching while the surface is learned.
+        if (detector->Learn(depth, frame.stride)) {
+            char line[160];
+            std::snprintf(line, sizeof(line),
+                          "Touch surface learned from %d depth frames: %.0f%% of pixels usable, contacts %.0f-%.0f mm "
+                          "above it.",
+                          settings.learnFrames, 100.0 * detector->UsablePixels() / (static_cast<double>(width) * height),
+                          settings.minMm, settings.maxMm);
+            std::cout << line << std::endl;
+        }
+    } else {
+        count = detector->Detect(depth, frame.stride, contacts.data());
+    }
+    Track(count, frame.synced_timestamp_ns ? frame.synced_timestamp_ns : frame.host_timestamp_ns);
+    return Encode(frame);
+}
+
+void TouchSurface::Consume(const kndi_frame& frame)
+{
+    if (frame.stream != KNDI_STREAM_DEPTH || !detector || frame.width != width || frame.height != height)
+        return;
+    size_t size = Process(frame);
+    if (!size || !SendDatagram(fd, packet, size)) {
+        sendErrors++;
+        return;
+    }
+    int64_t elapsedNs = HostNowNs() - frame.host_timestamp_ns;
+    latency[std::min(kLatencyBuckets - 1, static_cast<size_t>(std::max<int64_t>(0, elapsedNs) / kLatencyBucketNs))]++;
+    maxLatencyNs = std::max(maxLatencyNs, elapsedNs);
+    framesSent++;
+}
+
+// Raw depth of a table seen from above, 1 m away at the bottom of the image
+// and 1.2 m at the top; Kinect depth steps are too coarse for touches
+// much farther away.
+static void SyntheticTableDepth(int width, int height, std::vector<uint16_t>& depth)
+{
+    const uint16_t* mm = RawDepthToMillimetres();
+    int first, last;
+    ValidRawRange(mm, first, last);
+    depth.resize(static_cast<size_t>(width) * height);
+    for (int y = 0; y < height; y++) {
+        uint16_t distance = static_cast<uint16_t>(1200 - 200 * y / height);
+        uint16_t raw = static_cast<uint16_t>(std::lower_bound(mm + first, mm + last + 1, distance) - mm);
+        std::fill(depth.begin() + static_cast<size_t>(y) * width, depth.begin() + static_cast<size_t>(y + 1) * width,
+                  raw);
+    }
+}
+
+void TouchSurface::Plan(const PlanContext& context, Planner& planner) const
+{
+    const StreamShape& shape = context.Shape(KNDI_STREAM_DEPTH);
+    if (shape.framesPerSecond <= 0.0)
+        return;
+    int frameWidth = shape.width;
+    int frameHeight = shape.height;
+    // A table learned as the surface, and three fingertips 12 mm above it.
+    std::shared_ptr<std::vector<uint16_t>> surface = std::make_shared<std::vector<uint16_t>>();
+    SyntheticTableDepth(frameWidth, frameHeight, *surface);
+    std::shared_ptr<std::vector<uint16_t>> touched = std::make_shared<std::vector<uint16_t>>(*surface);
+    const uint16_t* mm = RawDepthToMillimetres();
+    for (int t = 0; t < 3; t++) {
+        int cx = frameWidth * (t + 1) / 4;
+        int cy = frameHeight * 3 / 4;
+        for (int y = cy - 5; y <= cy + 5; y++) {
+            for (int x = cx - 5; x <= cx + 5; x++) {
+                uint16_t& raw = (*touched)[static_cast<size_t>(y) * frameWidth + x];
+                uint16_t target = static_cast<uint16_t>(std::max(0, mm[raw] - 12));
+                while (raw > 0 && mm[raw - 1] && mm[raw] > target)
+                    raw--;
+            }
+        }
+    }
+    TouchSettings benchSettings = settings;
+    benchSettings.learnFrames = 1;
+    std::shared_ptr<TouchSurface> bench(new TouchSurface(-1, benchSettings));
+    bench->width = frameWidth;
+    bench->height = frameHeight;
+    bench->detector.reset(new TouchDetector(benchSettings, frameWidth, frameHeight));
+    bench->detector->Learn(surface->data(), frameWidth * 2);
+
+    PlanStage stage;
+    stage.name = "touch surface (TUIO)";
+    stage.framesPerSecond = shape.framesPerSecond;
+    // Depth, the two band tables, and the mask written and read back.
+    stage.bytesPerFrame = static_cast<size_t>(frameWidth) * frameHeight * 8;
+    stage.run = [bench, touched, frameWidth, frameHeight] {
+        kndi_frame frame = kndi_frame();
+        frame.stream = KNDI_STREAM_DEPTH;
+        frame.width = frameWidth;
+        frame.height = frameHeight;
+        frame.stride = frameWidth * 2;
+        frame.data = touched->data();
+        bench->Process(frame);
+    };
+    planner.Add(stage);
+}
+
+} // namespace kndi
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "marker_tracker.h"
+#include "sink.h"
+
+namespace kndi {
+
+struct TouchSettings {
+    float minMm = 6.0f;        // Band above the surface counted as contact; nearer is noise...
+    float maxMm = 25.0f;       // ...and farther a hand hovering.
+    int learnFrames = 60;      // Depth frames the surface is learned from, with nothing on it.
+    int minPixels = 12;        // Smaller contacts are noise.
+    int maxPixels = 3000;      // Larger ones are a palm or an arm resting on the surface.
+};
+
+// Finds contacts on a surface in raw depth, for a Kinect looking at or
+// along a table or wall. The surface depth of every pixel is learned from
+// the first frames, and turned into the band of raw disparities that lie
+// between minMm and maxMm above it (or above the noise the pixel showed
+// while learning, if more). A contact pixel is then one whose reading is
+// inside its band: two compares, 16 pixels per SSE2 instruction (8 with
+// NEON), into a mask that MarkerDetector clusters into contacts.
+class TouchDetector {
+public:
+    TouchDetector(const TouchSettings& settings, int width, int height);
+
+    // Add a raw depth frame (`stride` in bytes) to the surface; true once
+    // learnFrames have been, and contacts can be detected.
+    bool Learn(const uint16_t* depth, int stride);
+    bool Learned() const { return learned; }
+    // Pixels with a stable enough surface to detect contacts on.
+    int UsablePixels() const { return usable; }
+
+    // Contacts in a raw depth frame into `out` (MarkerDetector::kMaxMarkers
+    // long), at their centroid in depth pixels; returns how many.
+    int Detect(const uint16_t* depth, int stride, Marker* out);
+
+private:
+    void Finish();
+
+    TouchSettings settings;
+    int width;
+    int height;
+    int frames;                    // Learned so far.
+    bool learned;
+    int usable;
+    std::vector<uint32_t> sums;    // Surface readings in mm while learning...
+    std::vector<uint16_t> counts;  // ...how many there were...
+    std::vector<uint16_t> nearest; // ...and the nearest.
+    // Contact band per pixel in raw disparity, at most 0x7fff so SSE2's
+    // signed compares apply; low > high never matches.
+    std::vector<uint16_t> low;
+    std::vector<uint16_t> high;
+    std::vector<uint8_t> mask;
+    MarkerDetector clusters;
+};
+
+// Sends the contacts on a learned surface as TUIO 1.1 cursors
+// (/tuio/2Dcur source, alive, set and fseq) in one OSC bundle per depth
+// frame, time-tagged with the frame's capture time. Positions are the
+// depth image's, normalised to 0-1. Contacts are matched to the previous
+// frame's nearest cursor to keep their session id and give their velocity
+// and acceleration. The time from the depth callback to each bundle's
+// send is measured and summarised when the sink is destroyed. Not
+// available on Windows (Create() fails).
+class TouchSurface : public Sink {
+public:
+    // Send to `address`: "host:port", or "port" for 127.0.0.1. Returns
+    // nullptr (with the reason on stderr) if it cannot be resolved.
+    static TouchSurface* Create(const std::string& address, const TouchSettings& settings);
+    ~TouchSurface() override;
+
+    TouchSurface(const TouchSurface&) = delete;
+    TouchSurface& operator=(const TouchSurface&) = delete;
+
+    unsigned Streams() const override { return KNDI_STREAM_DEPTH; }
+    void Consume(const kndi_frame& frame) override;
+    void Configure(const PlanContext& context, KernelTuner& tuner, ThreadPool& pool) override;
+    void Plan(const PlanContext& context, Planner& planner) const override;
+
+private:
+    struct Cursor {
+        int32_t session;
+        float x, y;              // 0-1 across the depth image.
+        float velocityX, velocityY;   // Per second.
+        float speed;
+        float acceleration;
+    };
+    struct Match {
+        float distance;
+        int contact;
+        int cursor;
+    };
+
+    TouchSurface(int fd, const TouchSettings& settings);
+
+    // Learn or detect on a depth frame, track the cursors and encode the
+    // bundle into `packet`; returns its size (0 if it did not fit).
+    size_t Process(const kndi_frame& frame);
+    void Track(int count, int64_t timeNs);
+    size_t Encode(const kndi_frame& frame);
+
+    int fd;
+    TouchSettings settings;
+    std::unique_ptr<TouchDetector> detector;   // Sized for the depth stream in Configure().
+    int width;
+    int height;
+    std::vector<Marker> contacts;
+    std::vector<Cursor> cursors;
+    std::vector<Cursor> previous;
+    std::vector<Match> matches;
+    int32_t nextSession;
+    int64_t lastNs;
+    std::vector<uint8_t> packet;
+    // Depth callback to send, in kLatencyBucketNs buckets (the last one
+    // takes everything longer). Capture thread only, like the counters.
+    std::vector<uint64_t> latency;
+    int64_t maxLatencyNs;
+    uint64_t framesSent;
+    uint64_t sendErrors;
+};
+
+} // namespace kndi
@@ -0,0 +1,331 @@
+#include "usb_placement.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+
+#ifdef __linux__
+  #include <dirent.h>
+  #include <limits.h>
+#endif
+
+#include "thread_pool.h"
+
+namespace kndi {
+
+// Microsoft's vendor ID and the Kinect camera's product IDs (Xbox 360 and
+// Kinect for Windows); libfreenect's device index counts these.
+static const char* const kMicrosoftVendor = "045e";
+static const char* const kCameraProducts[] = { "02ae", "02bf" };
+
+static std::string ReadLine(const std::string& path)
+{
+    std::ifstream file(path.c_str());
+    std::string line;
+    std::getline(file, line);
+    while (!line.empty() && (line.back() == '\n' || line.back() == ' '))
+        line.pop_back();
+    return line;
+}
+
+static std::vector<std::string> ListDirectory(const std::string& path)
+{
+    std::vector<std::string> names;
+#ifdef __linux__
+    DIR* dir = opendir(path.c_str());
+    if (!dir)
+        return names;
+    while (dirent* entry = readdir(dir)) {
+        if (entry->d_name[0] != '.')
+            names.push_back(entry->d_name);
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+#else
+    (void)path;
+#endif
+    return names;
+}
+
+std::vector<int> ParseCpuList(const std::string& text)
+{
+    std::vector<int> cpus;
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = text.find(',', start);
+        if (end == std::string::npos)
+            end = text.size();
+        int first = 0;
+        int last = 0;
+        std::string range = text.substr(start, end - start);
+        int fields = std::sscanf(range.c_str(), "%d-%d", &first, &last);
+        if (fields == 1)
+            last = first;
+        if (fields >= 1) {
+            for (int cpu = first; cpu <= last && cpu >= 0; cpu++)
+                cpus.push_back(cpu);
+        }
+        start = end + 1;
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return cpus;
+}
+
+std::string FormatCpuList(const std::vector<int>& cpus)
+{
+    std::string text;
+    for (size_t i = 0; i < cpus.size();) {
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1)
+            j++;
+        if (!text.empty())
+            text += ',';
+        text += std::to_string(cpus[i]);
+        if (j > i)
+            text += '-' + std::to_string(cpus[j]);
+        i = j + 1;
+    }
+    return text;
+}
+
+// Fill in the controller of the USB device at `devicePath` (under
+// /sys/bus/usb/devices): the PCI device above its root hub "usbN".
+static bool ReadController(const std::string& root, const std::string& devicePath, UsbLocation& location)
+{
+#ifdef __linux__
+    char resolved[PATH_MAX];
+    if (!realpath(devicePath.c_str(), resolved))
+        return false;
+    std::string path = resolved;
+    size_t hub = path.find("/usb");
+    while (hub != std::string::npos &&
+           !(hub + 4 < path.size() && std::isdigit(static_cast<unsigned char>(path[hub + 4]))))
+        hub = path.find("/usb", hub + 1);
+    if (hub == std::string::npos)
+        return false;
+    std::string controllerPath = path.substr(0, hub);
+    location.controller = controllerPath.substr(controllerPath.rfind('/') + 1);
+
+    std::string node = ReadLine(controllerPath + "/numa_node");
+    location.numaNode = node.empty() ? -1 : std::atoi(node.c_str());
+    location.localCpus = ParseCpuList(ReadLine(controllerPath + "/local_cpulist"));
+    location.irqs.clear();
+    for (const std::string& name : ListDirectory(controllerPath + "/msi_irqs"))
+        location.irqs.push_back(std::atoi(name.c_str()));
+    if (location.irqs.empty()) {
+        int irq = std::atoi(ReadLine(controllerPath + "/irq").c_str());
+        if (irq > 0)
+            location.irqs.push_back(irq);
+    }
+    std::sort(location.irqs.begin(), location.irqs.end());
+    location.irqCpus.clear();
+    for (int irq : location.irqs) {
+        // The effective affinity is where the interrupt actually goes; older
+        // kernels only have the requested mask.
+        std::string base = root + "/proc/irq/" + std::to_string(irq);
+        std::string cpus = ReadLine(base + "/effective_affinity_list");
+        if (cpus.empty())
+            cpus = ReadLine(base + "/smp_affinity_list");
+        for (int cpu : ParseCpuList(cpus))
+            location.irqCpus.push_back(cpu);
+    }
+    std::sort(location.irqCpus.begin(), location.irqCpus.end());
+    location.irqCpus.erase(std::unique(location.irqCpus.begin(), location.irqCpus.end()), location.irqCpus.end());
+    return true;
+#else
+    (void)root;
+    (void)devicePath;
+    (void)location;
+    return false;
+#endif
+}
+
+bool LocateKinect(const std::string& serial, int index, UsbLocation& location, const std::string& root)
+{
+    std::string devices = root + "/sys/bus/usb/devices";
+    std::string match;
+    std::vector<std::pair<std::pair<int, std::string>, std::string>> cameras;
+    for (const std::string& name : ListDirectory(devices)) {
+        // Interfaces ("3-2:1.0") and root hubs ("usb3") are not devices.
+        if (name.find(':') != std::string::npos || name.compare(0, 3, "usb") == 0)
+            continue;
+        std::string path = devices + "/" + name;
+        if (ReadLine(path + "/idVendor") != kMicrosoftVendor)
+            continue;
+        // A Kinect for Windows reports its serial on the audio device, so
+        // any of the Kinect's devices may match; they share a controller.
+        if (!serial.empty() && match.empty() && ReadLine(path + "/serial") == serial)
+            match = name;
+        std::string product = ReadLine(path + "/idProduct");
+        if (product == kCameraProducts[0] || product == kCameraProducts[1])
+            cameras.push_back(std::make_pair(std::make_pair(std::atoi(ReadLine(path + "/busnum").c_str()),
+                                                            ReadLine(path + "/devpath")), name));
+    }
+    if (match.empty()) {
+        std::sort(cameras.begin(), cameras.end());
+        if (index < 0 || index >= static_cast<int>(cameras.size()))
+            return false;
+        match = cameras[index].second;
+    }
+    location = UsbLocation();
+    location.port = match;
+    location.bus = std::atoi(ReadLine(devices + "/" + match + "/busnum").c_str());
+    return ReadController(root, devices + "/" + match, location);
+}
+
+std::string DescribeUsbLocation(const UsbLocation& location)
+{
+    std::string text = "USB bus " + std::to_string(location.bus) + " port " + location.port + ", controller " +
+                       location.controller;
+    if (location.numaNode >= 0)
+        text += " (NUMA node " + std::to_string(location.numaNode) + ")";
+    if (!location.localCpus.empty())
+        text += ", local CPUs " + FormatCpuList(location.localCpus);
+    if (!location.irqs.empty()) {
+        text += location.irqs.size() == 1 ? ", IRQ " : ", IRQs ";
+        text += FormatCpuList(location.irqs);
+        text += location.irqCpus.empty() ? std::string(" (affinity unknown)")
+                                          : " on CPU " + FormatCpuList(location.irqCpus);
+    }
+    return text;
+}
+
+UsbPlacement::UsbPlacement(const std::string& root)
+    : root(root), allowed(AllowedCpus())
+{
+}
+
+std::vector<int> UsbPlacement::Siblings(int cpu) const
+{
+    std::vector<int> siblings = ParseCpuList(
+        ReadLine(root + "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/thread_siblings_list"));
+    if (siblings.empty())
+        siblings.push_back(cpu);
+    return siblings;
+}
+
+int UsbPlacement::Place(int deviceIndex, const UsbLocation& location)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                 [&](const Entry& entry) { return entry.deviceIndex == deviceIndex; }),
+                  entries.end());
+    std::vector<int> candidates;
+    for (int cpu : allowed) {
+        if (location.localCpus.empty() ||
+            std::find(location.localCpus.begin(), location.localCpus.end(), cpu) != location.localCpus.end())
+            candidates.push_back(cpu);
+    }
+    if (candidates.empty())
+        candidates = allowed;
+
+    // Lower is better; see the class comment for the order.
+    std::map<int, int> penalty;
+    for (const Entry& entry : entries) {
+        for (int sibling : Siblings(entry.cpu))
+            penalty[sibling] += sibling == entry.cpu ? 16 : 8;
+        if (entry.location.controller != location.controller) {
+            for (int cpu : entry.location.irqCpus)
+                penalty[cpu] += 4;
+        }
+    }
+    for (int cpu : location.irqCpus)
+        penalty[cpu] += 1;
+    int best = -1;
+    for (int cpu : candidates) {
+        if (best < 0 || penalty[cpu] <= penalty[best])
+            best = cpu;
+    }
+    if (best >= 0) {
+        Entry entry = { deviceIndex, best, location };
+        entries.push_back(entry);
+    }
+    return best;
+}
+
+std::vector<int> UsbPlacement::WorkerCpus() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<int> cpus;
+    for (const Entry& entry : entries) {
+        const std::vector<int>& local = entry.location.localCpus.empty() ? allowed : entry.location.localCpus;
+        for (int cpu : local) {
+            if (std::find(allowed.begin(), allowed.end(), cpu) != allowed.end())
+                cpus.push_back(cpu);
+        }
+    }
+    for (const Entry& entry : entries)
+        cpus.erase(std::remove(cpus.begin(), cpus.end(), entry.cpu), cpus.end());
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return cpus;
+}
+
+std::vector<std::string> UsbPlacement::SharedInterrupts(const UsbLocation& location) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::string> shared;
+    for (const Entry& entry : entries) {
+        if (entry.location.controller == location.controller)
+            continue;
+        for (int cpu : entry.location.irqCpus) {
+            if (std::find(location.irqCpus.begin(), location.irqCpus.end(), cpu) != location.irqCpus.end()) {
+                std::string text = entry.location.controller + " (CPU " + std::to_string(cpu) + ")";
+                if (std::find(shared.begin(), shared.end(), text) == shared.end())
+                    shared.push_back(text);
+            }
+        }
+    }
+    return shared;
+}
+
+// ---------------------------------------------------------------------------
+// Packet loss
+// ---------------------------------------------------------------------------
+
+// libfreenect's log callback has no user pointer, so counters are found by
+// context. Only touched on connect, disconnect and log messages.
+static std::mutex lossMutex;
+static std::vector<std::pair<freenect_context*, std::atomic<uint64_t>*>> lossCounters;
+
+static void LogCallback(freenect_context* ctx, freenect_loglevel level, const char* message)
+{
+    unsigned stream = 0;
+    int lost = 0;
+    if (std::sscanf(message, "[Stream %x] Lost %d packets", &stream, &lost) == 2 && lost > 0) {
+        std::lock_guard<std::mutex> lock(lossMutex);
+        for (const std::pair<freenect_context*, std::atomic<uint64_t>*>& counter : lossCounters) {
+            if (counter.first == ctx)
+                counter.second->fetch_add(static_cast<uint64_t>(lost));
+        }
+        return;
+    }
+    if (level <= FREENECT_LOG_WARNING)
+        std::fputs(message, stderr);
+}
+
+void WatchPacketLoss(freenect_context* ctx, std::atomic<uint64_t>* lost)
+{
+    {
+        std::lock_guard<std::mutex> lock(lossMutex);
+        lossCounters.push_back(std::make_pair(ctx, lost));
+    }
+    freenect_set_log_callback(ctx, LogCallback);
+    freenect_set_log_level(ctx, FREENECT_LOG_NOTICE);
+}
+
+void UnwatchPacketLoss(freenect_context* ctx)
+{
+    std::lock_guard<std::mutex> lock(lossMutex);
+    lossCounters.erase(std::remove_if(lossCounters.begin(), lossCounters.end(),
+                                      [ctx](const std::pair<freenect_context*, std::atomic<uint64_t>*>& counter) {
+                                          return counter.first == ctx;
+                                      }),
+                       lossCounters.end());
+}
+
+} // namespace kndi
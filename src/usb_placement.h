@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <libfreenect.h>
+
+namespace kndi {
+
+// Where a Kinect is attached to the host, read from sysfs (Linux only).
+struct UsbLocation {
+    std::string port;              // USB device name, e.g. "3-2.1".
+    int bus = -1;
+    std::string controller;        // PCI address of the host controller, e.g. "0000:00:14.0".
+    int numaNode = -1;             // -1: unknown or a single node.
+    std::vector<int> localCpus;    // CPUs local to the controller; empty if unknown.
+    std::vector<int> irqs;         // The controller's interrupts (legacy line or MSI vectors).
+    std::vector<int> irqCpus;      // CPUs those interrupts are delivered to.
+};
+
+// Find the Kinect whose camera serial (libfreenect's camera_serial) is
+// `serial` or, if no USB device has that serial, the `index`-th Kinect
+// camera in bus order. `root` prefixes /sys and /proc. False if it cannot
+// be found or the platform has no sysfs.
+bool LocateKinect(const std::string& serial, int index, UsbLocation& location,
+                  const std::string& root = std::string());
+
+// "0-3,8" <-> {0, 1, 2, 3, 8}, the kernel's CPU list format.
+std::vector<int> ParseCpuList(const std::string& text);
+std::string FormatCpuList(const std::vector<int>& cpus);
+
+// One line describing `location` for the log.
+std::string DescribeUsbLocation(const UsbLocation& location);
+
+// Chooses the core each Kinect's capture thread, which runs libfreenect's
+// event handling and the conversions of that Kinect's frames, is pinned
+// to. A core is picked among those local to the Kinect's USB controller,
+// avoiding in order: cores (and their hyperthread siblings) already
+// running another Kinect, cores that take another controller's
+// interrupts and the controller's own interrupt core; ties go to the
+// highest-numbered core, as core 0 takes most housekeeping. The shared
+// conversion workers are kept to the remaining local cores. Thread safe.
+class UsbPlacement {
+public:
+    // Snapshots the CPUs the process may use, before anything is pinned.
+    explicit UsbPlacement(const std::string& root = std::string());
+
+    // Core for the Kinect at `deviceIndex`, found at `location`, replacing
+    // any earlier choice for it; -1 if there is no usable core.
+    int Place(int deviceIndex, const UsbLocation& location);
+    // CPUs for the conversion workers: the placed controllers' local cores
+    // other than those running a capture thread; empty to leave them be.
+    std::vector<int> WorkerCpus() const;
+    // Controllers (other than `location`'s) whose interrupts share a CPU
+    // with `location`'s, as "controller (CPU n)" entries.
+    std::vector<std::string> SharedInterrupts(const UsbLocation& location) const;
+
+private:
+    struct Entry {
+        int deviceIndex;
+        int cpu;
+        UsbLocation location;
+    };
+
+    std::vector<int> Siblings(int cpu) const;
+
+    std::string root;
+    std::vector<int> allowed;
+    std::vector<Entry> entries;
+    mutable std::mutex mutex;
+};
+
+// Count the USB packets libfreenect reports lost on `ctx` into `lost`. It
+// logs every gap in a stream's packet sequence at notice level; messages
+// at warning level or worse still go to stderr, as without a callback.
+void WatchPacketLoss(freenect_context* ctx, std::atomic<uint64_t>* lost);
+// Stop counting for `ctx`, before it is shut down.
+void UnwatchPacketLoss(freenect_context* ctx);
+
+} // namespace kndi
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "thread_pool.h"
+
+namespace kndi {
+
+// Motion-adaptive temporal filter for 8-bit video (RGB or IR). Each sample
+// keeps a running average of its past values, in 8.4 fixed point; a new
+// value within `threshold` levels of the average is blended in with weight
+// 1 - strength, anything further away is motion and replaces it outright,
+// so moving edges do not smear. Sensor noise is what NDI's codec spends
+// most of its bits on in low light, and a still scene loses most of it.
+class VideoDenoiser {
+public:
+    // `strength` is the history's weight in [0, 0.95]; `threshold` in
+    // levels of 0-255. The history is allocated here, once.
+    VideoDenoiser(int width, int height, int bytesPerPixel, float strength, int threshold);
+
+    float Strength() const { return strength; }
+    int Threshold() const { return threshold; }
+
+    // Filter `frame` (width x height samples, `stride` bytes apart) in
+    // place, in row bands on `pool` (may be nullptr). A frame more than
+    // 200 ms after the previous one, e.g. after a reconnect or failover,
+    // starts the history again.
+    void Apply(ThreadPool* pool, uint8_t* frame, int stride, int64_t timestampNs);
+
+private:
+    void ApplyRows(uint8_t* frame, int stride, int firstRow, int rows, bool restart);
+
+    int width;
+    int height;
+    int rowSamples;                  // width * bytesPerPixel.
+    float strength;
+    int threshold;
+    int16_t alpha;                   // Weight of a new value, Q15.
+    int64_t lastNs;                  // 0 before the first frame.
+    std::vector<uint16_t> history;   // Per sample, 8.4 fixed point.
+};
+
+// Filter a synthetic noisy RGB sequence of this size with a moving object
+// and describe the CPU cost (one thread, then `pool`) and a bitrate proxy
+// before and after in `report`.
+void BenchmarkVideoDenoise(ThreadPool& pool, int width, int height, float strength, int threshold,
+                           std::string& report);
+
+} // namespace kndi
@@ -0,0 +1,177 @@
+#include "volume_crop.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+  #define KNDI_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  #include <arm_neon.h>
+  #define KNDI_NEON 1
+#endif
+
+#include "camera_model.h"
+#include "depth_units.h"
+
+namespace kndi {
+
+// Ray components are 2.14 fixed point; turned rays of the Kinect's field
+// of view stay well below 2 in every axis.
+static constexpr float kRayScale = 16384.0f;
+
+bool ParseVolumeBox(const std::string& value, VolumeBox& out)
+{
+    std::vector<float> numbers;
+    std::istringstream fields(value);
+    std::string field;
+    while (std::getline(fields, field, ',')) {
+        std::istringstream number(field);
+        float parsed = 0.0f;
+        if (!(number >> parsed) || !number.eof() || !std::isfinite(parsed))
+            return false;
+        numbers.push_back(parsed);
+    }
+    if (numbers.size() != 6 && numbers.size() != 9)
+        return false;
+    VolumeBox box;
+    for (int i = 0; i < 3; i++) {
+        box.centre[i] = numbers[i];
+        box.size[i] = numbers[3 + i];
+        if (std::fabs(box.centre[i]) > 20000.0f || box.size[i] <= 0.0f || box.size[i] > 40000.0f)
+            return false;
+    }
+    box.yawDeg = numbers.size() == 9 ? numbers[6] : 0.0f;
+    box.pitchDeg = numbers.size() == 9 ? numbers[7] : 0.0f;
+    box.rollDeg = numbers.size() == 9 ? numbers[8] : 0.0f;
+    out = box;
+    return true;
+}
+
+VolumeCrop::VolumeCrop(const VolumeBox& box, int width, int height)
+    : box(box), width(width), height(height)
+{
+    // Box axes in camera coordinates: R = Ry(yaw) * Rx(pitch) * Rz(roll).
+    const float radians = 3.14159265f / 180.0f;
+    float cy = std::cos(box.yawDeg * radians), sy = std::sin(box.yawDeg * radians);
+    float cp = std::cos(box.pitchDeg * radians), sp = std::sin(box.pitchDeg * radians);
+    float cr = std::cos(box.rollDeg * radians), sr = std::sin(box.rollDeg * radians);
+    const float r[9] = {
+        cy * cr + sy * sp * sr,  -cy * sr + sy * sp * cr, sy * cp,
+        cp * sr,                 cp * cr,                 -sp,
+        -sy * cr + cy * sp * sr, sy * sr + cy * sp * cr,  cy * cp
+    };
+    // Points go into the box's frame with R transposed, rays included.
+    Pose toBox;
+    for (int row = 0; row < 3; row++) {
+        for (int col = 0; col < 3; col++)
+            toBox.rotation[row * 3 + col] = r[col * 3 + row];
+        toBox.translation[row] = 0.0f;
+    }
+    std::vector<float> turned;
+    BuildRayTable(KinectDepthIntrinsics(width, height), toBox, width, height, turned);
+    size_t pixels = static_cast<size_t>(width) * height;
+    for (int axis = 0; axis < 3; axis++) {
+        rays[axis].resize(pixels);
+        for (size_t i = 0; i < pixels; i++)
+            rays[axis][i] = static_cast<int16_t>(std::lround(turned[i * 3 + axis] * kRayScale));
+    }
+
+    // A point z * ray is inside when, on every box axis,
+    // centre - size / 2 <= z * ray <= centre + size / 2.
+    for (int axis = 0; axis < 3; axis++) {
+        const float* t = toBox.rotation + axis * 3;
+        float centre = t[0] * box.centre[0] + t[1] * box.centre[1] + t[2] * box.centre[2];
+        float lowUnits = std::ceil((centre - box.size[axis] * 0.5f) / 2.0f);
+        float highUnits = std::floor((centre + box.size[axis] * 0.5f) / 2.0f);
+        low[axis] = static_cast<int16_t>(std::min(std::max(lowUnits, -32767.0f), 32767.0f));
+        high[axis] = static_cast<int16_t>(std::min(std::max(highUnits, -32767.0f), 32767.0f));
+    }
+}
+
+void VolumeCrop::ApplyRows(uint16_t* depth, int stride, int firstRow, int rows) const
+{
+    const uint16_t* mm = RawDepthToMillimetres();
+    for (int y = firstRow; y < firstRow + rows; y++) {
+        uint16_t* row = reinterpret_cast<uint16_t*>(reinterpret_cast<uint8_t*>(depth) + static_cast<size_t>(y) * stride);
+        const int16_t* rx = rays[0].data() + static_cast<size_t>(y) * width;
+        const int16_t* ry = rays[1].data() + static_cast<size_t>(y) * width;
+        const int16_t* rz = rays[2].data() + static_cast<size_t>(y) * width;
+        int x = 0;
+#if defined(KNDI_SSE2)
+        // mulhi(2z, ray) = z * ray / 2 in 2 mm units.
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i invalid = _mm_set1_epi16(static_cast<short>(kRawDepthInvalid));
+        const __m128i lows[3] = { _mm_set1_epi16(low[0]), _mm_set1_epi16(low[1]), _mm_set1_epi16(low[2]) };
+        const __m128i highs[3] = { _mm_set1_epi16(high[0]), _mm_set1_epi16(high[1]), _mm_set1_epi16(high[2]) };
+        for (; x + 8 <= width; x += 8) {
+            __m128i z2 = _mm_cvtsi32_si128(mm[row[x] & 2047]);
+            z2 = _mm_insert_epi16(z2, mm[row[x + 1] & 2047], 1);
+            z2 = _mm_insert_epi16(z2, mm[row[x + 2] & 2047], 2);
+            z2 = _mm_insert_epi16(z2, mm[row[x + 3] & 2047], 3);
+            z2 = _mm_insert_epi16(z2, mm[row[x + 4] & 2047], 4);
+            z2 = _mm_insert_epi16(z2, mm[row[x + 5] & 2047], 5);
+            z2 = _mm_insert_epi16(z2, mm[row[x + 6] & 2047], 6);
+            z2 = _mm_insert_epi16(z2, mm[row[x + 7] & 2047], 7);
+            __m128i inside = _mm_cmpgt_epi16(z2, zero);
+            z2 = _mm_add_epi16(z2, z2);
+            const int16_t* axes[3] = { rx + x, ry + x, rz + x };
+            for (int axis = 0; axis < 3; axis++) {
+                __m128i v = _mm_mulhi_epi16(z2, _mm_loadu_si128(reinterpret_cast<const __m128i*>(axes[axis])));
+                __m128i outside = _mm_or_si128(_mm_cmplt_epi16(v, lows[axis]), _mm_cmpgt_epi16(v, highs[axis]));
+                inside = _mm_andnot_si128(outside, inside);
+            }
+            __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+            raw = _mm_or_si128(_mm_and_si128(inside, raw), _mm_andnot_si128(inside, invalid));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(row + x), raw);
+        }
+#elif defined(KNDI_NEON)
+        // vqdmulh(z, ray) = 2 * z * ray >> 16, the same value as above.
+        const int16x8_t lows[3] = { vdupq_n_s16(low[0]), vdupq_n_s16(low[1]), vdupq_n_s16(low[2]) };
+        const int16x8_t highs[3] = { vdupq_n_s16(high[0]), vdupq_n_s16(high[1]), vdupq_n_s16(high[2]) };
+        for (; x + 8 <= width; x += 8) {
+            int16_t z[8];
+            for (int i = 0; i < 8; i++)
+                z[i] = static_cast<int16_t>(mm[row[x + i] & 2047]);
+            int16x8_t zv = vld1q_s16(z);
+            uint16x8_t inside = vcgtq_s16(zv, vdupq_n_s16(0));
+            const int16_t* axes[3] = { rx + x, ry + x, rz + x };
+            for (int axis = 0; axis < 3; axis++) {
+                int16x8_t v = vqdmulhq_s16(zv, vld1q_s16(axes[axis]));
+                inside = vandq_u16(inside, vandq_u16(vcgeq_s16(v, lows[axis]), vcleq_s16(v, highs[axis])));
+            }
+            vst1q_u16(row + x, vbslq_u16(inside, vld1q_u16(row + x), vdupq_n_u16(kRawDepthInvalid)));
+        }
+#endif
+        for (; x < width; x++) {
+            int z2 = 2 * mm[row[x] & 2047];
+            bool inside = z2 > 0;
+            const int16_t ray[3] = { rx[x], ry[x], rz[x] };
+            for (int axis = 0; axis < 3; axis++) {
+                int v = (z2 * ray[axis]) >> 16;
+                inside = inside && v >= low[axis] && v <= high[axis];
+            }
+            if (!inside)
+                row[x] = kRawDepthInvalid;
+        }
+    }
+}
+
+void VolumeCrop::Apply(ThreadPool* pool, uint16_t* depth, int stride) const
+{
+    int bands = pool ? std::min(pool->Size(), height) : 1;
+    if (bands <= 1) {
+        ApplyRows(depth, stride, 0, height);
+        return;
+    }
+    int rowsPerBand = (height + bands - 1) / bands;
+    pool->ParallelFor(bands, [&](int band) {
+        int first = band * rowsPerBand;
+        int rows = std::min(rowsPerBand, height - first);
+        if (rows > 0)
+            ApplyRows(depth, stride, first, rows);
+    });
+}
+
+} // namespace kndi
@@ -0,0 +1,229 @@
+// DepthFusion against synthetic Kinects of known geometry: two overhead
+// cameras at different heights see a floor and a box, overlapping over the
+// box. Checks the merged top-down depth and the point cloud.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "camera_model.h"
+#include "depth_units.h"
+#include "frame_pool.h"
+#include "fusion.h"
+#include "thread_pool.h"
+
+using namespace kndi;
+
+namespace {
+
+const int kWidth = 640;
+const int kHeight = 480;
+
+// The box: [-300, 300] x [-300, 300] x [0, 400] mm on a floor at Z = 0.
+const float kBoxHalf = 300.0f;
+const float kBoxTop = 400.0f;
+
+// Depth quantisation at 2-2.5 m is about 20 mm per raw step; merged cells
+// keep the nearest of several samples.
+const float kDepthToleranceMm = 20.0f;
+const float kPointToleranceMm = 15.0f;
+
+int failures = 0;
+
+void Check(bool ok, const char* what, double got, double want)
+{
+    if (ok)
+        return;
+    std::cerr << "FAIL: " << what << ": got " << got << ", want " << want << std::endl;
+    failures++;
+}
+
+// Camera at (x, y, height) looking straight down: image x along world +X,
+// image y along world -Y.
+Pose Overhead(float x, float y, float height)
+{
+    Pose pose = {
+        { 1.0f, 0.0f, 0.0f,
+          0.0f, -1.0f, 0.0f,
+          0.0f, 0.0f, -1.0f },
+        { x, y, height }
+    };
+    return pose;
+}
+
+// Raw disparity whose table value is nearest to `mm` (up to 10 m).
+uint16_t RawForMillimetres(float mm)
+{
+    static std::vector<uint16_t> nearest;
+    if (nearest.empty()) {
+        const uint16_t* table = RawDepthToMillimetres();
+        nearest.assign(10001, kRawDepthInvalid);
+        for (int target = 0; target <= 10000; target++) {
+            int bestError = 1 << 30;
+            for (int raw = 0; raw < kRawDepthInvalid; raw++) {
+                int error = std::abs(table[raw] - target);
+                if (table[raw] && error < bestError) {
+                    bestError = error;
+                    nearest[target] = static_cast<uint16_t>(raw);
+                }
+            }
+        }
+    }
+    int index = static_cast<int>(mm + 0.5f);
+    return index >= 0 && index <= 10000 ? nearest[index] : kRawDepthInvalid;
+}
+
+// Depth along the optical axis to the first surface hit by pixel (x, y).
+float TraceDepth(const Pose& pose, const Intrinsics& in, int x, int y)
+{
+    const float* r = pose.rotation;
+    float cam[3] = { (x - in.cx) / in.fx, (y - in.cy) / in.fy, 1.0f };
+    float dir[3];
+    for (int i = 0; i < 3; i++)
+        dir[i] = r[i * 3 + 0] * cam[0] + r[i * 3 + 1] * cam[1] + r[i * 3 + 2] * cam[2];
+    const float* origin = pose.translation;
+
+    float nearest = -origin[2] / dir[2];   // Floor.
+    // Slab test against the box.
+    float lo[3] = { -kBoxHalf, -kBoxHalf, 0.0f };
+    float hi[3] = { kBoxHalf, kBoxHalf, kBoxTop };
+    float enter = 0.0f;
+    float leave = 1e9f;
+    for (int i = 0; i < 3; i++) {
+        if (std::fabs(dir[i]) < 1e-9f) {
+            if (origin[i] < lo[i] || origin[i] > hi[i])
+                return nearest;
+            continue;
+        }
+        float a = (lo[i] - origin[i]) / dir[i];
+        float b = (hi[i] - origin[i]) / dir[i];
+        enter = std::max(enter, std::min(a, b));
+        leave = std::min(leave, std::max(a, b));
+    }
+    return enter <= leave ? std::min(nearest, enter) : nearest;
+}
+
+// Render raw depth of the scene as seen from `pose`.
+void Render(const Pose& pose, uint16_t* depth)
+{
+    Intrinsics in = KinectDepthIntrinsics(kWidth, kHeight);
+    for (int y = 0; y < kHeight; y++)
+        for (int x = 0; x < kWidth; x++)
+            depth[y * kWidth + x] = RawForMillimetres(TraceDepth(pose, in, x, y));
+}
+
+// Merged value of the top-down cell containing world (x, y).
+uint16_t Cell(const FusionSettings& settings, const std::vector<uint16_t>& merged, float x, float y)
+{
+    int u = static_cast<int>((x - settings.originXMm) / settings.cellMm);
+    int v = static_cast<int>((y - settings.originYMm) / settings.cellMm);
+    return merged[static_cast<size_t>(v) * settings.width + u];
+}
+
+// Whether a cloud point lies on the floor, the box top or a box side.
+bool OnSurface(const float* p)
+{
+    float t = kPointToleranceMm;
+    bool overBox = std::fabs(p[0]) <= kBoxHalf + t && std::fabs(p[1]) <= kBoxHalf + t;
+    bool onSide = overBox && p[2] >= -t && p[2] <= kBoxTop + t &&
+                  (std::fabs(std::fabs(p[0]) - kBoxHalf) <= t || std::fabs(std::fabs(p[1]) - kBoxHalf) <= t);
+    return std::fabs(p[2]) <= t || (overBox && std::fabs(p[2] - kBoxTop) <= t) || onSide;
+}
+
+// World position of pixel (x, y) of `raw` seen from `pose`, as fusion
+// should compute it.
+void Expected(const Pose& pose, const uint16_t* raw, int x, int y, float* out)
+{
+    Intrinsics in = KinectDepthIntrinsics(kWidth, kHeight);
+    float z = RawDepthToMillimetres()[raw[y * kWidth + x]];
+    float cam[3] = { z * (x - in.cx) / in.fx, z * (y - in.cy) / in.fy, z };
+    for (int i = 0; i < 3; i++)
+        out[i] = pose.rotation[i * 3 + 0] * cam[0] + pose.rotation[i * 3 + 1] * cam[1] +
+                 pose.rotation[i * 3 + 2] * cam[2] + pose.translation[i];
+}
+
+} // namespace
+
+int main()
+{
+    FusionSettings settings;   // Top-down, 512x512 cells of 10 mm, camera at 3000 mm.
+    std::vector<Pose> poses;
+    poses.push_back(Overhead(0.0f, 0.0f, 2500.0f));
+    poses.push_back(Overhead(1000.0f, 0.0f, 2000.0f));
+    DepthFusion fusion(settings, poses, Pose::Identity(), kWidth, kHeight, RoiMask());
+
+    std::vector<std::unique_ptr<FramePool>> pools;
+    std::vector<const uint16_t*> rendered;
+    for (size_t i = 0; i < poses.size(); i++) {
+        pools.push_back(std::unique_ptr<FramePool>(new FramePool(1, kWidth * kHeight * 2)));
+        FrameBuffer* buffer = pools[i]->Acquire();
+        uint16_t* depth = reinterpret_cast<uint16_t*>(buffer->storage);
+        Render(poses[i], depth);
+        buffer->frame.host_timestamp_ns = 0;
+        rendered.push_back(depth);
+        fusion.Submit(static_cast<int>(i), buffer);
+    }
+
+    ThreadPool pool(2);
+    std::vector<uint16_t> merged(static_cast<size_t>(settings.width) * settings.height);
+    std::vector<float> cloud(fusion.MaxCloudPoints() * 3);
+    size_t points = fusion.Fuse(pool, 0, merged.data(), cloud.data());
+
+    // Top-down distance is topMm minus the surface height.
+    const float floorMm = settings.topMm;
+    const float boxMm = settings.topMm - kBoxTop;
+    struct {
+        const char* what;
+        float x, y, want;
+    } cells[] = {
+        { "box centre, both cameras", 0.0f, 0.0f, boxMm },
+        { "box corner, both cameras", -200.0f, 150.0f, boxMm },
+        { "floor, both cameras", 700.0f, 400.0f, floorMm },
+        { "floor, camera 0 only", -1000.0f, 0.0f, floorMm },
+        { "floor, camera 1 only", 1800.0f, 0.0f, floorMm },
+        { "floor in camera 1's box shadow", -400.0f, 0.0f, floorMm },
+        { "outside both views", -2000.0f, -2000.0f, 0.0f },
+    };
+    for (const auto& cell : cells) {
+        uint16_t got = Cell(settings, merged, cell.x, cell.y);
+        Check(std::fabs(got - cell.want) <= kDepthToleranceMm, cell.what, got, cell.want);
+    }
+
+    // Every pixel has a reading, so each camera adds one point per step.
+    size_t perCamera = static_cast<size_t>((kWidth + 3) / 4) * ((kHeight + 3) / 4);
+    Check(points == perCamera * poses.size(), "cloud points", static_cast<double>(points),
+          static_cast<double>(perCamera * poses.size()));
+    size_t offSurface = 0;
+    for (size_t i = 0; i < points; i++)
+        offSurface += OnSurface(&cloud[i * 3]) ? 0 : 1;
+    Check(offSurface == 0, "cloud points off every surface", static_cast<double>(offSurface), 0.0);
+    // Each camera's slice starts with its pixel (0, 0); camera 0's
+    // (320, 240) looks at the box top, camera 1's at the floor.
+    for (size_t i = 0; i < poses.size() && points == perCamera * poses.size(); i++) {
+        const int probes[2][2] = { { 0, 0 }, { 320, 240 } };
+        for (const auto& probe : probes) {
+            float want[3];
+            Expected(poses[i], rendered[i], probe[0], probe[1], want);
+            size_t index = i * perCamera + (probe[1] / 4) * (kWidth / 4) + probe[0] / 4;
+            for (int axis = 0; axis < 3; axis++)
+                Check(std::fabs(cloud[index * 3 + axis] - want[axis]) <= 0.5f, "cloud coordinate",
+                      cloud[index * 3 + axis], want[axis]);
+        }
+        float centre[3];
+        Expected(poses[i], rendered[i], 320, 240, centre);
+        float height = i == 0 ? kBoxTop : 0.0f;
+        Check(std::fabs(centre[2] - height) <= kPointToleranceMm, "surface height below the camera", centre[2],
+              height);
+    }
+
+    if (failures) {
+        std::cerr << failures << " check(s) failed." << std::endl;
+        return 1;
+    }
+    std::printf("fusion_test: %zu cells and %zu points checked.\n", sizeof(cells) / sizeof(cells[0]), points);
+    return 0;
+}